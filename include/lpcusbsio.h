@@ -52,6 +52,15 @@ extern "C" {
  */
 #define LPCUSBSIO_READ_TMO                  500
 
+/** LPCUSBSIO_TIMEOUT Options of LPCUSBSIO_SetTimeout()
+* @{
+*/
+/** Work out the time-out from the bus speed and the size of each transfer */
+#define LPCUSBSIO_TIMEOUT_ADAPTIVE          0x01
+/** The time-out covers the whole response instead of being restarted for each packet */
+#define LPCUSBSIO_TIMEOUT_TOTAL             0x02
+/** @} */
+
 /** I2C_IO_OPTIONS Options to I2C_DeviceWrite & I2C_DeviceRead routines
 * @{
 */
@@ -96,9 +105,22 @@ I2C slaves */
 /******************************************************************************
 *								Type defines
 ******************************************************************************/
-/** @brief Handle type */
+/** @brief Handle type
+ *
+ * Device and port handles are opaque references into the device table of the library,
+ * not pointers. A handle of a closed device or port is rejected with
+ * LPCUSBSIO_ERR_BAD_HANDLE, also after the table entry has been reused.
+ */
 typedef void *LPC_HANDLE;
 
+/** @brief Completion callback of asynchronous requests.
+ *
+ * @param hReq : Handle of the completed request returned by one of the *_Async functions.
+ * @param result : Result of the request, the same value the blocking function would return.
+ * @param context : User context passed to the *_Async function.
+ */
+typedef void (*LPCUSBSIO_REQ_CALLBACK_T)(LPC_HANDLE hReq, int32_t result, void *context);
+
 /** @brief Error types returned by LPCUSBSIO APIs */
 typedef enum LPCUSBSIO_ERR_t {
     /** All API return positive number for success */
@@ -113,6 +135,8 @@ typedef enum LPCUSBSIO_ERR_t {
     LPCUSBSIO_ERR_MEM_ALLOC = -4,
     /** Mutex Creation error. */
     LPCUSBSIO_ERR_MUTEX_CREATE = -5,
+    /** Asynchronous request has not completed yet. */
+    LPCUSBSIO_ERR_PENDING = -6,
 
     /* Errors from hardware I2C interface*/
     /** Fatal error occurred */
@@ -180,6 +204,12 @@ typedef struct SPIXferParam_t {
     uint8_t *rxBuff;            /*!< Pointer memory where bytes received from SPI be stored */
 } SPI_XFER_T;
 
+/** @brief Segment of the data of a scatter-gather transfer, see SPI_TransferV() and I2C_FastXferV() */
+typedef struct LPCUSBSIO_IOVec_t {
+    uint8_t *data;              /*!< Bytes to be transmitted, or memory where received bytes be stored */
+    uint32_t len;               /*!< Number of bytes in the segment */
+} LPCUSBSIO_IOVEC_T;
+
 /* SPI config option aliases */
 #define SPI_CONFIG_OPTION_DATA_SIZE_8     HID_SPI_CONFIG_OPTION_DATA_SIZE_8
 #define SPI_CONFIG_OPTION_DATA_SIZE_16    HID_SPI_CONFIG_OPTION_DATA_SIZE_16
@@ -190,6 +220,9 @@ typedef struct SPIXferParam_t {
 #define SPI_CONFIG_OPTION_PRE_DELAY(x)    HID_SPI_CONFIG_OPTION_PRE_DELAY(x)
 #define SPI_CONFIG_OPTION_POST_DELAY(x)   HID_SPI_CONFIG_OPTION_POST_DELAY(x)
 
+/* SPI transfer option aliases */
+#define SPI_XFER_OPTION_TX_ONLY           HID_SPI_XFER_OPTION_TX_ONLY
+
 /******************************************************************************
 *                                LPCUSBSIO functions
 ******************************************************************************/
@@ -199,6 +232,11 @@ typedef struct SPIXferParam_t {
  * This function gets the number of LPCUSBSIO ports that are available on the controllers.
  * The number of ports available in each of these chips is different.
  *
+ * The enumeration is kept and indexed by serial number and path. Later calls with the same
+ * vid and pid return the kept one without rescanning the system as long as no HID device
+ * arrived or left in between. Platforms which cannot watch hot-plug events rescan on
+ * every call.
+ *
  * @param vid : Vendor ID.
  * @param pid : Product ID.
  *
@@ -208,6 +246,73 @@ typedef struct SPIXferParam_t {
  */
 LPCUSBSIO_API int LPCUSBSIO_GetNumPorts(uint32_t vid, uint32_t pid);
 
+#define LPCUSBSIO_BACKEND_HIDAPI            0	/*!< USB HID devices of the system, the default */
+#define LPCUSBSIO_BACKEND_MOCK              1	/*!< Emulated bridges answering like the firmware, for tests */
+
+/** @brief Select the HID backend used by the library.
+ *
+ * The emulated bridges of LPCUSBSIO_BACKEND_MOCK run the firmware protocol in the library
+ * with a configurable response latency and bandwidth, to test an application or measure
+ * the library without hardware. I2C slaves behave as 256 byte memories, SPI transfers
+ * return the transmitted data and GPIO ports keep their pin levels. The options are a
+ * comma separated list such as "devices=2,latency=100,bandwidth=1000000,maxdata=1024",
+ * see src/hid_api/mock/hid_mock.h for the full list.
+ *
+ * Without a call to this function the LPCUSBSIO_BACKEND environment variable selects the
+ * backend when the first enumeration is made: "mock" selects the emulated bridges, set up
+ * by the options in LPCUSBSIO_MOCK.
+ *
+ * The backend can only be changed while no device is open and no HIDAPI_Enumerate()
+ * enumeration or HIDAPI device handle is in use, and not concurrently with other calls.
+ * The kept enumeration is dropped, call LPCUSBSIO_GetNumPorts() again afterwards.
+ *
+ * @param backend : LPCUSBSIO_BACKEND_xxx.
+ * @param options : Options of the emulated bridges, NULL for the defaults. Ignored by
+ *                  LPCUSBSIO_BACKEND_HIDAPI.
+ *
+ * @returns
+ * LPCUSBSIO_OK on success, LPCUSBSIO_ERR_INVALID_PARAM for an unknown backend or options
+ * which cannot be parsed, LPCUSBSIO_ERR_HID_LIB if devices are still open.
+ *
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_SetBackend(uint32_t backend, const char *options);
+
+/** @brief Check whether the enumeration may be stale.
+ *
+ * This function does not enumerate, it is cheap enough to be polled. Any HID device
+ * plugged or unplugged counts, not only the LPCUSBSIO controllers.
+ *
+ * @returns
+ * 1 if a HID device arrived or left since the last enumeration by LPCUSBSIO_GetNumPorts(),
+ * if nothing was enumerated yet or if the platform cannot tell, 0 otherwise.
+ *
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_PortsChanged(void);
+
+/** @brief Find an enumerated port by the serial number of its controller.
+ *
+ * The lookup is hashed, it takes the same time for any number of controllers.
+ *
+ * @param serial : Serial number as reported in HIDAPI_DEVICE_INFO_T.serial_number.
+ *
+ * @returns
+ * The index of the first port with this serial number in the last enumeration by
+ * LPCUSBSIO_GetNumPorts(), or LPCUSBSIO_ERR_BAD_HANDLE if there is none.
+ *
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_GetIndexBySerial(const wchar_t *serial);
+
+/** @brief Find an enumerated port by its HID device path.
+ *
+ * @param path : Path as reported in HIDAPI_DEVICE_INFO_T.path.
+ *
+ * @returns
+ * The index of the port in the last enumeration by LPCUSBSIO_GetNumPorts(), or
+ * LPCUSBSIO_ERR_BAD_HANDLE if there is none.
+ *
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_GetIndexByPath(const char *path);
+
 /** @brief Opens the indexed Serial IO port.
 *
 * This function opens the indexed port and provides a handle to it. Valid values for
@@ -222,10 +327,76 @@ LPCUSBSIO_API int LPCUSBSIO_GetNumPorts(uint32_t vid, uint32_t pid);
 */
 LPCUSBSIO_API LPC_HANDLE LPCUSBSIO_Open(uint32_t index);
 
+/** @brief Opens the Serial IO port of the controller with the given serial number.
+*
+* The port is looked up in the last enumeration by LPCUSBSIO_GetNumPorts() and opened in
+* one step, a concurrent enumeration cannot make it open another controller.
+*
+* @param serial : Serial number as reported in HIDAPI_DEVICE_INFO_T.serial_number.
+*
+* @returns
+* This function returns a handle to LPCUSBSIO port object on
+* success or NULL on failure.
+*/
+LPCUSBSIO_API LPC_HANDLE LPCUSBSIO_OpenBySerial(const wchar_t *serial);
+
+/** @brief Opens several Serial IO ports at once.
+*
+* The ports are opened concurrently by up to 16 threads, so that the round trips asking
+* each controller for its capabilities overlap. The ports are selected either by index
+* as for LPCUSBSIO_Open() or by serial number as for LPCUSBSIO_OpenBySerial(), all of
+* them in the last enumeration by LPCUSBSIO_GetNumPorts().
+*
+* @param indices : Indexes of the ports to be opened, NULL to select them by serial number.
+* @param serials : Serial numbers of the ports to be opened, used when indices is NULL.
+* @param count : Number of ports to be opened.
+* @param phUsbSio : Array of count entries receiving the handles, NULL for each port
+*                   which could not be opened.
+*
+* @returns
+* 	- The number of ports opened.
+* 	- LPCUSBSIO_ERR_INVALID_PARAM if no ports or no handle array are given.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_OpenMany(const uint32_t *indices, const wchar_t *const *serials, uint32_t count,
+                                         LPC_HANDLE *phUsbSio);
+
+/** @brief Enables the cache of the controller capabilities.
+*
+* Opening a port asks the controller firmware for its number of ports, maximum data
+* size and version, one round trip per open. With the cache enabled the answers are
+* kept by vendor id, product id, serial number and USB release number, which follows
+* the firmware version, and a controller found in the cache is opened without asking.
+* The entries live as long as the library is loaded, and in a file if a path is given
+* so that later runs start with them. The entries of the file are loaded by this call,
+* it is rewritten whenever a controller is added. A new file replaces the old one as a
+* whole, processes sharing it read either the previous or the new entries.
+*
+* The cached answer is confirmed when the first request is sent to the controller, which
+* waits for the firmware to answer, and the entry is refreshed if the answer differs.
+* Controllers without a serial number, or with one which is not printable ASCII, are
+* not cached.
+*
+* Setting the environment variable LPCUSBSIO_CAPS_CACHE to a file path enables the cache
+* with that file before the first port is opened.
+*
+* @param enable : Non-zero to use the cache, zero to open without it. The entries are kept.
+* @param path : File keeping the entries across runs, NULL to keep them in memory only.
+*
+* @returns
+* 	- LPCUSBSIO_OK on success, also if the file does not exist yet.
+* 	- LPCUSBSIO_ERR_INVALID_PARAM if the path is too long.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_SetCapsCache(uint8_t enable, const char *path);
+
 
 /** @brief Closes a LPC Serial IO port.
 *
 * Closes a Serial IO port and frees all resources that were used by it.
+* Devices may be opened and closed from any thread while other threads use other
+* handles. Calls made on this handle by other threads while it is closed fail with
+* LPCUSBSIO_ERR_BAD_HANDLE.
 *
 * @param hUsbSio : Handle of the LPSUSBSIO port.
 *
@@ -247,7 +418,7 @@ LPCUSBSIO_API int32_t LPCUSBSIO_Close(LPC_HANDLE hUsbSio);
 */
 LPCUSBSIO_API const char *LPCUSBSIO_GetVersion(LPC_HANDLE hUsbSio);
 
-/** @brief Get a string describing the last error which occurred.
+/** @brief Get a string describing the last error which occurred in the calling thread.
 *
 * @param hUsbSio : A device handle returned from LPCUSBSIO_Open().
 *
@@ -304,6 +475,9 @@ LPCUSBSIO_API uint32_t LPCUSBSIO_GetMaxDataSize(LPC_HANDLE hUsbSio);
 
 /** @brief Returns the last error seen by the Library.
 *
+* The error is kept per thread, it is the result of the last library call made
+* by the calling thread.
+*
 * @returns
 * This function returns the last error seen by the library.
 * Check @ref LPCUSBSIO_ERR_T for more details on error code.
@@ -311,6 +485,249 @@ LPCUSBSIO_API uint32_t LPCUSBSIO_GetMaxDataSize(LPC_HANDLE hUsbSio);
 */
 LPCUSBSIO_API int32_t LPCUSBSIO_GetLastError(void);
 
+/** @brief Returns and clears the last error of a device.
+*
+* Records the latest failed transaction on the device, regardless of the thread
+* or port handle which submitted it, including asynchronous requests.
+*
+* @param hUsbSio : A device handle returned from LPCUSBSIO_Open().
+*
+* @returns
+* This function returns the last transaction error of the device, or LPCUSBSIO_OK
+* if no transaction failed since the device was opened or the previous call.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_GetDeviceError(LPC_HANDLE hUsbSio);
+
+#define LPCUSBSIO_READER_CALLER             0	/*!< Input reports are read by the waiting callers, the default */
+#define LPCUSBSIO_READER_OWN                1	/*!< A reader thread of the device's own */
+#define LPCUSBSIO_READER_SHARED             2	/*!< A reader thread shared with other devices */
+
+/** @brief Starts or stops the reader thread of a device.
+*
+* By default the input reports of a device are read by the calling threads, one of
+* the threads waiting for a transaction reads and dispatches the responses of all.
+* With the reader thread enabled, a library thread reads the input reports as soon
+* as they arrive and hands them over to the waiting transactions. This takes the
+* read system calls off the path of the callers and keeps the input reports flowing
+* while no caller waits. Completion callbacks still run from the library calls of
+* the application as described for the asynchronous requests.
+*
+* With LPCUSBSIO_READER_SHARED the device is served by one of the shared reader threads
+* instead of a thread of its own. Each shared thread waits on up to 64 devices at once,
+* so many open devices do not cost a thread each, see LPCUSBSIO_SetSharedReaders().
+* Where the HID backend cannot wait on several devices the device gets a thread of its
+* own. To change the kind of reader of a device, stop the reader first.
+*
+* The reader thread is stopped by LPCUSBSIO_Close().
+*
+* @param hUsbSio : A device handle returned from LPCUSBSIO_Open().
+* @param enable : LPCUSBSIO_READER_OWN or LPCUSBSIO_READER_SHARED to start a reader,
+*                 LPCUSBSIO_READER_CALLER to stop it. Other non-zero values are
+*                 taken as LPCUSBSIO_READER_OWN.
+*
+* @returns
+* 	- LPCUSBSIO_OK on success, also if a reader already runs or is already stopped.
+* 	- negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_SetReaderThread(LPC_HANDLE hUsbSio, uint8_t enable);
+
+/** @brief Sets the number of shared reader threads.
+*
+* The shared reader threads serve the devices whose reader was started with
+* LPCUSBSIO_READER_SHARED, see LPCUSBSIO_SetReaderThread(). Threads are started when
+* devices are added, each new device goes to the least loaded thread, and they exit
+* once the last device is closed. The devices already served keep their thread, a
+* lower number only applies to the threads started afterwards. More threads than
+* requested are started if all of them already serve 64 devices.
+*
+* @param numThreads : Maximum number of shared reader threads, at most 16. Zero, the
+*                     default, for one thread per processor.
+*
+* @returns
+* 	- LPCUSBSIO_OK on success.
+* 	- LPCUSBSIO_ERR_INVALID_PARAM if numThreads is too large.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_SetSharedReaders(uint32_t numThreads);
+
+/** @brief Set the transaction time-out of a device or of one of its ports.
+*
+* A transaction fails with LPCUSBSIO_ERR_TIMEOUT if its response does not arrive
+* within the time-out, which is LPCUSBSIO_READ_TMO milliseconds by default and is
+* restarted for each packet of the response. I2C and SPI ports use the time-out
+* of their device unless one is set for the port.
+*
+* With LPCUSBSIO_TIMEOUT_ADAPTIVE the time-out of an I2C or SPI transfer is twice
+* the expected completion time, worked out from the bus speed the port was opened
+* with and the number of bytes and packets, plus @a timeout_ms as a margin for the
+* USB and firmware latency. A dead slave is then detected after little more than
+* @a timeout_ms, while long transfers still get the time they need.
+*
+* @param handle : A device handle returned from LPCUSBSIO_Open(), or a port handle
+* returned from I2C_Open() or SPI_Open().
+* @param timeout_ms : Time-out or margin in milliseconds. Zero restores the default,
+* for a port the settings of its device.
+* @param flags : LPCUSBSIO_TIMEOUT_xxx options.
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_SetTimeout(LPC_HANDLE handle, uint32_t timeout_ms, uint32_t flags);
+
+/** @brief Set the transaction time-out of the calls made by the calling thread.
+*
+* Overrides the time-outs set by LPCUSBSIO_SetTimeout() for the transactions the
+* calling thread submits, blocking and asynchronous ones, on any device. The
+* time-out covers the whole response of each transaction.
+*
+* @param timeout_ms : Time-out in milliseconds, zero to use the settings of the handles again.
+*
+*/
+LPCUSBSIO_API void LPCUSBSIO_SetCallTimeout(uint32_t timeout_ms);
+
+/** Number of buckets of LPCUSBSIO_HISTOGRAM_T */
+#define LPCUSBSIO_STATS_BUCKETS             20
+
+/** @brief Latency histogram of LPCUSBSIO_STATS_T
+ *
+ * Bucket 0 counts the samples below 1 microsecond, bucket i the samples from 2^(i-1)
+ * up to 2^i microseconds. The last bucket also counts all longer samples.
+ */
+typedef struct LPCUSBSIO_HISTOGRAM {
+    uint32_t count[LPCUSBSIO_STATS_BUCKETS];	/*!< Samples of each bucket */
+    uint32_t maxUs;							/*!< Longest sample in microseconds */
+    uint64_t totalUs;						/*!< Sum of all samples in microseconds */
+} LPCUSBSIO_HISTOGRAM_T;
+
+/** @brief Traffic counters returned by LPCUSBSIO_GetStats()
+ *
+ * The report counters and the write and read histograms are kept for
+ * the device only, they are zero in the statistics of a port.
+ */
+typedef struct LPCUSBSIO_STATS {
+    uint64_t transactions;		/*!< Transactions completed, successful or not */
+    uint64_t errors;			/*!< Transactions which failed, time-outs included */
+    uint64_t timeouts;			/*!< Transactions which failed with LPCUSBSIO_ERR_TIMEOUT */
+    uint64_t bytesOut;			/*!< Payload bytes sent, transfer parameters included */
+    uint64_t bytesIn;			/*!< Payload bytes received */
+    uint64_t reportsOut;		/*!< HID output reports written */
+    uint64_t reportsIn;			/*!< HID input reports read */
+    uint64_t discarded;			/*!< Input reports no transaction waited for, late responses of timed out transactions */
+    uint64_t lockWaitUs;		/*!< Time submitters waited for their port queue and for the output pipe */
+    LPCUSBSIO_HISTOGRAM_T write;	/*!< Duration of the writes, one per batch of output reports */
+    LPCUSBSIO_HISTOGRAM_T read;		/*!< Duration of the reads which returned one or more input reports */
+    LPCUSBSIO_HISTOGRAM_T request;	/*!< Time from the submission to the completion of transactions */
+} LPCUSBSIO_STATS_T;
+
+/** @brief Get the traffic statistics of a device or of one of its ports.
+*
+* The counters are kept from the time the device was opened or the statistics were
+* reset, reading them does not hold up the traffic.
+*
+* @param handle : A device handle returned from LPCUSBSIO_Open(), or a port handle
+* returned from I2C_Open() or SPI_Open().
+* @param pStats : Structure the statistics are copied to.
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_GetStats(LPC_HANDLE handle, LPCUSBSIO_STATS_T *pStats);
+
+/** @brief Reset the traffic statistics of a device and of all its ports.
+*
+* @param hUsbSio : A device handle returned from LPCUSBSIO_Open().
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_ResetStats(LPC_HANDLE hUsbSio);
+
+/** Events of LPCUSBSIO_TRACE_REC_T */
+#define LPCUSBSIO_TRACE_SUBMIT              1	/*!< Transaction sent: len = payload bytes, aux = time-out in ms */
+#define LPCUSBSIO_TRACE_WRITE               2	/*!< Output report written: len = packet length, aux = packet number, result = bytes written or -1 */
+#define LPCUSBSIO_TRACE_READ                3	/*!< Input report read: len = packet length, aux = packet number, result = firmware response */
+#define LPCUSBSIO_TRACE_DISCARD             4	/*!< Input report nobody waited for: result = firmware response */
+#define LPCUSBSIO_TRACE_COMPLETE            5	/*!< Transaction done: len = bytes received, aux = duration in us, result = status */
+
+/** @brief Record of the binary trace, see LPCUSBSIO_SetTrace() */
+typedef struct LPCUSBSIO_TRACE_REC {
+    uint64_t timeUs;			/*!< Monotonic time stamp in microseconds */
+    uint32_t seq;				/*!< Running number of the record, the first one is 1 */
+    uint32_t thread;			/*!< Id of the thread which wrote the record */
+    uint8_t event;				/*!< LPCUSBSIO_TRACE_xxx */
+    uint8_t req;				/*!< Request code of the transaction */
+    uint8_t transId;			/*!< Transaction id */
+    uint8_t port;				/*!< Port number of the transaction */
+    uint32_t len;				/*!< Length, depends on the event */
+    uint32_t aux;				/*!< Additional value, depends on the event */
+    int32_t result;				/*!< Result, depends on the event */
+} LPCUSBSIO_TRACE_REC_T;
+
+/** @brief Start or stop the binary trace of a device.
+*
+* The transactions of the device and the HID reports they consist of are recorded in a
+* ring of fixed-size records. Writing a record takes no lock and formats nothing, so the
+* trace hardly changes the timing of the traffic. The oldest records are overwritten
+* once the ring is full.
+*
+* The ring is allocated by the first call and kept for the devices opened later, further
+* calls only start or stop the recording. Setting the environment variable
+* LPCUSBSIO_TRACE to the number of records starts the trace of every device when it is
+* opened, and LPCUSBSIO_TRACE_FILE names a file the trace is appended to by
+* LPCUSBSIO_Close(). Both work without changing or rebuilding the application, the file
+* is decoded by the libusbsio.tracedump Python module.
+*
+* @param hUsbSio : A device handle returned from LPCUSBSIO_Open().
+* @param numRecords : Size of the ring, rounded up to a power of two. 0 stops the trace.
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_SetTrace(LPC_HANDLE hUsbSio, uint32_t numRecords);
+
+/** @brief Copy the latest records of the binary trace.
+*
+* @param hUsbSio : A device handle returned from LPCUSBSIO_Open().
+* @param pRecs : Array the records are copied to, the oldest one first.
+* @param maxRecs : Size of the pRecs array.
+*
+* @returns
+* This function returns the number of records copied on success and negative error code
+* on failure. Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_GetTrace(LPC_HANDLE hUsbSio, LPCUSBSIO_TRACE_REC_T *pRecs, uint32_t maxRecs);
+
+/** @brief Append the binary trace of a device to a file.
+*
+* The file is a sequence of dumps. Each dump starts with the 8 characters "SIOTRACE",
+* followed by the 32-bit record size, the number of records, the number of records lost
+* because the ring wrapped and the firmware version, all little-endian. The records
+* follow, the oldest one first.
+*
+* @param hUsbSio : A device handle returned from LPCUSBSIO_Open().
+* @param path : Name of the file.
+*
+* @returns
+* This function returns the number of records written on success and negative error code
+* on failure, LPCUSBSIO_ERR_INVALID_PARAM if the file cannot be written. Check
+* @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t LPCUSBSIO_DumpTrace(LPC_HANDLE hUsbSio, const char *path);
+
 /******************************************************************************
 *								I2C functions
 ******************************************************************************/
@@ -475,6 +892,28 @@ LPCUSBSIO_API int32_t I2C_DeviceWrite(LPC_HANDLE hI2C,
  */
 LPCUSBSIO_API int32_t I2C_FastXfer(LPC_HANDLE hI2C, I2C_FAST_XFER_T *xfer);
 
+/**@brief	Scatter-gather version of I2C_FastXfer().
+ *
+ * The transmitted bytes are gathered from the @a txv segments straight into the USB
+ * reports, and the received bytes are stored straight into the @a rxv segments, in
+ * array order. Up to 16 segments may be given on each side, the total length on each
+ * side is limited to LPCUSBSIO_GetMaxDataSize().
+ *
+ * @param hI2C : Handle of the I2C port.
+ * @param slaveAddr : 7-bit address of the I2C slave.
+ * @param options : I2C_FAST_XFER_OPTION_ flags.
+ * @param txv : Segments of the bytes to be transmitted.
+ * @param txCount : Number of segments in @a txv, may be 0.
+ * @param rxv : Segments where the received bytes be stored.
+ * @param rxCount : Number of segments in @a rxv, may be 0.
+ * @returns
+ * This function returns number of bytes read or written on success and negative error code on failure.
+ * Check @ref LPCUSBSIO_ERR_T for more details on error code.
+ */
+LPCUSBSIO_API int32_t I2C_FastXferV(LPC_HANDLE hI2C, uint8_t slaveAddr, uint16_t options,
+                                    const LPCUSBSIO_IOVEC_T *txv, uint32_t txCount,
+                                    const LPCUSBSIO_IOVEC_T *rxv, uint32_t rxCount);
+
 /******************************************************************************
 *								SPI functions
 ******************************************************************************/
@@ -521,14 +960,45 @@ LPCUSBSIO_API int32_t SPI_Close(LPC_HANDLE hSPI);
 * Since SPI is full duplex transmission transmit length and receive length are the same
 * and represented by the member of @a xfer, @a length.
 *
+* When SPI_XFER_OPTION_TX_ONLY is set in @a options the received data is dropped and
+* @a rxBuff may be NULL. Firmware which supports this option does not send the received
+* data back, which halves the USB traffic of large writes. With older firmware the
+* library drops the received data itself.
+*
 * @param hSPI : Handle of the SPI port.
 * @param xfer : Pointer to a SPI_XFER_T structure.
 * @returns
-* This function returns number of bytes read on success and negative error code on failure.
+* This function returns number of bytes read, or written for SPI_XFER_OPTION_TX_ONLY
+* transfers, on success and negative error code on failure.
 * Check @ref LPCUSBSIO_ERR_T for more details on error code.
 */
 LPCUSBSIO_API int32_t SPI_Transfer(LPC_HANDLE hSPI, SPI_XFER_T *xfer);
 
+/**@brief	Scatter-gather version of SPI_Transfer().
+*
+* The length of the transfer is the total length of the @a txv segments, which are
+* gathered straight into the USB reports. The received bytes are stored straight into
+* the @a rxv segments in array order, received bytes beyond their total length are
+* dropped. Without receive segments the transfer is sent as SPI_XFER_OPTION_TX_ONLY.
+* Up to 16 segments may be given on each side, the length of the transfer is
+* limited to LPCUSBSIO_GetMaxDataSize().
+*
+* @param hSPI : Handle of the SPI port.
+* @param device : SPI slave device, use @ref LPCUSBSIO_GEN_SPI_DEVICE_NUM macro.
+* @param options : Transfer options, as in SPI_XFER_T.
+* @param txv : Segments of the bytes to be transmitted.
+* @param txCount : Number of segments in @a txv.
+* @param rxv : Segments where the received bytes be stored.
+* @param rxCount : Number of segments in @a rxv, may be 0.
+* @returns
+* This function returns number of bytes stored to the @a rxv segments, or the length of
+* the transfer if @a rxCount is 0, on success and negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*/
+LPCUSBSIO_API int32_t SPI_TransferV(LPC_HANDLE hSPI, uint8_t device, uint8_t options,
+                                    const LPCUSBSIO_IOVEC_T *txv, uint32_t txCount,
+                                    const LPCUSBSIO_IOVEC_T *rxv, uint32_t rxCount);
+
 /** @brief Reset SPI Controller.
 *
 *  @param hSPI : A device handle returned from SPI_Open().
@@ -544,6 +1014,36 @@ LPCUSBSIO_API int32_t SPI_Reset(LPC_HANDLE hSPI);
 *								GPIO functions
 ******************************************************************************/
 
+/** @brief Changes of one GPIO port applied by GPIO_UpdatePorts() */
+typedef struct GPIOPortUpdate_t {
+    uint32_t setPins;           /*!< Pins to be set high */
+    uint32_t clrPins;           /*!< Pins to be cleared */
+    uint32_t outPins;           /*!< Pins to be configured as output */
+    uint32_t inPins;            /*!< Pins to be configured as input */
+} GPIO_PORT_UPDATE_T;
+
+/** @brief GPIO event conditions of GPIO_Subscribe()
+ * @{
+ */
+#define GPIO_EVENT_RISING           0x01    /*!< Pin changed from low to high */
+#define GPIO_EVENT_FALLING          0x02    /*!< Pin changed from high to low */
+#define GPIO_EVENT_BOTH_EDGES       0x03    /*!< Pin changed in either direction */
+#define GPIO_EVENT_HIGH             0x04    /*!< Pin is high, reported when the level is entered */
+#define GPIO_EVENT_LOW              0x08    /*!< Pin is low, reported when the level is entered */
+/**
+ * @}
+ */
+
+/** @brief Callback of GPIO event subscriptions.
+ *
+ * @param hSub : Handle of the subscription returned by GPIO_Subscribe().
+ * @param port : GPIO port number.
+ * @param pins : Subscribed pins which met the condition since the previous call.
+ * @param status : Port pin status when the event was detected.
+ * @param context : User context passed to GPIO_Subscribe().
+ */
+typedef void (*GPIO_EVENT_CALLBACK_T)(LPC_HANDLE hSub, uint8_t port, uint32_t pins, uint32_t status, void *context);
+
 /** @brief Read a GPIO port.
 *
 * Reads the pin status of the GPIO port mentioned by @a port. Each port has 32 pins associated with it.
@@ -736,6 +1236,509 @@ LPCUSBSIO_API int32_t GPIO_TogglePin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t p
 */
 LPCUSBSIO_API int32_t GPIO_ConfigIOPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin, uint32_t mode);
 
+/** @brief Update and read several GPIO ports at once.
+*
+* Applies @a updates[i] to GPIO port i for ports 0 to @a count - 1. The firmware takes
+* one port per request, so the requests of all ports are sent back-to-back without
+* requests of other threads in between, and their responses are collected while the
+* following requests are sent. Updating all ports takes about one USB round trip.
+* For each port the output values are written before the direction, so pins switched
+* to output start at their new level. Ports without changes are skipped.
+*
+* @param hUsbSio: Handle to LPCUSBSIO port.
+* @param updates : Changes of each port, may be NULL to only read the ports.
+* @param status : Array where the status of each port after the update is stored, may be NULL.
+* @param count : Number of ports, at most LPCUSBSIO_GetNumGPIOPorts().
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success, otherwise the error code of the
+* first failed request. Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t GPIO_UpdatePorts(LPC_HANDLE hUsbSio, const GPIO_PORT_UPDATE_T *updates, uint32_t *status, uint32_t count);
+
+/** @brief Read a snapshot of several GPIO ports.
+*
+* Reads GPIO ports 0 to @a count - 1 as described for GPIO_UpdatePorts().
+*
+* @param hUsbSio: Handle to LPCUSBSIO port.
+* @param status : Array where the status of each port is stored.
+* @param count : Number of ports, at most LPCUSBSIO_GetNumGPIOPorts().
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t GPIO_ReadPorts(LPC_HANDLE hUsbSio, uint32_t *status, uint32_t count);
+
+/** @brief Enable or disable the GPIO state cache.
+*
+* While the cache is enabled the library remembers the direction, the output
+* values and the IOCON modes last written to or read from the GPIO ports of the
+* device. Direction, output and IOCON changes which would not change anything
+* on the device are then completed without a request, GPIO_GetPortDir() is
+* served from the cache once a direction request returned the register, and
+* GPIO_UpdatePorts() only sends the pins which really change. Pin levels are
+* always read from the device.
+*
+* The cache assumes the GPIO pins are only changed through this library handle.
+* The pins configured by I2C_Open() and SPI_Open() and the select pins driven by
+* SPI transfers are forgotten automatically, and a pin is forgotten after a
+* failed request. Enabling or disabling the cache clears it.
+*
+* @param hUsbSio: Handle to LPCUSBSIO port.
+* @param enable : Non-zero to enable the cache, zero to disable it.
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+* Check @ref LPCUSBSIO_ERR_T for more details on error code.
+*
+*/
+LPCUSBSIO_API int32_t GPIO_SetCache(LPC_HANDLE hUsbSio, uint8_t enable);
+
+/** @brief Subscribe to events of GPIO input pins.
+*
+* Watches @a pins of the GPIO port for the @a condition, a combination of the
+* GPIO_EVENT_xxx flags, instead of polling them with GPIO_ReadPort(). Level
+* conditions are reported when the level is entered, and right away if the pin
+* is at that level already.
+*
+* Firmware reporting HID_SIO_CAPS_GPIO_EVENTS detects the edges itself, so even
+* short pulses are reported. With other firmware the library samples the
+* watched ports every GPIO_SetSamplePeriod() milliseconds, and changes shorter
+* than that may be missed.
+*
+* The events are delivered by an event thread of the device. It runs @a callback,
+* which may call any function of the library, and wakes up GPIO_WaitEvent().
+* The reader thread of the device is started, see LPCUSBSIO_SetReaderThread().
+* It keeps running after the last subscription is cancelled, until it is stopped
+* with LPCUSBSIO_READER_CALLER or the device is closed.
+*
+* @param hUsbSio: Handle to LPCUSBSIO port.
+* @param port : GPIO port number.
+* @param pins : Pins to be watched.
+* @param condition : GPIO_EVENT_xxx flags.
+* @param callback : Function called with the pins which met the condition, may be NULL.
+* @param context : User context passed to @a callback.
+*
+* @returns
+* This function returns the handle of the subscription, to be released by
+* GPIO_Unsubscribe(), or NULL on failure. Call LPCUSBSIO_GetLastError() for the
+* error code.
+*
+*/
+LPCUSBSIO_API LPC_HANDLE GPIO_Subscribe(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins, uint8_t condition,
+                                        GPIO_EVENT_CALLBACK_T callback, void *context);
+
+/** @brief Wait for an event of a GPIO subscription.
+*
+* Returns the pins which met the condition since the previous call. Subscriptions
+* with a callback report their events to the callback only.
+*
+* @param hSub : Handle returned by GPIO_Subscribe().
+* @param pins : Pointer where the pins which met the condition are stored, may be NULL.
+* @param status : Pointer where the port status of the latest event is stored, may be NULL.
+* @param timeout_ms : Longest time to wait, 0 to only check for an event.
+*
+* @returns
+* This function returns LPCUSBSIO_OK if an event occurred, LPCUSBSIO_ERR_TIMEOUT
+* if none occurred in time, or another negative error code on failure.
+*
+*/
+LPCUSBSIO_API int32_t GPIO_WaitEvent(LPC_HANDLE hSub, uint32_t *pins, uint32_t *status, uint32_t timeout_ms);
+
+/** @brief Cancel a GPIO subscription.
+*
+* The callback of the subscription is not running any more when this function
+* returns, unless it is called from that callback. The handle is invalid afterwards,
+* also once a later subscription takes the same place. The reader thread started by
+* GPIO_Subscribe() is left running.
+*
+* @param hSub : Handle returned by GPIO_Subscribe().
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+*
+*/
+LPCUSBSIO_API int32_t GPIO_Unsubscribe(LPC_HANDLE hSub);
+
+/** @brief Set the sample period of GPIO subscriptions.
+*
+* Sets how often the library reads the watched GPIO ports when the firmware does
+* not detect the events itself. The default is 10 milliseconds.
+*
+* @param hUsbSio: Handle to LPCUSBSIO port.
+* @param period_ms : Milliseconds between two samples, 0 to sample continuously.
+*
+* @returns
+* This function returns LPCUSBSIO_OK on success and negative error code on failure.
+*
+*/
+LPCUSBSIO_API int32_t GPIO_SetSamplePeriod(LPC_HANDLE hUsbSio, uint32_t period_ms);
+
+/******************************************************************************
+*								Asynchronous requests
+******************************************************************************/
+
+/* The *_Async functions below submit the same request as their blocking counterparts
+ * and return a request handle without waiting for the response. Many requests may be
+ * outstanding on one or more devices at a time. Completion is observed in any of
+ * these ways:
+ *  - the optional callback is invoked once with the result of the request,
+ *  - LPCUSBSIO_ReqPoll() checks a request without blocking,
+ *  - LPCUSBSIO_ReqWait() and LPCUSBSIO_ReqWaitAny() block until one request completes.
+ *
+ * Input reports are only read while the application calls into the library, so an
+ * application driven by callbacks alone must keep calling LPCUSBSIO_ReqPoll() or one of the
+ * wait functions. Callbacks run from within such a call, in the thread that happens to
+ * read the device, without any library lock held, never while a request is being
+ * submitted. A callback may submit new requests and may free its own request. Requests of
+ * one port are sent in submission order, the ports of a device take turns on the USB pipe
+ * and each port may only hold part of the transactions in flight, so a long transfer on one
+ * port does not hold back the others. Data buffers passed to an *_Async function must stay valid
+ * until the request completes or is freed. Every request handle must be released by
+ * LPCUSBSIO_ReqFree(), LPCUSBSIO_Close() releases the outstanding requests of a device.
+ * Request descriptors come from a pool preallocated by LPCUSBSIO_Open(), an *_Async function
+ * fails with LPCUSBSIO_ERR_MEM_ALLOC while all descriptors of the device are held by
+ * unreleased requests.
+ */
+
+/** @brief Asynchronous version of I2C_DeviceRead().
+ *
+ * @param hI2C : Handle of the I2C port.
+ * @param deviceAddress : Address of the I2C slave. This is a 7bit value and
+ * it should not contain the data direction bit, i.e. the decimal
+ * value passed should be always less than 128
+ * @param buffer : Pointer to the buffer where data is to be read. It must stay valid
+ * until the request completes.
+ * @param sizeToTransfer : Number of bytes to be read
+ * @param options: This parameter specifies data transfer options. Check HID_I2C_TRANSFER_OPTIONS_ macros.
+ * @param callback : Function called when the request completes, may be NULL.
+ * @param context : User value passed to the callback.
+ *
+ * @returns
+ * This function returns a request handle on success or NULL on failure.
+ * Use LPCUSBSIO_GetLastError() function to get last error.
+ */
+LPCUSBSIO_API LPC_HANDLE I2C_DeviceReadAsync(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer, uint16_t sizeToTransfer,
+                                             uint8_t options, LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+
+/** @brief Asynchronous version of I2C_DeviceWrite().
+ *
+ * The data is copied when the request is submitted, @a buffer may be reused right after the call.
+ * Parameters are the same as of I2C_DeviceReadAsync().
+ *
+ * @returns
+ * This function returns a request handle on success or NULL on failure.
+ * Use LPCUSBSIO_GetLastError() function to get last error.
+ */
+LPCUSBSIO_API LPC_HANDLE I2C_DeviceWriteAsync(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer, uint16_t sizeToTransfer,
+                                              uint8_t options, LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+
+/** @brief Asynchronous version of I2C_FastXfer().
+ *
+ * The transmit data is copied when the request is submitted. The receive buffer @a xfer->rxBuff
+ * must stay valid until the request completes, the @a xfer structure itself may be reused.
+ *
+ * @param hI2C : Handle of the I2C port.
+ * @param xfer : Pointer to I2C_FAST_XFER_T structure.
+ * @param callback : Function called when the request completes, may be NULL.
+ * @param context : User value passed to the callback.
+ *
+ * @returns
+ * This function returns a request handle on success or NULL on failure.
+ * Use LPCUSBSIO_GetLastError() function to get last error.
+ */
+LPCUSBSIO_API LPC_HANDLE I2C_FastXferAsync(LPC_HANDLE hI2C, I2C_FAST_XFER_T *xfer,
+                                           LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+
+/** @brief Asynchronous version of SPI_Transfer().
+ *
+ * The transmit data is copied when the request is submitted. The receive buffer @a xfer->rxBuff
+ * must stay valid until the request completes, the @a xfer structure itself may be reused.
+ *
+ * @param hSPI : Handle of the SPI port.
+ * @param xfer : Pointer to SPI_XFER_T structure.
+ * @param callback : Function called when the request completes, may be NULL.
+ * @param context : User value passed to the callback.
+ *
+ * @returns
+ * This function returns a request handle on success or NULL on failure.
+ * Use LPCUSBSIO_GetLastError() function to get last error.
+ */
+LPCUSBSIO_API LPC_HANDLE SPI_TransferAsync(LPC_HANDLE hSPI, SPI_XFER_T *xfer,
+                                           LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+
+/** @brief Asynchronous GPIO functions.
+ *
+ * Each function submits the request of the GPIO function of the same name without the
+ * Async suffix and takes the same parameters followed by @a callback and @a context.
+ * Port status pointers, if any, must stay valid until the request completes.
+ * The result of the request is the value the blocking function would return.
+ *
+ * @returns
+ * These functions return a request handle on success or NULL on failure.
+ * Use LPCUSBSIO_GetLastError() function to get last error.
+ */
+LPCUSBSIO_API LPC_HANDLE GPIO_ReadPortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status,
+                                            LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_WritePortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status,
+                                             LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                           LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_ClearPortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                             LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_GetPortDirAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* pPins,
+                                              LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPortOutDirAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                                 LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPortInDirAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                                LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                          LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_GetPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                          LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_ClearPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                            LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_TogglePinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                             LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+LPCUSBSIO_API LPC_HANDLE GPIO_ConfigIOPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin, uint32_t mode,
+                                               LPCUSBSIO_REQ_CALLBACK_T callback, void *context);
+
+/** @brief Check an asynchronous request without blocking.
+ *
+ * Dispatches the responses already received by the device of the request, which may
+ * complete this and other requests and run their callbacks.
+ *
+ * @param hReq : Request handle returned by one of the *_Async functions.
+ *
+ * @returns
+ * This function returns LPCUSBSIO_ERR_PENDING while the request is in progress. Once the
+ * request completed it returns its result, the value the blocking function would return.
+ * Check @ref LPCUSBSIO_ERR_T for more details on error code.
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqPoll(LPC_HANDLE hReq);
+
+/** @brief Wait for an asynchronous request to complete.
+ *
+ * @param hReq : Request handle returned by one of the *_Async functions.
+ * @param timeout_ms : Maximum time to wait in milliseconds. A request never stays pending longer
+ * than its transaction time-out, see LPCUSBSIO_SetTimeout().
+ *
+ * @returns
+ * This function returns the result of the request, or LPCUSBSIO_ERR_PENDING if it did not
+ * complete within @a timeout_ms. Check @ref LPCUSBSIO_ERR_T for more details on error code.
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqWait(LPC_HANDLE hReq, uint32_t timeout_ms);
+
+/** @brief Wait until any of several asynchronous requests completes.
+ *
+ * The requests may belong to different devices.
+ *
+ * @param phReqs : Array of request handles returned by the *_Async functions.
+ * @param count : Number of handles in @a phReqs.
+ * @param timeout_ms : Maximum time to wait in milliseconds.
+ *
+ * @returns
+ * This function returns the index of the first completed request in @a phReqs, use
+ * LPCUSBSIO_ReqPoll() to read its result. It returns LPCUSBSIO_ERR_PENDING if no request
+ * completed within @a timeout_ms and a negative error code on failure.
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqWaitAny(LPC_HANDLE *phReqs, uint32_t count, uint32_t timeout_ms);
+
+/** @brief Release an asynchronous request.
+ *
+ * A request still in progress is cancelled, its callback is not called and a late response
+ * is discarded. The handle is invalid after this call, the request functions reject it
+ * with LPCUSBSIO_ERR_BAD_HANDLE also once its descriptor is reused by another request.
+ *
+ * @param hReq : Request handle returned by one of the *_Async functions.
+ *
+ * @returns
+ * This function returns LPCUSBSIO_OK on success and negative error code on failure.
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqFree(LPC_HANDLE hReq);
+
+/******************************************************************************
+*								Batched requests
+******************************************************************************/
+
+/** @brief Operation types of LPCUSBSIO_BATCH_OP_T */
+typedef enum LPCUSBSIO_BATCH_OPCODE {
+    /** I2C_DeviceRead() of @a length bytes into @a buffer */
+    LPCUSBSIO_BATCH_I2C_READ = 0,
+    /** I2C_DeviceWrite() of @a length bytes from @a buffer */
+    LPCUSBSIO_BATCH_I2C_WRITE = 1,
+    /** I2C_FastXfer() described by @a i2cXfer */
+    LPCUSBSIO_BATCH_I2C_XFER = 2,
+    /** SPI_Transfer() described by @a spiXfer */
+    LPCUSBSIO_BATCH_SPI_XFER = 3,
+    /** GPIO_SetPort() of @a pins */
+    LPCUSBSIO_BATCH_GPIO_SET = 4,
+    /** GPIO_ClearPort() of @a pins */
+    LPCUSBSIO_BATCH_GPIO_CLEAR = 5,
+    /** GPIO_ReadPort(), the port status is stored to @a pins */
+    LPCUSBSIO_BATCH_GPIO_READ = 6,
+} LPCUSBSIO_BATCH_OPCODE_T;
+
+/** @brief One operation of a batch executed by LPCUSBSIO_Batch()
+ *
+ * Operations address ports by number, so one list of operations may be executed
+ * on several devices. I2C and SPI ports must be open by I2C_Open() or SPI_Open().
+ */
+typedef struct LPCUSBSIO_BATCH_OP {
+    uint8_t op;					/*!< Operation, one of @ref LPCUSBSIO_BATCH_OPCODE_T */
+    uint8_t port;				/*!< I2C, SPI or GPIO port number */
+    uint8_t addr;				/*!< I2C slave address of read and write operations */
+    uint8_t options;			/*!< I2C_TRANSFER_OPTIONS_ flags of read and write operations */
+    uint16_t length;			/*!< Length of I2C read and write operations */
+    uint32_t pins;				/*!< GPIO pins to set or clear, or port status read */
+    uint8_t *buffer;			/*!< Data of I2C read and write operations */
+    I2C_FAST_XFER_T *i2cXfer;	/*!< Transfer of LPCUSBSIO_BATCH_I2C_XFER operations */
+    SPI_XFER_T *spiXfer;		/*!< Transfer of LPCUSBSIO_BATCH_SPI_XFER operations */
+    int32_t result;				/*!< Result of the operation, the value the blocking function returns */
+} LPCUSBSIO_BATCH_OP_T;
+
+/** @brief Execute a list of I2C, SPI and GPIO operations.
+ *
+ * The operations are submitted in order and back-to-back, requests of other threads are
+ * not interleaved with them. Responses are collected while the following operations are
+ * sent, so the batch takes a few USB frames instead of one round trip per operation.
+ * The batch starts once the transfers and streams running on its ports have finished.
+ * All operations are executed even if some of them fail.
+ *
+ * @param hUsbSio : Handle to LPCUSBSIO port.
+ * @param ops : Array of operations, the result of each operation is stored to its @a result field.
+ * @param count : Number of operations in @a ops.
+ *
+ * @returns
+ * This function returns LPCUSBSIO_OK if all operations succeeded, otherwise the error code
+ * of the first failed operation. Check @ref LPCUSBSIO_ERR_T for more details on error code.
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_Batch(LPC_HANDLE hUsbSio, LPCUSBSIO_BATCH_OP_T *ops, uint32_t count);
+
+/******************************************************************************
+*								Device groups
+******************************************************************************/
+
+/** @brief Create a group of devices.
+ *
+ * A group executes the same operations on several devices at once, see
+ * LPCUSBSIO_GroupBatch(). The devices stay owned by the application, closing
+ * one of them only makes its part of the following group operations fail.
+ *
+ * @param phUsbSio : Array of device handles returned from LPCUSBSIO_Open().
+ * @param count : Number of devices in @a phUsbSio.
+ *
+ * @returns
+ * This function returns the group handle, to be released by LPCUSBSIO_GroupFree(),
+ * or NULL on failure. Call LPCUSBSIO_GetLastError() for the error code, it is
+ * LPCUSBSIO_ERR_MEM_ALLOC if 64 groups exist already.
+ */
+LPCUSBSIO_API LPC_HANDLE LPCUSBSIO_GroupCreate(const LPC_HANDLE *phUsbSio, uint32_t count);
+
+/** @brief Execute a list of operations on every device of a group.
+ *
+ * Runs LPCUSBSIO_Batch() on all devices of the group in parallel, each device on
+ * a thread of its own, so the time taken does not grow with the number of devices.
+ * Every device gets its own copy of the operation list: @a ops holds @a count
+ * operations for each device, in the order the devices were passed to
+ * LPCUSBSIO_GroupCreate(). Write operations may share their buffers, read
+ * operations need a buffer per device.
+ *
+ * @param hGroup : Handle returned by LPCUSBSIO_GroupCreate().
+ * @param ops : Operation lists of all devices, the result of each operation is stored to its @a result field.
+ * @param count : Number of operations per device.
+ * @param results : Array where the LPCUSBSIO_Batch() result of each device is stored, may be NULL.
+ *
+ * @returns
+ * This function returns LPCUSBSIO_OK if all operations succeeded on all devices,
+ * otherwise the error code of the first device that failed.
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_GroupBatch(LPC_HANDLE hGroup, LPCUSBSIO_BATCH_OP_T *ops, uint32_t count, int32_t *results);
+
+/** @brief Release a group of devices.
+ *
+ * The devices are not closed. The handle is invalid after this call, the group functions
+ * reject it with LPCUSBSIO_ERR_BAD_HANDLE. Group operations running meanwhile complete.
+ *
+ * @param hGroup : Handle returned by LPCUSBSIO_GroupCreate().
+ *
+ * @returns
+ * This function returns LPCUSBSIO_OK on success and negative error code on failure.
+ */
+LPCUSBSIO_API int32_t LPCUSBSIO_GroupFree(LPC_HANDLE hGroup);
+
+/******************************************************************************
+*								Streamed transfers
+******************************************************************************/
+
+/** @brief Read any number of bytes from an addressed I2C slave.
+ *
+ * Same as I2C_DeviceRead() but not limited to LPCUSBSIO_GetMaxDataSize() bytes. The
+ * library splits the read into chunks the firmware accepts and keeps the next chunks
+ * queued while the previous ones complete. Only the first chunk generates the start
+ * condition and the slave address, only the last one the stop condition and the NACK
+ * of the last byte, as requested by @a options. Transfers of other threads on the same
+ * port wait until the stream has finished.
+ *
+ * @param hI2C	 : Handle of the I2C port.
+ * @param deviceAddress : Address of the I2C slave, less than 128.
+ * @param buffer : Pointer to the buffer where the read data is to be stored
+ * @param sizeToTransfer: Number of bytes to be read
+ * @param options: This parameter specifies data transfer options. Check HID_I2C_TRANSFER_OPTIONS_ macros.
+ * @returns
+ * This function returns number of bytes read on success and negative error code on failure.
+ * Check @ref LPCUSBSIO_ERR_T for more details on error code.
+ */
+LPCUSBSIO_API int32_t I2C_DeviceReadStream(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer,
+                                           uint32_t sizeToTransfer, uint8_t options);
+
+/** @brief Write any number of bytes to an addressed I2C slave.
+ *
+ * Same as I2C_DeviceWrite() but not limited to LPCUSBSIO_GetMaxDataSize() bytes, the
+ * data is split as described for I2C_DeviceReadStream(). When a chunk is cut short,
+ * for example by a NAK with I2C_TRANSFER_OPTIONS_BREAK_ON_NACK, no further chunks
+ * are sent, chunks already queued may still be transmitted.
+ *
+ * @param hI2C	 : Handle of the I2C port.
+ * @param deviceAddress : Address of the I2C slave, less than 128.
+ * @param buffer : Pointer to the buffer where the data to be written is stored
+ * @param sizeToTransfer: Number of bytes to be written
+ * @param options : This parameter specifies data transfer options. Check HID_I2C_TRANSFER_OPTIONS_ macros.
+ * @returns
+ * This function returns number of bytes written on success and negative error code on failure.
+ * Check @ref LPCUSBSIO_ERR_T for more details on error code.
+ */
+LPCUSBSIO_API int32_t I2C_DeviceWriteStream(LPC_HANDLE hI2C, uint8_t deviceAddress, const uint8_t *buffer,
+                                            uint32_t sizeToTransfer, uint8_t options);
+
+/** @brief Transmit and receive any number of bytes in SPI master mode.
+ *
+ * Same as SPI_Transfer() but not limited to LPCUSBSIO_GetMaxDataSize() bytes. The library
+ * splits the transfer into chunks the firmware accepts and keeps the next chunks queued
+ * while the previous ones complete. Transfers of other threads on the same port wait
+ * until the stream has finished.
+ *
+ * The firmware asserts the slave select for each chunk, so it is released for a short
+ * time between the chunks. Slaves which need the select asserted during the whole
+ * transfer can use a GPIO pin driven by GPIO_ClearPin() and GPIO_SetPin() as select and
+ * an unused pin for @a device.
+ *
+ * @param hSPI : Handle of the SPI port.
+ * @param device : SPI slave device, use @ref LPCUSBSIO_GEN_SPI_DEVICE_NUM macro.
+ * @param options : Transfer options, as in SPI_XFER_T.
+ * @param txBuff : Bytes to be transmitted.
+ * @param rxBuff : Memory where the received bytes are stored, may be NULL with SPI_XFER_OPTION_TX_ONLY.
+ * @param length : Number of bytes to transmit and receive.
+ * @returns
+ * This function returns number of bytes read on success and negative error code on failure.
+ * Check @ref LPCUSBSIO_ERR_T for more details on error code.
+ */
+LPCUSBSIO_API int32_t SPI_TransferStream(LPC_HANDLE hSPI, uint8_t device, uint8_t options, const uint8_t *txBuff,
+                                         uint8_t *rxBuff, uint32_t length);
+
 
 
 typedef void* HIDAPI_ENUM_HANDLE;
@@ -774,6 +1777,19 @@ typedef struct _HIDAPI_ENUM
     int32_t ex_info;
 } HIDAPI_ENUM_T;
 
+/** @brief Get the USB information of an enumerated port.
+ *
+ * The strings point into the enumeration kept by the library. They stay valid until it is
+ * replaced by a later LPCUSBSIO_GetNumPorts() or LPCUSBSIO_SetBackend() call, or dropped when
+ * the last open device is closed. Copy them to keep them longer.
+ *
+ * @param index : Index of the port in the last enumeration by LPCUSBSIO_GetNumPorts().
+ * @param pInfo : Receives the information.
+ *
+ * @returns
+ * LPCUSBSIO_OK on success, LPCUSBSIO_ERR_BAD_HANDLE if the index is not enumerated.
+ *
+ */
 LPCUSBSIO_API int32_t LPCUSBSIO_GetDeviceInfo(uint32_t index, HIDAPI_DEVICE_INFO_T* pInfo);
 LPCUSBSIO_API int32_t HIDAPI_EnumerateNext(HIDAPI_ENUM_HANDLE hHidEnum, HIDAPI_DEVICE_INFO_T* pInfo);
 LPCUSBSIO_API int32_t HIDAPI_EnumerateRewind(HIDAPI_ENUM_HANDLE hHidEnum);
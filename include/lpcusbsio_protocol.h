@@ -142,7 +142,7 @@ extern "C"
  *		byte[3]				: SPI device address
  *		byte[4 - ..] 		: Write data.
  * Response Packet layout:
- *		byte[0 - ..] 		: Read data.
+ *		byte[0 - ..] 		: Read data, none if HID_SPI_XFER_OPTION_TX_ONLY is set.
  * sesID field in header contains the SPI port number.
  */
 #define HID_SPI_REQ_DEVICE_XFER     0x13	/*!< Request to write and then read data from the SPI port */
@@ -194,6 +194,19 @@ extern "C"
  */
 #define HID_GPIO_REQ_IOCONFIG		 0x24
 
+/**  Request to watch GPIO pins for edges.
+ * Request Packet layout:
+ *		byte[0 -  3]	: Pins reported on rising edges
+ *		byte[4 -  7]	: Pins reported on falling edges
+ * Response Packet layout:
+ *		byte[0 -  3] 	: GPIO port PIN status
+ * sesID field in header contains the GPIO port number. Both masks zero stop
+ * watching the port. Afterwards the firmware sends an unsolicited input report
+ * with response code HID_SIO_RES_GPIO_EVENT whenever a watched edge occurs.
+ * Only supported if HID_SIO_CAPS_GPIO_EVENTS is reported.
+ */
+#define HID_GPIO_REQ_EVENT_CONFIG	 0x25
+
 /** Last GPIO specific request */
 #define HID_GPIO_REQ_MAX			 0x2F
 
@@ -208,13 +221,24 @@ extern "C"
  *		byte[0] 		: Number of I2C ports available on this instance
  *		byte[1]			: Number of SPI ports available on this instance
  *		byte[2]			: Number of GPIO ports available on this instance
- *		byte[3]			: Reserved
+ *		byte[3]			: Capability flags, check @ref HID_SIO_CAPS. Zero on older firmware.
  *		byte[4 -  5]	: Firmware Minor version number
  *		byte[6 -  7]	: Firmware Major version number
   *		byte[8 -...]	: Firmware version string
  */
 #define HID_SIO_REQ_DEV_INFO         0xF0
 
+/** HID_SIO_CAPS Optional features reported by HID_SIO_REQ_DEV_INFO
+ * @{
+ */
+/** HID_SPI_XFER_OPTION_TX_ONLY is supported by HID_SPI_REQ_DEVICE_XFER */
+#define HID_SIO_CAPS_SPI_TX_ONLY     0x01
+/** HID_GPIO_REQ_EVENT_CONFIG is supported */
+#define HID_SIO_CAPS_GPIO_EVENTS     0x02
+/**
+ * @}
+ */
+
 /** Last SIO specific request */
 #define HID_SIO_REQ_MAX			 	0xFF
 
@@ -247,6 +271,15 @@ typedef struct __HIDSIO_OUT_REPORT {
 #define HID_SIO_RES_INVALID_PARAM   0x12		/*!< Invalid parameters are provided for the given Request. */
 #define HID_SIO_RES_PARTIAL_DATA    0x13		/*!< Partial transfer completed. */
 
+/** Unsolicited GPIO event report, see HID_GPIO_REQ_EVENT_CONFIG.
+ * Response Packet layout:
+ *		byte[0 -  3] 	: GPIO port PIN status
+ *		byte[4 -  7] 	: Watched pins which had a rising edge since the last report
+ *		byte[8 - 11] 	: Watched pins which had a falling edge since the last report
+ * sesID field in header contains the GPIO port number, transId is not used.
+ */
+#define HID_SIO_RES_GPIO_EVENT      0x20
+
 /**
  * @brief	HID to SIO bridge response structure.
  *  Defines the structure of HID to SIO Response packet. This is same as
@@ -371,13 +404,22 @@ typedef struct __HIDI2C_XFER_PARAMS {
 /** Macro to convert SPI device to the GPIO pin number */
 #define HID_SPI_DEVICE_TO_PIN(n)  ((n) & 0x1F)
 
+/** HID_SPI_XFER_OPTIONS SPI transfer options
+ * @{
+ */
+/** Transmit only, the received data is not sent back. Check HID_SIO_CAPS_SPI_TX_ONLY before use. */
+#define HID_SPI_XFER_OPTION_TX_ONLY  0x01
+/**
+ * @}
+ */
+
 /**
 * @brief	HID to SPI bridge transfer parameters structure.
 *  Defines the parameters structure for HID_SPI_REQ_DEVICE_XFER command.
 */
 typedef struct __HIDSPI_XFER_PARAMS {
     uint16_t length;	/*!< Length of the SPI transfer.*/
-    uint8_t options;	/*!< SPI transfer options. Currently unused */
+    uint8_t options;	/*!< check @ref HID_SPI_XFER_OPTIONS. */
     uint8_t device; 	/*!< SPI slave device number i.e. SSELn.
                         Out of 8 bits the first 3 bits represent the port number and the last 5 bits represent the pin number */
     uint8_t data[];		/*!< Data corresponding to the response */
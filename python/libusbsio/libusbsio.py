@@ -11,8 +11,8 @@ import logging
 import os
 import platform
 import sys
-from ctypes import (CDLL, POINTER, Structure, c_char_p, c_int32, c_uint8,
-                    c_uint16, c_uint32, c_void_p, c_wchar_p)
+from ctypes import (CDLL, POINTER, Structure, byref, c_char_p, c_int32, c_uint8,
+                    c_uint16, c_uint32, c_uint64, c_void_p, c_wchar_p, cast, pointer)
 
 from typing import Generator, List, Tuple
 
@@ -58,6 +58,7 @@ class LIBUSBSIO(object):
     ERR_SYNCHRONIZATION = -3     # Thread Synchronization error.
     ERR_MEM_ALLOC = -4           # Memory allocation error.
     ERR_MUTEX_CREATE = -5        # Mutex creation error.
+    ERR_PENDING = -6             # Asynchronous request has not completed yet.
 
     # I2C hardware interface errors
     ERR_FATAL = -0x11            # Fatal error occurred
@@ -100,6 +101,45 @@ class LIBUSBSIO(object):
     def SPI_CONFIG_OPTION_POST_DELAY(x) -> int: # SPI Post Delay in micro seconds max of 255
         return (x & 0xff) << 16
 
+    # SPI transfer option flags
+    SPI_XFER_OPTION_TX_ONLY         = 0x01     # Transmit only, received data is dropped
+
+    # Transaction time-out options
+    TIMEOUT_ADAPTIVE                = 0x01     # Time-out worked out from the bus speed and transfer size
+    TIMEOUT_TOTAL                   = 0x02     # Time-out covers the whole response
+
+    # HID backends
+    BACKEND_HIDAPI                  = 0        # USB HID devices of the system
+    BACKEND_MOCK                    = 1        # Emulated bridges, for tests without hardware
+
+    # Readers of the input reports, see SetReaderThread
+    READER_CALLER                   = 0        # The waiting callers read, the default
+    READER_OWN                      = 1        # A reader thread of the device's own
+    READER_SHARED                   = 2        # A reader thread shared with other devices
+
+    # Events of the binary trace records
+    TRACE_SUBMIT                    = 1        # Transaction sent
+    TRACE_WRITE                     = 2        # Output report written
+    TRACE_READ                      = 3        # Input report read
+    TRACE_DISCARD                   = 4        # Input report nobody waited for
+    TRACE_COMPLETE                  = 5        # Transaction done
+
+    # GPIO event conditions
+    GPIO_EVENT_RISING               = 0x01     # Pin changed from low to high
+    GPIO_EVENT_FALLING              = 0x02     # Pin changed from high to low
+    GPIO_EVENT_BOTH_EDGES           = 0x03     # Pin changed in either direction
+    GPIO_EVENT_HIGH                 = 0x04     # Pin is high, reported when the level is entered
+    GPIO_EVENT_LOW                  = 0x08     # Pin is low, reported when the level is entered
+
+    # Batch operation types
+    BATCH_I2C_READ                  = 0        # I2C_DeviceRead
+    BATCH_I2C_WRITE                 = 1        # I2C_DeviceWrite
+    BATCH_I2C_XFER                  = 2        # I2C_FastXfer
+    BATCH_SPI_XFER                  = 3        # SPI_Transfer
+    BATCH_GPIO_SET                  = 4        # GPIO_SetPort
+    BATCH_GPIO_CLEAR                = 5        # GPIO_ClearPort
+    BATCH_GPIO_READ                 = 6        # GPIO_ReadPort
+
     def buffprint(buff:bytes) -> str:
         '''Internal buffer dump for logging purposes'''
         if not buff:
@@ -109,6 +149,39 @@ class LIBUSBSIO(object):
         else:
             return "0x"+buff.hex()
 
+    def _buffptr(buff, size:int, writable:bool):
+        '''Internal pointer to the memory of a buffer-protocol object (bytes, bytearray, memoryview, numpy array...)
+        to be passed to the library without a copy. Returns a tuple of the ctypes object and the size, which is
+        the buffer length in bytes if `size` is zero. Read-only buffers are not accepted for receiving, those
+        other than bytes are copied, as are sequences of integers and buffers smaller than a transmit `size`.'''
+        if buff is None:
+            return (None, size)
+        try:
+            view = memoryview(buff)
+        except TypeError:
+            view = memoryview(bytes(buff))
+        if not view.contiguous:
+            raise LIBUSBSIO_Exception("Buffer must be contiguous.")
+        nbytes = view.nbytes
+        if not size:
+            size = nbytes
+        if writable:
+            if view.readonly:
+                raise LIBUSBSIO_Exception("Receive buffer must be writable.")
+            if size > nbytes:
+                raise LIBUSBSIO_Exception("Receive buffer of %d bytes is too small for %d bytes." % (nbytes, size))
+        if not nbytes:
+            return (None, size)
+        if size > nbytes:
+            # transmit buffer shorter than the transfer, pad it with zeroes as before
+            return ((c_uint8 * size).from_buffer_copy(view.tobytes().ljust(size, b"\x00")), size)
+        if not view.readonly:
+            return ((c_uint8 * nbytes).from_buffer(view), size)
+        if isinstance(buff, bytes):
+            # bytes are immutable, their memory is passed in place
+            return (cast(c_char_p(buff), POINTER(c_uint8)), size)
+        return ((c_uint8 * nbytes).from_buffer_copy(view), size)
+
 
     # I2C Port configuration information.
     class I2C_PORTCONFIG_T(LibUsbStructure):
@@ -138,6 +211,63 @@ class LIBUSBSIO(object):
             ("rxBuff", POINTER(c_uint8)),    # Pointer to array of bytes to be transmitted
         ]
 
+    # One operation of LIBUSBSIO.Batch, the fields refer to the transfer structures above
+    class BATCH_OP_T(LibUsbStructure):
+        pass
+    BATCH_OP_T._fields_ = [
+            ("op", c_uint8),          # Operation, one of BATCH_xxx
+            ("port", c_uint8),        # I2C, SPI or GPIO port number
+            ("addr", c_uint8),        # I2C slave address of read and write operations
+            ("options", c_uint8),     # I2C transfer options of read and write operations
+            ("length", c_uint16),     # Length of I2C read and write operations
+            ("pins", c_uint32),       # GPIO pins to set or clear, or port status read
+            ("buffer", POINTER(c_uint8)),    # Data of I2C read and write operations
+            ("i2cXfer", POINTER(I2C_FAST_XFER_T)),    # Transfer of BATCH_I2C_XFER operations
+            ("spiXfer", POINTER(SPI_XFER_T)),    # Transfer of BATCH_SPI_XFER operations
+            ("result", c_int32),      # Result of the operation
+        ]
+
+    # Latency histogram of LIBUSBSIO.GetStats, count[0] is below 1us, count[i] from 2^(i-1) to 2^i us
+    class HISTOGRAM_T(LibUsbStructure):
+        _fields_ = [
+            ("count", c_uint32 * 20), # Samples per bucket
+            ("maxUs", c_uint32),      # Longest sample in microseconds
+            ("totalUs", c_uint64),    # Sum of all samples in microseconds
+        ]
+
+    # Traffic statistics of a device or port, see LIBUSBSIO.GetStats
+    class STATS_T(LibUsbStructure):
+        pass
+    STATS_T._fields_ = [
+            ("transactions", c_uint64), # Completed transactions
+            ("errors", c_uint64),     # Transactions which failed, time-outs included
+            ("timeouts", c_uint64),   # Transactions which timed out
+            ("bytesOut", c_uint64),   # Payload bytes sent
+            ("bytesIn", c_uint64),    # Payload bytes received
+            ("reportsOut", c_uint64), # HID output reports written, device only
+            ("reportsIn", c_uint64),  # HID input reports read, device only
+            ("discarded", c_uint64),  # Input reports nobody waited for, device only
+            ("lockWaitUs", c_uint64), # Microseconds spent waiting for the port queue and the device
+            ("write", HISTOGRAM_T),   # Duration of each report write, device only
+            ("read", HISTOGRAM_T),    # Duration of each report read, device only
+            ("request", HISTOGRAM_T), # Duration of each transaction
+        ]
+
+    # Record of the binary trace, see LIBUSBSIO.SetTrace and the libusbsio.tracedump module
+    class TRACE_REC_T(LibUsbStructure):
+        _fields_ = [
+            ("timeUs", c_uint64),     # Monotonic time stamp in microseconds
+            ("seq", c_uint32),        # Running number of the record
+            ("thread", c_uint32),     # Id of the thread which wrote the record
+            ("event", c_uint8),       # TRACE_xxx
+            ("req", c_uint8),         # Request code of the transaction
+            ("transId", c_uint8),     # Transaction id
+            ("port", c_uint8),        # Port number of the transaction
+            ("len", c_uint32),        # Length, depends on the event
+            ("aux", c_uint32),        # Additional value, depends on the event
+            ("result", c_int32),      # Result, depends on the event
+        ]
+
     # SPI Port configuration information
     class SPI_PORTCONFIG_T(LibUsbStructure):
         _fields_ = [
@@ -324,10 +454,38 @@ class LIBUSBSIO(object):
         self._GetNumPorts.argtypes = [c_uint32, c_uint32]
         self._GetNumPorts.restype = c_uint32
 
+        self._SetBackend = self._dll.LPCUSBSIO_SetBackend
+        self._SetBackend.argtypes = [c_uint32, c_char_p]
+        self._SetBackend.restype = c_int32
+
+        self._SetSharedReaders = self._dll.LPCUSBSIO_SetSharedReaders
+        self._SetSharedReaders.argtypes = [c_uint32]
+        self._SetSharedReaders.restype = c_int32
+
+        self._SetCapsCache = self._dll.LPCUSBSIO_SetCapsCache
+        self._SetCapsCache.argtypes = [c_uint8, c_char_p]
+        self._SetCapsCache.restype = c_int32
+
         self._Open = self._dll.LPCUSBSIO_Open
         self._Open.argtypes = [c_uint32]
         self._Open.restype = c_void_p
 
+        self._OpenBySerial = self._dll.LPCUSBSIO_OpenBySerial
+        self._OpenBySerial.argtypes = [c_wchar_p]
+        self._OpenBySerial.restype = c_void_p
+
+        self._GetIndexBySerial = self._dll.LPCUSBSIO_GetIndexBySerial
+        self._GetIndexBySerial.argtypes = [c_wchar_p]
+        self._GetIndexBySerial.restype = c_int32
+
+        self._GetIndexByPath = self._dll.LPCUSBSIO_GetIndexByPath
+        self._GetIndexByPath.argtypes = [c_char_p]
+        self._GetIndexByPath.restype = c_int32
+
+        self._PortsChanged = self._dll.LPCUSBSIO_PortsChanged
+        self._PortsChanged.argtypes = []
+        self._PortsChanged.restype = c_int32
+
         self._Close = self._dll.LPCUSBSIO_Close
         self._Close.argtypes = [c_void_p]
         self._Close.restype = c_int32
@@ -360,6 +518,46 @@ class LIBUSBSIO(object):
         self._GetLastError.argtypes = [c_void_p]
         self._GetLastError.restype = c_uint32
 
+        self._GetDeviceError = self._dll.LPCUSBSIO_GetDeviceError
+        self._GetDeviceError.argtypes = [c_void_p]
+        self._GetDeviceError.restype = c_int32
+
+        self._SetReaderThread = self._dll.LPCUSBSIO_SetReaderThread
+        self._SetReaderThread.argtypes = [c_void_p, c_uint8]
+        self._SetReaderThread.restype = c_int32
+
+        self._SetTimeout = self._dll.LPCUSBSIO_SetTimeout
+        self._SetTimeout.argtypes = [c_void_p, c_uint32, c_uint32]
+        self._SetTimeout.restype = c_int32
+
+        self._SetCallTimeout = self._dll.LPCUSBSIO_SetCallTimeout
+        self._SetCallTimeout.argtypes = [c_uint32]
+        self._SetCallTimeout.restype = None
+
+        self._Batch = self._dll.LPCUSBSIO_Batch
+        self._Batch.argtypes = [c_void_p, POINTER(LIBUSBSIO.BATCH_OP_T), c_uint32]
+        self._Batch.restype = c_int32
+
+        self._GetStats = self._dll.LPCUSBSIO_GetStats
+        self._GetStats.argtypes = [c_void_p, POINTER(LIBUSBSIO.STATS_T)]
+        self._GetStats.restype = c_int32
+
+        self._ResetStats = self._dll.LPCUSBSIO_ResetStats
+        self._ResetStats.argtypes = [c_void_p]
+        self._ResetStats.restype = c_int32
+
+        self._SetTrace = self._dll.LPCUSBSIO_SetTrace
+        self._SetTrace.argtypes = [c_void_p, c_uint32]
+        self._SetTrace.restype = c_int32
+
+        self._GetTrace = self._dll.LPCUSBSIO_GetTrace
+        self._GetTrace.argtypes = [c_void_p, POINTER(LIBUSBSIO.TRACE_REC_T), c_uint32]
+        self._GetTrace.restype = c_int32
+
+        self._DumpTrace = self._dll.LPCUSBSIO_DumpTrace
+        self._DumpTrace.argtypes = [c_void_p, c_char_p]
+        self._DumpTrace.restype = c_int32
+
         self._I2C_Open = self._dll.I2C_Open
         self._I2C_Open.argtypes = [c_void_p, POINTER(LIBUSBSIO.I2C_PORTCONFIG_T), c_uint8]
         self._I2C_Open.restype = c_void_p
@@ -400,6 +598,10 @@ class LIBUSBSIO(object):
         self._SPI_Transfer.argtypes = [c_void_p, POINTER(LIBUSBSIO.SPI_XFER_T)]
         self._SPI_Transfer.restype = c_int32
 
+        self._SPI_TransferStream = self._dll.SPI_TransferStream
+        self._SPI_TransferStream.argtypes = [c_void_p, c_uint8, c_uint8, POINTER(c_uint8), POINTER(c_uint8), c_uint32]
+        self._SPI_TransferStream.restype = c_int32
+
         self._SPI_Reset = self._dll.SPI_Reset
         self._SPI_Reset.argtypes = [c_void_p]
         self._SPI_Reset.restype = c_int32
@@ -408,6 +610,30 @@ class LIBUSBSIO(object):
         self._GPIO_ReadPort.argtypes = [c_void_p, c_uint8, POINTER(c_uint32)]
         self._GPIO_ReadPort.restype = c_int32
 
+        self._GPIO_ReadPorts = self._dll.GPIO_ReadPorts
+        self._GPIO_ReadPorts.argtypes = [c_void_p, POINTER(c_uint32), c_uint32]
+        self._GPIO_ReadPorts.restype = c_int32
+
+        self._GPIO_SetCache = self._dll.GPIO_SetCache
+        self._GPIO_SetCache.argtypes = [c_void_p, c_uint8]
+        self._GPIO_SetCache.restype = c_int32
+
+        self._GPIO_Subscribe = self._dll.GPIO_Subscribe
+        self._GPIO_Subscribe.argtypes = [c_void_p, c_uint8, c_uint32, c_uint8, c_void_p, c_void_p]
+        self._GPIO_Subscribe.restype = c_void_p
+
+        self._GPIO_WaitEvent = self._dll.GPIO_WaitEvent
+        self._GPIO_WaitEvent.argtypes = [c_void_p, POINTER(c_uint32), POINTER(c_uint32), c_uint32]
+        self._GPIO_WaitEvent.restype = c_int32
+
+        self._GPIO_Unsubscribe = self._dll.GPIO_Unsubscribe
+        self._GPIO_Unsubscribe.argtypes = [c_void_p]
+        self._GPIO_Unsubscribe.restype = c_int32
+
+        self._GPIO_SetSamplePeriod = self._dll.GPIO_SetSamplePeriod
+        self._GPIO_SetSamplePeriod.argtypes = [c_void_p, c_uint32]
+        self._GPIO_SetSamplePeriod.restype = c_int32
+
         self._GPIO_WritePort = self._dll.GPIO_WritePort
         self._GPIO_WritePort.argtypes = [c_void_p, c_uint8, POINTER(c_uint32)]
         self._GPIO_WritePort.restype = c_int32
@@ -554,6 +780,39 @@ class LIBUSBSIO(object):
     # all NXP USB devices
     VIDPID_NXP = (0x1FC9, 0)
 
+    @need_dll_loaded
+    def SetBackend(self, backend:int, options:str = None) -> int:
+        '''# Select the HID backend
+        BACKEND_MOCK emulates the bridges with the options given as "devices=2,latency=100,bandwidth=1000000".
+        Only possible while no device is open, enumerate again with GetNumPorts afterwards.
+
+        ## Returns
+        LPCUSBSIO_OK on success, negative error code otherwise.
+        '''
+        return self._SetBackend(backend, options.encode() if options else None)
+
+    @need_dll_loaded
+    def SetSharedReaders(self, numThreads:int = 0) -> int:
+        '''# Set the number of shared reader threads
+        The devices whose reader was started with READER_SHARED are served by up to numThreads
+        threads, 0 for one per processor.
+
+        ## Returns
+        LPCUSBSIO_OK on success, negative error code otherwise.
+        '''
+        return self._SetSharedReaders(numThreads)
+
+    @need_dll_loaded
+    def SetCapsCache(self, enable:bool = True, path:str = None) -> int:
+        '''# Enable the cache of the bridge capabilities
+        Bridges found in the cache are opened without asking the firmware for its ports and version.
+        The entries are also kept in the file given by path, if any, across runs.
+
+        ## Returns
+        LPCUSBSIO_OK on success, negative error code otherwise.
+        '''
+        return self._SetCapsCache(1 if enable else 0, path.encode() if path else None)
+
     @need_dll_loaded
     def GetNumPorts(self, vidpids:'list[tuple[int,int]]' = None) -> int:
         '''# Get number of USBSIO ports
@@ -601,6 +860,30 @@ class LIBUSBSIO(object):
         else:
             return None
 
+    @need_dll_loaded
+    def PortsChanged(self) -> bool:
+        '''# Check whether the enumeration may be stale
+        Returns True if a HID device was plugged or unplugged since the last GetNumPorts call, or if the
+        platform cannot tell. The check does not enumerate, it may be polled.
+        '''
+        return bool(self._PortsChanged())
+
+    @need_dll_loaded
+    def GetIndexBySerial(self, serial:str) -> int:
+        '''# Find an enumerated port by serial number
+        ## Returns
+        Index of the port to be passed to Open, negative error code if no enumerated port has this serial number.
+        '''
+        return self._GetIndexBySerial(serial)
+
+    @need_dll_loaded
+    def GetIndexByPath(self, path:str) -> int:
+        '''# Find an enumerated port by HID device path
+        ## Returns
+        Index of the port to be passed to Open, negative error code if no enumerated port has this path.
+        '''
+        return self._GetIndexByPath(path.encode('utf-8'))
+
     def IsOpen(self) -> bool:
         return self.IsDllLoaded() and self._h
     
@@ -627,6 +910,20 @@ class LIBUSBSIO(object):
         self._ports_open = []
         return bool(self._h)
 
+    def OpenBySerial(self, serial:str) -> bool:
+        '''# Open USBSIO port by serial number
+        Looks up the controller in the last GetNumPorts enumeration and opens it in one step.
+
+        ## Returns
+        Boolean True if open was successful. False if not successful.
+        '''
+        self.logger.info("Opening SIODevice %s" % serial)
+        self._h = self._OpenBySerial(serial)
+        self._devIx = self._GetIndexBySerial(serial) if self._h else -1
+        self.logger.debug("SIODevice %s Open returns %s" % (serial, self._h))
+        self._ports_open = []
+        return bool(self._h)
+
     @need_dll_loaded
     def Close(self) -> int:
         '''# Close USBSIO port
@@ -717,6 +1014,103 @@ class LIBUSBSIO(object):
         ret = self._GetLastError(self._h)
         return ret
 
+    @need_dll_open
+    def GetDeviceError(self) -> int:
+        '''# Get and clear last error of the device
+        Error of the latest failed transaction on the device, from any thread.
+
+        ## Returns
+        Last device error code, ERR_OK if none since the previous call.
+        '''
+        ret = self._GetDeviceError(self._h)
+        return ret
+
+    @need_dll_open
+    def SetReaderThread(self, enable: int = True) -> int:
+        '''# Start or stop the reader thread of the device
+        A library thread reads the device responses as soon as they arrive. True or READER_OWN
+        start a thread of the device's own, READER_SHARED a thread shared with other devices.
+
+        ## Returns
+        ERR_OK on success, negative error code otherwise.
+        '''
+        ret = self._SetReaderThread(self._h, int(enable))
+        return ret
+
+    @need_dll_open
+    def SetTimeout(self, timeout_ms:int, flags:int=0) -> int:
+        '''# Set the transaction time-out of the device
+        Used by the ports of the device which have no time-out of their own.
+
+        ## Args:
+        - `timeout_ms` Time-out, or margin with TIMEOUT_ADAPTIVE, in milliseconds. 0 restores the default.
+        - `flags` TIMEOUT_xxx options
+
+        ## Returns
+        ERR_OK on success, negative error code otherwise.
+        '''
+        ret = self._SetTimeout(self._h, timeout_ms, flags)
+        return ret
+
+    @need_dll_loaded
+    def SetCallTimeout(self, timeout_ms:int) -> None:
+        '''# Set the transaction time-out of the calling thread
+        Overrides the time-outs of all handles for the calls of this thread, 0 to use the handle settings again.
+        '''
+        self._SetCallTimeout(timeout_ms)
+
+    @need_dll_open
+    def GetStats(self) -> 'LIBUSBSIO.STATS_T':
+        '''# Get the traffic statistics of the device
+        Counters and latency histograms of all transactions since the device was opened or ResetStats() was called.
+
+        ## Returns
+        A STATS_T structure, `None` in case of failure.
+        '''
+        stats = LIBUSBSIO.STATS_T()
+        ret = self._GetStats(self._h, byref(stats))
+        return stats if ret == LIBUSBSIO.OK else None
+
+    @need_dll_open
+    def ResetStats(self) -> int:
+        '''# Clear the traffic statistics of the device and all its ports
+
+        ## Returns
+        ERR_OK on success, negative error code otherwise.
+        '''
+        ret = self._ResetStats(self._h)
+        return ret
+
+    @need_dll_open
+    def SetTrace(self, numRecords:int) -> int:
+        '''# Start or stop the binary trace of the device
+        The transactions and HID reports of the device are recorded in a ring of `numRecords` entries,
+        0 stops the recording. See LPCUSBSIO_SetTrace() for the LPCUSBSIO_TRACE environment variables.
+
+        ## Returns
+        ERR_OK on success, negative error code otherwise.
+        '''
+        ret = self._SetTrace(self._h, numRecords)
+        return ret
+
+    @need_dll_open
+    def GetTrace(self, maxRecs:int=1024) -> 'List[LIBUSBSIO.TRACE_REC_T]':
+        '''# Get the latest records of the binary trace, the oldest one first'''
+        recs = (LIBUSBSIO.TRACE_REC_T * maxRecs)()
+        ret = self._GetTrace(self._h, recs, maxRecs)
+        return list(recs[:ret]) if ret > 0 else []
+
+    @need_dll_open
+    def DumpTrace(self, path:str) -> int:
+        '''# Append the binary trace of the device to a file
+        Decode the file with `python -m libusbsio.tracedump FILE`.
+
+        ## Returns
+        Number of records written, negative error code otherwise.
+        '''
+        ret = self._DumpTrace(self._h, path.encode())
+        return ret
+
     class PORT:
         def __init__(self, libsio):
             self._sio: LIBUSBSIO = libsio
@@ -733,6 +1127,21 @@ class LIBUSBSIO(object):
                 raise LIBUSBSIO_Exception("%s port is not open." % name)
             return True
 
+        def Batch(self, batch:'LIBUSBSIO.BATCH') -> int:
+            '''# Execute a batch
+            Same as LIBUSBSIO.Batch() of the device this port belongs to.
+            '''
+            return self._sio.Batch(batch)
+
+        def GetStats(self) -> 'LIBUSBSIO.STATS_T':
+            '''# Get the traffic statistics of the port
+            Same as LIBUSBSIO.GetStats(), the report counters and the write and read histograms stay zero.
+            '''
+            self._check_port_open("I2C/SPI")
+            stats = LIBUSBSIO.STATS_T()
+            ret = self._sio._GetStats(self._h, byref(stats))
+            return stats if ret == LIBUSBSIO.OK else None
+
     def _I2C_NormalXferOptions(options:int, start:bool, stop:bool, ignoreNAK:bool, nackLastByte:bool, noAddress:bool) -> int:
         '''Convert I2C Read/Write transfer parameters to low-level option flags'''
         if start:
@@ -836,6 +1245,20 @@ class LIBUSBSIO(object):
             ret = self._sio._I2C_Reset(self._h)
             return ret
 
+        @need_port_open
+        def SetTimeout(self, timeout_ms:int, flags:int=0) -> int:
+            '''# Set the transaction time-out of the I2C port
+
+            ## Args:
+            - `timeout_ms` Time-out, or margin with TIMEOUT_ADAPTIVE, in milliseconds. 0 uses the device settings.
+            - `flags` TIMEOUT_xxx options
+
+            ## Returns
+            Zero on success. Negative error code if operation failed.
+            '''
+            ret = self._sio._SetTimeout(self._h, timeout_ms, flags)
+            return ret
+
         @need_port_open
         def DeviceRead(self, devAddr:int, rxSize:int, start:bool=True, stop:bool=True, ignoreNAK:bool=False, nackLastByte:bool=True, noAddress:bool=False) -> Tuple[bytes,int]:
             '''# I2C Read
@@ -872,6 +1295,30 @@ class LIBUSBSIO(object):
                 self.logger.debug("I2C%d read status=%d, received: %s" % (self._portNum, ret, LIBUSBSIO.buffprint(rxData)))
             return (rxData, ret)
 
+        @need_port_open
+        def DeviceReadInto(self, devAddr:int, rxBuff, rxSize:int=0, start:bool=True, stop:bool=True, ignoreNAK:bool=False, nackLastByte:bool=True, noAddress:bool=False) -> int:
+            '''# I2C Read into a buffer
+            Same as DeviceRead() but the data is received straight into the memory of a writable buffer
+            (bytearray, memoryview, numpy array...) without intermediate copies.
+
+            ## Args
+            - `devAddr`      - Device I2C address
+            - `rxBuff`       - Writable buffer receiving the data
+            - `rxSize`       - Number of bytes to read (the buffer length if zero)
+            - other arguments as in DeviceRead()
+
+            ## Returns
+            Number of bytes received or an error code if negative.
+            '''
+            rxPtr, rxSize = LIBUSBSIO._buffptr(rxBuff, rxSize, True)
+            options = LIBUSBSIO._I2C_NormalXferOptions(0, start, stop, ignoreNAK, nackLastByte, noAddress)
+
+            ret = self._sio._I2C_DeviceRead(self._h, devAddr, rxPtr, rxSize, options)
+
+            if(self.logger.isEnabledFor(logging.DEBUG)):
+                self.logger.debug("I2C%d read %d into buffer, status=%d" % (self._portNum, rxSize, ret))
+            return ret
+
         @need_port_open
         def DeviceWrite(self, devAddr:int, txData:bytes, txSize:int=0, start:bool=True, stop:bool=True, ignoreNAK:bool=False, noAddress:bool=False) -> int:
             '''# I2C Write
@@ -879,7 +1326,7 @@ class LIBUSBSIO(object):
 
             ## Args
             - `devAddr`      - Device I2C address
-            - `txData`       - Data to write
+            - `txData`       - Data to write, any buffer-protocol object is passed without a copy
             - `txSize`       - Number of bytes to write (auto-inferred from txData if zero)
             - `start`        - Generate start condition before transmitting
             - `stop`         - Generate stop condition at the end of transfer
@@ -893,13 +1340,11 @@ class LIBUSBSIO(object):
             ## Returns
             Number of bytes transmitted or an error code if negative.
             '''
-            if not txSize:
-                txSize = len(txData)
-            txBuff = (c_uint8 * txSize)(*txData)
+            txBuff, txSize = LIBUSBSIO._buffptr(txData, txSize, False)
             options = LIBUSBSIO._I2C_NormalXferOptions(0, start, stop, ignoreNAK, False, noAddress)
 
             if(self.logger.isEnabledFor(logging.DEBUG)):
-                self.logger.debug("I2C%d writing [%d]: %s" % (self._portNum, txSize, LIBUSBSIO.buffprint(txData)))
+                self.logger.debug("I2C%d writing [%d]: %s" % (self._portNum, txSize, LIBUSBSIO.buffprint(bytes(txData))))
 
             ret = self._sio._I2C_DeviceWrite(self._h, devAddr, txBuff, txSize, options)
 
@@ -926,9 +1371,7 @@ class LIBUSBSIO(object):
             Tuple of received data buffer and operation result code indicating number of bytes received
             or an error code if negative.
             '''
-            if (not txSize) and txData:
-                txSize = len(txData)
-            txBuff = (c_uint8 * txSize)(*txData) if txSize else None
+            txBuff, txSize = LIBUSBSIO._buffptr(txData, txSize, False)
             rxBuff = (c_uint8 * rxSize)()
             xfer = LIBUSBSIO.I2C_FAST_XFER_T()
             xfer.txSz = txSize
@@ -939,7 +1382,7 @@ class LIBUSBSIO(object):
             xfer.rxBuff = rxBuff
 
             if(self.logger.isEnabledFor(logging.DEBUG)):
-                self.logger.debug("I2C%d xfer: writing[%d]: %s, reading:%d" % (self._portNum, txSize, LIBUSBSIO.buffprint(txData), rxSize))
+                self.logger.debug("I2C%d xfer: writing[%d]: %s, reading:%d" % (self._portNum, txSize, LIBUSBSIO.buffprint(bytes(txData or b'')), rxSize))
 
             ret = self._sio._I2C_FastXfer(self._h, xfer)
             if(ret > 0):
@@ -951,6 +1394,35 @@ class LIBUSBSIO(object):
                 self.logger.debug("I2C%d status=%d, received: %s" % (self._portNum, ret, LIBUSBSIO.buffprint(rxData)))
             return (rxData, ret)
 
+        @need_port_open
+        def FastXferInto(self, devAddr:int, txData, rxBuff, txSize:int=0, rxSize:int=0, ignoreNAK:bool=False, nackLastByte:bool=True) -> int:
+            '''# I2C Transfer into a buffer
+            Same as FastXfer() but both the transmitted and the received data stay in the memory of the given
+            buffers (bytes, bytearray, memoryview, numpy array...) without intermediate copies.
+
+            ## Args
+            - `devAddr`      - Device I2C address
+            - `txData`       - Data to write or None
+            - `rxBuff`       - Writable buffer receiving the data or None
+            - `txSize`       - Number of bytes to write (the txData length if zero)
+            - `rxSize`       - Number of bytes to read (the rxBuff length if zero)
+            - other arguments as in FastXfer()
+
+            ## Returns
+            Operation result code indicating number of bytes received or an error code if negative.
+            '''
+            xfer = LIBUSBSIO.I2C_FAST_XFER_T()
+            xfer.txBuff, xfer.txSz = LIBUSBSIO._buffptr(txData, txSize, False)
+            xfer.rxBuff, xfer.rxSz = LIBUSBSIO._buffptr(rxBuff, rxSize, True)
+            xfer.options = LIBUSBSIO._I2C_FastXferOptions(0, ignoreNAK, nackLastByte)
+            xfer.slaveAddr = devAddr
+
+            ret = self._sio._I2C_FastXfer(self._h, xfer)
+
+            if(self.logger.isEnabledFor(logging.DEBUG)):
+                self.logger.debug("I2C%d xfer into buffer: wrote %d, read %d, status=%d" % (self._portNum, xfer.txSz, xfer.rxSz, ret))
+            return ret
+
     def _SPI_OpenOptions(options:int, dataSize:int, cpol:int, cpha:int, preDelay:int, postDelay:int) -> int:
         '''Convert SPI Open parameters to low-level option flags'''
         if cpol:
@@ -1058,6 +1530,20 @@ class LIBUSBSIO(object):
             ret:int = self._sio._SPI_Reset(self._h)
             return ret
 
+        @need_port_open
+        def SetTimeout(self, timeout_ms:int, flags:int=0) -> int:
+            '''# Set the transaction time-out of the SPI port
+
+            ## Args:
+            - `timeout_ms` Time-out, or margin with TIMEOUT_ADAPTIVE, in milliseconds. 0 uses the device settings.
+            - `flags` TIMEOUT_xxx options
+
+            ## Returns
+            Zero on success. Low-level library error code otherwise.
+            '''
+            ret:int = self._sio._SetTimeout(self._h, timeout_ms, flags)
+            return ret
+
         @need_port_open
         def Transfer(self, devSelectPort:int, devSelectPin:int, txData:bytes, size:int=0, options:int=0) -> Tuple[bytes,int]:
             '''# SPI Data Transfer
@@ -1068,17 +1554,15 @@ class LIBUSBSIO(object):
             - `devSelectPin`  GPIO pin of the slave-select signal.
             - `txData`        Data to transmit, zeroes will be sent if this is None.
             - `size`          Size of the transfer. Auto-inferred from txData if omitted.
-            - `options`       Transfer options, unused.
+            - `options`       Transfer options, SPI_XFER_OPTION_TX_ONLY drops the received data.
 
             ## Returns
             Tuple of received data buffer and operation result code indicating number of bytes received
             or an error code if negative.
             '''
-            if not size and txData:
-                size = len(txData)
             if not txData:
                 txData = b"\x00" * size
-            txBuff = (c_uint8 * size)(*txData)
+            txBuff, size = LIBUSBSIO._buffptr(txData, size, False)
             rxBuff = (c_uint8 * size)()
             xfer = LIBUSBSIO.SPI_XFER_T()
             xfer.length = size
@@ -1088,7 +1572,7 @@ class LIBUSBSIO(object):
             xfer.rxBuff = rxBuff
 
             if(self.logger.isEnabledFor(logging.DEBUG)):
-                self.logger.debug("SPI%d SSEL%d.%d transmitting[%d]: %s" % (self._portNum, devSelectPort, devSelectPin, size, LIBUSBSIO.buffprint(txData)))
+                self.logger.debug("SPI%d SSEL%d.%d transmitting[%d]: %s" % (self._portNum, devSelectPort, devSelectPin, size, LIBUSBSIO.buffprint(bytes(txData))))
 
             ret:int = self._sio._SPI_Transfer(self._h, xfer)
             rxData = bytes(rxBuff)
@@ -1097,6 +1581,100 @@ class LIBUSBSIO(object):
                 self.logger.debug("SPI%d status=%d, received: %s" % (self._portNum, ret, LIBUSBSIO.buffprint(rxData)))
             return (rxData, ret)
 
+        @need_port_open
+        def TransferInto(self, devSelectPort:int, devSelectPin:int, txData, rxBuff, size:int=0, options:int=0) -> int:
+            '''# SPI Data Transfer into a buffer
+            Same as Transfer() but both the transmitted and the received data stay in the memory of the given
+            buffers (bytes, bytearray, memoryview, numpy array...) without intermediate copies. The same
+            writable buffer may be passed as txData and rxBuff.
+
+            ## Args:
+            - `devSelectPort` GPIO port of the slave-select signal.
+            - `devSelectPin`  GPIO pin of the slave-select signal.
+            - `txData`        Data to transmit.
+            - `rxBuff`        Writable buffer receiving the data, None to drop it (see SPI_XFER_OPTION_TX_ONLY).
+            - `size`          Size of the transfer. Auto-inferred from txData if omitted.
+            - `options`       Transfer options.
+
+            ## Returns
+            Operation result code indicating number of bytes received or an error code if negative.
+            '''
+            xfer = LIBUSBSIO.SPI_XFER_T()
+            xfer.txBuff, size = LIBUSBSIO._buffptr(txData, size, False)
+            if rxBuff is None:
+                options |= LIBUSBSIO.SPI_XFER_OPTION_TX_ONLY
+            else:
+                xfer.rxBuff, _ = LIBUSBSIO._buffptr(rxBuff, size, True)
+            xfer.length = size
+            xfer.options = options
+            xfer.device = (((devSelectPort & 0x07) << 5) | (devSelectPin & 0x1F))
+
+            ret:int = self._sio._SPI_Transfer(self._h, xfer)
+
+            if(self.logger.isEnabledFor(logging.DEBUG)):
+                self.logger.debug("SPI%d SSEL%d.%d transferred %d bytes into buffer, status=%d" % (self._portNum, devSelectPort, devSelectPin, size, ret))
+            return ret
+
+        def TransferStream(self, devSelectPort:int, devSelectPin:int, txData:bytes, size:int=0, options:int=0) -> Tuple[bytes,int]:
+            '''# SPI Data Transfer of any size
+            Same as Transfer() but not limited to the maximum data size of the device,
+            the library splits the data into chunks and keeps them queued.
+
+            ## Args:
+            - `devSelectPort` GPIO port of the slave-select signal.
+            - `devSelectPin`  GPIO pin of the slave-select signal.
+            - `txData`        Data to transmit, zeroes will be sent if this is None.
+            - `size`          Size of the transfer. Auto-inferred from txData if omitted.
+            - `options`       Transfer options, SPI_XFER_OPTION_TX_ONLY drops the received data.
+
+            ## Returns
+            Tuple of received data buffer and operation result code indicating number of bytes received
+            or an error code if negative.
+            '''
+            if not txData:
+                txData = b"\x00" * size
+            txBuff, size = LIBUSBSIO._buffptr(txData, size, False)
+            rxBuff = (c_uint8 * size)()
+            device = (((devSelectPort & 0x07) << 5) | (devSelectPin & 0x1F))
+
+            ret:int = self._sio._SPI_TransferStream(self._h, device, options, txBuff, rxBuff, size)
+            rxData = bytes(rxBuff)
+
+            if(self.logger.isEnabledFor(logging.DEBUG)):
+                self.logger.debug("SPI%d SSEL%d.%d streamed %d bytes, status=%d" % (self._portNum, devSelectPort, devSelectPin, size, ret))
+            return (rxData, ret)
+
+        @need_port_open
+        def TransferStreamInto(self, devSelectPort:int, devSelectPin:int, txData, rxBuff, size:int=0, options:int=0) -> int:
+            '''# SPI Data Transfer of any size into a buffer
+            Same as TransferStream() but both the transmitted and the received data stay in the memory of the
+            given buffers (bytes, bytearray, memoryview, numpy array...) without intermediate copies, use it
+            for flash dumps and other bulk transfers.
+
+            ## Args:
+            - `devSelectPort` GPIO port of the slave-select signal.
+            - `devSelectPin`  GPIO pin of the slave-select signal.
+            - `txData`        Data to transmit.
+            - `rxBuff`        Writable buffer receiving the data, None to drop it.
+            - `size`          Size of the transfer. Auto-inferred from txData if omitted.
+            - `options`       Transfer options.
+
+            ## Returns
+            Operation result code indicating number of bytes received or an error code if negative.
+            '''
+            txBuff, size = LIBUSBSIO._buffptr(txData, size, False)
+            if rxBuff is None:
+                options |= LIBUSBSIO.SPI_XFER_OPTION_TX_ONLY
+            else:
+                rxBuff, _ = LIBUSBSIO._buffptr(rxBuff, size, True)
+            device = (((devSelectPort & 0x07) << 5) | (devSelectPin & 0x1F))
+
+            ret:int = self._sio._SPI_TransferStream(self._h, device, options, txBuff, rxBuff, size)
+
+            if(self.logger.isEnabledFor(logging.DEBUG)):
+                self.logger.debug("SPI%d SSEL%d.%d streamed %d bytes into buffer, status=%d" % (self._portNum, devSelectPort, devSelectPin, size, ret))
+            return ret
+
     @need_dll_open
     def GPIO_ReadPort(self, port:int) -> Tuple[int,int]:
         '''# Read GPIO port
@@ -1112,6 +1690,89 @@ class LIBUSBSIO(object):
         ret = self._GPIO_ReadPort(self._h, port, val)
         return (val.value, ret)
 
+    @need_dll_open
+    def GPIO_ReadPorts(self, count:int=0) -> Tuple[List[int],int]:
+        '''# Read several GPIO ports
+        Read ports 0 to count-1 at once, with their requests sent back-to-back.
+
+        ## Args:
+        - `count` Number of ports, all ports of the device if 0
+
+        ## Returns
+        Tuple of list of 32bit GPIO port values and operation result code, negative in case of error.
+        '''
+        if not count:
+            count = self.GetNumGPIOPorts()
+        vals = (c_uint32 * count)()
+        ret = self._GPIO_ReadPorts(self._h, vals, count)
+        return (list(vals), ret)
+
+    @need_dll_open
+    def GPIO_SetCache(self, enable:bool) -> int:
+        '''# Enable GPIO state cache
+        Skip direction, output and IOCON changes which would not change the device state.
+
+        ## Args:
+        - `enable` True to enable the cache, False to disable it
+
+        ## Returns
+        Operation result code, negative in case of error.
+        '''
+        return self._GPIO_SetCache(self._h, 1 if enable else 0)
+
+    @need_dll_open
+    def GPIO_Subscribe(self, port:int, pins:int, condition:int) -> Tuple[int,int]:
+        '''# Subscribe to GPIO pin events
+        Watch input pins for edges or levels instead of polling them, see GPIO_WaitEvent.
+
+        ## Args:
+        - `port` GPIO port number
+        - `pins` Pins to be watched
+        - `condition` Combination of GPIO_EVENT_xxx flags
+
+        ## Returns
+        Tuple of subscription handle, None on failure, and operation result code.
+        '''
+        hSub = self._GPIO_Subscribe(self._h, port, pins, condition, None, None)
+        return (hSub, LIBUSBSIO.OK if hSub else c_int32(self._GetLastError(self._h)).value)
+
+    @need_dll_open
+    def GPIO_WaitEvent(self, hSub:int, timeout_ms:int) -> Tuple[int,int,int]:
+        '''# Wait for a GPIO event
+        Wait until pins of the subscription met its condition.
+
+        ## Args:
+        - `hSub` Subscription handle returned by GPIO_Subscribe
+        - `timeout_ms` Longest time to wait, 0 to only check for an event
+
+        ## Returns
+        Tuple of pins which met the condition, port status and operation result code,
+        ERR_TIMEOUT if no event occurred in time.
+        '''
+        pins = c_uint32(0)
+        status = c_uint32(0)
+        ret = self._GPIO_WaitEvent(hSub, pins, status, timeout_ms)
+        return (pins.value, status.value, ret)
+
+    @need_dll_open
+    def GPIO_Unsubscribe(self, hSub:int) -> int:
+        '''# Cancel a GPIO subscription
+
+        ## Returns
+        Operation result code, negative in case of error.
+        '''
+        return self._GPIO_Unsubscribe(hSub)
+
+    @need_dll_open
+    def GPIO_SetSamplePeriod(self, period_ms:int) -> int:
+        '''# Set the GPIO sample period
+        Milliseconds between two reads of the watched ports when the firmware does not report events.
+
+        ## Returns
+        Operation result code, negative in case of error.
+        '''
+        return self._GPIO_SetSamplePeriod(self._h, period_ms)
+
     @need_dll_open
     def GPIO_WritePort(self, port:int, value:int) -> Tuple[int,int]:
         '''# Write GPIO port
@@ -1280,6 +1941,141 @@ class LIBUSBSIO(object):
         ret = self._GPIO_ConfigIOPin(self._h, port, pin, mode)
         return ret
 
+    class BATCH:
+        '''# List of operations executed by a single library call
+        Collects I2C, SPI and GPIO operations to be executed by LIBUSBSIO.Batch(), for example a whole register
+        script. The operations are sent back-to-back without interpreter work in between, the Python thread
+        only runs again once the last response arrived. A list may be executed any number of times, each run
+        refreshes the results and the received data. Do not run the same list on several devices at once.
+
+        Ports are given by number or by the I2C or SPI object. Each operation method returns the index of the
+        operation, to be passed to Result(), Data() or Pins() after the run.
+        '''
+        def __init__(self):
+            self._ops:'list[LIBUSBSIO.BATCH_OP_T]' = []
+            self._keep = []     # buffers and transfer descriptors the operations point to
+            self._rx = {}       # operation index -> received data buffer
+            self._array = None  # operations as passed to the library, built by the first run
+
+        def __len__(self) -> int:
+            return len(self._ops)
+
+        def _add(self, op:'LIBUSBSIO.BATCH_OP_T', rxBuff=None, *keep) -> int:
+            '''Internal, append an operation'''
+            ix = len(self._ops)
+            self._ops.append(op)
+            self._keep.extend(keep)
+            if rxBuff is not None:
+                self._rx[ix] = rxBuff
+            self._array = None
+            return ix
+
+        def _port(port) -> int:
+            '''Internal, port number of a port object or number'''
+            return port._portNum if isinstance(port, LIBUSBSIO.PORT) else port
+
+        def I2C_Read(self, port, devAddr:int, rxSize:int, start:bool=True, stop:bool=True, ignoreNAK:bool=False, nackLastByte:bool=True, noAddress:bool=False, rxBuff=None) -> int:
+            '''# Add an I2C Read
+            Arguments as in I2C.DeviceRead(). The data is received into `rxBuff` if given, see I2C.DeviceReadInto().
+            '''
+            if rxBuff is None:
+                rxBuff = (c_uint8 * rxSize)()
+            ptr, rxSize = LIBUSBSIO._buffptr(rxBuff, rxSize, True)
+            op = LIBUSBSIO.BATCH_OP_T(op=LIBUSBSIO.BATCH_I2C_READ, port=LIBUSBSIO.BATCH._port(port), addr=devAddr,
+                                      options=LIBUSBSIO._I2C_NormalXferOptions(0, start, stop, ignoreNAK, nackLastByte, noAddress),
+                                      length=rxSize, buffer=ptr)
+            return self._add(op, ptr, ptr)
+
+        def I2C_Write(self, port, devAddr:int, txData, txSize:int=0, start:bool=True, stop:bool=True, ignoreNAK:bool=False, noAddress:bool=False) -> int:
+            '''# Add an I2C Write
+            Arguments as in I2C.DeviceWrite(). The data is not copied, keep a writable `txData` unchanged until the run.
+            '''
+            ptr, txSize = LIBUSBSIO._buffptr(txData, txSize, False)
+            op = LIBUSBSIO.BATCH_OP_T(op=LIBUSBSIO.BATCH_I2C_WRITE, port=LIBUSBSIO.BATCH._port(port), addr=devAddr,
+                                      options=LIBUSBSIO._I2C_NormalXferOptions(0, start, stop, ignoreNAK, False, noAddress),
+                                      length=txSize, buffer=ptr)
+            return self._add(op, None, ptr)
+
+        def I2C_FastXfer(self, port, devAddr:int, txData=None, rxSize:int=0, ignoreNAK:bool=False, nackLastByte:bool=True, txSize:int=0, rxBuff=None) -> int:
+            '''# Add an I2C Transfer
+            Arguments as in I2C.FastXfer(). The data is received into `rxBuff` if given.
+            '''
+            if rxBuff is None and rxSize:
+                rxBuff = (c_uint8 * rxSize)()
+            xfer = LIBUSBSIO.I2C_FAST_XFER_T()
+            xfer.txBuff, xfer.txSz = LIBUSBSIO._buffptr(txData, txSize, False)
+            rxPtr, xfer.rxSz = LIBUSBSIO._buffptr(rxBuff, rxSize, True)
+            xfer.rxBuff = rxPtr
+            xfer.options = LIBUSBSIO._I2C_FastXferOptions(0, ignoreNAK, nackLastByte)
+            xfer.slaveAddr = devAddr
+            op = LIBUSBSIO.BATCH_OP_T(op=LIBUSBSIO.BATCH_I2C_XFER, port=LIBUSBSIO.BATCH._port(port),
+                                      i2cXfer=pointer(xfer))
+            return self._add(op, rxPtr, xfer, op.i2cXfer)
+
+        def SPI_Transfer(self, port, devSelectPort:int, devSelectPin:int, txData, size:int=0, options:int=0, rxBuff=None) -> int:
+            '''# Add an SPI Transfer
+            Arguments as in SPI.Transfer(). The data is received into `rxBuff` if given, nothing is received
+            with SPI_XFER_OPTION_TX_ONLY.
+            '''
+            xfer = LIBUSBSIO.SPI_XFER_T()
+            xfer.txBuff, size = LIBUSBSIO._buffptr(txData, size, False)
+            rxPtr = None
+            if not (options & LIBUSBSIO.SPI_XFER_OPTION_TX_ONLY):
+                if rxBuff is None:
+                    rxBuff = (c_uint8 * size)()
+                rxPtr, _ = LIBUSBSIO._buffptr(rxBuff, size, True)
+                xfer.rxBuff = rxPtr
+            xfer.length = size
+            xfer.options = options
+            xfer.device = (((devSelectPort & 0x07) << 5) | (devSelectPin & 0x1F))
+            op = LIBUSBSIO.BATCH_OP_T(op=LIBUSBSIO.BATCH_SPI_XFER, port=LIBUSBSIO.BATCH._port(port),
+                                      spiXfer=pointer(xfer))
+            return self._add(op, rxPtr, xfer, op.spiXfer)
+
+        def GPIO_SetPort(self, port:int, setpins:int) -> int:
+            '''# Add a GPIO_SetPort'''
+            return self._add(LIBUSBSIO.BATCH_OP_T(op=LIBUSBSIO.BATCH_GPIO_SET, port=port, pins=setpins))
+
+        def GPIO_ClearPort(self, port:int, clrpins:int) -> int:
+            '''# Add a GPIO_ClearPort'''
+            return self._add(LIBUSBSIO.BATCH_OP_T(op=LIBUSBSIO.BATCH_GPIO_CLEAR, port=port, pins=clrpins))
+
+        def GPIO_ReadPort(self, port:int) -> int:
+            '''# Add a GPIO_ReadPort, the status is returned by Pins()'''
+            return self._add(LIBUSBSIO.BATCH_OP_T(op=LIBUSBSIO.BATCH_GPIO_READ, port=port))
+
+        def Result(self, ix:int) -> int:
+            '''# Result of an operation after the run, the value the blocking function returns'''
+            return self._array[ix].result if self._array is not None else LIBUSBSIO.ERR_FATAL
+
+        def Pins(self, ix:int) -> int:
+            '''# Port status read by a GPIO_ReadPort operation'''
+            return self._array[ix].pins if self._array is not None else 0
+
+        def Data(self, ix:int) -> bytes:
+            '''# Data received by an I2C or SPI operation, empty if it failed'''
+            ret = self.Result(ix)
+            if ix not in self._rx or ret <= 0:
+                return b''
+            return bytes(cast(self._rx[ix], POINTER(c_uint8 * ret)).contents)
+
+    @need_dll_open
+    def Batch(self, batch:'LIBUSBSIO.BATCH') -> int:
+        '''# Execute a list of I2C, SPI and GPIO operations
+        Runs all operations of the batch in one library call, see LIBUSBSIO.BATCH. Like all calls of this module,
+        the call releases the Python GIL while it waits for the device, so other Python threads keep running.
+
+        ## Returns
+        Zero if all operations succeeded, otherwise the error code of the first failed one. The result of
+        each operation is returned by batch.Result().
+        '''
+        if batch._array is None:
+            batch._array = (LIBUSBSIO.BATCH_OP_T * len(batch._ops))(*batch._ops)
+        ret = self._Batch(self._h, batch._array, len(batch._ops))
+        if(self.logger.isEnabledFor(logging.DEBUG)):
+            self.logger.debug("Batch of %d operations, status=%d" % (len(batch._ops), ret))
+        return ret
+
     @need_dll_loaded
     def HIDAPI_Enumerate(self, vidpid:'tuple[int,int]' = None, read_ex_info:bool = False) -> Generator[HIDAPI_DEVICE_INFO_T, None, None]:
         '''# USB HID enumeration generator
@@ -1418,13 +2214,11 @@ class LIBUSBSIO(object):
             Total number of bytes written to to device. Note that this may be smaller or even larger value than
             the `size` depending on the physical HID output report size.
             '''
-            if not size:
-                size = len(data)
+            buff, size = LIBUSBSIO._buffptr(data, size, False)
 
             if(self.logger.isEnabledFor(logging.DEBUG)):
-                self.logger.debug("HID device %d writing[%d]: %s" % (self._h, size, LIBUSBSIO.buffprint(data)))
+                self.logger.debug("HID device %d writing[%d]: %s" % (self._h, size, LIBUSBSIO.buffprint(bytes(data))))
 
-            buff = (c_uint8 * size)(*data)
             ret = self._sio._HIDAPI_DeviceWrite(self._h, buff, size, timeout_ms)
             self.logger.debug("HID device %d wrote %d bytes" % (self._h, ret))
             return ret
@@ -1455,6 +2249,27 @@ class LIBUSBSIO(object):
                 self.logger.debug("HID device %d read[%d]: %s" % (self._h, ret, LIBUSBSIO.buffprint(data)))
             return (data, ret)
 
+        @need_device_open
+        def ReadInto(self, buff, timeout_ms:int, size:int = 0) -> int:
+            '''# Read from HID device into a buffer
+            Same as Read() but the report is received straight into the memory of a writable buffer
+            (bytearray, memoryview, numpy array...) without intermediate copies.
+
+            ## Args
+            - `buff`       Writable buffer receiving the data.
+            - `timeout_ms` Read timeout.
+            - `size`       Size of the data to be read, the buffer length if zero.
+
+            ## Returns
+            Number of data bytes received if positive, otherwise an error code.
+            '''
+            ptr, size = LIBUSBSIO._buffptr(buff, size, True)
+            ret = self._sio._HIDAPI_DeviceRead(self._h, ptr, size, timeout_ms)
+
+            if(self.logger.isEnabledFor(logging.DEBUG)):
+                self.logger.debug("HID device %d read %d bytes into buffer" % (self._h, ret))
+            return ret
+
     @need_dll_loaded
     def HIDAPI_DeviceCreate(self) -> HID_DEVICE:
         '''# Create HID device object.
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022 NXP
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# NXP USBSIO Library - decoder of the binary trace files written by LPCUSBSIO_DumpTrace()
+#
+# Usage: python -m libusbsio.tracedump [-s] FILE
+#
+import argparse
+import struct
+import sys
+from typing import Generator, List, Tuple
+
+# file and record layout, see LPCUSBSIO_TRACE_REC_T and LPCUSBSIO_DumpTrace() in lpcusbsio.h
+MAGIC = b"SIOTRACE"
+HEADER = struct.Struct("<8sIIII")
+RECORD = struct.Struct("<QIIBBBBIIi")
+
+EVENTS = {1: "SUBMIT", 2: "WRITE", 3: "READ", 4: "DISCARD", 5: "COMPLETE"}
+
+REQUESTS = {
+    0x00: "I2C_RESET", 0x01: "I2C_INIT", 0x02: "I2C_DEINIT", 0x03: "I2C_WRITE", 0x04: "I2C_READ", 0x05: "I2C_XFER",
+    0x10: "SPI_RESET", 0x11: "SPI_INIT", 0x12: "SPI_DEINIT", 0x13: "SPI_XFER",
+    0x20: "GPIO_VALUE", 0x21: "GPIO_DIR", 0x23: "GPIO_TOGGLE", 0x24: "GPIO_IOCONFIG", 0x25: "GPIO_EVENT_CFG",
+    0xF0: "DEV_INFO",
+}
+
+# LPCUSBSIO_ERR_T codes of COMPLETE records
+ERRORS = {
+    0: "OK", -1: "ERR_HID_LIB", -2: "ERR_BAD_HANDLE", -3: "ERR_SYNCHRONIZATION", -4: "ERR_MEM_ALLOC",
+    -5: "ERR_MUTEX_CREATE", -6: "ERR_PENDING", -0x11: "ERR_FATAL", -0x12: "ERR_I2C_NAK", -0x13: "ERR_I2C_BUS",
+    -0x14: "ERR_I2C_SLAVE_NAK", -0x15: "ERR_I2C_ARBLOST", -0x20: "ERR_TIMEOUT", -0x21: "ERR_INVALID_CMD",
+    -0x22: "ERR_INVALID_PARAM", -0x23: "ERR_PARTIAL_DATA",
+}
+
+class TraceRecord:
+    '''One record of LPCUSBSIO_TRACE_REC_T'''
+    def __init__(self, data: bytes):
+        (self.timeUs, self.seq, self.thread, self.event, self.req, self.transId, self.port,
+         self.len, self.aux, self.result) = RECORD.unpack_from(data)
+
+def read_dumps(path: str) -> Generator[Tuple[int, int, List[TraceRecord]], None, None]:
+    '''# Read a trace file
+    Yields a (fwVersion, lost, records) tuple for each dump appended to the file.
+    '''
+    with open(path, "rb") as f:
+        data = f.read()
+    ofs = 0
+    while ofs + HEADER.size <= len(data):
+        magic, recSize, count, lost, fwVersion = HEADER.unpack_from(data, ofs)
+        if magic != MAGIC or recSize < RECORD.size:
+            raise ValueError("%s: no trace dump at offset %d" % (path, ofs))
+        ofs += HEADER.size
+        recs = [TraceRecord(data[ofs + i * recSize:ofs + (i + 1) * recSize]) for i in range(count)]
+        ofs += count * recSize
+        yield fwVersion, lost, recs
+
+def format_record(rec: TraceRecord, t0: int) -> str:
+    '''One line of text for a record, t0 is the time stamp printed as zero'''
+    ev = EVENTS.get(rec.event, "EVENT_%d" % rec.event)
+    line = "%12.3f ms  %08x  %-8s %-14s port=%d id=%-3d" % ((rec.timeUs - t0) / 1000.0, rec.thread, ev,
+        REQUESTS.get(rec.req, "0x%02x" % rec.req), rec.port, rec.transId)
+    if rec.event == 1:
+        line += " len=%d tmo=%dms" % (rec.len, rec.aux)
+    elif rec.event == 2:
+        line += " packet=%d len=%d res=%d" % (rec.aux, rec.len, rec.result)
+    elif rec.event in (3, 4):
+        line += " packet=%d len=%d resp=0x%02x" % (rec.aux, rec.len, rec.result)
+    elif rec.event == 5:
+        line += " rx=%d %dus %s" % (rec.len, rec.aux, ERRORS.get(rec.result, str(rec.result)))
+    return line
+
+def summary(recs: List[TraceRecord]) -> List[str]:
+    '''Lines reporting the failed, discarded and unfinished transactions of a dump'''
+    lines = []
+    open_reqs = {}
+    for rec in recs:
+        if rec.event == 1:
+            open_reqs[rec.transId] = rec
+        elif rec.event == 5:
+            open_reqs.pop(rec.transId, None)
+            if rec.result != 0:
+                lines.append("  failed:     seq=%d %s" % (rec.seq, format_record(rec, recs[0].timeUs).strip()))
+        elif rec.event == 4:
+            lines.append("  discarded:  seq=%d %s" % (rec.seq, format_record(rec, recs[0].timeUs).strip()))
+    for rec in open_reqs.values():
+        lines.append("  unfinished: seq=%d %s" % (rec.seq, format_record(rec, recs[0].timeUs).strip()))
+    return lines
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(prog="python -m libusbsio.tracedump",
+                                     description="Decode a LIBUSBSIO binary trace file.")
+    parser.add_argument("file", help="file written by LPCUSBSIO_DumpTrace() or through LPCUSBSIO_TRACE_FILE")
+    parser.add_argument("-s", "--summary", action="store_true", help="only list failed, discarded and unfinished transactions")
+    args = parser.parse_args(argv)
+
+    for n, (fwVersion, lost, recs) in enumerate(read_dumps(args.file)):
+        print("dump %d: FW %d.%d, %d records, %d lost" % (n, fwVersion >> 16, fwVersion & 0xFFFF, len(recs), lost))
+        if not recs:
+            continue
+        if args.summary:
+            for line in summary(recs):
+                print(line)
+        else:
+            for rec in recs:
+                print("%8d %s" % (rec.seq, format_record(rec, recs[0].timeUs)))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
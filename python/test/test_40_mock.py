@@ -0,0 +1,284 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022 NXP
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# TEST CODE of NXP USBSIO Library - tests against the emulated bridges of the mock backend
+#
+# These tests need no hardware, each one selects the mock backend with the options
+# it needs and returns to the HID backend afterwards.
+#
+
+import unittest
+import functools
+import logging
+import sys
+import os
+import threading
+
+from test import *
+
+# emulated bridges, see src/hid_api/mock/hid_mock.h
+MOCK_VIDPIDS = [ LIBUSBSIO.VIDPID_MCULINK ]
+MOCK_I2C_ADDR = 0x50
+MOCK_NAK_ADDR = 0x51
+
+def use_mock(options):
+    '''Decorator to run a test on the emulated bridges with the first one open'''
+    def decorator(func):
+        @functools.wraps(func)
+        def wrapper(self, *args, **kwargs):
+            self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_MOCK, options), LIBUSBSIO.OK)
+            try:
+                self.assertTrue(self.sio.GetNumPorts(vidpids=MOCK_VIDPIDS) > 0)
+                self.assertTrue(self.sio.Open(0))
+                return func(self, *args, **kwargs)
+            finally:
+                # the ports are closed before their device
+                self.i2c = None
+                self.spi = None
+                self.sio.Close()
+                self.sio.SetBackend(LIBUSBSIO.BACKEND_HIDAPI)
+        return wrapper
+    return decorator
+
+class TestMockBackend(TestBase):
+
+    def tearDown(self):
+        self.sio.SetBackend(LIBUSBSIO.BACKEND_HIDAPI)
+        super().tearDown()
+
+    def test_SetBackend_Enumerate(self):
+        self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_MOCK, "devices=3,latency=100"), LIBUSBSIO.OK)
+        self.assertEqual(self.sio.GetNumPorts(vidpids=MOCK_VIDPIDS), 3)
+        for ix in range(3):
+            info = self.sio.GetDeviceInfo(ix)
+            self.assertTrue(info)
+            self.assertEqual((info.vendor_id, info.product_id), LIBUSBSIO.VIDPID_MCULINK)
+        self.assertEqual(self.sio.GetDeviceInfo(3), None)
+
+        # options which are not given keep their value
+        self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_MOCK, "latency=200"), LIBUSBSIO.OK)
+        self.assertEqual(self.sio.GetNumPorts(vidpids=MOCK_VIDPIDS), 3)
+        self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_MOCK, "devices=1"), LIBUSBSIO.OK)
+        self.assertEqual(self.sio.GetNumPorts(vidpids=MOCK_VIDPIDS), 1)
+
+    def test_SetBackend_BadParams(self):
+        self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_MOCK, "devices=1,bogus=2"), LIBUSBSIO.ERR_INVALID_PARAM)
+        self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_MOCK, "latency="), LIBUSBSIO.ERR_INVALID_PARAM)
+        self.assertEqual(self.sio.SetBackend(7), LIBUSBSIO.ERR_INVALID_PARAM)
+
+    @use_mock("devices=1,latency=100")
+    def test_SetBackend_WhileOpen(self):
+        # the backend cannot change under an open device
+        self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_HIDAPI), LIBUSBSIO.ERR_HID_LIB)
+        self.assertTrue(self.sio.IsOpen())
+        self.sio.Close()
+        self.assertEqual(self.sio.SetBackend(LIBUSBSIO.BACKEND_MOCK, "devices=2"), LIBUSBSIO.OK)
+        self.assertEqual(self.sio.GetNumPorts(vidpids=MOCK_VIDPIDS), 2)
+        self.assertTrue(self.sio.Open(1))
+
+    @use_mock("devices=1,latency=100,nak=0x51")
+    def test_Mock_Transfers(self):
+        self.assertTrue(self.sio.GetVersion())
+        self.assertTrue(self.sio.GetNumI2CPorts() > 0 and self.sio.GetNumSPIPorts() > 0)
+
+        # I2C slaves keep what was written to them
+        self.i2c = self.sio.I2C_Open(400000)
+        self.assertTrue(self.i2c)
+        self.assertEqual(self.i2c.DeviceWrite(MOCK_I2C_ADDR, b"hello"), 5)
+        (data, ret) = self.i2c.DeviceRead(MOCK_I2C_ADDR, 5)
+        self.assertEqual((data, ret), (b"hello", 5))
+        self.assertTrue(self.i2c.DeviceWrite(MOCK_NAK_ADDR, b"hello") < 0)
+
+        # SPI returns the transmitted data
+        self.spi = self.sio.SPI_Open(1000000)
+        self.assertTrue(self.spi)
+        (data, ret) = self.spi.Transfer(0, 0, b"loopback")
+        self.assertEqual((data, ret), (b"loopback", 8))
+
+        # GPIO ports keep their pin levels
+        self.assertTrue(self.sio.GPIO_SetPortOutDir(1, 0x0C) >= 0)
+        self.assertTrue(self.sio.GPIO_SetPort(1, 0x0C) >= 0)
+        (pins, ret) = self.sio.GPIO_ReadPort(1)
+        self.assertTrue(ret >= 0)
+        self.assertEqual(pins & 0x0C, 0x0C)
+        self.assertTrue(self.sio.GPIO_ClearPin(1, 2) >= 0)
+        self.assertEqual(self.sio.GPIO_GetPin(1, 2), 0)
+        self.assertEqual(self.sio.GPIO_GetPin(1, 3), 1)
+
+class TestMockInto(TestBase):
+
+    @use_mock("devices=1,latency=100")
+    def test_I2C_ReadInto(self):
+        self.i2c = self.sio.I2C_Open(400000)
+        self.assertTrue(self.i2c)
+        self.assertEqual(self.i2c.DeviceWrite(MOCK_I2C_ADDR, bytearray(b"abcdef")), 6)
+
+        rx = bytearray(6)
+        self.assertEqual(self.i2c.DeviceReadInto(MOCK_I2C_ADDR, rx), 6)
+        self.assertEqual(rx, b"abcdef")
+
+        # a slice is received in place, the bytes around it stay untouched
+        rx = bytearray(b"\xAA" * 10)
+        self.assertEqual(self.i2c.DeviceReadInto(MOCK_I2C_ADDR, memoryview(rx)[2:6]), 4)
+        self.assertEqual(rx, b"\xAA\xAAabcd" + b"\xAA" * 4)
+        self.assertEqual(self.i2c.DeviceReadInto(MOCK_I2C_ADDR, rx, 3), 3)
+        self.assertEqual(rx, b"abcbcd" + b"\xAA" * 4)
+
+        self.assertEqual(self.i2c.FastXferInto(MOCK_I2C_ADDR, memoryview(b"xyz"), memoryview(rx)[5:8]), 3)
+        self.assertEqual(rx[5:8], b"xyz")
+
+        # receive buffers must be writable and large enough
+        with self.assertRaises(LIBUSBSIO_Exception):
+            self.i2c.DeviceReadInto(MOCK_I2C_ADDR, b"abcdef")
+        with self.assertRaises(LIBUSBSIO_Exception):
+            self.i2c.DeviceReadInto(MOCK_I2C_ADDR, bytearray(4), 5)
+        with self.assertRaises(LIBUSBSIO_Exception):
+            self.i2c.FastXferInto(MOCK_I2C_ADDR, b"abc", bytearray(2), rxSize=3)
+
+    @use_mock("devices=1,latency=100")
+    def test_SPI_TransferInto(self):
+        self.spi = self.sio.SPI_Open(1000000)
+        self.assertTrue(self.spi)
+
+        # the same buffer transmits and receives
+        buff = bytearray(range(100))
+        self.assertEqual(self.spi.TransferInto(0, 0, buff, buff), 100)
+        self.assertEqual(buff, bytearray(range(100)))
+
+        rx = bytearray(8)
+        self.assertEqual(self.spi.TransferInto(0, 0, b"loopback", memoryview(rx)), 8)
+        self.assertEqual(rx, b"loopback")
+        self.assertTrue(self.spi.TransferInto(0, 0, b"tx only", None) >= 0)
+
+        # streams span many reports
+        data = bytes(range(256)) * 40
+        rx = bytearray(len(data))
+        self.assertEqual(self.spi.TransferStreamInto(0, 0, data, rx), len(data))
+        self.assertEqual(rx, data)
+
+        with self.assertRaises(LIBUSBSIO_Exception):
+            self.spi.TransferInto(0, 0, b"loopback", bytearray(4))
+        with self.assertRaises(LIBUSBSIO_Exception):
+            self.spi.TransferStreamInto(0, 0, data, b"\x00" * len(data))
+
+class TestMockBatch(TestBase):
+
+    @use_mock("devices=1,latency=100")
+    def test_Batch_Ops(self):
+        self.i2c = self.sio.I2C_Open(400000)
+        self.spi = self.sio.SPI_Open(1000000)
+        self.assertTrue(self.i2c and self.spi)
+
+        # ports are given by object or by number
+        tx = bytearray(b"123")
+        rx = bytearray(3)
+        b = LIBUSBSIO.BATCH()
+        w = b.I2C_Write(self.i2c, MOCK_I2C_ADDR, tx)
+        r = b.I2C_Read(0, MOCK_I2C_ADDR, 3)
+        ri = b.I2C_Read(self.i2c, MOCK_I2C_ADDR, 3, rxBuff=rx)
+        x = b.I2C_FastXfer(0, MOCK_I2C_ADDR, b"ab", 2)
+        s = b.SPI_Transfer(self.spi, 0, 0, bytearray(b"spi!"))
+        t = b.SPI_Transfer(0, 0, 0, b"tx", options=LIBUSBSIO.SPI_XFER_OPTION_TX_ONLY)
+        g0 = b.GPIO_SetPort(1, 0x05)
+        g1 = b.GPIO_ReadPort(1)
+        g2 = b.GPIO_ClearPort(1, 0x01)
+        g3 = b.GPIO_ReadPort(1)
+        self.assertEqual(len(b), 10)
+
+        self.assertEqual(self.sio.Batch(b), LIBUSBSIO.OK)
+        self.assertEqual(b.Result(w), 3)
+        self.assertEqual(b.Data(r), b"123")
+        self.assertEqual(rx, b"123")
+        self.assertEqual(b.Data(x), b"ab")
+        self.assertEqual(b.Data(s), b"spi!")
+        self.assertEqual(b.Data(t), b"")
+        self.assertTrue(b.Result(g0) >= 0 and b.Result(g2) >= 0)
+        self.assertEqual(b.Pins(g1) & 0x05, 0x05)
+        self.assertEqual(b.Pins(g3) & 0x05, 0x04)
+
+        # each run refreshes the results, the transmitted data is not copied
+        tx[:] = b"456"
+        self.assertEqual(self.i2c.Batch(b), LIBUSBSIO.OK)
+        self.assertEqual(b.Data(r), b"456")
+        self.assertEqual(rx, b"456")
+
+    @use_mock("devices=1,latency=100,nak=0x51")
+    def test_Batch_Failure(self):
+        self.i2c = self.sio.I2C_Open(400000)
+        self.assertTrue(self.i2c)
+
+        # a failed operation does not stop the following ones
+        b = LIBUSBSIO.BATCH()
+        w = b.I2C_Write(self.i2c, MOCK_I2C_ADDR, b"ok")
+        n = b.I2C_Write(self.i2c, MOCK_NAK_ADDR, b"nak")
+        r = b.I2C_Read(self.i2c, MOCK_I2C_ADDR, 2)
+        ret = self.sio.Batch(b)
+        self.assertTrue(ret < 0)
+        self.assertEqual(b.Result(n), ret)
+        self.assertEqual(b.Result(w), 2)
+        self.assertEqual(b.Data(n), b"")
+        self.assertEqual(b.Data(r), b"ok")
+
+        # results are not available before the first run
+        self.assertEqual(LIBUSBSIO.BATCH().Result(0), LIBUSBSIO.ERR_FATAL)
+        self.assertEqual(self.sio.Batch(LIBUSBSIO.BATCH()), LIBUSBSIO.OK)
+
+class TestMockSharedReaders(TestBase):
+
+    def tearDown(self):
+        self.sio.SetSharedReaders(0)
+        super().tearDown()
+
+    def test_SetSharedReaders_BadParams(self):
+        self.assertEqual(self.sio.SetSharedReaders(17), LIBUSBSIO.ERR_INVALID_PARAM)
+        self.assertEqual(self.sio.SetSharedReaders(16), LIBUSBSIO.OK)
+        self.assertEqual(self.sio.SetSharedReaders(0), LIBUSBSIO.OK)
+
+    @use_mock("devices=2,latency=100")
+    def test_SetSharedReaders(self):
+        # both devices are served by the same thread
+        self.assertEqual(self.sio.SetSharedReaders(1), LIBUSBSIO.OK)
+        sio2 = LIBUSBSIO(loglevel=LOGLEVEL)
+        self.assertTrue(sio2.Open(1))
+        i2cs = []
+        try:
+            for sio in (self.sio, sio2):
+                self.assertEqual(sio.SetReaderThread(LIBUSBSIO.READER_SHARED), LIBUSBSIO.OK)
+                i2c = sio.I2C_Open(400000)
+                self.assertTrue(i2c)
+                i2cs.append(i2c)
+
+            # each device keeps its own slave memory
+            for (ix, i2c) in enumerate(i2cs):
+                self.assertEqual(i2c.DeviceWrite(MOCK_I2C_ADDR, bytes([ix]) * 4), 4)
+            for (ix, i2c) in enumerate(i2cs):
+                self.assertEqual(i2c.DeviceRead(MOCK_I2C_ADDR, 4), (bytes([ix]) * 4, 4))
+
+            # transfers of both devices complete while the other one is busy
+            errors = []
+            def run(i2c, value):
+                for _ in range(100):
+                    if i2c.FastXfer(MOCK_I2C_ADDR, bytes([value]), rxSize=1) != (bytes([value]), 1):
+                        errors.append(value)
+            threads = [ threading.Thread(target=run, args=(i2c, ix)) for (ix, i2c) in enumerate(i2cs) ]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+            self.assertEqual(errors, [])
+
+            # the caller reads the responses once the shared reader is stopped
+            self.assertEqual(self.sio.SetReaderThread(LIBUSBSIO.READER_CALLER), LIBUSBSIO.OK)
+            self.assertEqual(i2cs[0].DeviceRead(MOCK_I2C_ADDR, 4), (b"\x00" * 4, 4))
+            self.assertEqual(self.sio.SetReaderThread(LIBUSBSIO.READER_SHARED), LIBUSBSIO.OK)
+            self.assertEqual(i2cs[1].DeviceRead(MOCK_I2C_ADDR, 4), (b"\x01" * 4, 4))
+        finally:
+            # the ports are closed before their devices
+            for i2c in i2cs:
+                i2c.Close()
+            sio2.Close()
+
+if __name__ == '__main__':
+    unittest.main()
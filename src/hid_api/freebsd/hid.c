@@ -83,6 +83,46 @@ int HID_API_EXPORT hid_write_timeout(hid_device *dev, const unsigned char *data,
     return bytes_written;
 }
 
+int HID_API_EXPORT hid_write_reports(hid_device *dev, const unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    size_t done;
+
+    /* one write per report, the system hidapi has no vectored I/O */
+    for (done = 0; done < count; done++)
+    {
+        if (hid_write_timeout(dev, data + done * length, length, milliseconds) <= 0)
+            break;
+    }
+    return (done > 0) ? (int)done : -1;
+}
+
+int HID_API_EXPORT hid_read_reports(hid_device *dev, unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    size_t done;
+    int res = 0;
+
+    /* only the first report is waited for */
+    for (done = 0; done < count; done++)
+    {
+        res = hid_read_timeout(dev, data + done * length, length, (done == 0) ? milliseconds : 0);
+        if (res <= 0)
+            break;
+    }
+    return (done > 0) ? (int)done : res;
+}
+
+int HID_API_EXPORT hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds)
+{
+    /* The system hidapi does not expose its handles, each device needs its own reader. */
+    return -1;
+}
+
+long HID_API_EXPORT hid_hotplug_count(void)
+{
+    /* The system hidapi has no hot-plug support, every enumeration has to rescan. */
+    return -1;
+}
+
 int HID_API_EXPORT hid_get_report_lengths(hid_device* device, unsigned short* output_report_length, unsigned short* input_report_length)
 {
     if (output_report_length)
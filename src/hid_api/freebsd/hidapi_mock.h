@@ -53,3 +53,11 @@ int HID_API_EXPORT hid_write_timeout(hid_device *dev, const unsigned char *data,
 int HID_API_EXPORT hid_get_report_lengths(hid_device* device, unsigned short* output_report_length, unsigned short* input_report_length);
 
 int HID_API_EXPORT hid_get_usage(hid_device* device, unsigned short* usage_page, unsigned short* usage);
+
+long HID_API_EXPORT hid_hotplug_count(void);
+
+int HID_API_EXPORT hid_write_reports(hid_device *dev, const unsigned char *data, size_t length, size_t count, int milliseconds);
+
+int HID_API_EXPORT hid_read_reports(hid_device *dev, unsigned char *data, size_t length, size_t count, int milliseconds);
+
+int HID_API_EXPORT hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds);
@@ -445,6 +445,86 @@ extern "C" {
         */
         int HID_API_EXPORT hid_get_usage(hid_device* device, unsigned short* usage_page, unsigned short* usage);
 
+        /** @brief Count the HID devices plugged or unplugged so far
+
+            The first call starts watching the system for arrivals and
+            removals of HID devices, later calls return the running count
+            without enumerating. Two equal results mean that no device
+            arrived or left in between.
+
+            @ingroup API
+
+            @returns
+                This function returns the number of hot-plug events seen
+                since the first call, or -1 if the platform cannot tell.
+        */
+        long HID_API_EXPORT hid_hotplug_count(void);
+
+        /** @brief Write several Output reports at once
+
+            The reports are stored back to back, each of them starting
+            with its Report ID like for hid_write(). Platforms able to
+            pass all of them to the system in one call do so.
+
+            @ingroup API
+            @param device A device handle returned from hid_open().
+            @param data The reports, count times length bytes.
+            @param length The length in bytes of each report.
+            @param count The number of reports.
+            @param milliseconds Timeout of each write like for
+                hid_write_timeout().
+
+            @returns
+                This function returns the number of reports written,
+                which is less than count if a write failed after the
+                first one, or -1 if no report was written.
+        */
+        int HID_API_EXPORT hid_write_reports(hid_device *device, const unsigned char *data, size_t length, size_t count, int milliseconds);
+
+        /** @brief Read the Input reports already received
+
+            Waits for the first report like hid_read_timeout() and
+            collects the reports received in the meantime without
+            waiting any longer. Platforms able to read all of them in
+            one call do so.
+
+            @ingroup API
+            @param device A device handle returned from hid_open().
+            @param data Buffer of count times length bytes, report n is
+                stored at data + n * length.
+            @param length The size of the buffer of each report.
+            @param count The maximum number of reports to read.
+            @param milliseconds Timeout for the first report, -1 for
+                blocking wait.
+
+            @returns
+                This function returns the number of reports read, 0 if
+                no report arrived in time and -1 on error.
+        */
+        int HID_API_EXPORT hid_read_reports(hid_device *device, unsigned char *data, size_t length, size_t count, int milliseconds);
+
+        /** @brief Wait for Input reports on several devices
+
+            Lets one thread serve many devices: the ready devices are
+            then read with hid_read_reports() or hid_read_timeout()
+            without waiting. A device which failed or was unplugged is
+            reported ready, its next read returns the error.
+
+            @ingroup API
+            @param devices The device handles.
+            @param count The number of devices, 0 to check whether the
+                platform supports this function.
+            @param ready Set to non-zero for each device with an Input
+                report or an error, and to zero for the others.
+            @param milliseconds Timeout, -1 for blocking wait.
+
+            @returns
+                This function returns the number of ready devices, 0 if
+                none got ready in time, or -1 if the platform cannot
+                wait on several devices.
+        */
+        int HID_API_EXPORT hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds);
+
         /** @brief Get a runtime version of the library.
 
             @ingroup API
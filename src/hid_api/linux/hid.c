@@ -38,9 +38,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <sys/utsname.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 
 /* Linux */
 #include <linux/hidraw.h>
@@ -64,6 +66,10 @@
 #define USB_CTRL_GET_TIMEOUT  5000
 #define USB_CTRL_SET_TIMEOUT  5000
 
+/* Maximum number of reports passed to one readv()/writev(). hidraw handles each
+   segment as one report, so a whole transaction goes in a single system call. */
+#define HID_REPORTS_IOV       32
+
 /* USB HID device property names */
 const char *device_string_names[] = {
     "manufacturer", "product", "serial",
@@ -91,6 +97,12 @@ struct hid_device_
 
 static __u32 kernel_version = 0;
 
+/* udev monitor of the hidraw subsystem, created by the first hid_hotplug_count() call */
+static pthread_mutex_t hotplug_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct udev *hotplug_udev = NULL;
+static struct udev_monitor *hotplug_mon = NULL;
+static long hotplug_events = 0;
+
 static __u32 detect_kernel_version(void)
 {
     struct utsname name;
@@ -497,10 +509,78 @@ int HID_API_EXPORT hid_init(void)
 
 int HID_API_EXPORT hid_exit(void)
 {
-    /* Nothing to do for this in the Linux/hidraw implementation. */
+    /* The count keeps running, changes until the next monitor starts are counted as one. */
+    pthread_mutex_lock(&hotplug_mutex);
+    if (hotplug_mon)
+    {
+        hotplug_events++;
+        udev_monitor_unref(hotplug_mon);
+        udev_unref(hotplug_udev);
+        hotplug_mon = NULL;
+        hotplug_udev = NULL;
+    }
+    pthread_mutex_unlock(&hotplug_mutex);
+
     return 0;
 }
 
+long HID_API_EXPORT hid_hotplug_count(void)
+{
+    struct udev_device *dev;
+    struct pollfd pfd;
+    const char *action;
+    long res = -1;
+
+    pthread_mutex_lock(&hotplug_mutex);
+    if (!hotplug_mon)
+    {
+        hotplug_udev = udev_new();
+        if (hotplug_udev)
+        {
+            hotplug_mon = udev_monitor_new_from_netlink(hotplug_udev, "udev");
+            if (hotplug_mon && (udev_monitor_filter_add_match_subsystem_devtype(hotplug_mon, "hidraw", NULL) < 0 ||
+                                udev_monitor_enable_receiving(hotplug_mon) < 0))
+            {
+                udev_monitor_unref(hotplug_mon);
+                hotplug_mon = NULL;
+            }
+            if (!hotplug_mon)
+            {
+                udev_unref(hotplug_udev);
+                hotplug_udev = NULL;
+            }
+        }
+    }
+
+    if (hotplug_mon)
+    {
+        /* Drain the queued events without blocking. */
+        pfd.fd = udev_monitor_get_fd(hotplug_mon);
+        pfd.events = POLLIN;
+        while (poll(&pfd, 1, 0) > 0)
+        {
+            errno = 0;
+            dev = udev_monitor_receive_device(hotplug_mon);
+            if (!dev)
+            {
+                /* Events were dropped when the socket overflowed, any of them may be a hot-plug */
+                if (errno != ENOBUFS)
+                    break;
+                hotplug_events++;
+                continue;
+            }
+            action = udev_device_get_action(dev);
+            if (action && (strcmp(action, "add") == 0 || strcmp(action, "remove") == 0))
+                hotplug_events++;
+            udev_device_unref(dev);
+        }
+        res = hotplug_events;
+    }
+    pthread_mutex_unlock(&hotplug_mutex);
+
+    return res;
+}
+
 struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
 {
     struct udev *udev;
@@ -760,8 +840,9 @@ hid_device *HID_API_EXPORT hid_open_path(const char *path)
 
     dev = new_hid_device();
 
-    /* OPEN HERE */
-    dev->device_handle = open(path, O_RDWR);
+    /* OPEN HERE. Non-blocking so that hid_read_reports() can collect the queued reports
+       without waiting, the reads wait in poll() instead. */
+    dev->device_handle = open(path, O_RDWR | O_NONBLOCK);
 
     /* If we have a good handle, return it. */
     if (dev->device_handle > 0)
@@ -875,34 +956,29 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
     int bytes_read;
-
-    if (milliseconds >= 0)
+    int ret;
+    struct pollfd fds;
+
+    /* Milliseconds is either -1 (blocking), 0 (non-blocking) or > 0 (contains
+       a valid timeout). In all cases we want to call poll() and wait for data
+       to arrive, the handle itself never blocks. Don't rely on read() for
+       errors since some kernels don't seem to properly report device
+       disconnection through read() when in non-blocking mode.  */
+    fds.fd = dev->device_handle;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    ret = poll(&fds, 1, milliseconds);
+    if (ret == -1 || ret == 0)
     {
-        /* Milliseconds is either 0 (non-blocking) or > 0 (contains
-           a valid timeout). In both cases we want to call poll()
-           and wait for data to arrive.  Don't rely on non-blocking
-           operation (O_NONBLOCK) since some kernels don't seem to
-           properly report device disconnection through read() when
-           in non-blocking mode.  */
-        int ret;
-        struct pollfd fds;
-
-        fds.fd = dev->device_handle;
-        fds.events = POLLIN;
-        fds.revents = 0;
-        ret = poll(&fds, 1, milliseconds);
-        if (ret == -1 || ret == 0)
-        {
-            /* Error or timeout */
-            return ret;
-        }
-        else
-        {
-            /* Check for errors on the file descriptor. This will
-               indicate a device disconnection. */
-            if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
-                return -1;
-        }
+        /* Error or timeout */
+        return ret;
+    }
+    else
+    {
+        /* Check for errors on the file descriptor. This will
+           indicate a device disconnection. */
+        if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
+            return -1;
     }
 
     bytes_read = read(dev->device_handle, data, length);
@@ -920,6 +996,139 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
     return bytes_read;
 }
 
+int HID_API_EXPORT hid_write_reports(hid_device *dev, const unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    struct iovec iov[HID_REPORTS_IOV];
+    size_t done = 0;
+    size_t n, i;
+    ssize_t res;
+
+    if (length < (size_t)dev->output_report_length)
+    {
+        /* short reports need padding, one by one */
+        for (done = 0; done < count; done++)
+        {
+            if (hid_write_timeout(dev, data + done * length, length, milliseconds) <= 0)
+                break;
+        }
+        return (done > 0) ? (int)done : -1;
+    }
+
+    while (done < count)
+    {
+        n = count - done;
+        if (n > HID_REPORTS_IOV)
+            n = HID_REPORTS_IOV;
+        for (i = 0; i < n; i++)
+        {
+            iov[i].iov_base = (void *)(data + (done + i) * length);
+            iov[i].iov_len = length;
+        }
+
+        res = writev(dev->device_handle, iov, (int)n);
+        if (res < 0)
+        {
+            /* same retries as hid_write_timeout() */
+            if ((errno == ETIMEDOUT) && (milliseconds != 0))
+            {
+                if (milliseconds > 0)
+                {
+                    milliseconds -= USB_CTRL_SET_TIMEOUT;
+                    if (milliseconds <= 0)
+                        break;
+                }
+                continue;
+            }
+            break;
+        }
+
+        /* the kernel stops at the first report which failed */
+        done += (size_t)res / length;
+        if ((size_t)res != n * length)
+            break;
+    }
+
+    return (done > 0) ? (int)done : -1;
+}
+
+int HID_API_EXPORT hid_read_reports(hid_device *dev, unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    struct iovec iov[HID_REPORTS_IOV];
+    size_t report = (size_t)dev->input_report_length + (dev->uses_numbered_reports ? 1 : 0);
+    size_t i;
+    ssize_t res;
+    int ret;
+    struct pollfd fds;
+
+    if ((count <= 1) || (report == 0) || (report > length) ||
+        (kernel_version != 0 && kernel_version < KERNEL_VERSION(2, 6, 34) && dev->uses_numbered_reports))
+    {
+        /* one report at a time */
+        ret = hid_read_timeout(dev, data, length, milliseconds);
+        return (ret > 0) ? 1 : ret;
+    }
+    if (count > HID_REPORTS_IOV)
+        count = HID_REPORTS_IOV;
+
+    fds.fd = dev->device_handle;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    ret = poll(&fds, 1, milliseconds);
+    if (ret == -1 || ret == 0)
+        return ret;
+    if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return -1;
+
+    /* each segment takes one report, the kernel stops at the first empty queue or
+       shorter report */
+    for (i = 0; i < count; i++)
+    {
+        iov[i].iov_base = data + i * length;
+        iov[i].iov_len = report;
+    }
+    res = readv(dev->device_handle, iov, (int)count);
+    if (res < 0)
+        return (errno == EAGAIN || errno == EINPROGRESS) ? 0 : -1;
+
+    return (int)(((size_t)res + report - 1) / report);
+}
+
+int HID_API_EXPORT hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds)
+{
+    struct pollfd local[HID_REPORTS_IOV];
+    struct pollfd *fds = local;
+    size_t i;
+    int ret;
+
+    if (count == 0)
+        return 0;
+    if (count > HID_REPORTS_IOV)
+    {
+        fds = malloc(count * sizeof(struct pollfd));
+        if (fds == NULL)
+            return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        fds[i].fd = devices[i]->device_handle;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    ret = poll(fds, (nfds_t)count, milliseconds);
+    if (ret < 0)
+    {
+        /* interrupted, nothing is ready */
+        ret = 0;
+    }
+    for (i = 0; i < count; i++)
+        ready[i] = (fds[i].revents != 0) ? 1 : 0;
+
+    if (fds != local)
+        free(fds);
+    return ret;
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
     return hid_read_timeout(dev, data, length, (dev->blocking) ? -1 : 0);
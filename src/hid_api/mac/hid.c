@@ -202,6 +202,15 @@ static struct hid_api_version api_version = {
 static	IOHIDManagerRef hid_mgr = 0x0;
 static	int is_macos_10_10_or_greater = 0;
 
+/* hot-plug watcher, created by the first hid_hotplug_count() call */
+static	IOHIDManagerRef hotplug_mgr = 0x0;
+static	CFRunLoopRef hotplug_run_loop = 0x0;
+static	long hotplug_events = 0;
+
+/* hid_poll() waiters, woken up by the run loop threads of all devices */
+static	pthread_mutex_t poll_mutex = PTHREAD_MUTEX_INITIALIZER;
+static	pthread_cond_t poll_cond = PTHREAD_COND_INITIALIZER;
+
 
 #if 0
 static void register_error(hid_device *dev, const char *op)
@@ -374,6 +383,15 @@ int HID_API_EXPORT hid_exit(void)
 		CFRelease(hid_mgr);
 		hid_mgr = NULL;
 	}
+	if (hotplug_mgr) {
+		/* The count keeps running, changes until the next watcher starts are counted as one. */
+		hotplug_events++;
+		IOHIDManagerUnscheduleFromRunLoop(hotplug_mgr, hotplug_run_loop, kCFRunLoopDefaultMode);
+		IOHIDManagerClose(hotplug_mgr, kIOHIDOptionsTypeNone);
+		CFRelease(hotplug_mgr);
+		hotplug_mgr = NULL;
+		hotplug_run_loop = NULL;
+	}
 
 	return 0;
 }
@@ -385,6 +403,41 @@ static void process_pending_events(void) {
 	} while(res != kCFRunLoopRunFinished && res != kCFRunLoopRunTimedOut);
 }
 
+static void hid_hotplug_callback(void *context, IOReturn result, void *sender, IOHIDDeviceRef device)
+{
+	(void) context;
+	(void) result;
+	(void) sender;
+	(void) device;
+
+	hotplug_events++;
+}
+
+long HID_API_EXPORT hid_hotplug_count(void)
+{
+	if (hid_init() < 0)
+		return -1;
+
+	if (!hotplug_mgr) {
+		/* A manager of its own, hid_enumerate() changes the matching of hid_mgr. */
+		hotplug_mgr = IOHIDManagerCreate(kCFAllocatorDefault, kIOHIDOptionsTypeNone);
+		if (!hotplug_mgr)
+			return -1;
+		IOHIDManagerSetDeviceMatching(hotplug_mgr, NULL);
+		IOHIDManagerRegisterDeviceMatchingCallback(hotplug_mgr, hid_hotplug_callback, NULL);
+		IOHIDManagerRegisterDeviceRemovalCallback(hotplug_mgr, hid_hotplug_callback, NULL);
+		hotplug_run_loop = CFRunLoopGetCurrent();
+		IOHIDManagerScheduleWithRunLoop(hotplug_mgr, hotplug_run_loop, kCFRunLoopDefaultMode);
+	}
+
+	/* The callbacks only run on the run loop of the thread which made the first call. */
+	if (CFRunLoopGetCurrent() != hotplug_run_loop)
+		return -1;
+
+	process_pending_events();
+	return hotplug_events;
+}
+
 static struct hid_device_info *create_device_info_with_usage(IOHIDDeviceRef dev, int32_t usage_page, int32_t usage)
 {
 	unsigned short dev_vid;
@@ -662,6 +715,14 @@ static void hid_device_removal_callback(void *context, IOReturn result,
 	CFRunLoopStop(d->run_loop);
 }
 
+/* Wake up the hid_poll() callers to check their devices again */
+static void poll_signal(void)
+{
+	pthread_mutex_lock(&poll_mutex);
+	pthread_cond_broadcast(&poll_cond);
+	pthread_mutex_unlock(&poll_mutex);
+}
+
 /* The Run Loop calls this function for each input report received.
    This function puts the data into a linked list to be picked up by
    hid_read(). */
@@ -716,6 +777,8 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 	/* Unlock */
 	pthread_mutex_unlock(&dev->mutex);
 
+	poll_signal();
+
 }
 
 /* This gets called when the read_thread's run loop gets signaled by
@@ -781,6 +844,7 @@ static void *read_thread(void *param)
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cond_broadcast(&dev->condition);
 	pthread_mutex_unlock(&dev->mutex);
+	poll_signal();
 
 	/* Wait here until hid_close() is called and makes it past
 	   the call to CFRunLoopWakeUp(). This thread still needs to
@@ -1104,6 +1168,76 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_write_reports(hid_device *dev, const unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+	size_t done;
+
+	/* one IOHIDDeviceSetReport() per report */
+	for (done = 0; done < count; done++) {
+		if (hid_write_timeout(dev, data + done * length, length, milliseconds) <= 0)
+			break;
+	}
+	return (done > 0) ? (int)done : -1;
+}
+
+int HID_API_EXPORT hid_read_reports(hid_device *dev, unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+	size_t done;
+	int res = 0;
+
+	/* the run loop thread queued the reports, only the first one is waited for */
+	for (done = 0; done < count; done++) {
+		res = hid_read_timeout(dev, data + done * length, length, (done == 0) ? milliseconds : 0);
+		if (res <= 0)
+			break;
+	}
+	return (done > 0) ? (int)done : res;
+}
+
+int HID_API_EXPORT hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds)
+{
+	struct timespec ts;
+	struct timeval tv;
+	size_t i;
+	int num;
+
+	if (count == 0)
+		return 0;
+
+	if (milliseconds > 0) {
+		gettimeofday(&tv, NULL);
+		TIMEVAL_TO_TIMESPEC(&tv, &ts);
+		ts.tv_sec += milliseconds / 1000;
+		ts.tv_nsec += (milliseconds % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+
+	/* The run loop threads queue the reports under the lock of their device and then
+	   take poll_mutex to signal, holding it while checking loses no wake-up. */
+	pthread_mutex_lock(&poll_mutex);
+	for (;;) {
+		num = 0;
+		for (i = 0; i < count; i++) {
+			pthread_mutex_lock(&devices[i]->mutex);
+			ready[i] = (devices[i]->input_reports || devices[i]->disconnected || devices[i]->shutdown_thread) ? 1 : 0;
+			pthread_mutex_unlock(&devices[i]->mutex);
+			num += ready[i];
+		}
+		if (num > 0 || milliseconds == 0)
+			break;
+		if (milliseconds < 0)
+			pthread_cond_wait(&poll_cond, &poll_mutex);
+		else if (pthread_cond_timedwait(&poll_cond, &poll_mutex, &ts) != 0)
+			break;
+	}
+	pthread_mutex_unlock(&poll_mutex);
+
+	return num;
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
@@ -0,0 +1,738 @@
+/*
+ * Copyright 2022 NXP
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * NXP USBSIO Library: emulated USBSIO bridge, a HID backend for testing without hardware
+ *
+ * Each emulated bridge runs the firmware protocol of lpcusbsio_protocol.h: the output
+ * reports of a request are collected until the transfer is complete, the request is
+ * executed and its response reports are queued with the time they become readable.
+ * I2C slaves are 256 byte memories written by writes and read back by reads, SPI
+ * transfers return the transmitted data and GPIO ports keep their pin and direction
+ * registers. The latency and bandwidth options let the bridge take as long as a real
+ * one, or respond at once to measure the overhead of the library itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#if defined(__FreeBSD__)
+#include "hidapi_mock.h"
+#else
+#include "hidapi.h"
+#endif
+#include "lpcusbsio.h"
+#include "lpcusbsio_protocol.h"
+#include "hid_mock.h"
+
+/*****************************************************************************
+ * Private types/enumerations/variables
+ ****************************************************************************/
+
+#define MOCK_MAX_DEVICES        16
+#define MOCK_I2C_PORTS          2
+#define MOCK_SPI_PORTS          2
+#define MOCK_GPIO_PORTS         8
+#define MOCK_I2C_SLAVES         128
+#define MOCK_SLAVE_MEM          256
+#define MOCK_FW_VERSION         ((2u << 16) | 5u)
+#define MOCK_FW_BUILD           "mock"
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION MOCK_MUTEX_T;
+typedef CONDITION_VARIABLE MOCK_COND_T;
+#else
+typedef pthread_mutex_t MOCK_MUTEX_T;
+typedef pthread_cond_t MOCK_COND_T;
+#endif
+
+/* input report and the time it becomes readable */
+typedef struct {
+    unsigned long long due;
+    unsigned char data[HID_SIO_PACKET_SZ];
+} MOCK_REPORT_T;
+
+struct mock_device {
+    MOCK_MUTEX_T lock;
+    MOCK_COND_T cond;           /* signalled when a report is queued */
+    /* queued input reports, a ring growing as needed */
+    MOCK_REPORT_T *queue;
+    unsigned int qSize, qHead, qTail;
+    /* request being collected from its output reports */
+    unsigned char *req;
+    unsigned int reqLen;
+    unsigned char reqTrans, reqSes, reqCode;
+    unsigned long long busyUntil;   /* end of the last emulated transfer */
+    unsigned int gpio[MOCK_GPIO_PORTS];
+    unsigned int dir[MOCK_GPIO_PORTS];
+    unsigned char *mem;         /* MOCK_I2C_SLAVES memories of MOCK_SLAVE_MEM bytes */
+    unsigned int maxData;       /* maximum data size the buffers were allocated for */
+};
+
+/* settings of mock_hid_configure() */
+static struct {
+    unsigned int devices;
+    unsigned int latency;
+    unsigned int bandwidth;
+    unsigned int maxData;
+    unsigned int caps;
+    unsigned int nak;
+    unsigned int pid;
+} g_mock = { 1, 100, 0, 1024, HID_SIO_CAPS_SPI_TX_ONLY, 0, MCULINKSIO_PID };
+
+static volatile long g_mockHotplug;
+
+/* mock_hid_poll() waiters, woken up whenever a report is queued on any device. The lock of a
+   device may be held while taking g_pollLock, never the other way round. */
+#ifdef _WIN32
+static SRWLOCK g_pollLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE g_pollCond = CONDITION_VARIABLE_INIT;
+#else
+static pthread_mutex_t g_pollLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_pollCond = PTHREAD_COND_INITIALIZER;
+#endif
+static unsigned long g_pollSeq;
+
+/*****************************************************************************
+ * Private functions
+ ****************************************************************************/
+
+static unsigned long long mock_now_us(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000 +
+           (unsigned long long)((now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + (unsigned long long)(ts.tv_nsec / 1000);
+#endif
+}
+
+static void mock_lock(struct mock_device *d)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&d->lock);
+#else
+    pthread_mutex_lock(&d->lock);
+#endif
+}
+
+static void mock_unlock(struct mock_device *d)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&d->lock);
+#else
+    pthread_mutex_unlock(&d->lock);
+#endif
+}
+
+/* wait for the condition at most us microseconds, called with the lock held */
+static void mock_wait(struct mock_device *d, unsigned long long us)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(&d->cond, &d->lock, (DWORD)((us + 999) / 1000));
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += (time_t)(us / 1000000);
+    ts.tv_nsec += (long)(us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&d->cond, &d->lock, &ts);
+#endif
+}
+
+static char *mock_strdup(const char *s)
+{
+    char *p = malloc(strlen(s) + 1);
+
+    if (p != NULL) {
+        strcpy(p, s);
+    }
+    return p;
+}
+
+static wchar_t *mock_wcsdup(const wchar_t *s)
+{
+    wchar_t *p = malloc((wcslen(s) + 1) * sizeof(wchar_t));
+
+    if (p != NULL) {
+        wcscpy(p, s);
+    }
+    return p;
+}
+
+/* queue the response reports of a request, called with the lock held */
+static void mock_respond(struct mock_device *d, unsigned char resp, const unsigned char *data, unsigned int len,
+                         unsigned int reqLen)
+{
+    HID_SIO_IN_REPORT_T *pIn;
+    MOCK_REPORT_T *grown;
+    unsigned long long start, due;
+    unsigned int packets = HID_SIO_CALC_PACKETS_COUNT(len);
+    unsigned int i, one, ofs = 0;
+
+    /* the bus is busy for both directions of this request after the previous one */
+    start = mock_now_us();
+    if (d->busyUntil > start) {
+        start = d->busyUntil;
+    }
+    if (g_mock.bandwidth > 0) {
+        start += (unsigned long long)(reqLen + len) * 1000000 / g_mock.bandwidth;
+    }
+    d->busyUntil = start;
+    due = start + g_mock.latency;
+
+    if ((d->qTail - d->qHead + packets) > d->qSize) {
+        grown = malloc((d->qSize * 2 + packets) * sizeof(MOCK_REPORT_T));
+        if (grown == NULL) {
+            return;
+        }
+        for (i = 0; i < (d->qTail - d->qHead); i++) {
+            grown[i] = d->queue[(d->qHead + i) % d->qSize];
+        }
+        free(d->queue);
+        d->queue = grown;
+        d->qTail -= d->qHead;
+        d->qHead = 0;
+        d->qSize = d->qSize * 2 + packets;
+    }
+
+    for (i = 0; i < packets; i++) {
+        one = ((len - ofs) > HID_SIO_PACKET_DATA_SZ) ? HID_SIO_PACKET_DATA_SZ : (len - ofs);
+        d->queue[d->qTail % d->qSize].due = due;
+        memset(&d->queue[d->qTail % d->qSize].data[0], 0, HID_SIO_PACKET_SZ);
+        pIn = (HID_SIO_IN_REPORT_T *)&d->queue[d->qTail % d->qSize].data[0];
+        pIn->transfer_len = (uint16_t)HID_SIO_CALC_TRANSFER_LEN(len);
+        pIn->packet_num = (uint16_t)i;
+        pIn->packet_len = (uint8_t)(one + HID_SIO_PACKET_HEADER_SZ);
+        pIn->transId = d->reqTrans;
+        pIn->sesId = d->reqSes;
+        pIn->resp = resp;
+        if (one > 0) {
+            memcpy(&pIn->data[0], data + ofs, one);
+        }
+        ofs += one;
+        d->qTail++;
+    }
+#ifdef _WIN32
+    WakeAllConditionVariable(&d->cond);
+    AcquireSRWLockExclusive(&g_pollLock);
+    g_pollSeq++;
+    WakeAllConditionVariable(&g_pollCond);
+    ReleaseSRWLockExclusive(&g_pollLock);
+#else
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_lock(&g_pollLock);
+    g_pollSeq++;
+    pthread_cond_broadcast(&g_pollCond);
+    pthread_mutex_unlock(&g_pollLock);
+#endif
+}
+
+/* take the poll sequence, or wait at most us microseconds for it to change from seq */
+static unsigned long mock_poll_wait(unsigned long seq, unsigned long long us)
+{
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&g_pollLock);
+    if ((us > 0) && (g_pollSeq == seq)) {
+        SleepConditionVariableSRW(&g_pollCond, &g_pollLock, (DWORD)((us + 999) / 1000), 0);
+    }
+    seq = g_pollSeq;
+    ReleaseSRWLockExclusive(&g_pollLock);
+#else
+    struct timespec ts;
+
+    pthread_mutex_lock(&g_pollLock);
+    if ((us > 0) && (g_pollSeq == seq)) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += (time_t)(us / 1000000);
+        ts.tv_nsec += (long)(us % 1000000) * 1000;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&g_pollCond, &g_pollLock, &ts);
+    }
+    seq = g_pollSeq;
+    pthread_mutex_unlock(&g_pollLock);
+#endif
+    return seq;
+}
+
+/* execute a complete request, called with the lock held */
+static void mock_execute(struct mock_device *d)
+{
+    const unsigned char *a = d->req;
+    unsigned char *out = d->req + d->reqLen;    /* the request buffer has room for the response */
+    unsigned char resp = HID_SIO_RES_OK;
+    unsigned int n = 0, i, set, clr;
+    const HID_I2C_RW_PARAMS_T *rw = (const HID_I2C_RW_PARAMS_T *)a;
+    const HID_I2C_XFER_PARAMS_T *xfer = (const HID_I2C_XFER_PARAMS_T *)a;
+    const HID_SPI_XFER_PARAMS_T *spi = (const HID_SPI_XFER_PARAMS_T *)a;
+    unsigned char *mem;
+
+    switch (d->reqCode) {
+    case HID_SIO_REQ_DEV_INFO:
+        memset(out, 0, 12);
+        out[0] = MOCK_I2C_PORTS;
+        out[1] = MOCK_SPI_PORTS;
+        out[2] = MOCK_GPIO_PORTS;
+        out[3] = (unsigned char)g_mock.caps;
+        out[4] = (unsigned char)g_mock.maxData;
+        out[5] = (unsigned char)(g_mock.maxData >> 8);
+        out[8] = (unsigned char)MOCK_FW_VERSION;
+        out[9] = (unsigned char)(MOCK_FW_VERSION >> 8);
+        out[10] = (unsigned char)(MOCK_FW_VERSION >> 16);
+        memcpy(out + 12, MOCK_FW_BUILD, sizeof(MOCK_FW_BUILD));
+        n = 12 + sizeof(MOCK_FW_BUILD);
+        break;
+
+    case HID_I2C_REQ_RESET:
+    case HID_I2C_REQ_INIT_PORT:
+    case HID_I2C_REQ_DEINIT_PORT:
+    case HID_SPI_REQ_RESET:
+    case HID_SPI_REQ_INIT_PORT:
+    case HID_SPI_REQ_DEINIT_PORT:
+    case HID_GPIO_REQ_IOCONFIG:
+        resp = (d->reqSes < ((d->reqCode <= HID_I2C_REQ_MAX) ? MOCK_I2C_PORTS :
+                             ((d->reqCode <= HID_SPI_REQ_MAX) ? MOCK_SPI_PORTS : MOCK_GPIO_PORTS))) ?
+               HID_SIO_RES_OK : HID_SIO_RES_INVALID_PARAM;
+        break;
+
+    case HID_I2C_REQ_DEVICE_WRITE:
+    case HID_I2C_REQ_DEVICE_READ:
+        if ((d->reqLen < sizeof(HID_I2C_RW_PARAMS_T)) || (rw->slaveAddr >= MOCK_I2C_SLAVES) || (rw->length > d->maxData)) {
+            resp = HID_SIO_RES_INVALID_PARAM;
+            break;
+        }
+        if ((g_mock.nak != 0) && (rw->slaveAddr == g_mock.nak)) {
+            resp = HID_SIO_RES_SLAVE_NAK;
+            break;
+        }
+        mem = d->mem + rw->slaveAddr * MOCK_SLAVE_MEM;
+        if (d->reqCode == HID_I2C_REQ_DEVICE_WRITE) {
+            for (i = 0; (i < rw->length) && (sizeof(HID_I2C_RW_PARAMS_T) + i < d->reqLen); i++) {
+                mem[i % MOCK_SLAVE_MEM] = a[sizeof(HID_I2C_RW_PARAMS_T) + i];
+            }
+        }
+        else {
+            for (i = 0; i < rw->length; i++) {
+                out[i] = mem[i % MOCK_SLAVE_MEM];
+            }
+            n = rw->length;
+        }
+        break;
+
+    case HID_I2C_REQ_DEVICE_XFER:
+        if ((d->reqLen < sizeof(HID_I2C_XFER_PARAMS_T)) || (xfer->slaveAddr >= MOCK_I2C_SLAVES) ||
+            (xfer->rxLength > d->maxData)) {
+            resp = HID_SIO_RES_INVALID_PARAM;
+            break;
+        }
+        if ((g_mock.nak != 0) && (xfer->slaveAddr == g_mock.nak)) {
+            resp = HID_SIO_RES_SLAVE_NAK;
+            break;
+        }
+        mem = d->mem + xfer->slaveAddr * MOCK_SLAVE_MEM;
+        for (i = 0; (i < xfer->txLength) && (sizeof(HID_I2C_XFER_PARAMS_T) + i < d->reqLen); i++) {
+            mem[i % MOCK_SLAVE_MEM] = a[sizeof(HID_I2C_XFER_PARAMS_T) + i];
+        }
+        for (i = 0; i < xfer->rxLength; i++) {
+            out[i] = mem[i % MOCK_SLAVE_MEM];
+        }
+        n = xfer->rxLength;
+        break;
+
+    case HID_SPI_REQ_DEVICE_XFER:
+        if ((d->reqLen < sizeof(HID_SPI_XFER_PARAMS_T)) ||
+            (d->reqLen - sizeof(HID_SPI_XFER_PARAMS_T) < spi->length)) {
+            resp = HID_SIO_RES_INVALID_PARAM;
+            break;
+        }
+        /* loopback, MISO is wired to MOSI */
+        if (((spi->options & HID_SPI_XFER_OPTION_TX_ONLY) == 0) || ((g_mock.caps & HID_SIO_CAPS_SPI_TX_ONLY) == 0)) {
+            memcpy(out, a + sizeof(HID_SPI_XFER_PARAMS_T), spi->length);
+            n = spi->length;
+        }
+        break;
+
+    case HID_GPIO_REQ_PORT_VALUE:
+    case HID_GPIO_REQ_PORT_DIR:
+        if ((d->reqSes >= MOCK_GPIO_PORTS) || (d->reqLen < 8)) {
+            resp = HID_SIO_RES_INVALID_PARAM;
+            break;
+        }
+        memcpy(&set, a, 4);
+        memcpy(&clr, a + 4, 4);
+        if (d->reqCode == HID_GPIO_REQ_PORT_VALUE) {
+            d->gpio[d->reqSes] = (d->gpio[d->reqSes] | set) & ~clr;
+            memcpy(out, &d->gpio[d->reqSes], 4);
+        }
+        else {
+            d->dir[d->reqSes] = (d->dir[d->reqSes] | set) & ~clr;
+            memcpy(out, &d->dir[d->reqSes], 4);
+        }
+        n = 4;
+        break;
+
+    case HID_GPIO_REQ_TOGGLE_PIN:
+        if ((d->reqSes >= MOCK_GPIO_PORTS) || (d->reqLen < 1) || (a[0] > 31)) {
+            resp = HID_SIO_RES_INVALID_PARAM;
+            break;
+        }
+        d->gpio[d->reqSes] ^= 1u << a[0];
+        break;
+
+    default:
+        /* GPIO events and unknown requests are not emulated */
+        resp = HID_SIO_RES_INVALID_CMD;
+        break;
+    }
+
+    mock_respond(d, resp, out, (resp == HID_SIO_RES_OK) ? n : 0, d->reqLen);
+}
+
+/* parse one unsigned number of the options, returns the character following it */
+static const char *mock_number(const char *s, unsigned int *value)
+{
+    char *end;
+
+    *value = (unsigned int)strtoul(s, &end, 0);
+    return (end != s) ? end : NULL;
+}
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+int mock_hid_configure(const char *options)
+{
+    static const char *names[] = { "devices=", "latency=", "bandwidth=", "maxdata=", "caps=", "nak=", "pid=" };
+    unsigned int *values[] = { &g_mock.devices, &g_mock.latency, &g_mock.bandwidth, &g_mock.maxData,
+                               &g_mock.caps, &g_mock.nak, &g_mock.pid };
+    unsigned int devices = g_mock.devices;
+    const char *s = options;
+    size_t i, len;
+
+    while ((s != NULL) && (*s != 0)) {
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            len = strlen(names[i]);
+            if (strncmp(s, names[i], len) == 0) {
+                s = mock_number(s + len, values[i]);
+                break;
+            }
+        }
+        if ((i == sizeof(names) / sizeof(names[0])) || (s == NULL) || ((*s != 0) && (*s != ','))) {
+            return -1;
+        }
+        if (*s == ',') {
+            s++;
+        }
+    }
+    if (g_mock.devices > MOCK_MAX_DEVICES) {
+        g_mock.devices = MOCK_MAX_DEVICES;
+    }
+    if (g_mock.devices != devices) {
+        g_mockHotplug++;
+    }
+    return 0;
+}
+
+int mock_hid_exit(void)
+{
+    return 0;
+}
+
+long mock_hid_hotplug_count(void)
+{
+    return g_mockHotplug;
+}
+
+struct hid_device_info *mock_hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+    struct hid_device_info *head = NULL, *info;
+    char path[16];
+    wchar_t serial[16];
+    unsigned int i;
+
+    if (((vendor_id != 0) && (vendor_id != LPCUSBSIO_VID)) || ((product_id != 0) && (product_id != g_mock.pid))) {
+        return NULL;
+    }
+    for (i = g_mock.devices; i > 0; i--) {
+        info = calloc(1, sizeof(struct hid_device_info));
+        if (info == NULL) {
+            break;
+        }
+        snprintf(path, sizeof(path), "mock:%u", i - 1);
+        swprintf(serial, sizeof(serial) / sizeof(serial[0]), L"MOCK%u", i - 1);
+        info->path = mock_strdup(path);
+        info->serial_number = mock_wcsdup(serial);
+        info->manufacturer_string = mock_wcsdup(L"NXP");
+        info->product_string = mock_wcsdup(L"MCUSIO mock bridge");
+        info->vendor_id = LPCUSBSIO_VID;
+        info->product_id = (unsigned short)g_mock.pid;
+        info->release_number = (unsigned short)(((MOCK_FW_VERSION >> 8) & 0xFF00) | (MOCK_FW_VERSION & 0xFF));
+        info->usage_page = 0xFF00 | HID_USAGE_PAGE_SERIAL_IO;
+        info->next = head;
+        head = info;
+    }
+    return head;
+}
+
+void mock_hid_free_enumeration(struct hid_device_info *devs)
+{
+    struct hid_device_info *next;
+
+    while (devs != NULL) {
+        next = devs->next;
+        free(devs->path);
+        free(devs->serial_number);
+        free(devs->manufacturer_string);
+        free(devs->product_string);
+        free(devs);
+        devs = next;
+    }
+}
+
+hid_device *mock_hid_open_path(const char *path)
+{
+    struct mock_device *d;
+    unsigned int index;
+
+    if ((path == NULL) || (strncmp(path, "mock:", 5) != 0) || (mock_number(path + 5, &index) == NULL) ||
+        (index >= g_mock.devices)) {
+        return NULL;
+    }
+    d = calloc(1, sizeof(struct mock_device));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->qSize = 64;
+    d->queue = malloc(d->qSize * sizeof(MOCK_REPORT_T));
+    /* room for the parameters and data of a request and for its response */
+    d->maxData = g_mock.maxData;
+    d->req = malloc(2 * (d->maxData + HID_SIO_PACKET_SZ));
+    d->mem = calloc(MOCK_I2C_SLAVES, MOCK_SLAVE_MEM);
+    if ((d->queue == NULL) || (d->req == NULL) || (d->mem == NULL)) {
+        free(d->queue);
+        free(d->req);
+        free(d->mem);
+        free(d);
+        return NULL;
+    }
+#ifdef _WIN32
+    InitializeCriticalSection(&d->lock);
+    InitializeConditionVariable(&d->cond);
+#else
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+#endif
+    return (hid_device *)d;
+}
+
+void mock_hid_close(hid_device *device)
+{
+    struct mock_device *d = (struct mock_device *)device;
+
+    if (d == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    DeleteCriticalSection(&d->lock);
+#else
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->cond);
+#endif
+    free(d->queue);
+    free(d->req);
+    free(d->mem);
+    free(d);
+}
+
+int mock_hid_write(hid_device *device, const unsigned char *data, size_t length)
+{
+    struct mock_device *d = (struct mock_device *)device;
+    const HID_SIO_OUT_REPORT_T *pOut = (const HID_SIO_OUT_REPORT_T *)(data + 1);
+    unsigned int len;
+
+    /* the first byte is the report id */
+    if ((length < HID_SIO_PACKET_HEADER_SZ + 1) || (pOut->packet_len < HID_SIO_PACKET_HEADER_SZ) ||
+        (pOut->packet_len > HID_SIO_PACKET_SZ) || (pOut->packet_len >= length)) {
+        return -1;
+    }
+    len = pOut->packet_len - HID_SIO_PACKET_HEADER_SZ;
+
+    mock_lock(d);
+    if ((pOut->packet_num == 0) || (pOut->transId != d->reqTrans)) {
+        d->reqLen = 0;
+        d->reqTrans = pOut->transId;
+        d->reqSes = pOut->sesId;
+        d->reqCode = pOut->req;
+    }
+    if (d->reqLen + len <= d->maxData + HID_SIO_PACKET_SZ) {
+        memcpy(d->req + d->reqLen, &pOut->data[0], len);
+        d->reqLen += len;
+    }
+    if ((pOut->packet_num + 1) * HID_SIO_PACKET_HEADER_SZ + d->reqLen >= pOut->transfer_len) {
+        mock_execute(d);
+    }
+    mock_unlock(d);
+
+    return (int)length;
+}
+
+int mock_hid_write_timeout(hid_device *device, const unsigned char *data, size_t length, int milliseconds)
+{
+    (void)milliseconds;
+    return mock_hid_write(device, data, length);
+}
+
+int mock_hid_read_timeout(hid_device *device, unsigned char *data, size_t length, int milliseconds)
+{
+    struct mock_device *d = (struct mock_device *)device;
+    unsigned long long now = mock_now_us();
+    unsigned long long deadline = (milliseconds < 0) ? (unsigned long long)-1 : now + (unsigned long long)milliseconds * 1000;
+    unsigned long long wait;
+    int res = 0;
+
+    mock_lock(d);
+    for (;;) {
+        if ((d->qHead != d->qTail) && (d->queue[d->qHead % d->qSize].due <= now)) {
+            res = (length < HID_SIO_PACKET_SZ) ? (int)length : HID_SIO_PACKET_SZ;
+            memcpy(data, &d->queue[d->qHead % d->qSize].data[0], res);
+            d->qHead++;
+            if (d->qHead == d->qTail) {
+                d->qHead = d->qTail = 0;
+            }
+            break;
+        }
+        if (now >= deadline) {
+            break;
+        }
+        wait = deadline - now;
+        if ((d->qHead != d->qTail) && (d->queue[d->qHead % d->qSize].due - now < wait)) {
+            wait = d->queue[d->qHead % d->qSize].due - now;
+        }
+        if (wait > 1000000) {
+            /* blocking reads wake up once a second */
+            wait = 1000000;
+        }
+        mock_wait(d, wait);
+        now = mock_now_us();
+    }
+    mock_unlock(d);
+
+    return res;
+}
+
+int mock_hid_write_reports(hid_device *device, const unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    size_t done;
+
+    for (done = 0; done < count; done++) {
+        if (mock_hid_write_timeout(device, data + done * length, length, milliseconds) <= 0) {
+            break;
+        }
+    }
+    return (done > 0) ? (int)done : -1;
+}
+
+int mock_hid_read_reports(hid_device *device, unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    size_t done;
+    int res = 0;
+
+    for (done = 0; done < count; done++) {
+        res = mock_hid_read_timeout(device, data + done * length, length, (done == 0) ? milliseconds : 0);
+        if (res <= 0) {
+            break;
+        }
+    }
+    return (done > 0) ? (int)done : res;
+}
+
+int mock_hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds)
+{
+    struct mock_device *d;
+    unsigned long long now = mock_now_us();
+    unsigned long long deadline = (milliseconds < 0) ? (unsigned long long)-1 : now + (unsigned long long)milliseconds * 1000;
+    unsigned long long wait;
+    unsigned long seq = mock_poll_wait(0, 0);
+    size_t i;
+    int num;
+
+    for (;;) {
+        num = 0;
+        wait = deadline - now;
+        for (i = 0; i < count; i++) {
+            d = (struct mock_device *)devices[i];
+            mock_lock(d);
+            ready[i] = 0;
+            if (d->qHead != d->qTail) {
+                if (d->queue[d->qHead % d->qSize].due <= now) {
+                    ready[i] = 1;
+                    num++;
+                }
+                else if (d->queue[d->qHead % d->qSize].due - now < wait) {
+                    wait = d->queue[d->qHead % d->qSize].due - now;
+                }
+            }
+            mock_unlock(d);
+        }
+        if ((num > 0) || (now >= deadline)) {
+            break;
+        }
+        if (wait > 1000000) {
+            /* blocking polls wake up once a second */
+            wait = 1000000;
+        }
+        seq = mock_poll_wait(seq, wait);
+        now = mock_now_us();
+    }
+
+    return num;
+}
+
+const wchar_t *mock_hid_error(hid_device *device)
+{
+    (void)device;
+    return L"Emulated USBSIO bridge error";
+}
+
+int mock_hid_get_report_lengths(hid_device *device, unsigned short *output_report_length, unsigned short *input_report_length)
+{
+    (void)device;
+    *output_report_length = HID_SIO_PACKET_SZ;
+    *input_report_length = HID_SIO_PACKET_SZ;
+    return 0;
+}
+
+int mock_hid_get_usage(hid_device *device, unsigned short *usage_page, unsigned short *usage)
+{
+    (void)device;
+    *usage_page = 0xFF00 | HID_USAGE_PAGE_SERIAL_IO;
+    *usage = 0;
+    return 0;
+}
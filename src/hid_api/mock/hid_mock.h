@@ -0,0 +1,51 @@
+/*
+ * Copyright 2022 NXP
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * NXP USBSIO Library: emulated USBSIO bridge, a HID backend for testing without hardware
+ */
+
+#ifndef __HID_MOCK_H_
+#define __HID_MOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The functions behave like the hidapi functions of the same name. The emulated bridges
+   only exist for this backend, see LPCUSBSIO_SetBackend() of lpcusbsio.h. */
+int mock_hid_exit(void);
+struct hid_device_info *mock_hid_enumerate(unsigned short vendor_id, unsigned short product_id);
+void mock_hid_free_enumeration(struct hid_device_info *devs);
+hid_device *mock_hid_open_path(const char *path);
+void mock_hid_close(hid_device *device);
+int mock_hid_write(hid_device *device, const unsigned char *data, size_t length);
+int mock_hid_write_timeout(hid_device *device, const unsigned char *data, size_t length, int milliseconds);
+int mock_hid_read_timeout(hid_device *device, unsigned char *data, size_t length, int milliseconds);
+int mock_hid_write_reports(hid_device *device, const unsigned char *data, size_t length, size_t count, int milliseconds);
+int mock_hid_read_reports(hid_device *device, unsigned char *data, size_t length, size_t count, int milliseconds);
+int mock_hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds);
+const wchar_t *mock_hid_error(hid_device *device);
+int mock_hid_get_report_lengths(hid_device *device, unsigned short *output_report_length, unsigned short *input_report_length);
+int mock_hid_get_usage(hid_device *device, unsigned short *usage_page, unsigned short *usage);
+long mock_hid_hotplug_count(void);
+
+/* Set up the emulated bridges from a comma separated list of name=value options:
+ *   devices=N      number of bridges enumerated, 1 by default
+ *   latency=US     time from the last output report of a request to its response, 100 us by default
+ *   bandwidth=BPS  bytes per second of the emulated USB and bus transfers, 0 for no limit
+ *   maxdata=N      maximum data size reported by the firmware, 1024 by default
+ *   caps=N         HID_SIO_CAPS_xxx flags reported by the firmware
+ *   nak=ADDR       I2C slave address which does not acknowledge, 0 for none
+ *   pid=N          product id of the bridges, MCULINKSIO_PID by default
+ * Changing the number of bridges counts as a hot plug event. Returns 0 on success, -1
+ * if the options cannot be parsed.
+ */
+int mock_hid_configure(const char *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HID_MOCK_H_ */
@@ -49,6 +49,7 @@ extern "C" {
 #endif
 #include <setupapi.h>
 #include <winioctl.h>
+#include <cfgmgr32.h>
 #ifdef HIDAPI_USE_DDK
 #include <hidsdi.h>
 #endif
@@ -113,6 +114,7 @@ typedef BOOLEAN(__stdcall *HidD_GetFeature_)(HANDLE handle, PVOID data, ULONG le
 typedef BOOLEAN(__stdcall *HidD_GetIndexedString_)(HANDLE handle, ULONG string_index, PVOID buffer, ULONG buffer_len);
 typedef BOOLEAN(__stdcall *HidD_GetPreparsedData_)(HANDLE handle, PHIDP_PREPARSED_DATA *preparsed_data);
 typedef BOOLEAN(__stdcall *HidD_FreePreparsedData_)(PHIDP_PREPARSED_DATA preparsed_data);
+typedef BOOLEAN(__stdcall *HidD_SetNumInputBuffers_)(HANDLE handle, ULONG number_buffers);
 typedef NTSTATUS(__stdcall *HidP_GetCaps_)(PHIDP_PREPARSED_DATA preparsed_data, HIDP_CAPS *caps);
 
 static HidD_GetAttributes_ HidD_GetAttributes;
@@ -124,12 +126,40 @@ static HidD_GetFeature_ HidD_GetFeature;
 static HidD_GetIndexedString_ HidD_GetIndexedString;
 static HidD_GetPreparsedData_ HidD_GetPreparsedData;
 static HidD_FreePreparsedData_ HidD_FreePreparsedData;
+static HidD_SetNumInputBuffers_ HidD_SetNumInputBuffers;
 static HidP_GetCaps_ HidP_GetCaps;
 
 static HMODULE lib_handle = NULL;
 static BOOLEAN initialized = FALSE;
+
+/* Device interface notifications need Windows 8, cfgmgr32.dll is loaded by the
+   first hid_hotplug_count() call so that older systems only lose the count. */
+#ifdef CM_NOTIFY_FILTER_FLAG_ALL_INTERFACE_CLASSES
+typedef CONFIGRET(WINAPI *CM_Register_Notification_)(PCM_NOTIFY_FILTER filter, PVOID context, PCM_NOTIFY_CALLBACK callback, PHCMNOTIFICATION notify_context);
+typedef CONFIGRET(WINAPI *CM_Unregister_Notification_)(HCMNOTIFICATION notify_context);
+
+static CM_Unregister_Notification_ CM_Unregister_Notification_ptr;
+static HMODULE hotplug_lib = NULL;
+static HCMNOTIFICATION hotplug_notify = NULL;
+#endif
+/* 0 not watching, 1 being set up, 2 watching, 3 not supported */
+static volatile LONG hotplug_state = 0;
+static volatile LONG hotplug_events = 0;
 #endif /* HIDAPI_USE_DDK */
 
+/* Overlapped reads kept posted, and output reports in flight at once in hid_write_reports().
+   HID_INPUT_BUFFERS is the number of input reports the HID class driver queues while no
+   read is posted, 32 by default and at most 512. */
+#ifndef HID_READS_PENDING
+#define HID_READS_PENDING 8
+#endif
+#ifndef HID_WRITES_PENDING
+#define HID_WRITES_PENDING 8
+#endif
+#ifndef HID_INPUT_BUFFERS
+#define HID_INPUT_BUFFERS 256
+#endif
+
 struct hid_device_
 {
     HANDLE device_handle;
@@ -140,15 +170,20 @@ struct hid_device_
     USAGE usage_page;
     void *last_error_str;
     DWORD last_error_num;
-    BOOL read_pending;
+    /* ring of posted reads, they complete in the order posted and read_head is the oldest */
+    size_t read_head;
+    size_t read_posted;
     char *read_buf;
-    OVERLAPPED read_ol;
-    OVERLAPPED write_ol;
+    OVERLAPPED read_ol[HID_READS_PENDING];
+    unsigned char *write_buf;
+    OVERLAPPED write_ol[HID_WRITES_PENDING];
 };
 
 static hid_device *new_hid_device()
 {
     hid_device *dev = (hid_device *)calloc(1, sizeof(hid_device));
+    int i;
+
     dev->device_handle = INVALID_HANDLE_VALUE;
     dev->blocking = TRUE;
     dev->output_report_length = 0;
@@ -157,23 +192,32 @@ static hid_device *new_hid_device()
     dev->usage = 0;
     dev->last_error_str = NULL;
     dev->last_error_num = 0;
-    dev->read_pending = FALSE;
+    dev->read_head = 0;
+    dev->read_posted = 0;
     dev->read_buf = NULL;
     memset(&dev->read_ol, 0, sizeof(dev->read_ol));
-    dev->read_ol.hEvent = CreateEvent(NULL, FALSE, FALSE /*inital state f=nonsignaled*/, NULL);
+    for (i = 0; i < HID_READS_PENDING; i++)
+        dev->read_ol[i].hEvent = CreateEvent(NULL, FALSE, FALSE /*inital state f=nonsignaled*/, NULL);
+    dev->write_buf = NULL;
     memset(&dev->write_ol, 0, sizeof(dev->write_ol));
-    dev->write_ol.hEvent = CreateEvent(NULL, FALSE, FALSE /*inital state f=nonsignaled*/, NULL);
+    for (i = 0; i < HID_WRITES_PENDING; i++)
+        dev->write_ol[i].hEvent = CreateEvent(NULL, FALSE, FALSE /*inital state f=nonsignaled*/, NULL);
 
     return dev;
 }
 
 static void free_hid_device(hid_device *dev)
 {
-    CloseHandle(dev->read_ol.hEvent);
-    CloseHandle(dev->write_ol.hEvent);
+    int i;
+
+    for (i = 0; i < HID_READS_PENDING; i++)
+        CloseHandle(dev->read_ol[i].hEvent);
+    for (i = 0; i < HID_WRITES_PENDING; i++)
+        CloseHandle(dev->write_ol[i].hEvent);
     CloseHandle(dev->device_handle);
     LocalFree(dev->last_error_str);
     free(dev->read_buf);
+    free(dev->write_buf);
     free(dev);
 }
 
@@ -228,6 +272,7 @@ static int lookup_functions()
         RESOLVE(HidD_GetIndexedString);
         RESOLVE(HidD_GetPreparsedData);
         RESOLVE(HidD_FreePreparsedData);
+        RESOLVE(HidD_SetNumInputBuffers);
         RESOLVE(HidP_GetCaps);
 #undef RESOLVE
     }
@@ -276,10 +321,85 @@ int HID_API_EXPORT hid_exit(void)
     }
     lib_handle = NULL;
     initialized = FALSE;
+#endif
+#ifdef CM_NOTIFY_FILTER_FLAG_ALL_INTERFACE_CLASSES
+    /* The count keeps running, changes until the next registration are counted as one. */
+    if (InterlockedCompareExchange(&hotplug_state, 1, 2) == 2)
+    {
+        InterlockedIncrement(&hotplug_events);
+        CM_Unregister_Notification_ptr(hotplug_notify);
+        FreeLibrary(hotplug_lib);
+        hotplug_notify = NULL;
+        hotplug_lib = NULL;
+        InterlockedExchange(&hotplug_state, 0);
+    }
 #endif
     return 0;
 }
 
+#ifdef CM_NOTIFY_FILTER_FLAG_ALL_INTERFACE_CLASSES
+static DWORD CALLBACK hotplug_callback(HCMNOTIFICATION notify, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA data, DWORD size)
+{
+    (void)notify;
+    (void)context;
+    (void)data;
+    (void)size;
+
+    if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL || action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL)
+        InterlockedIncrement(&hotplug_events);
+    return ERROR_SUCCESS;
+}
+
+static LONG register_hotplug(void)
+{
+    CM_Register_Notification_ reg;
+    CM_NOTIFY_FILTER filter;
+    GUID InterfaceClassGuid = { 0x4d1e55b2, 0xf16f, 0x11cf, { 0x88, 0xcb, 0x00, 0x11, 0x11, 0x00, 0x00, 0x30 } };
+
+    hotplug_lib = LoadLibraryA("cfgmgr32.dll");
+    if (hotplug_lib)
+    {
+        reg = (CM_Register_Notification_)GetProcAddress(hotplug_lib, "CM_Register_Notification");
+        CM_Unregister_Notification_ptr = (CM_Unregister_Notification_)GetProcAddress(hotplug_lib, "CM_Unregister_Notification");
+        if (reg && CM_Unregister_Notification_ptr)
+        {
+            memset(&filter, 0, sizeof(filter));
+            filter.cbSize = sizeof(filter);
+            filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+            filter.u.DeviceInterface.ClassGuid = InterfaceClassGuid;
+            if (reg(&filter, NULL, hotplug_callback, &hotplug_notify) == CR_SUCCESS)
+                return 2;
+        }
+        FreeLibrary(hotplug_lib);
+        hotplug_lib = NULL;
+    }
+    return 3;
+}
+#endif
+
+long HID_API_EXPORT hid_hotplug_count(void)
+{
+    LONG state = InterlockedCompareExchange(&hotplug_state, 1, 0);
+
+    if (state == 0)
+    {
+#ifdef CM_NOTIFY_FILTER_FLAG_ALL_INTERFACE_CLASSES
+        state = register_hotplug();
+#else
+        state = 3;
+#endif
+        InterlockedExchange(&hotplug_state, state);
+    }
+    /* Another thread is registering, its notifications start in a moment. */
+    while (state == 1)
+    {
+        Sleep(0);
+        state = hotplug_state;
+    }
+
+    return (state == 2) ? (long)hotplug_events : -1;
+}
+
 struct hid_device_info HID_API_EXPORT *HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
 {
     BOOL res;
@@ -612,7 +732,12 @@ HID_API_EXPORT hid_device *HID_API_CALL hid_open_path(const char *path)
     dev->usage = caps.Usage;
     HidD_FreePreparsedData(pp_data);
 
-    dev->read_buf = (char *)malloc(dev->input_report_length);
+    /* Let the driver queue bursts of input reports, such as the responses of a long
+       SPI transfer. The default of 32 lasts only 32 ms at one full speed report per frame. */
+    HidD_SetNumInputBuffers(dev->device_handle, HID_INPUT_BUFFERS);
+
+    dev->read_buf = (char *)malloc(HID_READS_PENDING * dev->input_report_length);
+    dev->write_buf = (unsigned char *)malloc(HID_WRITES_PENDING * dev->output_report_length);
 
     return dev;
 
@@ -632,8 +757,7 @@ int HID_API_EXPORT HID_API_CALL hid_write_timeout(hid_device *dev,
     BOOL res;
 
     unsigned char *buf;
-    dev->write_ol.Offset = 0;
-    dev->write_ol.OffsetHigh = 0;
+    OVERLAPPED *ol = &dev->write_ol[0];
 
     /* Make sure the right number of bytes are passed to WriteFile. Windows
     expects the number of bytes which are in the _longest_ report (plus
@@ -656,7 +780,7 @@ int HID_API_EXPORT HID_API_CALL hid_write_timeout(hid_device *dev,
         length = dev->output_report_length;
     }
 
-    res = WriteFile(dev->device_handle, buf, (DWORD)length, NULL, &dev->write_ol);
+    res = WriteFile(dev->device_handle, buf, (DWORD)length, NULL, ol);
 
     if (!res)
     {
@@ -671,7 +795,7 @@ int HID_API_EXPORT HID_API_CALL hid_write_timeout(hid_device *dev,
     }
 
     /* Wait for the write to complete. */
-    res = WaitForSingleObject(dev->write_ol.hEvent, milliseconds);
+    res = WaitForSingleObject(ol->hEvent, milliseconds);
     if (res != WAIT_OBJECT_0)
     {
         /* The WaitForSingleObject operation failed. */
@@ -682,7 +806,7 @@ int HID_API_EXPORT HID_API_CALL hid_write_timeout(hid_device *dev,
     }
 
     /* WaitForSingleObject() told us that WriteFile has completed.*/
-    res = GetOverlappedResult(dev->device_handle, &dev->write_ol, &bytes_written, TRUE /*wait*/);
+    res = GetOverlappedResult(dev->device_handle, ol, &bytes_written, TRUE /*wait*/);
     if (!res)
     {
         /* The GetOverlappedResult operation failed. */
@@ -703,35 +827,46 @@ int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *
     return hid_write_timeout(dev, data, length, (dev->blocking) ? -1 : 0);
 }
 
-int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+/* Post overlapped reads until HID_READS_PENDING of them are outstanding, so that the
+   input reports are picked up while the previous ones are processed. Returns FALSE if
+   no read is outstanding. */
+static BOOL post_reads(hid_device *dev)
 {
-    DWORD bytes_read = 0;
-    BOOL res;
+    size_t slot;
 
-    if (!dev->read_pending)
+    while (dev->read_posted < HID_READS_PENDING)
     {
-        /* Start an Overlapped I/O read. */
-        dev->read_pending = TRUE;
-        memset(dev->read_buf, 0, dev->input_report_length);
-        res = ReadFile(dev->device_handle, dev->read_buf, (DWORD)dev->input_report_length, &bytes_read, &dev->read_ol);
-
-        if (!res)
+        slot = (dev->read_head + dev->read_posted) % HID_READS_PENDING;
+        if (!ReadFile(dev->device_handle, dev->read_buf + slot * dev->input_report_length,
+                      (DWORD)dev->input_report_length, NULL, &dev->read_ol[slot]) &&
+            (GetLastError() != ERROR_IO_PENDING))
         {
-            if (GetLastError() != ERROR_IO_PENDING)
-            {
-                /* ReadFile() has failed.
-                Clean up and return error. */
-                CancelIo(dev->device_handle);
-                dev->read_pending = FALSE;
-                goto end_of_function;
-            }
+            /* ReadFile() has failed, the reads posted already are still completed.
+            The next call tries again. */
+            register_error(dev, L"ReadFile");
+            break;
         }
+        dev->read_posted++;
     }
+    return (dev->read_posted > 0);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+    DWORD bytes_read = 0;
+    OVERLAPPED *ol;
+    char *buf;
+    BOOL res;
 
-    if (milliseconds >= 0)
+    if (!post_reads(dev))
+        return -1;
+
+    ol = &dev->read_ol[dev->read_head];
+    if ((milliseconds >= 0) && !HasOverlappedIoCompleted(ol))
     {
-        /* See if there is any data yet. */
-        res = WaitForSingleObject(dev->read_ol.hEvent, milliseconds);
+        /* See if there is any data yet. The event may have been consumed by
+           hid_poll() already, a completed read is not waited for. */
+        res = WaitForSingleObject(ol->hEvent, milliseconds);
         if (res != WAIT_OBJECT_0)
         {
             /* There was no data this time. Return zero bytes available,
@@ -742,15 +877,23 @@ int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char
 
     /* Either WaitForSingleObject() told us that ReadFile has completed, or
     we are in non-blocking mode. Get the number of bytes read. The actual
-    data has been copied to the data[] array which was passed to ReadFile(). */
-    res = GetOverlappedResult(dev->device_handle, &dev->read_ol, &bytes_read, TRUE /*wait*/);
+    data has been copied to the read_buf[] slot which was passed to ReadFile(). */
+    res = GetOverlappedResult(dev->device_handle, ol, &bytes_read, TRUE /*wait*/);
+    buf = dev->read_buf + dev->read_head * dev->input_report_length;
 
-    /* Set pending back to false, even if GetOverlappedResult() returned error. */
-    dev->read_pending = FALSE;
+    /* The next read is the oldest one now, even if GetOverlappedResult() returned error. */
+    dev->read_head = (dev->read_head + 1) % HID_READS_PENDING;
+    dev->read_posted--;
 
-    if (res && bytes_read > 0)
+    if (!res)
     {
-        if (dev->read_buf[0] == 0x0)
+        register_error(dev, L"GetOverlappedResult");
+        return -1;
+    }
+
+    if (bytes_read > 0)
+    {
+        if (buf[0] == 0x0)
         {
             /* If report numbers aren't being used, but Windows sticks a report
             number (0x0) on the beginning of the report anyway. To make this
@@ -759,24 +902,132 @@ int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char
             size_t copy_len;
             bytes_read--;
             copy_len = length > bytes_read ? bytes_read : length;
-            memcpy(data, dev->read_buf + 1, copy_len);
+            memcpy(data, buf + 1, copy_len);
         }
         else
         {
             /* Copy the whole buffer, report number and all. */
             size_t copy_len = length > bytes_read ? bytes_read : length;
-            memcpy(data, dev->read_buf, copy_len);
+            memcpy(data, buf, copy_len);
         }
     }
 
-end_of_function:
-    if (!res)
+    return bytes_read;
+}
+
+int HID_API_EXPORT hid_write_reports(hid_device *dev, const unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    size_t copy_len = (length < dev->output_report_length) ? length : dev->output_report_length;
+    size_t posted = 0;
+    size_t done = 0;
+    size_t written = 0;
+    DWORD bytes_written;
+    OVERLAPPED *ol;
+    unsigned char *buf;
+    BOOL failed = FALSE;
+
+    /* Up to HID_WRITES_PENDING reports are in flight, the oldest one is waited for
+    before its slot is used again. The reports are padded as in hid_write_timeout(). */
+    while (done < count)
     {
-        register_error(dev, L"GetOverlappedResult");
+        if (!failed && (posted < count) && (posted - done < HID_WRITES_PENDING))
+        {
+            ol = &dev->write_ol[posted % HID_WRITES_PENDING];
+            buf = dev->write_buf + (posted % HID_WRITES_PENDING) * dev->output_report_length;
+            memcpy(buf, data + posted * length, copy_len);
+            memset(buf + copy_len, 0, dev->output_report_length - copy_len);
+            if (!WriteFile(dev->device_handle, buf, dev->output_report_length, NULL, ol) &&
+                (GetLastError() != ERROR_IO_PENDING))
+            {
+                register_error(dev, L"WriteFile");
+                failed = TRUE;
+            }
+            else
+            {
+                posted++;
+            }
+            continue;
+        }
+        if (done == posted)
+            break;
+
+        /* Wait for the oldest write. After a failure the writes still in flight
+        are cancelled, the reports following the failed one do not count. */
+        ol = &dev->write_ol[done % HID_WRITES_PENDING];
+        if (!failed && !HasOverlappedIoCompleted(ol) && (WaitForSingleObject(ol->hEvent, milliseconds) != WAIT_OBJECT_0))
+        {
+            register_error(dev, L"WaitForSingleObject");
+            failed = TRUE;
+        }
+        if (failed)
+            CancelIoEx(dev->device_handle, ol);
+        if (GetOverlappedResult(dev->device_handle, ol, &bytes_written, TRUE /*wait*/))
+        {
+            if (!failed)
+                written++;
+        }
+        else if (!failed)
+        {
+            register_error(dev, L"GetOverlappedResult");
+            failed = TRUE;
+        }
+        done++;
+    }
+    return (written > 0) ? (int)written : -1;
+}
+
+int HID_API_EXPORT hid_read_reports(hid_device *dev, unsigned char *data, size_t length, size_t count, int milliseconds)
+{
+    size_t done;
+    int res = 0;
+
+    /* only the first report is waited for, the others have completed already or
+       are left posted */
+    for (done = 0; done < count; done++)
+    {
+        res = hid_read_timeout(dev, data + done * length, length, (done == 0) ? milliseconds : 0);
+        if (res <= 0)
+            break;
+    }
+    return (done > 0) ? (int)done : res;
+}
+
+int HID_API_EXPORT hid_poll(hid_device **devices, size_t count, unsigned char *ready, int milliseconds)
+{
+    HANDLE events[MAXIMUM_WAIT_OBJECTS];
+    size_t i;
+    int num = 0;
+
+    if (count == 0)
+        return 0;
+    if (count > MAXIMUM_WAIT_OBJECTS)
         return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        hid_device *dev = devices[i];
+
+        /* A failed ReadFile() is reported by the next read. */
+        ready[i] = (!post_reads(dev) || HasOverlappedIoCompleted(&dev->read_ol[dev->read_head])) ? 1 : 0;
+        num += ready[i];
+        events[i] = dev->read_ol[dev->read_head].hEvent;
     }
 
-    return bytes_read;
+    if ((num == 0) && (milliseconds != 0))
+    {
+        if (WaitForMultipleObjects((DWORD)count, events, FALSE, (milliseconds < 0) ? INFINITE : (DWORD)milliseconds) == WAIT_TIMEOUT)
+            return 0;
+        for (i = 0; i < count; i++)
+        {
+            if (HasOverlappedIoCompleted(&devices[i]->read_ol[devices[i]->read_head]))
+            {
+                ready[i] = 1;
+                num++;
+            }
+        }
+    }
+
+    return num;
 }
 
 int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length)
@@ -847,7 +1098,15 @@ void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev)
 {
     if (!dev)
         return;
-    CancelIo(dev->device_handle);
+    /* The posted reads write to the buffers until they are cancelled. */
+    CancelIoEx(dev->device_handle, NULL);
+    while (dev->read_posted > 0)
+    {
+        DWORD bytes_read;
+        GetOverlappedResult(dev->device_handle, &dev->read_ol[dev->read_head], &bytes_read, TRUE /*wait*/);
+        dev->read_head = (dev->read_head + 1) % HID_READS_PENDING;
+        dev->read_posted--;
+    }
     free_hid_device(dev);
 }
 
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <ctype.h>
 #if defined(__FreeBSD__)
@@ -20,10 +21,13 @@
 #endif
 #include "lpcusbsio.h"
 #include "lpcusbsio_protocol.h"
+#include "hid_api/mock/hid_mock.h"
 #ifdef _WIN32
 #include <Windows.h>
 #else
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #endif
 
 /* enable debug logging */
@@ -41,7 +45,7 @@
 /* On windows the HID report data starts after first byte since this byte is used for reportID. */
 #define HID_REPORT_DATA_OFFSET		1
 
-#define NUM_LIB_ERR_STRINGS         6
+#define NUM_LIB_ERR_STRINGS         7
 #define NUM_FW_ERR_STRINGS          6
 #define NUM_BRIDGE_ERR_STRINGS      4
 #define MAX_FWVER_STRLEN			60
@@ -49,42 +53,475 @@
 #define MAX_I2C_PORTS				8
 #define MAX_SPI_PORTS				8
 
-typedef struct LPCUSBSIO_Port_Ctrl {
+/* Maximum number of SIO transactions kept in flight on a single device. The transId
+   space is 256 values wide, keep this well below that to avoid aliasing late responses. */
+#define SIO_MAX_INFLIGHT			16
+#define SIO_NUM_TRANS_IDS			256
+/* Transactions are submitted through one queue per I2C and SPI port and one shared by the
+   GPIO and device requests. A single queue may only use part of the in-flight slots so that
+   a long transfer on one port leaves room for the others. */
+#define SIO_NUM_QUEUES				(MAX_I2C_PORTS + MAX_SPI_PORTS + 1)
+#define SIO_QUEUE_GPIO				(MAX_I2C_PORTS + MAX_SPI_PORTS)
+#define SIO_MAX_INFLIGHT_QUEUE		(SIO_MAX_INFLIGHT / 2)
+/* Number of asynchronous request descriptors preallocated per device. Handles which are
+   not released by LPCUSBSIO_ReqFree() keep their descriptor. */
+#ifndef SIO_REQ_POOL_SIZE
+#define SIO_REQ_POOL_SIZE			128	/* at most 256, the index of a request handle is 8 bits */
+#endif
+/* Handles given to the application are not pointers but table references: the device
+   slot, the kind of handle, the port number and the low bits of the slot sequence number.
+   A handle is validated in constant time and a stale one fails the sequence check.
+   The sequence number of a slot steps through the SIO_SLOT_xxx states, modulo 4.
+   Request and GPIO subscription handles carry the index of the entry in the table of the
+   device and a 12-bit generation in place of the port and sequence number: the low four
+   bits of the open count of the slot, seq / 4, above the eight bit reuse count of the entry.
+   Entries are reused in turn, so a stale handle only matches after 256 reuses of its entry
+   and 16 opens of its slot. */
+#ifndef SIO_MAX_DEVICES
+#define SIO_MAX_DEVICES				256
+#endif
+#define SIO_HANDLE_DEV				1
+#define SIO_HANDLE_I2C				2
+#define SIO_HANDLE_SPI				3
+#define SIO_HANDLE_GPIO_SUB			4
+#define SIO_HANDLE_REQ				5
+#define SIO_HANDLE_GROUP			6	/* the slot field is the index in g_Ctrl.groups */
+#define SIO_HANDLE_SLOT(h)			((h) & 0xFFu)
+#define SIO_HANDLE_PORT(h)			(((h) >> 8) & 0xFu)
+#define SIO_HANDLE_KIND(h)			(((h) >> 12) & 0xFu)
+#define SIO_HANDLE_SEQ(h)			(((h) >> 16) & 0xFFFFu)
+#define SIO_HANDLE_INDEX(h)			(((h) >> 16) & 0xFFu)
+#define SIO_HANDLE_GEN(h)			((((h) >> 20) & 0xFF0u) | (((h) >> 8) & 0xFu))
+#define SIO_HANDLE_OPENS(h)			(((h) >> 28) & 0xFu)
+/* Device groups existing at the same time, see LPCUSBSIO_GroupCreate() */
+#ifndef SIO_MAX_GROUPS
+#define SIO_MAX_GROUPS				64	/* at most 256, like the device slots */
+#endif
+#define SIO_SLOT_FREE				0
+#define SIO_SLOT_OPENING			1
+#define SIO_SLOT_OPEN				2
+#define SIO_SLOT_CLOSING			3
+/* Optional reader thread of a device, see LPCUSBSIO_SetReaderThread(). Input reports are
+   read ahead into a ring of SIO_RING_SIZE reports, a power of two. */
+#ifndef SIO_RING_SIZE
+#define SIO_RING_SIZE				128
+#endif
+/* Maximum number of output reports written, and of input reports read, by one call of the
+   HID backend. A transaction of up to SIO_WRITE_BATCH reports is written at once. */
+#ifndef SIO_WRITE_BATCH
+#define SIO_WRITE_BATCH				32
+#endif
+#ifndef SIO_READ_BATCH
+#define SIO_READ_BATCH				16
+#endif
+#ifndef SIO_READER_POLL_MS
+#define SIO_READER_POLL_MS			50
+#endif
+#define SIO_READER_CALLER			0	/* the waiting callers take turns in reading */
+#define SIO_READER_STARTING			1	/* reader role reserved for the thread being started */
+#define SIO_READER_THREAD			2	/* the reader thread owns the input pipe */
+#define SIO_READER_STOPPING			3	/* the reader thread has been asked to exit */
+#define SIO_READER_SHARED			4	/* a shared reader thread owns the input pipe */
+/* Shared reader threads, see LPCUSBSIO_SetSharedReaders(). Each waits on up to
+   SIO_SHARED_MAX_DEVICES devices and looks at its device list every SIO_SHARED_POLL_MS. */
+#define SIO_MAX_SHARED_READERS		16
+#ifndef SIO_SHARED_MAX_DEVICES
+#define SIO_SHARED_MAX_DEVICES		64
+#endif
+#ifndef SIO_SHARED_POLL_MS
+#define SIO_SHARED_POLL_MS			10
+#endif
+/* capability cache, see LPCUSBSIO_SetCapsCache(), and worker threads of LPCUSBSIO_OpenMany() */
+#define SIO_MAX_CAPS				SIO_MAX_DEVICES
+#define SIO_CAPS_SERIAL_LEN			64
+#define SIO_OPEN_THREADS			16
+/* sizes of the binary trace ring, see LPCUSBSIO_SetTrace() */
+#define SIO_TRACE_MIN_RECS			16
+#define SIO_TRACE_MAX_RECS			(1u << 20)
+#define SIO_TRACE_PATH_LEN			260
+/* GPIO ports whose state is kept by GPIO_SetCache() */
+#define SIO_MAX_GPIO_PORTS			8
+/* GPIO event subscriptions of a device, at most 256 like the request descriptors */
+#define SIO_MAX_GPIO_SUBS			16
+/* Default period of the GPIO sampler, see GPIO_SetSamplePeriod() */
+#define SIO_GPIO_SAMPLE_MS			10
+#define SIO_EVENTS_STOPPED			0	/* no event thread */
+#define SIO_EVENTS_RUNNING			1	/* the event thread delivers the GPIO events */
+#define SIO_EVENTS_STOPPING			2	/* the event thread has been asked to exit */
+/* Most segments on either side of a scatter-gather transfer */
+#ifndef SIO_MAX_IOV
+#define SIO_MAX_IOV					16
+#endif
+/* Longest blocking read of LPCUSBSIO_ReqWaitAny() when the requests belong to several devices */
+#define SIO_WAIT_ANY_SLICE			1
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION SIO_MUTEX_T;
+typedef CONDITION_VARIABLE SIO_COND_T;
+#else
+typedef pthread_mutex_t SIO_MUTEX_T;
+typedef pthread_cond_t SIO_COND_T;
+#endif
+
+#ifdef _WIN32
+typedef INIT_ONCE SIO_ONCE_T;
+#define SIO_ONCE_INIT				INIT_ONCE_STATIC_INIT
+#else
+typedef pthread_once_t SIO_ONCE_T;
+#define SIO_ONCE_INIT				PTHREAD_ONCE_INIT
+#endif
+
+#ifdef _WIN32
+typedef HANDLE SIO_THREAD_T;
+typedef DWORD SIO_THREAD_RET_T;
+#define SIO_THREAD_API				WINAPI
+#else
+typedef pthread_t SIO_THREAD_T;
+typedef void *SIO_THREAD_RET_T;
+#define SIO_THREAD_API
+#endif
+typedef SIO_THREAD_RET_T (SIO_THREAD_API *SIO_THREAD_FN_T)(void *arg);
+
+#ifdef _MSC_VER
+#define SIO_THREAD_LOCAL			__declspec(thread)
+#else
+#define SIO_THREAD_LOCAL			__thread
+#endif
+
+/* SIO transaction states */
+#define SIO_REQ_IDLE				0	/* not submitted yet */
+#define SIO_REQ_PENDING				1	/* request sent, waiting for response */
+#define SIO_REQ_DONE				2	/* response received or transaction failed */
+
+/* How the API result is derived from a completed transaction */
+#define SIO_RES_STATUS				0	/* transaction status, LPCUSBSIO_OK on success */
+#define SIO_RES_IN_LEN				1	/* number of response bytes received */
+#define SIO_RES_OUT_LEN				2	/* number of payload bytes written */
+#define SIO_RES_XFER_LEN			3	/* response bytes, or bytes written for Tx only transfers */
+#define SIO_RES_GPIO				4	/* response length, port status copied to pStatus */
+#define SIO_RES_GPIO_PIN			5	/* state of a single port pin */
+
+/* Completion callback states of asynchronous requests */
+#define SIO_CB_IDLE					0	/* callback not due yet or already run */
+#define SIO_CB_QUEUED				1	/* waiting in the callback queue of the device */
+#define SIO_CB_RUNNING				2	/* callback is executing */
+#define SIO_CB_FREE					3	/* request was freed from its own callback */
+
+/* marks live asynchronous request descriptors */
+#define SIO_REQ_MAGIC				0x5153494FUL
+
+struct LPCUSBSIO_Ctrl;
+
+typedef struct LPCUSBSIO_Request {
+    uint8_t transId;		/* transaction identifier assigned on submit */
+    uint8_t state;			/* SIO_REQ_xxx state */
+    uint8_t resKind;		/* SIO_RES_xxx, how the API result is derived */
+    uint8_t pin;			/* GPIO pin reported by SIO_RES_GPIO_PIN */
+    uint8_t txHeld;			/* submitter already owns the output pipe, see LPCUSBSIO_Batch */
+    uint8_t queueHeld;		/* submitter already holds the queue mutex, see SIO_StreamTransfer */
+    uint8_t queue;			/* submission queue, see SIO_QueueIndex */
+    uint8_t req;			/* HID_xxx_REQ_ code and sesId of the transaction */
+    uint8_t sesId;
+    uint32_t args[2];		/* GPIO masks or IOCON mode, SPI device, see SIO_GpioShadowLocked */
+    uint32_t timeout;		/* response time-out in milliseconds, see SIO_RequestTimeout */
+    uint8_t tmoTotal;		/* timeout covers the whole response, not each packet */
+    uint32_t txLen;			/* output payload bytes, counted by the statistics */
+    uint64_t startUs;		/* SIO_GetTickUs() when the request was submitted */
+    uint8_t *inData;		/* response payload destination, may be NULL */
+    const LPCUSBSIO_IOVEC_T *inSegs;	/* response segments of scatter-gather transfers, used instead of inData */
+    uint32_t numInSegs;
+    uint32_t inSegIdx;		/* segment and offset the next response byte goes to */
+    uint32_t inSegOfs;
+    uint32_t inSize;		/* capacity of the inData buffer */
+    uint32_t inLen;			/* response payload bytes received so far */
+    uint32_t outLen;		/* payload bytes written, reported by SIO_RES_OUT_LEN */
+    uint32_t *pStatus;		/* GPIO status destination of SIO_RES_GPIO, may be NULL */
+    uint8_t gpioData[4];	/* response buffer of GPIO requests */
+    int32_t status;			/* final transaction result once state is SIO_REQ_DONE */
+    int32_t result;			/* API result once state is SIO_REQ_DONE */
+    uint64_t deadline;		/* tick count when the transaction times out */
+    struct LPCUSBSIO_Ctrl *dev;	/* device the request is submitted to */
+
+    /* asynchronous requests only */
+    uint32_t magic;			/* SIO_REQ_MAGIC while the request handle is valid */
+    uint32_t gen;			/* generation carried by the request handle */
+    uint8_t cbState;		/* SIO_CB_xxx state */
+    LPCUSBSIO_REQ_CALLBACK_T callback;
+    void *context;
+    struct LPCUSBSIO_Request *cbNext;	/* callback queue link */
+    struct LPCUSBSIO_Request *prev;		/* list of asynchronous requests of the device */
+    struct LPCUSBSIO_Request *next;
+} LPCUSBSIO_Request_t;
+
+/* Piece of the output payload of a transaction, the pieces are gathered into the output reports */
+typedef struct LPCUSBSIO_Segment {
+    const uint8_t *data;
+    uint32_t len;
+} LPCUSBSIO_Segment_t;
+
+/* Devices of a group created by LPCUSBSIO_GroupCreate() */
+typedef struct LPCUSBSIO_Group {
+    uint32_t count;
+    LPC_HANDLE members[];
+} LPCUSBSIO_Group_t;
+
+/* Entry of the group table, the handle of a group carries the index and the sequence
+   number of its entry, which is incremented when the group is freed */
+typedef struct LPCUSBSIO_GroupSlot {
+    uint32_t seq;
+    LPCUSBSIO_Group_t *group;	/* NULL while the entry is free */
+} LPCUSBSIO_GroupSlot_t;
+
+/* Part of a group operation executed on one device */
+typedef struct LPCUSBSIO_GroupJob {
     LPC_HANDLE hUsbSio;
+    LPCUSBSIO_BATCH_OP_T *ops;
+    uint32_t count;
+    int32_t result;
+    uint8_t threaded;		/* runs on a thread of its own, joined by LPCUSBSIO_GroupBatch */
+    SIO_THREAD_T thread;
+} LPCUSBSIO_GroupJob_t;
+
+/* Last known state of a GPIO port, kept while GPIO_SetCache() is enabled */
+typedef struct LPCUSBSIO_GpioShadow {
+    uint32_t dir;			/* direction register, 1 for outputs */
+    uint32_t dirKnown;		/* pins whose direction is known */
+    uint32_t out;			/* output values last written */
+    uint32_t outKnown;
+    uint32_t mode[32];		/* IOCON mode last configured for each pin */
+    uint32_t modeKnown;
+} LPCUSBSIO_GpioShadow_t;
+
+/* GPIO event subscription, see GPIO_Subscribe() */
+typedef struct LPCUSBSIO_GpioSub {
+    uint8_t active;
+    uint8_t port;
+    uint8_t condition;		/* GPIO_EVENT_xxx flags */
+    uint8_t primed;			/* set once the first port status was matched */
+    uint32_t gen;			/* generation carried by the handle, see SIO_SubHandle() */
+    uint32_t pins;
+    uint32_t cbPins;		/* pins which met the condition, not passed to the callback yet */
+    uint32_t waitPins;		/* pins which met the condition, not collected by GPIO_WaitEvent yet */
+    uint32_t status;		/* port status of the latest event */
+    GPIO_EVENT_CALLBACK_T callback;
+    void *context;
+} LPCUSBSIO_GpioSub_t;
+
+typedef struct LPCUSBSIO_Port_Ctrl {
+    LPC_HANDLE hUsbSio;		/* owning LPCUSBSIO_Ctrl_t while the port is open, NULL otherwise */
     uint8_t portNum;
+    uint8_t tmoFlags;		/* LPCUSBSIO_TIMEOUT_xxx flags used with timeout */
+    uint32_t timeout;		/* time-out in milliseconds, 0 to use the one of the device */
+    uint32_t busSpeed;		/* bus clock in Hz the port was opened with */
+    LPCUSBSIO_STATS_T stats;	/* transactions of the port, protected by sioMutex */
 } LPCUSBSIO_PortCtrl_t;
 
 typedef struct LPCUSBSIO_Ctrl {
 
-    struct hid_device_info *hidInfo;
+    /* Device structures are never freed but reused by the next device opened in the same
+       slot, so a thread racing with LPCUSBSIO_Close() never touches freed memory. The
+       synchronization objects are created once, all fields from hidDev on are cleared
+       on every open. */
+    SIO_MUTEX_T sioMutex;	/* protects the transaction table, held shortly */
+    SIO_MUTEX_T queueMutex[SIO_NUM_QUEUES];	/* admits one submitter of each queue to the pipe */
+    SIO_COND_T rxCond;		/* signalled when a transaction completes or the reader role is free */
+    SIO_COND_T eventCond;	/* signalled when a GPIO event is due or the event thread has to exit */
+    uint32_t slot;				/* index in g_Ctrl.devSlots */
+    /* binary trace ring, allocated by the first LPCUSBSIO_SetTrace() of the slot and kept
+       for the devices opened in it later, see SIO_Trace() */
+    LPCUSBSIO_TRACE_REC_T *trace;
+    uint32_t traceMask;
+    /* reuse count of each request descriptor, kept so that the handles of a device closed
+       before do not match the requests of the next one, under sioMutex */
+    uint8_t reqGen[SIO_REQ_POOL_SIZE];
+    /* reuse count of each GPIO subscription, kept for the same reason, under sioMutex */
+    uint8_t subGen[SIO_MAX_GPIO_SUBS];
+
     hid_device *hidDev;
+    uint32_t seq;				/* slot sequence number this device was opened with */
+    /* set once LPCUSBSIO_Close() started, no more requests are accepted, protected by sioMutex */
+    uint8_t closing;
     uint8_t peripheralId[8];
     uint8_t transId;
     uint8_t maxI2CPorts;
     uint8_t maxSPIPorts;
     uint8_t maxGPIOPorts;
+    uint8_t caps;				/* HID_SIO_CAPS_xxx flags of the firmware */
     uint32_t maxDataSize;
     uint32_t fwVersion;
     char fwBuild[MAX_FWVER_STRLEN];
-    uint8_t outPacket[HID_SIO_PACKET_SZ + 1];
-    uint8_t inPacket[HID_SIO_PACKET_SZ + 1];
+    /* capabilities taken from the cache are confirmed before the first request:
+       1 until then, 2 while HID_SIO_REQ_DEV_INFO is in flight, 0 afterwards */
+    volatile uint32_t capsCheck;
+    uint32_t capsEntry;			/* index + 1 of the cache entry used */
+    uint8_t outReports[SIO_WRITE_BATCH][HID_SIO_PACKET_SZ + 1];	/* owned by the submitter whose pipe turn it is */
+    uint8_t inReports[SIO_READ_BATCH][HID_SIO_PACKET_SZ + 1];	/* owned by the active reader */
 
     LPCUSBSIO_PortCtrl_t i2cPorts[MAX_I2C_PORTS];
     LPCUSBSIO_PortCtrl_t spiPorts[MAX_SPI_PORTS];
-#ifdef _WIN32
-    HANDLE sioMutex;
-#else
-    pthread_mutex_t sioMutex;
-#endif
 
-    struct LPCUSBSIO_Ctrl *next;
+    /* in-flight transactions indexed by transId, protected by sioMutex */
+    LPCUSBSIO_Request_t *pending[SIO_NUM_TRANS_IDS];
+    uint32_t numPending;
+    /* set while one of the waiting callers reads and dispatches input reports */
+    uint8_t readerActive;
+    /* completed asynchronous requests whose callback is due, protected by sioMutex */
+    LPCUSBSIO_Request_t *cbHead;
+    LPCUSBSIO_Request_t *cbTail;
+    /* all asynchronous requests allocated on this device, protected by sioMutex */
+    LPCUSBSIO_Request_t *asyncReqs;
+    /* descriptors of asynchronous requests, nothing is allocated per transfer */
+    LPCUSBSIO_Request_t reqPool[SIO_REQ_POOL_SIZE];
+    LPCUSBSIO_Request_t *reqFree;		/* oldest released descriptor, reused first */
+    LPCUSBSIO_Request_t *reqFreeTail;
+    /* in-flight transactions of each submission queue, protected by sioMutex */
+    uint8_t queuePending[SIO_NUM_QUEUES];
+    /* turns of the output pipe are handed out in FIFO order, protected by sioMutex */
+    uint32_t pipeTicket;
+    uint32_t pipeServing;
+    /* last failure of a transaction on this device, protected by sioMutex */
+    int32_t lastError;
+    /* transaction time-out set by LPCUSBSIO_SetTimeout(), protected by sioMutex */
+    uint32_t timeout;
+    uint8_t tmoFlags;
+    /* GPIO shadow registers, protected by sioMutex */
+    uint8_t gpioCache;
+    LPCUSBSIO_GpioShadow_t gpioShadow[SIO_MAX_GPIO_PORTS];
+    /* GPIO event subscriptions and their event thread, protected by sioMutex */
+    LPCUSBSIO_GpioSub_t gpioSubs[SIO_MAX_GPIO_SUBS];
+    uint32_t gpioLevel[SIO_MAX_GPIO_PORTS];	/* port status of the latest event or sample */
+    uint8_t gpioLevelKnown;			/* ports whose gpioLevel is valid, one bit each */
+    uint8_t eventMode;				/* SIO_EVENTS_xxx */
+    uint8_t eventCbSub;				/* subscription whose callback is running, plus one */
+    uint32_t subNext;				/* where GPIO_Subscribe() looks for a free entry first */
+    uint32_t samplePeriod;			/* milliseconds between two samples of the watched ports */
+    SIO_THREAD_T eventThread;
+    /* traffic statistics, protected by sioMutex. Samples taken without the lock are
+       collected locally and added once it is taken again. */
+    LPCUSBSIO_STATS_T stats;
+    /* records are reserved by incrementing traceHead, written without locking */
+    volatile uint32_t traceOn;
+    volatile uint32_t traceHead;
+    /* SIO_READER_xxx, who reads the input reports, protected by sioMutex */
+    uint8_t readerMode;
+    SIO_THREAD_T readerThread;
+    uint8_t sharedReader;			/* index + 1 of the shared reader thread serving the device */
+    uint64_t sharedRetry;			/* tick until which a failing device is skipped, shared reader only */
+    /* input reports read ahead by the reader thread. The thread produces them without
+       locking, the consumer is whichever thread holds sioMutex. */
+    volatile uint32_t ringHead;
+    volatile uint32_t ringTail;
+    uint8_t ring[SIO_RING_SIZE][HID_SIO_PACKET_SZ + 1];
 
 } LPCUSBSIO_Ctrl_t;
 
-struct LPCSIO_Ctrl {
-    struct hid_device_info *devInfoList;
+typedef struct LPCUSBSIO_Slot {
+    volatile uint32_t seq;		/* SIO_SLOT_xxx state in the low two bits, incremented on every change */
+    LPCUSBSIO_Ctrl_t *dev;		/* allocated by the first open of the slot, kept afterwards */
+} LPCUSBSIO_Slot_t;
+
+/* Result of one LPCUSBSIO_GetNumPorts() call, freed once the last user released it */
+typedef struct LPCUSBSIO_DevList {
+    struct hid_device_info *info;
+    volatile uint32_t refs;
+    uint32_t vid;				/* filter of the enumeration */
+    uint32_t pid;
+    long hotplugCount;			/* hid_hotplug_count() taken before the enumeration, -1 if unknown */
+    uint32_t count;
+    const struct SIO_HidBackend *hid;	/* backend which made the enumeration and frees it */
+    struct hid_device_info **byIndex;
+    /* open addressed tables of index + 1 hashed by serial number and by path, 0 marks a free bucket */
+    uint32_t hashMask;
+    uint32_t *bySerial;
+    uint32_t *byPath;
+} LPCUSBSIO_DevList_t;
+
+/* Capabilities of a controller as answered to HID_SIO_REQ_DEV_INFO, kept by identity */
+typedef struct SIO_CapsEntry {
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t release;			/* USB release number, follows the firmware version */
+    char serial[SIO_CAPS_SERIAL_LEN];
+    uint8_t maxI2CPorts;
+    uint8_t maxSPIPorts;
+    uint8_t maxGPIOPorts;
+    uint8_t caps;
+    uint32_t maxDataSize;
+    uint32_t fwVersion;
+    char fwBuild[MAX_FWVER_STRLEN];
+} SIO_CapsEntry_t;
+
+/* Devices opened by LPCUSBSIO_OpenMany(), each worker thread takes the next one */
+typedef struct SIO_OpenJob {
+    struct hid_device_info **infos;
+    LPC_HANDLE *phUsbSio;
+    uint32_t count;
+    volatile uint32_t next;
+} SIO_OpenJob_t;
+
+/* HID functions of a backend, the hidapi of the platform or the emulated bridges */
+typedef struct SIO_HidBackend {
+    int (*exit)(void);
+    struct hid_device_info *(*enumerate)(unsigned short vendor_id, unsigned short product_id);
+    void (*free_enumeration)(struct hid_device_info *devs);
+    hid_device *(*open_path)(const char *path);
+    void (*close)(hid_device *device);
+    int (*write)(hid_device *device, const unsigned char *data, size_t length);
+    int (*write_timeout)(hid_device *device, const unsigned char *data, size_t length, int milliseconds);
+    int (*read_timeout)(hid_device *device, unsigned char *data, size_t length, int milliseconds);
+    int (*write_reports)(hid_device *device, const unsigned char *data, size_t length, size_t count, int milliseconds);
+    int (*read_reports)(hid_device *device, unsigned char *data, size_t length, size_t count, int milliseconds);
+    int (*poll)(hid_device **devices, size_t count, unsigned char *ready, int milliseconds);
+    const wchar_t *(*error)(hid_device *device);
+    int (*get_report_lengths)(hid_device *device, unsigned short *output_report_length, unsigned short *input_report_length);
+    int (*get_usage)(hid_device *device, unsigned short *usage_page, unsigned short *usage);
+    long (*hotplug_count)(void);
+} SIO_HidBackend_t;
+
+/* Reader thread shared by several devices */
+typedef struct SIO_SharedReader {
+    SIO_MUTEX_T mutex;			/* protects the fields below, initialized once and kept */
+    SIO_COND_T cond;			/* signalled after each pass over the devices and when one is added */
+    SIO_THREAD_T thread;
+    uint8_t running;
+    uint32_t pass;				/* incremented after each pass over the devices */
+    uint32_t numDevs;			/* also changed only under sharedMutex */
+    LPCUSBSIO_Ctrl_t *devs[SIO_SHARED_MAX_DEVICES];
+} SIO_SharedReader_t;
 
-    LPCUSBSIO_Ctrl_t *devList;
+struct LPCSIO_Ctrl {
+    /* current enumeration, the pointer is swapped under devInfoMutex */
+    LPCUSBSIO_DevList_t *devInfoList;
+    SIO_MUTEX_T devInfoMutex;
+
+    /* open devices, slots are claimed and released with atomic operations */
+    LPCUSBSIO_Slot_t devSlots[SIO_MAX_DEVICES];
+    volatile uint32_t numDevices;
+    volatile uint32_t nextSlot;	/* slots are claimed round robin to delay their reuse */
+
+    /* shared reader threads, the table is changed under sharedMutex */
+    SIO_MUTEX_T sharedMutex;
+    SIO_COND_T sharedCond;			/* signalled once the stopped threads have been joined */
+    uint32_t sharedJoining;			/* non-zero while stopped threads are joined */
+    volatile uint32_t sharedMax;	/* LPCUSBSIO_SetSharedReaders(), 0 for one per processor */
+    uint32_t numShared;				/* threads running */
+    uint32_t numSharedInit;			/* entries whose mutex and cond are initialized */
+    SIO_SharedReader_t shared[SIO_MAX_SHARED_READERS];
+
+    /* device groups, the table is changed under groupMutex */
+    SIO_MUTEX_T groupMutex;
+    uint32_t nextGroup;			/* entries are claimed round robin to delay their reuse */
+    LPCUSBSIO_GroupSlot_t groups[SIO_MAX_GROUPS];
+
+    /* capability cache, the entries are changed under capsMutex */
+    SIO_MUTEX_T capsMutex;
+    SIO_MUTEX_T capsSaveMutex;		/* held while the file is written, outside capsMutex */
+    volatile uint32_t capsOn;
+    uint32_t numCaps;
+    uint32_t capsGen;				/* incremented whenever an entry changes */
+    uint32_t capsSavedGen;			/* capsGen of the entries last written, under capsSaveMutex */
+    char capsPath[SIO_TRACE_PATH_LEN];	/* empty to keep the entries in memory only */
+    SIO_CapsEntry_t caps[SIO_MAX_CAPS];
 };
 
 
@@ -99,7 +536,34 @@ static const char *g_fwInitVer = "FW Ver Unavailable";
 static char g_Version[128];
 
 static struct LPCSIO_Ctrl g_Ctrl = {0, };
-static int32_t g_lastError = LPCUSBSIO_OK;
+
+static const SIO_HidBackend_t g_hidApi = {
+    hid_exit, hid_enumerate, hid_free_enumeration, hid_open_path, hid_close, hid_write, hid_write_timeout,
+    hid_read_timeout, hid_write_reports, hid_read_reports, hid_poll, hid_error, hid_get_report_lengths, hid_get_usage, hid_hotplug_count,
+};
+static const SIO_HidBackend_t g_hidMock = {
+    mock_hid_exit, mock_hid_enumerate, mock_hid_free_enumeration, mock_hid_open_path, mock_hid_close,
+    mock_hid_write, mock_hid_write_timeout, mock_hid_read_timeout, mock_hid_write_reports, mock_hid_read_reports,
+    mock_hid_poll, mock_hid_error, mock_hid_get_report_lengths,
+    mock_hid_get_usage, mock_hid_hotplug_count,
+};
+/* selected backend, only changed while no device, enumeration or HIDAPI handle is in use */
+static const SIO_HidBackend_t *volatile g_hid = &g_hidApi;
+/* the LPCUSBSIO_BACKEND environment variable is read once */
+static SIO_ONCE_T g_hidSelected = SIO_ONCE_INIT;
+/* the global mutexes are initialized once */
+static SIO_ONCE_T g_globalsInit = SIO_ONCE_INIT;
+/* each thread sees the errors of its own calls only */
+static SIO_THREAD_LOCAL int32_t g_lastError = LPCUSBSIO_OK;
+/* non-zero while the calling thread owns the output pipe or a port queue across several
+   requests, it leaves the callbacks to other callers as they may submit requests */
+static SIO_THREAD_LOCAL uint32_t g_cbHold = 0;
+/* transaction time-out of the calling thread, see LPCUSBSIO_SetCallTimeout() */
+static SIO_THREAD_LOCAL uint32_t g_callTimeout = 0;
+/* set on the event threads of the devices */
+static SIO_THREAD_LOCAL uint8_t g_inEventThread = 0;
+/* set while the calling thread confirms cached capabilities, see SIO_CapsCheck() */
+static SIO_THREAD_LOCAL uint8_t g_inCapsCheck = 0;
 
 static const wchar_t *g_LibErrMsgs[NUM_LIB_ERR_STRINGS] = {
     L"No errors are recorded.",
@@ -108,6 +572,7 @@ static const wchar_t *g_LibErrMsgs[NUM_LIB_ERR_STRINGS] = {
     L"Mutex Calls failed.",	/* LPCUSBSIO_ERR_SYNCHRONIZATION */
     L"Memory Allocation Error.",	/* LPCUSBSIO_ERR_MEM_ALLOC */
     L"Mutex Creation Error.",	/* LPCUSBSIO_ERR_MUTEX_CREATE */
+    L"Request has not completed yet.",	/* LPCUSBSIO_ERR_PENDING */
 };
 
 static const wchar_t *g_fwErrMsgs[NUM_FW_ERR_STRINGS] = {
@@ -136,6 +601,10 @@ static const wchar_t *g_BridgeErrMsgs[NUM_BRIDGE_ERR_STRINGS + 1] = {
  ****************************************************************************/
 
 static int32_t LibCleanup();
+static void SIO_SharedStopAll(void);
+static void SIO_CapsSetup(uint8_t enable, const char *path);
+static void SIO_CapsCheck(LPCUSBSIO_Ctrl_t *dev);
+extern HIDAPI_ENUM_T* g_hidapiEnums;
 
 #if SIO_DEBUG>0
 
@@ -176,1063 +645,5082 @@ void Log(const char* format, ...)
 #define Log(x, ...)
 #endif
 
-static struct hid_device_info *GetDevAtIndex(uint32_t index)
+/* Thin OS wrappers of the synchronization primitives used by the transaction engine */
+static int32_t SIO_MutexInit(SIO_MUTEX_T *m)
 {
-    struct hid_device_info *cur_dev = g_Ctrl.devInfoList;
-    int32_t count = 0;
-
-    while (cur_dev) {
-        if (count++ == index) {
-            break;
-        }
-
-        cur_dev = cur_dev->next;
-    }
-    return cur_dev;
+#ifdef _WIN32
+    InitializeCriticalSection(m);
+    return 0;
+#else
+    return pthread_mutex_init(m, NULL);
+#endif
 }
 
-static int32_t validHandle(LPCUSBSIO_Ctrl_t *dev)
+static void SIO_MutexDestroy(SIO_MUTEX_T *m)
 {
-    LPCUSBSIO_Ctrl_t *curDev = g_Ctrl.devList;
+#ifdef _WIN32
+    DeleteCriticalSection(m);
+#else
+    pthread_mutex_destroy(m);
+#endif
+}
 
-    while (dev != curDev) {
-        curDev = curDev->next;
-    }
+static int32_t SIO_MutexLock(SIO_MUTEX_T *m)
+{
+#ifdef _WIN32
+    EnterCriticalSection(m);
+    return 0;
+#else
+    return pthread_mutex_lock(m);
+#endif
+}
 
-    return (curDev == NULL) ? 0 : 1;
+static int32_t SIO_MutexUnlock(SIO_MUTEX_T *m)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(m);
+    return 0;
+#else
+    return pthread_mutex_unlock(m);
+#endif
 }
 
-static int32_t validPortHandle(LPC_HANDLE hPort)
+static int32_t SIO_CondInit(SIO_COND_T *c)
 {
-    uintptr_t portAdr = (uintptr_t)hPort;
-    uintptr_t lowAdr, highAdr;
-    LPCUSBSIO_Ctrl_t *curDev = g_Ctrl.devList;
-    int32_t ret = 0;
+#ifdef _WIN32
+    InitializeConditionVariable(c);
+    return 0;
+#else
+    return pthread_cond_init(c, NULL);
+#endif
+}
 
-    while (NULL != curDev) {
-        lowAdr = (uintptr_t)&curDev->i2cPorts[0];
-        highAdr = lowAdr + ((MAX_I2C_PORTS + MAX_SPI_PORTS)* sizeof(LPCUSBSIO_PortCtrl_t));
+static void SIO_CondBroadcast(SIO_COND_T *c)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(c);
+#else
+    pthread_cond_broadcast(c);
+#endif
+}
 
-        if ((portAdr >= lowAdr) && (portAdr <= highAdr)) {
-            ret = 1;
-            break;
-        }
-        curDev = curDev->next;
+/* wait for condition with the mutex held, spurious wake-ups are possible */
+static void SIO_CondWait(SIO_COND_T *c, SIO_MUTEX_T *m, uint32_t timeout_ms)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(c, m, timeout_ms);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
     }
+    pthread_cond_timedwait(c, m, &ts);
+#endif
+}
 
-    return ret;
+#ifdef _WIN32
+static BOOL CALLBACK SIO_OnceCallback(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    (void)once;
+    (void)context;
+    ((void (*)(void))param)();
+    return TRUE;
 }
+#endif
 
-static void freeDevice(LPCUSBSIO_Ctrl_t *dev)
+/* run fn exactly once, the callers which come later wait until it has returned */
+static void SIO_Once(SIO_ONCE_T *once, void (*fn)(void))
 {
-    LPCUSBSIO_Ctrl_t *curDev = g_Ctrl.devList;
+#ifdef _WIN32
+    InitOnceExecuteOnce(once, SIO_OnceCallback, (PVOID)fn, NULL);
+#else
+    pthread_once(once, fn);
+#endif
+}
 
-    if (curDev == dev) {
-        g_Ctrl.devList = dev->next;
-    }
-    else {
-        while (curDev) {
-            if (curDev->next == dev) {
-                /* update linked list */
-                curDev->next = dev->next;
-                break;
-            }
-            curDev = curDev->next;
-        }
-    }
-    free(dev);
+static int32_t SIO_ThreadCreate(SIO_THREAD_T *t, SIO_THREAD_FN_T fn, void *arg)
+{
+#ifdef _WIN32
+    *t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    return (*t != NULL) ? 0 : -1;
+#else
+    return pthread_create(t, NULL, fn, arg);
+#endif
+}
 
-    /* unload HID library if all devices are closed. */
-    if (g_Ctrl.devList == NULL) {
-        hid_free_enumeration(g_Ctrl.devInfoList);
-        g_Ctrl.devInfoList = NULL;
+static void SIO_ThreadJoin(SIO_THREAD_T t)
+{
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
+}
 
-        // potential place to unload HID library
-        LibCleanup();
-    }
+/* Atomic operations on 32-bit words used by the device table and the input ring */
+static uint32_t SIO_AtomicLoad(volatile uint32_t *p)
+{
+#ifdef _WIN32
+    return (uint32_t)InterlockedCompareExchange((volatile LONG *)p, 0, 0);
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
 }
 
-static const wchar_t *GetErrorString(int32_t err)
+static void SIO_AtomicStore(volatile uint32_t *p, uint32_t value)
 {
-    const wchar_t *retStr = g_LibErrMsgs[0];
-    int index = abs(err);
+#ifdef _WIN32
+    InterlockedExchange((volatile LONG *)p, (LONG)value);
+#else
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+#endif
+}
 
-    if (index < 0x10) {
-        retStr = (index < NUM_LIB_ERR_STRINGS) ? g_LibErrMsgs[index] : g_LibErrMsgs[0];
-    }
-    else if (index < 0x20) {
-        index -= 0x10;
-        retStr = (index < NUM_FW_ERR_STRINGS) ? g_fwErrMsgs[index] : g_fwErrMsgs[0];
-    }
-    else if (index < 0x30) {
-        index -= 0x20;
-        retStr = (index < NUM_BRIDGE_ERR_STRINGS) ? g_BridgeErrMsgs[index] : g_BridgeErrMsgs[NUM_BRIDGE_ERR_STRINGS];
-    }
+/* returns non-zero if *p was expected and has been replaced by value */
+static int32_t SIO_AtomicCas(volatile uint32_t *p, uint32_t expected, uint32_t value)
+{
+#ifdef _WIN32
+    return (InterlockedCompareExchange((volatile LONG *)p, (LONG)value, (LONG)expected) == (LONG)expected) ? 1 : 0;
+#else
+    return __atomic_compare_exchange_n(p, &expected, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ? 1 : 0;
+#endif
+}
 
-    return retStr;
+/* Fences ordering plain memory accesses against the atomic operations above, for the trace seqlock.
+   A release fence keeps the accesses before it ahead of the stores after it, an acquire fence
+   keeps the loads before it ahead of the accesses after it. */
+static void SIO_FenceRelease(void)
+{
+#ifdef _WIN32
+    MemoryBarrier();
+#else
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
 }
 
-static int32_t ConvertResp(int32_t res)
+static void SIO_FenceAcquire(void)
 {
-    int ret;
+#ifdef _WIN32
+    MemoryBarrier();
+#else
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
 
-    if (res == HID_SIO_RES_OK) {
-        ret = LPCUSBSIO_OK;
-    }
-    else {
-        ret = -(res + 0x10);
-    }
-    return ret;
+/* returns the new value */
+static uint32_t SIO_AtomicAdd(volatile uint32_t *p, int32_t delta)
+{
+#ifdef _WIN32
+    return (uint32_t)InterlockedExchangeAdd((volatile LONG *)p, (LONG)delta) + (uint32_t)delta;
+#else
+    return __atomic_add_fetch(p, (uint32_t)delta, __ATOMIC_ACQ_REL);
+#endif
 }
 
-static int32_t SIO_SendRequest(LPCUSBSIO_Ctrl_t *dev, uint8_t portNum, uint8_t req, uint8_t *outData, uint32_t outDataLen, uint8_t *inData, uint32_t *inLen)
+/* monotonic millisecond tick counter */
+static uint64_t SIO_GetTickMs(void)
 {
-    HID_SIO_OUT_REPORT_T *pOut;
-    HID_SIO_IN_REPORT_T *pIn;
-    int32_t res = 0;
-    uint8_t read_pending;
-    uint32_t outLen = outDataLen;
-    uint32_t oneTx;
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
 
-    Log("SIO_SendRequest(dev, portNum=%d, req=0x%x, outData, outLen=%d, inData, inLen)\n", portNum, req, outLen);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (uint64_t)(ts.tv_nsec / 1000000L);
+#endif
+}
 
-    if (((outLen > 0) && (outData == NULL)) || ((inLen != NULL) && (inData == NULL))) {
-        /* Param Error */
-        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+/* monotonic microsecond tick counter of the statistics */
+static uint64_t SIO_GetTickUs(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
     }
+    QueryPerformanceCounter(&now);
+    return ((uint64_t)(now.QuadPart / freq.QuadPart) * 1000000) +
+           (uint64_t)((now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
 
-#if SIO_DEBUG>0
-    if(outDataLen)
-    {
-        uint32_t i;
-        Log("  outData[%d]: ", outDataLen);
-        for(i=0; i<outDataLen; i++)
-            Log("%02X ", outData[i]);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (uint64_t)(ts.tv_nsec / 1000L);
+#endif
+}
 
-        Log("\n              ");
-        for(i=0; i<outDataLen; i++)
-            Log("%c", isprint(outData[i]) ? outData[i] : '.');
+/* Add a sample to a latency histogram */
+static void SIO_HistAdd(LPCUSBSIO_HISTOGRAM_T *hist, uint64_t us)
+{
+    uint32_t i = 0;
 
-        Log("\n");
+    while ((i < (LPCUSBSIO_STATS_BUCKETS - 1)) && ((us >> i) != 0)) {
+        i++;
     }
-#endif
+    hist->count[i]++;
+    hist->totalUs += us;
+    if (us > hist->maxUs) {
+        hist->maxUs = (us > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t)us;
+    }
+}
 
-    /* construct SIO request and send to device. */
+/* id of the calling thread for the trace records */
+static uint32_t SIO_ThreadId(void)
+{
 #ifdef _WIN32
-    if (WaitForSingleObject(dev->sioMutex, INFINITE) != WAIT_OBJECT_0) {
-        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
-    }
+    return (uint32_t)GetCurrentThreadId();
 #else
-    if (pthread_mutex_lock(&dev->sioMutex) != 0) {
-        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
-    }
+    return (uint32_t)(uintptr_t)pthread_self();
 #endif
-    dev->outPacket[0] = 0;
-    g_lastError = LPCUSBSIO_OK;
-    pOut = (HID_SIO_OUT_REPORT_T *)&dev->outPacket[HID_REPORT_DATA_OFFSET];
-    pOut->transId = dev->transId++;
-    pOut->sesId = portNum;
-    pOut->req = req;
-    pOut->transfer_len = HID_SIO_CALC_TRANSFER_LEN(outLen);
-    pOut->packet_num = 0;
-    do {
-        if (outLen > HID_SIO_PACKET_DATA_SZ) {
-            oneTx = HID_SIO_PACKET_DATA_SZ;
-        }
-        else {
-            oneTx = outLen;
-        }
-
-        pOut->packet_len = oneTx + HID_SIO_PACKET_HEADER_SZ;
-
-        Log("SIO_SendRequest: transId=%d, packet_num=%d, packet_len=%d, transfer_len=%d\n", pOut->transId, pOut->packet_num, pOut->packet_len, pOut->transfer_len);
-
-        memset(&pOut->data[0], 0, HID_SIO_PACKET_DATA_SZ);
-        memcpy(&pOut->data[0], outData, oneTx);
+}
 
-        /* the +1 is for HID_REPORT_DATA_OFFSET */
-        res = hid_write(dev->hidDev, &dev->outPacket[0], HID_SIO_PACKET_SZ + 1);
+/* Add a record to the trace of the device. Any thread may call it with or without sioMutex:
+   the record is reserved with an atomic increment and its seq is stored last, so a
+   reader can tell a complete record from one being overwritten. */
+static void SIO_Trace(LPCUSBSIO_Ctrl_t *dev, uint8_t event, uint8_t req, uint8_t transId, uint8_t port,
+                      uint32_t len, uint32_t aux, int32_t result)
+{
+    LPCUSBSIO_TRACE_REC_T *rec;
+    uint32_t seq;
 
-        outLen -= oneTx;
-        outData += oneTx;
-        pOut->packet_num++;
+    if (SIO_AtomicLoad(&dev->traceOn) == 0) {
+        return;
+    }
+    seq = SIO_AtomicAdd(&dev->traceHead, 1);
+    rec = &dev->trace[(seq - 1) & dev->traceMask];
+    SIO_AtomicStore(&rec->seq, 0);
+    /* a reader must not see the new fields with the old seq */
+    SIO_FenceRelease();
+    rec->timeUs = SIO_GetTickUs();
+    rec->thread = SIO_ThreadId();
+    rec->event = event;
+    rec->req = req;
+    rec->transId = transId;
+    rec->port = port;
+    rec->len = len;
+    rec->aux = aux;
+    rec->result = result;
+    SIO_AtomicStore(&rec->seq, seq);
+}
 
-        Log("SIO_SendRequest: result=%d, outLen remaining=%d\n", res, outLen);
+/* Value of an environment variable, NULL if it is not set */
+static const char *SIO_GetEnv(const char *name, char *buff, uint32_t size)
+{
+#ifdef _WIN32
+    DWORD len = GetEnvironmentVariableA(name, buff, size);
 
-    } while ((res > 0) && ((outLen > 0)));
+    return ((len > 0) && (len < size)) ? buff : NULL;
+#else
+    const char *value = getenv(name);
 
-    /* Start Read */
-    if (inLen != NULL) {
-        *inLen = 0;
+    if ((value == NULL) || (strlen(value) >= size)) {
+        return NULL;
     }
-    read_pending = 1;
-    while ((res> 0) && (read_pending)) {
-        res = hid_read_timeout(dev->hidDev, &dev->inPacket[0], HID_SIO_PACKET_SZ + 1, LPCUSBSIO_READ_TMO);
+    strcpy(buff, value);
+    return buff;
+#endif
+}
 
-        Log("SIO_SendRequest: hid_read_timeout result=%d\n", res);
+static void SIO_InitGlobals(void)
+{
+    SIO_MutexInit(&g_Ctrl.devInfoMutex);
+    SIO_MutexInit(&g_Ctrl.sharedMutex);
+    SIO_CondInit(&g_Ctrl.sharedCond);
+    SIO_MutexInit(&g_Ctrl.capsMutex);
+    SIO_MutexInit(&g_Ctrl.capsSaveMutex);
+    SIO_MutexInit(&g_Ctrl.groupMutex);
+}
 
-        if (res > 0) {
-            /* check reponse received from LPC */
-            pIn = (HID_SIO_IN_REPORT_T *)&dev->inPacket[0];
+/* Initialize the global mutexes if it has not been done yet */
+static void SIO_Globals(void)
+{
+    SIO_Once(&g_globalsInit, SIO_InitGlobals);
+}
 
-            Log("SIO_SendRequest: input packet: resp=%d, transId=%d, packet_len=%d, packet_num=%d, transfer_len=%d\n", pIn->resp, pIn->transId, pIn->packet_len, pIn->packet_num, pIn->transfer_len);
+static void SIO_HidSelectOnce(void)
+{
+    char env[256];
 
-            if (pIn->transId != pOut->transId) {
-                /* May be previous response discard it. */
-                Log("SIO_SendRequest: pIn->transId != pOut->transId (%d != %d), discard\n", pIn->transId, pOut->transId);
-                continue;
-            }
-            else {
-                if (pIn->resp == HID_SIO_RES_OK) {
-                    if (inLen != NULL) {
-                        memcpy(inData, &pIn->data[0], pIn->packet_len - HID_SIO_PACKET_HEADER_SZ);
-                        inData += pIn->packet_len - HID_SIO_PACKET_HEADER_SZ;
-                        *inLen += pIn->packet_len - HID_SIO_PACKET_HEADER_SZ;
-                    }
-                    if ((pIn->packet_num * HID_SIO_PACKET_SZ + pIn->packet_len) == pIn->transfer_len) {
-                        Log("SIO_SendRequest: finished\n");
-                        read_pending = 0;
-                        res = LPCUSBSIO_OK;
-                    }
-                    else {
-                        Log("SIO_SendRequest: not finished\n");
-                    }
-                }
-                else {
-                    /* update status */
-                    res = ConvertResp(pIn->resp);
-                    Log("SIO_SendRequest: ConvertResp res=%d\n", res);
-                    read_pending = 0;
-                }
-            }
+    SIO_Globals();
+    if ((SIO_GetEnv("LPCUSBSIO_BACKEND", &env[0], sizeof(env)) != NULL) && (strcmp(env, "mock") == 0)) {
+        if ((SIO_GetEnv("LPCUSBSIO_MOCK", &env[0], sizeof(env)) == NULL) || (mock_hid_configure(env) == 0)) {
+            g_hid = &g_hidMock;
         }
-        else if (res == 0) {
-            Log("SIO_SendRequest: wait timeout!\n");
-            res = LPCUSBSIO_ERR_TIMEOUT;
-            read_pending = 0;
-        }
-    }
-#ifdef _WIN32
-    if (!ReleaseMutex(dev->sioMutex)) {
-        res = LPCUSBSIO_ERR_SYNCHRONIZATION;
     }
-#else
-    if (pthread_mutex_unlock(&dev->sioMutex) != 0) {
-        res = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    /* the capability cache is read before the first device is opened */
+    if (SIO_GetEnv("LPCUSBSIO_CAPS_CACHE", &env[0], sizeof(env)) != NULL) {
+        SIO_CapsSetup(1, env);
     }
-#endif
-    Log("SIO_SendRequest: returning %d\n", res);
-    return g_lastError = res;
 }
 
-static int32_t GPIO_SendCmd(LPC_HANDLE hUsbSio, uint8_t port, uint32_t cmd, uint32_t setPins, uint32_t clrPins, uint32_t* status)
+/* Select the backend named by the LPCUSBSIO_BACKEND environment variable the first time a
+   backend is needed, "mock" gets the emulated bridges configured by LPCUSBSIO_MOCK.
+   LPCUSBSIO_CAPS_CACHE names the file of the capability cache. Callers which come while
+   another thread reads the environment sleep until it is done. */
+static void SIO_HidSelect(void)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
-    int32_t res;
-    uint8_t *outData;
-    uint8_t *inData;
-    uint32_t inLen;
+    SIO_Once(&g_hidSelected, SIO_HidSelectOnce);
+}
 
-    if (validHandle(hUsbSio) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+/* Allocate the trace ring of the device if needed and start recording */
+static int32_t SIO_TraceStart(LPCUSBSIO_Ctrl_t *dev, uint32_t numRecords)
+{
+    uint32_t size = SIO_TRACE_MIN_RECS;
+
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return LPCUSBSIO_ERR_SYNCHRONIZATION;
     }
-    /* construct req packet */
-    outData = (uint8_t *)malloc(8);
-    inData = (uint8_t *)malloc(4);
-    if ((outData != NULL) && (inData != NULL)) {
-        memcpy(outData, &setPins, sizeof(uint32_t));
-        memcpy(outData + 4, &clrPins, sizeof(uint32_t));
-
-        res = SIO_SendRequest(dev, port, cmd, outData, 8, inData, &inLen);
-        if (res == LPCUSBSIO_OK) {
-            /* parse response */
-            res = inLen;
-            if (res != 0) {
-                /* copy data back to user buffer */
-                *status = *((uint32_t*)inData);
-            }
+    if (dev->trace == NULL) {
+        while ((size < numRecords) && (size < SIO_TRACE_MAX_RECS)) {
+            size <<= 1;
         }
-        free(outData);
-        free(inData);
-    }
-    else {
-        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
-        res = LPCUSBSIO_ERR_MEM_ALLOC;
+        dev->trace = calloc(size, sizeof(LPCUSBSIO_TRACE_REC_T));
+        if (dev->trace == NULL) {
+            SIO_MutexUnlock(&dev->sioMutex);
+            return LPCUSBSIO_ERR_MEM_ALLOC;
+        }
+        dev->traceMask = size - 1;
     }
-    return res;
+    /* the ring is set up before the writers can see traceOn */
+    SIO_AtomicStore(&dev->traceOn, 1);
+    SIO_MutexUnlock(&dev->sioMutex);
+    return LPCUSBSIO_OK;
 }
 
-void free_hid_dev(struct hid_device_info *dev)
+/* Copy the complete records among the latest maxRecs ones of the trace, the oldest one first.
+   Returns the number of records copied. */
+static uint32_t SIO_TraceCopy(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_TRACE_REC_T *pRecs, uint32_t maxRecs, uint32_t *pLost)
 {
-    dev->next = NULL;
-    hid_free_enumeration(dev);
+    LPCUSBSIO_TRACE_REC_T *ring;
+    uint32_t head, mask, seq, first, n = 0;
+
+    /* the ring of a device never changes once allocated */
+    SIO_MutexLock(&dev->sioMutex);
+    ring = dev->trace;
+    mask = dev->traceMask;
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    head = SIO_AtomicLoad(&dev->traceHead);
+    first = (head > mask) ? (head - mask - 1) : 0;
+    *pLost = first;
+    if ((ring == NULL) || (maxRecs == 0)) {
+        return 0;
+    }
+    if ((head - first) > maxRecs) {
+        first = head - maxRecs;
+    }
+    for (seq = first + 1; seq != head + 1; seq++) {
+        /* skip the records a writer overwrites while they are copied */
+        if (SIO_AtomicLoad(&ring[(seq - 1) & mask].seq) != seq) {
+            continue;
+        }
+        pRecs[n] = ring[(seq - 1) & mask];
+        /* the copy is complete before the seq is checked again */
+        SIO_FenceAcquire();
+        if (SIO_AtomicLoad(&ring[(seq - 1) & mask].seq) == seq) {
+            n++;
+        }
+    }
+    return n;
 }
 
-/*****************************************************************************
- * Public functions
- ****************************************************************************/
+/* Append the trace of the device to a file, see LPCUSBSIO_DumpTrace() */
+static int32_t SIO_TraceDump(LPCUSBSIO_Ctrl_t *dev, const char *path)
+{
+    LPCUSBSIO_TRACE_REC_T *pRecs;
+    uint32_t hdr[4];
+    uint32_t n;
+    FILE *f;
+
+    pRecs = malloc((dev->traceMask + 1) * sizeof(LPCUSBSIO_TRACE_REC_T));
+    if (pRecs == NULL) {
+        return LPCUSBSIO_ERR_MEM_ALLOC;
+    }
+    n = SIO_TraceCopy(dev, pRecs, dev->traceMask + 1, &hdr[2]);
+    hdr[0] = sizeof(LPCUSBSIO_TRACE_REC_T);
+    hdr[1] = n;
+    hdr[3] = dev->fwVersion;
 
-LPCUSBSIO_API int32_t LPCUSBSIO_GetNumPorts(uint32_t vid, uint32_t pid)
+#ifdef _WIN32
+    if (fopen_s(&f, path, "ab") != 0) {
+        f = NULL;
+    }
+#else
+    f = fopen(path, "ab");
+#endif
+    if (f == NULL) {
+        free(pRecs);
+        return LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    if ((fwrite("SIOTRACE", 8, 1, f) != 1) || (fwrite(&hdr[0], sizeof(hdr), 1, f) != 1) ||
+        ((n > 0) && (fwrite(pRecs, sizeof(LPCUSBSIO_TRACE_REC_T), n, f) != n))) {
+        n = (uint32_t)LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    fclose(f);
+    free(pRecs);
+    return (int32_t)n;
+}
+
+/* Add the samples of a local histogram to the statistics */
+static void SIO_HistMerge(LPCUSBSIO_HISTOGRAM_T *hist, const LPCUSBSIO_HISTOGRAM_T *add)
+{
+    uint32_t i;
+
+    for (i = 0; i < LPCUSBSIO_STATS_BUCKETS; i++) {
+        hist->count[i] += add->count[i];
+    }
+    hist->totalUs += add->totalUs;
+    if (add->maxUs > hist->maxUs) {
+        hist->maxUs = add->maxUs;
+    }
+}
+
+/* Take a reference to the current enumeration, may return NULL */
+static LPCUSBSIO_DevList_t *SIO_AcquireDevList(void)
+{
+    LPCUSBSIO_DevList_t *list;
+
+    /* the mutex only covers loading the pointer and taking the reference */
+    SIO_Globals();
+    SIO_MutexLock(&g_Ctrl.devInfoMutex);
+    list = g_Ctrl.devInfoList;
+    if (list != NULL) {
+        SIO_AtomicAdd(&list->refs, 1);
+    }
+    SIO_MutexUnlock(&g_Ctrl.devInfoMutex);
+
+    return list;
+}
+
+/* Replace the current enumeration, returns the previous one whose reference passes to the caller */
+static LPCUSBSIO_DevList_t *SIO_SwapDevList(LPCUSBSIO_DevList_t *list)
+{
+    LPCUSBSIO_DevList_t *old;
+
+    SIO_Globals();
+    SIO_MutexLock(&g_Ctrl.devInfoMutex);
+    old = g_Ctrl.devInfoList;
+    g_Ctrl.devInfoList = list;
+    SIO_MutexUnlock(&g_Ctrl.devInfoMutex);
+
+    return old;
+}
+
+static void SIO_ReleaseDevList(LPCUSBSIO_DevList_t *list)
+{
+    if ((list != NULL) && (SIO_AtomicAdd(&list->refs, -1) == 0)) {
+        list->hid->free_enumeration(list->info);
+        free(list->byIndex);
+        free(list);
+    }
+}
+
+static struct hid_device_info *GetDevAtIndex(LPCUSBSIO_DevList_t *list, uint32_t index)
+{
+    return ((list != NULL) && (index < list->count)) ? list->byIndex[index] : NULL;
+}
+
+/* FNV-1a of a serial number or of a path */
+static uint32_t SIO_HashKey(const wchar_t *serial, const char *path)
+{
+    uint32_t hash = 2166136261u;
+
+    if (serial != NULL) {
+        while (*serial != 0) {
+            hash = (hash ^ (uint32_t)*serial++) * 16777619u;
+        }
+    }
+    else {
+        while (*path != 0) {
+            hash = (hash ^ (uint8_t)*path++) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+/* Find the bucket of a serial number or of a path, either the free one ending its chain or the
+   one holding the first device with that key */
+static uint32_t *SIO_DevListBucket(LPCUSBSIO_DevList_t *list, const wchar_t *serial, const char *path)
 {
+    uint32_t *table = (serial != NULL) ? list->bySerial : list->byPath;
     struct hid_device_info *cur_dev;
-    struct hid_device_info *temp_dev;
-    struct hid_device_info *prev_dev = NULL;
-    int32_t count = 0;
+    uint32_t i = SIO_HashKey(serial, path);
 
-    Log("LPCUSBSIO_GetNumPorts(vid=0x%x, pid=0x%x)\n", vid, pid);
+    /* the tables are at least twice the size of the list, a free bucket always ends the chain */
+    for (;; i++) {
+        if (table[i & list->hashMask] == 0) {
+            break;
+        }
+        cur_dev = list->byIndex[table[i & list->hashMask] - 1];
+        if ((serial != NULL) ? ((cur_dev->serial_number != NULL) && (wcscmp(cur_dev->serial_number, serial) == 0))
+                             : ((cur_dev->path != NULL) && (strcmp(cur_dev->path, path) == 0))) {
+            break;
+        }
+    }
+    return &table[i & list->hashMask];
+}
+
+/* Index the filtered enumeration by position, serial number and path */
+static int32_t SIO_IndexDevList(LPCUSBSIO_DevList_t *list)
+{
+    struct hid_device_info *cur_dev;
+    uint32_t *bucket;
+    uint32_t size = 4;
+    uint32_t i;
 
-    /* free any HID device structures if we were called previously */
-    if (g_Ctrl.devInfoList != NULL) {
-        hid_free_enumeration(g_Ctrl.devInfoList);
-        g_Ctrl.devInfoList = NULL;
+    while (size < (2 * list->count)) {
+        size <<= 1;
+    }
+    list->byIndex = (struct hid_device_info **)malloc((list->count * sizeof(struct hid_device_info *)) +
+                                                      (2 * size * sizeof(uint32_t)));
+    if (list->byIndex == NULL) {
+        return LPCUSBSIO_ERR_MEM_ALLOC;
+    }
+    list->bySerial = (uint32_t *)(list->byIndex + list->count);
+    list->byPath = list->bySerial + size;
+    list->hashMask = size - 1;
+    memset(list->bySerial, 0, 2 * size * sizeof(uint32_t));
+
+    for (i = 0, cur_dev = list->info; i < list->count; i++, cur_dev = cur_dev->next) {
+        list->byIndex[i] = cur_dev;
+        /* a key seen twice resolves to the first device carrying it */
+        if ((cur_dev->serial_number != NULL) && (cur_dev->serial_number[0] != 0)) {
+            bucket = SIO_DevListBucket(list, cur_dev->serial_number, NULL);
+            if (*bucket == 0) {
+                *bucket = i + 1;
+            }
+        }
+        if (cur_dev->path != NULL) {
+            bucket = SIO_DevListBucket(list, NULL, cur_dev->path);
+            if (*bucket == 0) {
+                *bucket = i + 1;
+            }
+        }
     }
+    return LPCUSBSIO_OK;
+}
 
-    cur_dev = g_Ctrl.devInfoList = hid_enumerate(vid, pid);
+/* Index of the device with the given serial number or path in a list, -1 if none */
+static int32_t SIO_FindDev(LPCUSBSIO_DevList_t *list, const wchar_t *serial, const char *path)
+{
+    if ((list == NULL) || ((serial == NULL) && (path == NULL))) {
+        return -1;
+    }
+    return (int32_t)*SIO_DevListBucket(list, serial, path) - 1;
+}
 
-    Log("hid_enumerate returns %p\n", cur_dev);
+/* Build the handle of a device or of one of its ports */
+static LPC_HANDLE SIO_MakeHandle(LPCUSBSIO_Ctrl_t *dev, uint32_t kind, uint32_t port)
+{
+    return (LPC_HANDLE)(uintptr_t)(((dev->seq & 0xFFFFu) << 16) | (kind << 12) | (port << 8) | dev->slot);
+}
 
-    while (cur_dev)
-    {
-#if SIO_DEBUG
-        char ps[512];
-        wcstombs(ps, cur_dev->product_string, sizeof(ps)-1);
-        Log("    #if=%d product_string=%s ...", cur_dev->interface_number, ps);
-#endif
+/* Build the handle of a request descriptor or GPIO subscription of dev */
+static LPC_HANDLE SIO_EntryHandle(const LPCUSBSIO_Ctrl_t *dev, uint32_t kind, uint32_t index, uint32_t gen)
+{
+    return (LPC_HANDLE)(uintptr_t)(((gen & 0xFF0u) << 20) | (index << 16) | (kind << 12) | ((gen & 0xFu) << 8) |
+                                   dev->slot);
+}
 
-        /* iterate through the list and remove non-SIO devices */
-#ifdef __MACH__
-        /* usage_page only usable on Win/Mac */
-        if (cur_dev->usage_page != (0xFF00| HID_USAGE_PAGE_SERIAL_IO))
-        {
-#else
-        /* interface name used instead of usage_page indication */
-        if (wcsncmp(cur_dev->product_string, L"LPCSIO", 6) != 0 && wcsncmp(cur_dev->product_string, L"MCUSIO", 6) != 0)
-        {
-#endif
-            temp_dev = cur_dev->next;
-            /* Update head pointer if the head is removed */
-            if (g_Ctrl.devInfoList == cur_dev) {
-                g_Ctrl.devInfoList = temp_dev;
+static LPC_HANDLE SIO_ReqHandle(const LPCUSBSIO_Request_t *pReq)
+{
+    return SIO_EntryHandle(pReq->dev, SIO_HANDLE_REQ, (uint32_t)(pReq - &pReq->dev->reqPool[0]), pReq->gen);
+}
+
+/* Handle of subscription index of dev, called with sioMutex held */
+static LPC_HANDLE SIO_SubHandle(const LPCUSBSIO_Ctrl_t *dev, uint32_t index)
+{
+    return SIO_EntryHandle(dev, SIO_HANDLE_GPIO_SUB, index, dev->gpioSubs[index].gen);
+}
+
+/* Generation of a table entry of dev reused count times, see SIO_EntryHandle() */
+static uint32_t SIO_EntryGen(const LPCUSBSIO_Ctrl_t *dev, uint8_t count)
+{
+    return (((dev->seq >> 2) & 0xFu) << 8) | count;
+}
+
+/* Resolve a handle of the given kind to its device, NULL if it does not refer to an open device */
+static LPCUSBSIO_Ctrl_t *SIO_LookupHandle(LPC_HANDLE handle, uint32_t kind)
+{
+    uint32_t h = (uint32_t)(uintptr_t)handle;
+    LPCUSBSIO_Slot_t *slot;
+
+    if (((uintptr_t)h != (uintptr_t)handle) || (SIO_HANDLE_KIND(h) != kind) || (SIO_HANDLE_SLOT(h) >= SIO_MAX_DEVICES)) {
+        return NULL;
+    }
+    slot = &g_Ctrl.devSlots[SIO_HANDLE_SLOT(h)];
+    /* handles carry the sequence number of an open slot, any later state change fails the check */
+    if ((SIO_AtomicLoad(&slot->seq) & 0xFFFFu) != SIO_HANDLE_SEQ(h)) {
+        return NULL;
+    }
+    return slot->dev;
+}
+
+/* Resolve a request or GPIO subscription handle to its device, NULL unless the index is
+   below count and the slot is open since the handle was returned. The entry itself is
+   checked under sioMutex of the device, against the generation of the handle. */
+static LPCUSBSIO_Ctrl_t *SIO_LookupEntry(LPC_HANDLE handle, uint32_t kind, uint32_t count)
+{
+    uint32_t h = (uint32_t)(uintptr_t)handle;
+    LPCUSBSIO_Slot_t *slot;
+    uint32_t seq;
+
+    if (((uintptr_t)h != (uintptr_t)handle) || (SIO_HANDLE_KIND(h) != kind) || (SIO_HANDLE_SLOT(h) >= SIO_MAX_DEVICES) ||
+        (SIO_HANDLE_INDEX(h) >= count)) {
+        return NULL;
+    }
+    slot = &g_Ctrl.devSlots[SIO_HANDLE_SLOT(h)];
+    seq = SIO_AtomicLoad(&slot->seq);
+    if (((seq & 3) != SIO_SLOT_OPEN) || (((seq >> 2) & 0xFu) != SIO_HANDLE_OPENS(h))) {
+        return NULL;
+    }
+    return slot->dev;
+}
+
+static LPCUSBSIO_Ctrl_t *SIO_GetDevice(LPC_HANDLE hUsbSio)
+{
+    return SIO_LookupHandle(hUsbSio, SIO_HANDLE_DEV);
+}
+
+/* Resolve an I2C or SPI port handle, NULL unless the port is open */
+static LPCUSBSIO_PortCtrl_t *SIO_GetPort(LPC_HANDLE hPort, uint32_t kind)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_LookupHandle(hPort, kind);
+    LPCUSBSIO_PortCtrl_t *port;
+    uint32_t portNum = SIO_HANDLE_PORT((uint32_t)(uintptr_t)hPort);
+
+    if (dev == NULL) {
+        return NULL;
+    }
+    if (kind == SIO_HANDLE_I2C) {
+        port = (portNum < MAX_I2C_PORTS) ? &dev->i2cPorts[portNum] : NULL;
+    }
+    else {
+        port = (portNum < MAX_SPI_PORTS) ? &dev->spiPorts[portNum] : NULL;
+    }
+    return ((port != NULL) && (port->hUsbSio == dev)) ? port : NULL;
+}
+
+/* Create the device structure of a slot and its synchronization objects */
+static LPCUSBSIO_Ctrl_t *SIO_CreateDevice(uint32_t slot)
+{
+    LPCUSBSIO_Ctrl_t *dev = malloc(sizeof(LPCUSBSIO_Ctrl_t));
+    uint32_t i;
+
+    if (dev == NULL) {
+        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+        return NULL;
+    }
+    memset(dev, 0, sizeof(LPCUSBSIO_Ctrl_t));
+    dev->slot = slot;
+    for (i = 0; i < SIO_NUM_QUEUES; i++) {
+        if (SIO_MutexInit(&dev->queueMutex[i]) != 0) {
+            break;
+        }
+    }
+    if ((i == SIO_NUM_QUEUES) && (SIO_MutexInit(&dev->sioMutex) == 0)) {
+        if ((SIO_CondInit(&dev->rxCond) == 0) && (SIO_CondInit(&dev->eventCond) == 0)) {
+            return dev;
+        }
+        SIO_MutexDestroy(&dev->sioMutex);
+    }
+    while (i > 0) {
+        SIO_MutexDestroy(&dev->queueMutex[--i]);
+    }
+    g_lastError = LPCUSBSIO_ERR_MUTEX_CREATE;
+    free(dev);
+    return NULL;
+}
+
+/* Claim a free slot of the device table and return its cleared device structure. The
+   handles of the device become valid once SIO_PublishSlot() is called. */
+static LPCUSBSIO_Ctrl_t *SIO_ClaimSlot(void)
+{
+    LPCUSBSIO_Slot_t *slot;
+    LPCUSBSIO_Ctrl_t *dev;
+    uint32_t i, n, seq;
+
+    i = SIO_AtomicLoad(&g_Ctrl.nextSlot);
+    for (n = 0; n < SIO_MAX_DEVICES; n++, i++) {
+        i %= SIO_MAX_DEVICES;
+        slot = &g_Ctrl.devSlots[i];
+        seq = SIO_AtomicLoad(&slot->seq);
+        if (((seq & 3) == SIO_SLOT_FREE) && SIO_AtomicCas(&slot->seq, seq, seq + 1)) {
+            break;
+        }
+    }
+    if (n == SIO_MAX_DEVICES) {
+        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+        return NULL;
+    }
+    SIO_AtomicStore(&g_Ctrl.nextSlot, i + 1);
+
+    if (slot->dev == NULL) {
+        slot->dev = SIO_CreateDevice(i);
+        if (slot->dev == NULL) {
+            SIO_AtomicStore(&slot->seq, seq + 4);
+            return NULL;
+        }
+    }
+    dev = slot->dev;
+    /* a stale request or subscription handle may be checked against the tables meanwhile */
+    SIO_MutexLock(&dev->sioMutex);
+    memset(&dev->hidDev, 0, sizeof(LPCUSBSIO_Ctrl_t) - offsetof(LPCUSBSIO_Ctrl_t, hidDev));
+    dev->seq = seq + 2;
+    SIO_MutexUnlock(&dev->sioMutex);
+    SIO_AtomicAdd(&g_Ctrl.numDevices, 1);
+
+    return dev;
+}
+
+/* Make the handles of a claimed slot valid */
+static void SIO_PublishSlot(LPCUSBSIO_Ctrl_t *dev)
+{
+    SIO_AtomicStore(&g_Ctrl.devSlots[dev->slot].seq, dev->seq);
+}
+
+/* Give the slot of a device back, the handles of the device must be invalid already */
+static void freeDevice(LPCUSBSIO_Ctrl_t *dev)
+{
+    LPCUSBSIO_DevList_t *list;
+
+    SIO_AtomicStore(&g_Ctrl.devSlots[dev->slot].seq, (dev->seq & ~3u) + 4);
+
+    /* unload HID library if all devices are closed. */
+    if (SIO_AtomicAdd(&g_Ctrl.numDevices, -1) == 0) {
+        list = SIO_SwapDevList(NULL);
+        SIO_ReleaseDevList(list);
+        SIO_SharedStopAll();
+
+        // potential place to unload HID library
+        LibCleanup();
+    }
+}
+
+static const wchar_t *GetErrorString(int32_t err)
+{
+    const wchar_t *retStr = g_LibErrMsgs[0];
+    int index = abs(err);
+
+    if (index < 0x10) {
+        retStr = (index < NUM_LIB_ERR_STRINGS) ? g_LibErrMsgs[index] : g_LibErrMsgs[0];
+    }
+    else if (index < 0x20) {
+        index -= 0x10;
+        retStr = (index < NUM_FW_ERR_STRINGS) ? g_fwErrMsgs[index] : g_fwErrMsgs[0];
+    }
+    else if (index < 0x30) {
+        index -= 0x20;
+        retStr = (index < NUM_BRIDGE_ERR_STRINGS) ? g_BridgeErrMsgs[index] : g_BridgeErrMsgs[NUM_BRIDGE_ERR_STRINGS];
+    }
+
+    return retStr;
+}
+
+static int32_t ConvertResp(int32_t res)
+{
+    int ret;
+
+    if (res == HID_SIO_RES_OK) {
+        ret = LPCUSBSIO_OK;
+    }
+    else {
+        ret = -(res + 0x10);
+    }
+    return ret;
+}
+
+/* Derive the API result of a completed transaction, called with sioMutex held */
+static void SIO_FinishRequest(LPCUSBSIO_Request_t *pReq)
+{
+    int32_t res = pReq->status;
+    uint32_t value;
+
+    if (res == LPCUSBSIO_OK) {
+        switch (pReq->resKind) {
+        case SIO_RES_IN_LEN:
+            res = pReq->inLen;
+            break;
+        case SIO_RES_OUT_LEN:
+            res = pReq->outLen;
+            break;
+        case SIO_RES_XFER_LEN:
+            /* no response data means Tx only transfer, report transferred size */
+            res = (pReq->inLen != 0) ? pReq->inLen : pReq->outLen;
+            break;
+        case SIO_RES_GPIO:
+            res = pReq->inLen;
+            if ((res != 0) && (pReq->pStatus != NULL)) {
+                memcpy(pReq->pStatus, &pReq->gpioData[0], sizeof(uint32_t));
             }
-            /*If previously valid device found then point it to next node */
-            if (prev_dev != NULL) {
-                prev_dev->next = temp_dev;
+            break;
+        case SIO_RES_GPIO_PIN:
+            res = pReq->inLen;
+            if (res > 0) {
+                memcpy(&value, &pReq->gpioData[0], sizeof(uint32_t));
+                res = (value & (1 << pReq->pin)) ? 1 : 0;
             }
-            free_hid_dev(cur_dev);
-            cur_dev = temp_dev;
-            Log("skipping\n");
-            continue;
+            break;
+        default:
+            break;
         }
-        Log("using as device %d\n", count);
-        count++;
-        prev_dev = cur_dev;
-        cur_dev = cur_dev->next;
     }
+    pReq->result = res;
+}
 
-    Log("LPCUSBSIO_GetNumPorts returns %d\n", count);
+/* Keep the GPIO shadow registers in step with a completed transaction, called with sioMutex held */
+static void SIO_GpioShadowLocked(LPCUSBSIO_Ctrl_t *dev, const LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_GpioShadow_t *s = (pReq->sesId < SIO_MAX_GPIO_PORTS) ? &dev->gpioShadow[pReq->sesId] : NULL;
+    uint32_t value, port, pin;
+
+    switch (pReq->req) {
+    case HID_I2C_REQ_INIT_PORT:
+    case HID_SPI_REQ_INIT_PORT:
+        /* the firmware configures the pins of the port */
+        memset(&dev->gpioShadow[0], 0, sizeof(dev->gpioShadow));
+        return;
+    case HID_SPI_REQ_DEVICE_XFER:
+        /* the firmware drives the select pin of the device */
+        port = HID_SPI_DEVICE_TO_PORT(pReq->args[0]);
+        pin = HID_SPI_DEVICE_TO_PIN(pReq->args[0]);
+        if (port < SIO_MAX_GPIO_PORTS) {
+            dev->gpioShadow[port].dirKnown &= ~(1UL << pin);
+            dev->gpioShadow[port].outKnown &= ~(1UL << pin);
+        }
+        return;
+    case HID_GPIO_REQ_PORT_VALUE:
+    case HID_GPIO_REQ_PORT_DIR:
+    case HID_GPIO_REQ_TOGGLE_PIN:
+    case HID_GPIO_REQ_IOCONFIG:
+        break;
+    default:
+        return;
+    }
+    if (s == NULL) {
+        return;
+    }
+    if (pReq->status != LPCUSBSIO_OK) {
+        /* the request may or may not have been applied */
+        memset(s, 0, sizeof(LPCUSBSIO_GpioShadow_t));
+        return;
+    }
 
-    return count;
+    switch (pReq->req) {
+    case HID_GPIO_REQ_PORT_VALUE:
+        s->out = (s->out | pReq->args[0]) & ~pReq->args[1];
+        s->outKnown |= pReq->args[0] | pReq->args[1];
+        break;
+    case HID_GPIO_REQ_PORT_DIR:
+        /* the response holds the whole direction register */
+        if (pReq->inLen >= sizeof(uint32_t)) {
+            memcpy(&value, &pReq->gpioData[0], sizeof(uint32_t));
+            s->dir = value;
+            s->dirKnown = 0xFFFFFFFFUL;
+        }
+        break;
+    case HID_GPIO_REQ_TOGGLE_PIN:
+        s->out ^= (1UL << (pReq->pin & 0x1F));
+        break;
+    default:
+        pin = pReq->pin & 0x1F;
+        s->mode[pin] = pReq->args[0];
+        s->modeKnown |= (1UL << pin);
+        break;
+    }
 }
 
-LPCUSBSIO_API int32_t LPCUSBSIO_GetDeviceInfo(uint32_t index, HIDAPI_DEVICE_INFO_T* pInfo)
+/* I2C or SPI port a request is addressed to, NULL for GPIO and device requests */
+static LPCUSBSIO_PortCtrl_t *SIO_ReqPort(LPCUSBSIO_Ctrl_t *dev, uint8_t req, uint8_t portNum)
 {
-    struct hid_device_info* dev = GetDevAtIndex(index);
+    if (req <= HID_I2C_REQ_MAX) {
+        return &dev->i2cPorts[portNum % MAX_I2C_PORTS];
+    }
+    if (req <= HID_SPI_REQ_MAX) {
+        return &dev->spiPorts[portNum % MAX_SPI_PORTS];
+    }
+    return NULL;
+}
 
-    if (dev)
-    {
-        memset(pInfo, 0, sizeof(*pInfo));
-        pInfo->path = dev->path;
-        pInfo->vendor_id = dev->vendor_id;
-        pInfo->product_id = dev->product_id;
-        pInfo->serial_number = dev->serial_number;
+/* Count a completed transaction in the statistics of a device or port */
+static void SIO_StatsComplete(LPCUSBSIO_STATS_T *stats, const LPCUSBSIO_Request_t *pReq, int32_t status, uint64_t us)
+{
+    stats->transactions++;
+    stats->bytesOut += pReq->txLen;
+    stats->bytesIn += pReq->inLen;
+    if (status != LPCUSBSIO_OK) {
+        stats->errors++;
+        if (status == LPCUSBSIO_ERR_TIMEOUT) {
+            stats->timeouts++;
+        }
+    }
+    SIO_HistAdd(&stats->request, us);
+}
+
+/* Finish a transaction and remove it from the in-flight table, called with sioMutex held */
+static void SIO_CompleteRequest(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_Request_t *pReq, int32_t status)
+{
+    LPCUSBSIO_PortCtrl_t *port;
+    uint64_t us;
+
+    if (pReq->state == SIO_REQ_PENDING) {
+        dev->pending[pReq->transId] = NULL;
+        dev->numPending--;
+        dev->queuePending[pReq->queue]--;
+
+        us = SIO_GetTickUs() - pReq->startUs;
+        SIO_StatsComplete(&dev->stats, pReq, status, us);
+        port = SIO_ReqPort(dev, pReq->req, pReq->sesId);
+        if (port != NULL) {
+            SIO_StatsComplete(&port->stats, pReq, status, us);
+        }
+        SIO_Trace(dev, LPCUSBSIO_TRACE_COMPLETE, pReq->req, pReq->transId, pReq->sesId, pReq->inLen,
+                  (us > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t)us, status);
+    }
+    pReq->status = status;
+    SIO_FinishRequest(pReq);
+    pReq->state = SIO_REQ_DONE;
+    if (status != LPCUSBSIO_OK) {
+        dev->lastError = status;
+    }
+    if (dev->gpioCache) {
+        SIO_GpioShadowLocked(dev, pReq);
+    }
+
+    if (pReq->callback != NULL) {
+        /* callbacks are run later by SIO_RunCallbacksLocked without sioMutex held */
+        pReq->cbState = SIO_CB_QUEUED;
+        pReq->cbNext = NULL;
+        if (dev->cbTail != NULL) {
+            dev->cbTail->cbNext = pReq;
+        }
+        else {
+            dev->cbHead = pReq;
+        }
+        dev->cbTail = pReq;
+    }
+}
+
+/* Remove an asynchronous request from the device and release it, called with sioMutex held */
+static void SIO_FreeRequest(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_Request_t *prev = NULL;
+    LPCUSBSIO_Request_t *cur = dev->cbHead;
+
+    if (pReq->state == SIO_REQ_PENDING) {
+        /* cancel, a late response is discarded like that of a timed out transaction */
+        dev->pending[pReq->transId] = NULL;
+        dev->numPending--;
+        dev->queuePending[pReq->queue]--;
+        SIO_CondBroadcast(&dev->rxCond);
+    }
+    if (pReq->cbState == SIO_CB_QUEUED) {
+        /* drop the callback which has not run yet */
+        while ((cur != NULL) && (cur != pReq)) {
+            prev = cur;
+            cur = cur->cbNext;
+        }
+        if (cur != NULL) {
+            if (prev != NULL) {
+                prev->cbNext = cur->cbNext;
+            }
+            else {
+                dev->cbHead = cur->cbNext;
+            }
+            if (dev->cbTail == cur) {
+                dev->cbTail = prev;
+            }
+        }
+    }
+
+    if (pReq->prev != NULL) {
+        pReq->prev->next = pReq->next;
+    }
+    else {
+        dev->asyncReqs = pReq->next;
+    }
+    if (pReq->next != NULL) {
+        pReq->next->prev = pReq->prev;
+    }
+    pReq->magic = 0;
+
+    /* return the descriptor to the pool, behind the ones released before */
+    pReq->next = NULL;
+    if (dev->reqFreeTail != NULL) {
+        dev->reqFreeTail->next = pReq;
+    }
+    else {
+        dev->reqFree = pReq;
+    }
+    dev->reqFreeTail = pReq;
+}
+
+/* Invoke the completion callbacks which became due, called with sioMutex held.
+ * The mutex is released while a callback runs so that it may use any library call.
+ */
+static void SIO_RunCallbacksLocked(LPCUSBSIO_Ctrl_t *dev)
+{
+    LPCUSBSIO_Request_t *pReq;
+    LPCUSBSIO_REQ_CALLBACK_T callback;
+    void *context;
+    int32_t result;
+
+    while ((dev->cbHead != NULL) && (g_cbHold == 0)) {
+        pReq = dev->cbHead;
+        dev->cbHead = pReq->cbNext;
+        if (dev->cbHead == NULL) {
+            dev->cbTail = NULL;
+        }
+        pReq->cbNext = NULL;
+        pReq->cbState = SIO_CB_RUNNING;
+        callback = pReq->callback;
+        context = pReq->context;
+        result = pReq->result;
+
+        SIO_MutexUnlock(&dev->sioMutex);
+        callback(SIO_ReqHandle(pReq), result, context);
+        SIO_MutexLock(&dev->sioMutex);
+
+        if (pReq->cbState == SIO_CB_FREE) {
+            /* LPCUSBSIO_ReqFree was called from within the callback */
+            SIO_FreeRequest(dev, pReq);
+        }
+        else {
+            pReq->cbState = SIO_CB_IDLE;
+        }
+    }
+}
+
+/* Fail all in-flight transactions of the device, called with sioMutex held */
+static void SIO_FailPending(LPCUSBSIO_Ctrl_t *dev, int32_t status)
+{
+    uint32_t i;
+
+    for (i = 0; (i < SIO_NUM_TRANS_IDS) && (dev->numPending > 0); i++) {
+        if (dev->pending[i] != NULL) {
+            SIO_CompleteRequest(dev, dev->pending[i], status);
+        }
+    }
+}
+
+/* Time out the in-flight transactions whose deadline has passed, called with sioMutex held */
+static void SIO_ExpirePending(LPCUSBSIO_Ctrl_t *dev, uint64_t now)
+{
+    uint32_t i, left = dev->numPending;
+
+    for (i = 0; (i < SIO_NUM_TRANS_IDS) && (left > 0); i++) {
+        if (dev->pending[i] != NULL) {
+            left--;
+            if (now >= dev->pending[i]->deadline) {
+                Log("SIO_ExpirePending: transId=%d timed out\n", i);
+                SIO_CompleteRequest(dev, dev->pending[i], LPCUSBSIO_ERR_TIMEOUT);
+            }
+        }
+    }
+}
+
+/* Copy response payload straight into the receive segments of a scatter-gather transfer */
+static void SIO_ScatterIn(LPCUSBSIO_Request_t *pReq, const uint8_t *data, uint32_t len)
+{
+    const LPCUSBSIO_IOVEC_T *seg;
+    uint32_t n;
+
+    while ((len > 0) && (pReq->inSegIdx < pReq->numInSegs)) {
+        seg = &pReq->inSegs[pReq->inSegIdx];
+        n = seg->len - pReq->inSegOfs;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(seg->data + pReq->inSegOfs, data, n);
+        data += n;
+        len -= n;
+        pReq->inLen += n;
+        pReq->inSegOfs += n;
+        if (pReq->inSegOfs == seg->len) {
+            pReq->inSegIdx++;
+            pReq->inSegOfs = 0;
+        }
+    }
+}
+
+/* Match a new status of a GPIO port against its subscriptions, called with sioMutex held.
+ * rose and fell are the edges latched by the firmware, the edges between the previous
+ * and the new status are added here.
+ */
+static void SIO_GpioEventLocked(LPCUSBSIO_Ctrl_t *dev, uint8_t port, uint32_t status, uint32_t rose, uint32_t fell)
+{
+    LPCUSBSIO_GpioSub_t *sub;
+    uint32_t prev = dev->gpioLevel[port];
+    uint32_t fired, high, low, i;
+    uint8_t watched = 0, wake = 0;
+
+    for (i = 0; i < SIO_MAX_GPIO_SUBS; i++) {
+        if (dev->gpioSubs[i].active && (dev->gpioSubs[i].port == port)) {
+            watched = 1;
+        }
+    }
+    if (watched == 0) {
+        /* late report of a port nobody watches any more */
+        return;
+    }
+    if (dev->gpioLevelKnown & (1u << port)) {
+        rose |= ~prev & status;
+        fell |= prev & ~status;
+    }
+    else {
+        rose = 0;
+        fell = 0;
+    }
+    dev->gpioLevel[port] = status;
+    dev->gpioLevelKnown |= (uint8_t)(1u << port);
+
+    for (i = 0; i < SIO_MAX_GPIO_SUBS; i++) {
+        sub = &dev->gpioSubs[i];
+        if ((sub->active == 0) || (sub->port != port)) {
+            continue;
+        }
+        /* levels are reported when entered, and for the first status after subscribing */
+        high = sub->primed ? (status & (~prev | fell)) : status;
+        low = sub->primed ? (~status & (prev | rose)) : ~status;
+        fired = 0;
+        if (sub->primed && (sub->condition & GPIO_EVENT_RISING)) {
+            fired |= rose;
+        }
+        if (sub->primed && (sub->condition & GPIO_EVENT_FALLING)) {
+            fired |= fell;
+        }
+        if (sub->condition & GPIO_EVENT_HIGH) {
+            fired |= high;
+        }
+        if (sub->condition & GPIO_EVENT_LOW) {
+            fired |= low;
+        }
+        fired &= sub->pins;
+        sub->primed = 1;
+        if (fired != 0) {
+            if (sub->callback != NULL) {
+                sub->cbPins |= fired;
+            }
+            else {
+                sub->waitPins |= fired;
+            }
+            sub->status = status;
+            wake = 1;
+        }
+    }
+    if (wake) {
+        SIO_CondBroadcast(&dev->eventCond);
+    }
+}
+
+/* Hand an input report over to the transaction it belongs to, called with sioMutex held */
+static void SIO_DispatchReport(LPCUSBSIO_Ctrl_t *dev, const uint8_t *packet)
+{
+    const HID_SIO_IN_REPORT_T *pIn = (const HID_SIO_IN_REPORT_T *)packet;
+    LPCUSBSIO_Request_t *pReq = dev->pending[pIn->transId];
+    uint32_t event[3];
+    uint32_t len;
+
+    Log("SIO_DispatchReport: input packet: resp=%d, transId=%d, packet_len=%d, packet_num=%d, transfer_len=%d\n", pIn->resp, pIn->transId, pIn->packet_len, pIn->packet_num, pIn->transfer_len);
+
+    dev->stats.reportsIn++;
+    SIO_Trace(dev, LPCUSBSIO_TRACE_READ, (pReq != NULL) ? pReq->req : 0, pIn->transId, pIn->sesId,
+              pIn->packet_len, pIn->packet_num, pIn->resp);
+
+    if (pIn->resp == HID_SIO_RES_GPIO_EVENT) {
+        /* unsolicited report of the firmware, not part of a transaction */
+        if ((pIn->sesId < SIO_MAX_GPIO_PORTS) && (pIn->packet_len >= HID_SIO_PACKET_HEADER_SZ + sizeof(event))) {
+            memcpy(&event[0], &pIn->data[0], sizeof(event));
+            SIO_GpioEventLocked(dev, pIn->sesId, event[0], event[1], event[2]);
+        }
+        return;
+    }
+
+    if (pReq == NULL) {
+        /* May be response of a timed out transaction, discard it. */
+        Log("SIO_DispatchReport: no transaction waits for transId=%d, discard\n", pIn->transId);
+        dev->stats.discarded++;
+        SIO_Trace(dev, LPCUSBSIO_TRACE_DISCARD, 0, pIn->transId, pIn->sesId, pIn->packet_len, pIn->packet_num, pIn->resp);
+        return;
+    }
+
+    if (pIn->resp != HID_SIO_RES_OK) {
+        /* update status */
+        SIO_CompleteRequest(dev, pReq, ConvertResp(pIn->resp));
+        Log("SIO_DispatchReport: ConvertResp res=%d\n", pReq->status);
+        return;
+    }
+
+    if ((pIn->packet_len < HID_SIO_PACKET_HEADER_SZ) || (pIn->packet_len > HID_SIO_PACKET_SZ)) {
+        SIO_CompleteRequest(dev, pReq, LPCUSBSIO_ERR_HID_LIB);
+        return;
+    }
+
+    if ((pReq->inData != NULL) || (pReq->inSegs != NULL)) {
+        len = pIn->packet_len - HID_SIO_PACKET_HEADER_SZ;
+        if (len > (pReq->inSize - pReq->inLen)) {
+            len = pReq->inSize - pReq->inLen;
+        }
+        if (pReq->inSegs != NULL) {
+            SIO_ScatterIn(pReq, &pIn->data[0], len);
+        }
+        else {
+            memcpy(pReq->inData + pReq->inLen, &pIn->data[0], len);
+            pReq->inLen += len;
+        }
+    }
+
+    if ((pIn->packet_num * HID_SIO_PACKET_SZ + pIn->packet_len) == pIn->transfer_len) {
+        Log("SIO_DispatchReport: transId=%d finished\n", pIn->transId);
+        SIO_CompleteRequest(dev, pReq, LPCUSBSIO_OK);
+    }
+    else if (pReq->tmoTotal == 0) {
+        /* restart the timeout for the next packet of a multi-packet response */
+        pReq->deadline = SIO_GetTickMs() + pReq->timeout;
+    }
+}
+
+/* Dispatch the input reports queued by the reader thread, called with sioMutex held.
+ * Returns the number of reports dispatched.
+ */
+static int32_t SIO_DrainRingLocked(LPCUSBSIO_Ctrl_t *dev)
+{
+    uint32_t head = SIO_AtomicLoad(&dev->ringHead);
+    uint32_t tail = dev->ringTail;
+    int32_t count = 0;
+
+    while (tail != head) {
+        SIO_DispatchReport(dev, &dev->ring[tail & (SIO_RING_SIZE - 1)][0]);
+        tail++;
+        count++;
+    }
+    if (count > 0) {
+        /* the slots are released only after dispatching, hand them back to the reader thread */
+        SIO_AtomicStore(&dev->ringTail, tail);
+        SIO_CondBroadcast(&dev->rxCond);
+    }
+    return count;
+}
+
+/* Read the input reports of a device into the ring, waiting up to timeout ms for the
+ * first one, and dispatch them by transId. Reports received in a burst are queued in the
+ * ring and dispatched under one lock of sioMutex, the waiting callers may also dispatch
+ * them first. Called by the reader of the device without sioMutex held, returns with it
+ * held and the last hid_read_reports() result.
+ */
+static int32_t SIO_ReaderPass(LPCUSBSIO_Ctrl_t *dev, int timeout)
+{
+    LPCUSBSIO_HISTOGRAM_T readUs;
+    uint32_t head = dev->ringHead;
+    uint32_t room;
+    int32_t res = 0;
+    uint64_t start;
+
+    memset(&readUs, 0, sizeof(readUs));
+    do {
+        room = SIO_RING_SIZE - (head - SIO_AtomicLoad(&dev->ringTail));
+        if (room == 0) {
+            /* ring is full, dispatch before reading more */
+            break;
+        }
+        /* read into the free slots up to the end of the ring */
+        if (room > (SIO_RING_SIZE - (head & (SIO_RING_SIZE - 1)))) {
+            room = SIO_RING_SIZE - (head & (SIO_RING_SIZE - 1));
+        }
+        start = SIO_GetTickUs();
+        res = g_hid->read_reports(dev->hidDev, &dev->ring[head & (SIO_RING_SIZE - 1)][0], HID_SIO_PACKET_SZ + 1,
+                                  room, timeout);
+        if (res > 0) {
+            SIO_HistAdd(&readUs, SIO_GetTickUs() - start);
+            head += (uint32_t)res;
+            SIO_AtomicStore(&dev->ringHead, head);
+        }
+        /* collect what else is already there without blocking */
+        timeout = 0;
+    } while (res > 0);
+
+    SIO_MutexLock(&dev->sioMutex);
+    SIO_HistMerge(&dev->stats.read, &readUs);
+    SIO_DrainRingLocked(dev);
+    if (res < 0) {
+        Log("SIO_ReaderPass: hid_read_reports result=%d\n", res);
+        SIO_FailPending(dev, LPCUSBSIO_ERR_HID_LIB);
+    }
+    SIO_ExpirePending(dev, SIO_GetTickMs());
+    SIO_CondBroadcast(&dev->rxCond);
+
+    return res;
+}
+
+/* Reader thread of a device: reads the input reports as soon as they arrive and hands
+ * them over by transId.
+ */
+static SIO_THREAD_RET_T SIO_THREAD_API SIO_ReaderThread(void *arg)
+{
+    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)arg;
+    uint8_t stop = 0;
+    int32_t res;
+
+    while (stop == 0) {
+        res = SIO_ReaderPass(dev, SIO_READER_POLL_MS);
+        if ((res < 0) && (dev->readerMode == SIO_READER_THREAD)) {
+            /* do not spin on a failing device */
+            SIO_CondWait(&dev->rxCond, &dev->sioMutex, SIO_READER_POLL_MS);
+        }
+        stop = (dev->readerMode == SIO_READER_STOPPING) ? 1 : 0;
+        SIO_MutexUnlock(&dev->sioMutex);
+    }
+
+    return 0;
+}
+
+/* Reader thread shared by several devices: waits until any of them has input reports
+ * and reads those devices without blocking. The transactions of the quiet devices are
+ * timed out every SIO_READER_POLL_MS.
+ */
+static SIO_THREAD_RET_T SIO_THREAD_API SIO_SharedReaderThread(void *arg)
+{
+    SIO_SharedReader_t *sr = (SIO_SharedReader_t *)arg;
+    LPCUSBSIO_Ctrl_t *devs[SIO_SHARED_MAX_DEVICES];
+    hid_device *hids[SIO_SHARED_MAX_DEVICES];
+    uint8_t ready[SIO_SHARED_MAX_DEVICES];
+    uint64_t now;
+    uint64_t sweep = 0;
+    uint32_t i;
+    uint32_t n;
+    int res;
+
+    SIO_MutexLock(&sr->mutex);
+    while (sr->running) {
+        /* the devices are not removed before the end of the pass, see SIO_SharedRemove() */
+        now = SIO_GetTickMs();
+        for (i = 0, n = 0; i < sr->numDevs; i++) {
+            if (sr->devs[i]->sharedRetry <= now) {
+                devs[n] = sr->devs[i];
+                hids[n] = devs[n]->hidDev;
+                n++;
+            }
+        }
+        if (n == 0) {
+            SIO_CondWait(&sr->cond, &sr->mutex, (sr->numDevs == 0) ? LPCUSBSIO_READ_TMO : SIO_READER_POLL_MS);
+        }
+        else {
+            SIO_MutexUnlock(&sr->mutex);
+
+            res = g_hid->poll(hids, n, ready, SIO_SHARED_POLL_MS);
+            now = SIO_GetTickMs();
+            for (i = 0; i < n; i++) {
+                if ((res > 0) && ready[i]) {
+                    if (SIO_ReaderPass(devs[i], 0) < 0) {
+                        /* do not spin on a failing device */
+                        devs[i]->sharedRetry = now + SIO_READER_POLL_MS;
+                    }
+                    SIO_MutexUnlock(&devs[i]->sioMutex);
+                }
+                else if (now >= sweep) {
+                    SIO_MutexLock(&devs[i]->sioMutex);
+                    SIO_ExpirePending(devs[i], now);
+                    SIO_CondBroadcast(&devs[i]->rxCond);
+                    SIO_MutexUnlock(&devs[i]->sioMutex);
+                }
+            }
+            if (now >= sweep) {
+                sweep = now + SIO_READER_POLL_MS;
+            }
+
+            SIO_MutexLock(&sr->mutex);
+        }
+        sr->pass++;
+        SIO_CondBroadcast(&sr->cond);
+    }
+    SIO_MutexUnlock(&sr->mutex);
+
+    return 0;
+}
+
+static uint32_t SIO_NumProcessors(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return (uint32_t)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (n > 0) ? (uint32_t)n : 1;
+#endif
+}
+
+/* Hand a device over to the least loaded shared reader thread, starting a new thread
+ * while fewer than the maximum run or all of them are full. Called with sioMutex held.
+ */
+static int32_t SIO_SharedAdd(LPCUSBSIO_Ctrl_t *dev)
+{
+    SIO_SharedReader_t *sr = NULL;
+    uint32_t max = SIO_AtomicLoad(&g_Ctrl.sharedMax);
+    uint32_t i;
+    int32_t res = LPCUSBSIO_OK;
+
+    if (max == 0) {
+        max = SIO_NumProcessors();
+    }
+    if (max > SIO_MAX_SHARED_READERS) {
+        max = SIO_MAX_SHARED_READERS;
+    }
+
+    SIO_MutexLock(&g_Ctrl.sharedMutex);
+    /* the entries are not reused before the threads stopped last have exited */
+    while (g_Ctrl.sharedJoining != 0) {
+        SIO_CondWait(&g_Ctrl.sharedCond, &g_Ctrl.sharedMutex, LPCUSBSIO_READ_TMO);
+    }
+    for (i = 0; i < g_Ctrl.numShared; i++) {
+        if ((sr == NULL) || (g_Ctrl.shared[i].numDevs < sr->numDevs)) {
+            sr = &g_Ctrl.shared[i];
+        }
+    }
+    if ((sr == NULL) || ((sr->numDevs > 0) && (g_Ctrl.numShared < max)) || (sr->numDevs == SIO_SHARED_MAX_DEVICES)) {
+        if (g_Ctrl.numShared < SIO_MAX_SHARED_READERS) {
+            sr = &g_Ctrl.shared[g_Ctrl.numShared];
+            if (g_Ctrl.numShared == g_Ctrl.numSharedInit) {
+                SIO_MutexInit(&sr->mutex);
+                SIO_CondInit(&sr->cond);
+                g_Ctrl.numSharedInit++;
+            }
+            sr->running = 1;
+            sr->numDevs = 0;
+            if (SIO_ThreadCreate(&sr->thread, SIO_SharedReaderThread, sr) != 0) {
+                res = LPCUSBSIO_ERR_SYNCHRONIZATION;
+            }
+            else {
+                g_Ctrl.numShared++;
+            }
+        }
+        else if ((sr == NULL) || (sr->numDevs == SIO_SHARED_MAX_DEVICES)) {
+            res = LPCUSBSIO_ERR_SYNCHRONIZATION;
+        }
+    }
+    if (res == LPCUSBSIO_OK) {
+        SIO_MutexLock(&sr->mutex);
+        dev->sharedReader = (uint8_t)(sr - &g_Ctrl.shared[0] + 1);
+        dev->sharedRetry = 0;
+        sr->devs[sr->numDevs++] = dev;
+        SIO_CondBroadcast(&sr->cond);
+        SIO_MutexUnlock(&sr->mutex);
+    }
+    SIO_MutexUnlock(&g_Ctrl.sharedMutex);
+
+    return res;
+}
+
+/* Take a device away from its shared reader thread. Called without sioMutex held,
+ * returns once the thread no longer uses the device.
+ */
+static void SIO_SharedRemove(LPCUSBSIO_Ctrl_t *dev)
+{
+    SIO_SharedReader_t *sr = &g_Ctrl.shared[dev->sharedReader - 1];
+    uint32_t pass;
+    uint32_t i;
+
+    SIO_MutexLock(&g_Ctrl.sharedMutex);
+    SIO_MutexLock(&sr->mutex);
+    for (i = 0; i < sr->numDevs; i++) {
+        if (sr->devs[i] == dev) {
+            sr->devs[i] = sr->devs[--sr->numDevs];
+            break;
+        }
+    }
+    SIO_MutexUnlock(&g_Ctrl.sharedMutex);
+
+    /* the pass running may still read the device */
+    pass = sr->pass;
+    while (sr->pass == pass) {
+        SIO_CondWait(&sr->cond, &sr->mutex, LPCUSBSIO_READ_TMO);
+    }
+    SIO_MutexUnlock(&sr->mutex);
+    dev->sharedReader = 0;
+}
+
+/* Stop the shared reader threads once no device is served any more */
+static void SIO_SharedStopAll(void)
+{
+    SIO_THREAD_T threads[SIO_MAX_SHARED_READERS];
+    uint32_t num = 0;
+    uint32_t i;
+
+    SIO_MutexLock(&g_Ctrl.sharedMutex);
+    for (i = 0; i < g_Ctrl.numShared; i++) {
+        if (g_Ctrl.shared[i].numDevs != 0) {
+            break;
+        }
+    }
+    if ((i == g_Ctrl.numShared) && (g_Ctrl.sharedJoining == 0)) {
+        for (i = 0; i < g_Ctrl.numShared; i++) {
+            SIO_MutexLock(&g_Ctrl.shared[i].mutex);
+            g_Ctrl.shared[i].running = 0;
+            SIO_CondBroadcast(&g_Ctrl.shared[i].cond);
+            SIO_MutexUnlock(&g_Ctrl.shared[i].mutex);
+            threads[num++] = g_Ctrl.shared[i].thread;
+        }
+        g_Ctrl.numShared = 0;
+        g_Ctrl.sharedJoining = num;
+    }
+    SIO_MutexUnlock(&g_Ctrl.sharedMutex);
+
+    if (num == 0) {
+        return;
+    }
+    /* each thread may finish a poll of up to SIO_SHARED_POLL_MS first */
+    for (i = 0; i < num; i++) {
+        SIO_ThreadJoin(threads[i]);
+    }
+    SIO_MutexLock(&g_Ctrl.sharedMutex);
+    g_Ctrl.sharedJoining = 0;
+    SIO_CondBroadcast(&g_Ctrl.sharedCond);
+    SIO_MutexUnlock(&g_Ctrl.sharedMutex);
+}
+
+/* Stop the reader thread of a device and give the reader role back to the callers.
+ * Called without sioMutex held, returns once no reader thread runs any more.
+ */
+static void SIO_StopReader(LPCUSBSIO_Ctrl_t *dev)
+{
+    uint8_t shared;
+
+    SIO_MutexLock(&dev->sioMutex);
+    while ((dev->readerMode == SIO_READER_STARTING) || (dev->readerMode == SIO_READER_STOPPING)) {
+        SIO_CondWait(&dev->rxCond, &dev->sioMutex, LPCUSBSIO_READ_TMO);
+    }
+    if ((dev->readerMode == SIO_READER_THREAD) || (dev->readerMode == SIO_READER_SHARED)) {
+        shared = (dev->readerMode == SIO_READER_SHARED);
+        dev->readerMode = SIO_READER_STOPPING;
+        SIO_MutexUnlock(&dev->sioMutex);
+
+        if (shared) {
+            SIO_SharedRemove(dev);
+        }
+        else {
+            SIO_ThreadJoin(dev->readerThread);
+        }
+
+        SIO_MutexLock(&dev->sioMutex);
+        SIO_DrainRingLocked(dev);
+        dev->readerMode = SIO_READER_CALLER;
+        SIO_CondBroadcast(&dev->rxCond);
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+}
+
+/* Read and dispatch one input report of a device, called with sioMutex held.
+ * The first caller which finds the reader role free reads the input reports received so
+ * far and dispatches them by transId, all other callers sleep until a transaction completes.
+ * When the reader thread runs the callers only dispatch the reports it queued.
+ * Returns the hid_read_reports() result, the number of queued reports dispatched,
+ * or zero when the caller did not read.
+ */
+static int32_t SIO_ReadLocked(LPCUSBSIO_Ctrl_t *dev, uint32_t timeout_ms)
+{
+    int32_t res = 0;
+    int32_t i;
+    uint64_t start;
+
+    if (dev->readerMode != SIO_READER_CALLER) {
+        res = SIO_DrainRingLocked(dev);
+        if ((res == 0) && (timeout_ms > 0)) {
+            SIO_CondWait(&dev->rxCond, &dev->sioMutex, timeout_ms);
+            res = SIO_DrainRingLocked(dev);
+        }
+    }
+    else if (dev->readerActive || dev->closing) {
+        SIO_CondWait(&dev->rxCond, &dev->sioMutex, timeout_ms);
+    }
+    else {
+        dev->readerActive = 1;
+        SIO_MutexUnlock(&dev->sioMutex);
+
+        start = SIO_GetTickUs();
+        res = g_hid->read_reports(dev->hidDev, &dev->inReports[0][0], HID_SIO_PACKET_SZ + 1, SIO_READ_BATCH,
+                                  (int)timeout_ms);
+        Log("SIO_ReadLocked: hid_read_reports result=%d\n", res);
+
+        SIO_MutexLock(&dev->sioMutex);
+        dev->readerActive = 0;
+
+        if (res > 0) {
+            SIO_HistAdd(&dev->stats.read, SIO_GetTickUs() - start);
+            for (i = 0; i < res; i++) {
+                SIO_DispatchReport(dev, &dev->inReports[i][0]);
+            }
+        }
+        else if (res < 0) {
+            SIO_FailPending(dev, LPCUSBSIO_ERR_HID_LIB);
+        }
+        SIO_ExpirePending(dev, SIO_GetTickMs());
+
+        /* wake up the waiters to check their transactions or to take over the reader role */
+        SIO_CondBroadcast(&dev->rxCond);
+    }
+
+    return res;
+}
+
+/* Make progress on the in-flight transactions of a device and run the callbacks which
+ * became due, called with sioMutex held. Returns the SIO_ReadLocked() result.
+ */
+static int32_t SIO_ProgressLocked(LPCUSBSIO_Ctrl_t *dev, uint32_t timeout_ms)
+{
+    int32_t res = SIO_ReadLocked(dev, timeout_ms);
+
+    SIO_RunCallbacksLocked(dev);
+
+    return res;
+}
+
+/* Submission queue of a request: one per I2C and SPI port, GPIO and device requests share one */
+static uint8_t SIO_QueueIndex(uint8_t req, uint8_t portNum)
+{
+    if (req <= HID_I2C_REQ_MAX) {
+        return portNum % MAX_I2C_PORTS;
+    }
+    if (req <= HID_SPI_REQ_MAX) {
+        return MAX_I2C_PORTS + (portNum % MAX_SPI_PORTS);
+    }
+    return SIO_QUEUE_GPIO;
+}
+
+/* Wait for the turn to write to the output pipe, called with sioMutex held.
+ * Turns are served in arrival order so that every port gets its share of the pipe.
+ */
+static void SIO_PipeAcquireLocked(LPCUSBSIO_Ctrl_t *dev)
+{
+    uint32_t ticket = dev->pipeTicket++;
+
+    while (ticket != dev->pipeServing) {
+        SIO_CondWait(&dev->rxCond, &dev->sioMutex, LPCUSBSIO_READ_TMO);
+    }
+}
+
+/* Pass the output pipe to the next submitter, called with sioMutex held */
+static void SIO_PipeReleaseLocked(LPCUSBSIO_Ctrl_t *dev)
+{
+    dev->pipeServing++;
+    SIO_CondBroadcast(&dev->rxCond);
+}
+
+/* Dispatch the input reports already received without blocking, called with sioMutex held */
+static void SIO_PollLocked(LPCUSBSIO_Ctrl_t *dev)
+{
+    while ((dev->readerActive == 0) && (dev->numPending > 0)) {
+        if (SIO_ProgressLocked(dev, 0) <= 0) {
+            break;
+        }
+    }
+    SIO_RunCallbacksLocked(dev);
+}
+
+/* Wait for pReq for at most maxWait milliseconds, called with sioMutex held */
+static void SIO_StepLocked(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_Request_t *pReq, uint32_t maxWait)
+{
+    uint64_t now = SIO_GetTickMs();
+
+    if (now >= pReq->deadline) {
+        Log("SIO_StepLocked: wait timeout!\n");
+        SIO_CompleteRequest(dev, pReq, LPCUSBSIO_ERR_TIMEOUT);
+        SIO_RunCallbacksLocked(dev);
+        return;
+    }
+    if ((pReq->deadline - now) < maxWait) {
+        maxWait = (uint32_t)(pReq->deadline - now);
+    }
+    SIO_ProgressLocked(dev, maxWait);
+}
+
+/* Work out the response time-out of a transaction of outLen payload bytes: the call
+ * time-out of the thread, or the settings of its port or device. Adaptive time-outs
+ * add twice the expected bus time of the output and response bytes plus one USB
+ * interval per report, the settings are the margin then. Called with sioMutex held.
+ */
+static void SIO_RequestTimeout(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_Request_t *pReq, uint8_t req, uint8_t portNum, uint32_t outLen)
+{
+    const LPCUSBSIO_PortCtrl_t *port = SIO_ReqPort(dev, req, portNum);
+    uint32_t timeout = dev->timeout;
+    uint32_t bitsPerByte = (req <= HID_I2C_REQ_MAX) ? 9 : 8;	/* I2C data bits and the acknowledge */
+    uint32_t reports;
+    uint8_t flags = dev->tmoFlags;
+    uint64_t busMs;
+
+    if (g_callTimeout != 0) {
+        pReq->timeout = g_callTimeout;
+        pReq->tmoTotal = 1;
+        return;
+    }
+    if ((port != NULL) && (port->timeout != 0)) {
+        timeout = port->timeout;
+        flags = port->tmoFlags;
+    }
+    if ((flags & LPCUSBSIO_TIMEOUT_ADAPTIVE) && (port != NULL) && (port->busSpeed != 0)) {
+        /* an upper bound, the output includes the transfer parameters */
+        busMs = (((uint64_t)outLen + pReq->inSize) * bitsPerByte * 1000 + port->busSpeed - 1) / port->busSpeed;
+        reports = HID_SIO_CALC_PACKETS_COUNT(outLen) + HID_SIO_CALC_PACKETS_COUNT(pReq->inSize);
+        timeout += (uint32_t)(2 * (busMs + reports));
+    }
+    pReq->timeout = timeout;
+    pReq->tmoTotal = (flags & LPCUSBSIO_TIMEOUT_TOTAL) ? 1 : 0;
+}
+
+/* Assign a transId to the transaction and send all its output reports to the device.
+ * The response is collected later by SIO_WaitRequest or by whichever caller reads
+ * the device, so more transactions may be submitted before this one completes.
+ * Submitters of one port are queued behind each other, different ports take turns on
+ * the output pipe. Callbacks are not run from here, the caller owns a pipe turn while
+ * it waits and a callback submitting another request could never get one.
+ * Returns an error only if the request could not be registered, failures after that
+ * are reported as the status of the completed request.
+ */
+static int32_t SIO_SubmitRequest(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_Request_t *pReq, uint8_t portNum, uint8_t req,
+                                 const LPCUSBSIO_Segment_t *segs, uint32_t numSegs)
+{
+    HID_SIO_OUT_REPORT_T *pOut;
+    LPCUSBSIO_PortCtrl_t *port;
+    LPCUSBSIO_HISTOGRAM_T writeUs;
+    int32_t res = 0;
+    uint32_t outLen = 0;
+    uint32_t oneTx, copied, n;
+    uint32_t segIdx = 0, segOfs = 0;
+    uint32_t numOut, written = 0;
+    uint16_t packetNum = 0;
+    uint64_t start, waitUs;
+    uint8_t hdr[HID_REPORT_DATA_OFFSET + HID_SIO_PACKET_HEADER_SZ];
+
+    /* the owner of a pipe turn or a queue could not send HID_SIO_REQ_DEV_INFO */
+    if ((SIO_AtomicLoad(&dev->capsCheck) != 0) && (req != HID_SIO_REQ_DEV_INFO) && (pReq->txHeld == 0) &&
+        (pReq->queueHeld == 0) && (g_cbHold == 0) && (g_inCapsCheck == 0)) {
+        SIO_CapsCheck(dev);
+    }
+
+    pReq->startUs = SIO_GetTickUs();
+    for (n = 0; n < numSegs; n++) {
+        outLen += segs[n].len;
+    }
+
+    Log("SIO_SubmitRequest(dev, portNum=%d, req=0x%x, segs, outLen=%d)\n", portNum, req, outLen);
+
+#if SIO_DEBUG>0
+    if(outLen)
+    {
+        uint32_t i;
+        Log("  outData[%d]: ", outLen);
+        for(n=0; n<numSegs; n++)
+            for(i=0; i<segs[n].len; i++)
+                Log("%02X ", segs[n].data[i]);
+
+        Log("\n              ");
+        for(n=0; n<numSegs; n++)
+            for(i=0; i<segs[n].len; i++)
+                Log("%c", isprint(segs[n].data[i]) ? segs[n].data[i] : '.');
+
+        Log("\n");
+    }
+#endif
+
+    pReq->dev = dev;
+    pReq->state = SIO_REQ_IDLE;
+    pReq->inLen = 0;
+    pReq->inSegIdx = 0;
+    pReq->inSegOfs = 0;
+    pReq->status = LPCUSBSIO_OK;
+    pReq->queue = SIO_QueueIndex(req, portNum);
+    pReq->req = req;
+    pReq->sesId = portNum;
+    pReq->txLen = outLen;
+
+    if ((pReq->txHeld == 0) && (pReq->queueHeld == 0) && (SIO_MutexLock(&dev->queueMutex[pReq->queue]) != 0)) {
+        return LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    SIO_MutexLock(&dev->sioMutex);
+
+    /* keep the transactions of one port from taking all in-flight slots */
+    while ((dev->queuePending[pReq->queue] >= SIO_MAX_INFLIGHT_QUEUE) && (dev->closing == 0)) {
+        SIO_ReadLocked(dev, LPCUSBSIO_READ_TMO);
+    }
+    if (pReq->txHeld == 0) {
+        SIO_PipeAcquireLocked(dev);
+    }
+    /* keep the number of transactions in flight limited */
+    while ((dev->numPending >= SIO_MAX_INFLIGHT) && (dev->closing == 0)) {
+        SIO_ReadLocked(dev, LPCUSBSIO_READ_TMO);
+    }
+    if (dev->closing) {
+        /* the device is being closed by another thread */
+        if (pReq->txHeld == 0) {
+            SIO_PipeReleaseLocked(dev);
+        }
+        SIO_MutexUnlock(&dev->sioMutex);
+        if ((pReq->txHeld == 0) && (pReq->queueHeld == 0)) {
+            SIO_MutexUnlock(&dev->queueMutex[pReq->queue]);
+        }
+        return LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    /* register the transaction before sending so that no response can be missed */
+    while (dev->pending[dev->transId] != NULL) {
+        dev->transId++;
+    }
+    pReq->transId = dev->transId++;
+    pReq->deadline = (uint64_t)-1;
+    SIO_RequestTimeout(dev, pReq, req, portNum, outLen);
+    pReq->state = SIO_REQ_PENDING;
+    dev->pending[pReq->transId] = pReq;
+    dev->numPending++;
+    dev->queuePending[pReq->queue]++;
+
+    SIO_Trace(dev, LPCUSBSIO_TRACE_SUBMIT, req, pReq->transId, portNum, outLen, pReq->timeout, 0);
+
+    waitUs = SIO_GetTickUs() - pReq->startUs;
+    dev->stats.lockWaitUs += waitUs;
+    port = SIO_ReqPort(dev, req, portNum);
+    if (port != NULL) {
+        port->stats.lockWaitUs += waitUs;
+    }
+
+    SIO_MutexUnlock(&dev->sioMutex);
+    memset(&writeUs, 0, sizeof(writeUs));
+
+    /* the report number and header are the same in all reports of the transaction
+       but for packet_num, and for packet_len of a short last packet */
+    hdr[0] = 0;
+    pOut = (HID_SIO_OUT_REPORT_T *)&hdr[HID_REPORT_DATA_OFFSET];
+    pOut->transfer_len = HID_SIO_CALC_TRANSFER_LEN(pReq->txLen);
+    pOut->packet_num = 0;
+    pOut->packet_len = HID_SIO_PACKET_SZ;
+    pOut->transId = pReq->transId;
+    pOut->sesId = portNum;
+    pOut->req = req;
+
+    /* construct SIO request and send to device, the pipe turn keeps its reports together.
+       The reports are built in batches of SIO_WRITE_BATCH, each written by one call. */
+    do {
+        numOut = 0;
+        do {
+            memcpy(&dev->outReports[numOut][0], hdr, sizeof(hdr));
+            pOut = (HID_SIO_OUT_REPORT_T *)&dev->outReports[numOut][HID_REPORT_DATA_OFFSET];
+            pOut->packet_num = packetNum++;
+            oneTx = HID_SIO_PACKET_DATA_SZ;
+            if (outLen < HID_SIO_PACKET_DATA_SZ) {
+                oneTx = outLen;
+                pOut->packet_len = oneTx + HID_SIO_PACKET_HEADER_SZ;
+            }
+
+            Log("SIO_SubmitRequest: transId=%d, packet_num=%d, packet_len=%d, transfer_len=%d\n", pOut->transId, pOut->packet_num, pOut->packet_len, pOut->transfer_len);
+
+            /* gather the payload straight into the report */
+            for (copied = 0; copied < oneTx; ) {
+                n = segs[segIdx].len - segOfs;
+                if (n > (oneTx - copied)) {
+                    n = oneTx - copied;
+                }
+                memcpy(&pOut->data[copied], segs[segIdx].data + segOfs, n);
+                copied += n;
+                segOfs += n;
+                if (segOfs == segs[segIdx].len) {
+                    segIdx++;
+                    segOfs = 0;
+                }
+            }
+            if (oneTx < HID_SIO_PACKET_DATA_SZ) {
+                /* only the last packet has an unused tail */
+                memset(&pOut->data[oneTx], 0, HID_SIO_PACKET_DATA_SZ - oneTx);
+            }
+
+            outLen -= oneTx;
+            numOut++;
+        } while ((outLen > 0) && (numOut < SIO_WRITE_BATCH));
+
+        /* the +1 is for HID_REPORT_DATA_OFFSET */
+        start = SIO_GetTickUs();
+        res = g_hid->write_reports(dev->hidDev, &dev->outReports[0][0], HID_SIO_PACKET_SZ + 1, numOut, -1);
+        SIO_HistAdd(&writeUs, SIO_GetTickUs() - start);
+        for (n = 0; n < numOut; n++) {
+            pOut = (HID_SIO_OUT_REPORT_T *)&dev->outReports[n][HID_REPORT_DATA_OFFSET];
+            SIO_Trace(dev, LPCUSBSIO_TRACE_WRITE, req, pOut->transId, portNum, pOut->packet_len, pOut->packet_num,
+                      ((int32_t)n < res) ? (HID_SIO_PACKET_SZ + 1) : -1);
+        }
+        if (res > 0) {
+            written += (uint32_t)res;
+        }
+
+        Log("SIO_SubmitRequest: result=%d, outLen remaining=%d\n", res, outLen);
+
+    } while ((res == (int32_t)numOut) && (outLen > 0));
+
+    SIO_MutexLock(&dev->sioMutex);
+    SIO_HistMerge(&dev->stats.write, &writeUs);
+    /* the output reports are still ours until the pipe is released */
+    dev->stats.reportsOut += written;
+    if (pReq->txHeld == 0) {
+        SIO_PipeReleaseLocked(dev);
+    }
+    if (pReq->state == SIO_REQ_PENDING) {
+        if (res == (int32_t)numOut) {
+            /* start the response timeout once the request is out */
+            pReq->deadline = SIO_GetTickMs() + pReq->timeout;
+        }
+        else {
+            SIO_CompleteRequest(dev, pReq, LPCUSBSIO_ERR_HID_LIB);
+            SIO_CondBroadcast(&dev->rxCond);
+        }
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+    if ((pReq->txHeld == 0) && (pReq->queueHeld == 0)) {
+        SIO_MutexUnlock(&dev->queueMutex[pReq->queue]);
+    }
+
+    return LPCUSBSIO_OK;
+}
+
+/* Wait until the submitted transaction completes, fails or times out */
+static int32_t SIO_WaitRequest(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_Request_t *pReq)
+{
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    while (pReq->state != SIO_REQ_DONE) {
+        SIO_StepLocked(dev, pReq, (uint32_t)-1);
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return pReq->status;
+}
+
+/* Complete a blocking call: wait for the request submitted by one of the *_Submit
+   helpers and return its API result. res is the result of the submit helper. */
+static int32_t SIO_WaitResult(LPCUSBSIO_Request_t *pReq, int32_t res)
+{
+    if (res == LPCUSBSIO_OK) {
+        g_lastError = SIO_WaitRequest(pReq->dev, pReq);
+        res = (g_lastError == LPCUSBSIO_ERR_SYNCHRONIZATION) ? g_lastError : pReq->result;
+    }
+    return res;
+}
+
+/* Blocking transaction. On input *inLen holds the capacity of inData and on return
+   the number of response bytes received. */
+static int32_t SIO_SendRequest(LPCUSBSIO_Ctrl_t *dev, uint8_t portNum, uint8_t req, uint8_t *outData, uint32_t outDataLen, uint8_t *inData, uint32_t *inLen)
+{
+    LPCUSBSIO_Request_t sioReq;
+    LPCUSBSIO_Segment_t seg;
+    int32_t res;
+
+    Log("SIO_SendRequest(dev, portNum=%d, req=0x%x, outData, outLen=%d, inData, inLen)\n", portNum, req, outDataLen);
+
+    if (((outDataLen > 0) && (outData == NULL)) || ((inLen != NULL) && (inData == NULL))) {
+        /* Param Error */
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    sioReq.inData = (inLen != NULL) ? inData : NULL;
+    sioReq.inSize = (inLen != NULL) ? *inLen : 0;
+
+    seg.data = outData;
+    seg.len = outDataLen;
+    res = SIO_SubmitRequest(dev, &sioReq, portNum, req, &seg, 1);
+    if (res == LPCUSBSIO_OK) {
+        res = SIO_WaitRequest(dev, &sioReq);
+    }
+
+    if (inLen != NULL) {
+        *inLen = sioReq.inLen;
+    }
+
+    Log("SIO_SendRequest: returning %d\n", res);
+    return g_lastError = res;
+}
+
+/* Deinitialize an open I2C or SPI port, the port is left open if the request fails */
+static int32_t SIO_ClosePort(LPCUSBSIO_PortCtrl_t *port, uint8_t req)
+{
+    int32_t res = SIO_SendRequest(port->hUsbSio, port->portNum, req, NULL, 0, NULL, NULL);
+
+    if (res == LPCUSBSIO_OK) {
+        port->portNum = 0;
+        port->hUsbSio = NULL;
+    }
+    return res;
+}
+
+/* Take the descriptor of an asynchronous request from the pool of the device */
+static LPCUSBSIO_Request_t *SIO_AllocRequest(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    LPCUSBSIO_Request_t *pReq;
+
+    if (dev == NULL) {
+        g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        return NULL;
+    }
+
+    SIO_MutexLock(&dev->sioMutex);
+    pReq = dev->reqFree;
+    if (dev->closing) {
+        SIO_MutexUnlock(&dev->sioMutex);
+        g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        return NULL;
+    }
+    if (pReq == NULL) {
+        /* all descriptors are in use by unreleased requests */
+        SIO_MutexUnlock(&dev->sioMutex);
+        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+        return NULL;
+    }
+    dev->reqFree = pReq->next;
+    if (dev->reqFree == NULL) {
+        dev->reqFreeTail = NULL;
+    }
+
+    memset(pReq, 0, sizeof(LPCUSBSIO_Request_t));
+    pReq->dev = dev;
+    pReq->magic = SIO_REQ_MAGIC;
+    pReq->gen = SIO_EntryGen(dev, ++dev->reqGen[pReq - &dev->reqPool[0]]);
+    pReq->callback = callback;
+    pReq->context = context;
+
+    pReq->next = dev->asyncReqs;
+    if (dev->asyncReqs != NULL) {
+        dev->asyncReqs->prev = pReq;
+    }
+    dev->asyncReqs = pReq;
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return pReq;
+}
+
+/* Return the handle of a submitted asynchronous request, or release the request
+   and return NULL if the submit helper failed with res. */
+static LPC_HANDLE SIO_AsyncHandle(LPCUSBSIO_Request_t *pReq, int32_t res)
+{
+    LPCUSBSIO_Ctrl_t *dev;
+
+    if (pReq == NULL) {
+        return NULL;
+    }
+    if (res != LPCUSBSIO_OK) {
+        dev = pReq->dev;
+        SIO_MutexLock(&dev->sioMutex);
+        /* LPCUSBSIO_Close() may have released the request already */
+        if (pReq->magic == SIO_REQ_MAGIC) {
+            SIO_FreeRequest(dev, pReq);
+        }
+        SIO_MutexUnlock(&dev->sioMutex);
+        return NULL;
+    }
+    return SIO_ReqHandle(pReq);
+}
+
+/* Check the segments of a scatter-gather transfer and return their total length in *pLen.
+   When segs is not NULL the segments are also converted to output payload pieces. */
+static int32_t SIO_CheckIov(const LPCUSBSIO_IOVEC_T *iov, uint32_t count, uint32_t maxLen, LPCUSBSIO_Segment_t *segs,
+                            uint32_t *pLen)
+{
+    uint32_t i, len = 0;
+
+    if ((count > SIO_MAX_IOV) || ((count > 0) && (iov == NULL))) {
+        return LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    for (i = 0; i < count; i++) {
+        if (((iov[i].len > 0) && (iov[i].data == NULL)) || (iov[i].len > (maxLen - len))) {
+            return LPCUSBSIO_ERR_INVALID_PARAM;
+        }
+        len += iov[i].len;
+        if (segs != NULL) {
+            segs[i].data = iov[i].data;
+            segs[i].len = iov[i].len;
+        }
+    }
+    *pLen = len;
+    return LPCUSBSIO_OK;
+}
+
+/* Resolve a request handle and return its descriptor with sioMutex of its device held,
+   NULL if the request has been released */
+static LPCUSBSIO_Request_t *SIO_LockRequest(LPC_HANDLE hReq)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_LookupEntry(hReq, SIO_HANDLE_REQ, SIO_REQ_POOL_SIZE);
+    LPCUSBSIO_Request_t *pReq;
+
+    if (dev == NULL) {
+        return NULL;
+    }
+    pReq = &dev->reqPool[SIO_HANDLE_INDEX((uint32_t)(uintptr_t)hReq)];
+    SIO_MutexLock(&dev->sioMutex);
+    if ((pReq->magic != SIO_REQ_MAGIC) || (pReq->gen != SIO_HANDLE_GEN((uint32_t)(uintptr_t)hReq))) {
+        SIO_MutexUnlock(&dev->sioMutex);
+        return NULL;
+    }
+    return pReq;
+}
+
+/* Submit a GPIO port request. The response is reported through status, or as the
+   state of pin for getPin requests. */
+static int32_t GPIO_SubmitCmd(LPC_HANDLE hUsbSio, uint8_t port, uint32_t cmd, uint32_t setPins, uint32_t clrPins,
+                              uint32_t* status, uint8_t getPin, uint8_t pin, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Segment_t seg;
+    uint8_t outData[8];
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* construct req packet */
+    memcpy(outData, &setPins, sizeof(uint32_t));
+    memcpy(outData + 4, &clrPins, sizeof(uint32_t));
+    seg.data = outData;
+    seg.len = sizeof(outData);
+
+    pReq->resKind = getPin ? SIO_RES_GPIO_PIN : SIO_RES_GPIO;
+    pReq->pin = pin;
+    pReq->pStatus = status;
+    pReq->args[0] = setPins;
+    pReq->args[1] = clrPins;
+    pReq->inData = &pReq->gpioData[0];
+    pReq->inSize = sizeof(pReq->gpioData);
+    return SIO_SubmitRequest(dev, pReq, port, (uint8_t)cmd, &seg, 1);
+}
+
+/* Drop the pins of a GPIO value or direction change which are known to be in the
+   requested state already, called with sioMutex held */
+static void GPIO_TrimLocked(LPCUSBSIO_Ctrl_t *dev, uint8_t port, uint32_t cmd, uint32_t *setPins, uint32_t *clrPins)
+{
+    const LPCUSBSIO_GpioShadow_t *s;
+
+    if ((dev->gpioCache == 0) || (port >= SIO_MAX_GPIO_PORTS)) {
+        return;
+    }
+    s = &dev->gpioShadow[port];
+    if (cmd == HID_GPIO_REQ_PORT_VALUE) {
+        *setPins &= ~(s->outKnown & s->out);
+        *clrPins &= ~(s->outKnown & ~s->out);
+    }
+    else if (cmd == HID_GPIO_REQ_PORT_DIR) {
+        *setPins &= ~(s->dirKnown & s->dir);
+        *clrPins &= ~(s->dirKnown & ~s->dir);
+    }
+}
+
+/* Serve a blocking GPIO request from the shadow registers when it would not change
+   anything on the device. Returns non-zero if the request was served. */
+static int32_t GPIO_CachedCmd(LPCUSBSIO_Ctrl_t *dev, uint8_t port, uint32_t cmd, uint32_t setPins, uint32_t clrPins,
+                              uint32_t* status, uint8_t getPin)
+{
+    const LPCUSBSIO_GpioShadow_t *s;
+    uint8_t served = 0;
+
+    /* pin levels are always read from the device */
+    if ((dev == NULL) || getPin || ((cmd == HID_GPIO_REQ_PORT_VALUE) && (status != NULL))) {
+        return 0;
+    }
+    SIO_MutexLock(&dev->sioMutex);
+    if ((dev->gpioCache != 0) && (port < SIO_MAX_GPIO_PORTS)) {
+        s = &dev->gpioShadow[port];
+        if ((setPins != 0) || (clrPins != 0)) {
+            GPIO_TrimLocked(dev, port, cmd, &setPins, &clrPins);
+            served = ((setPins == 0) && (clrPins == 0)) ? 1 : 0;
+        }
+        if ((cmd == HID_GPIO_REQ_PORT_DIR) && (status != NULL)) {
+            /* the direction read back must be complete */
+            served = (s->dirKnown == 0xFFFFFFFFUL) ? 1 : 0;
+            if (served) {
+                *status = s->dir;
+            }
+        }
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return served;
+}
+
+static int32_t GPIO_SendCmd(LPC_HANDLE hUsbSio, uint8_t port, uint32_t cmd, uint32_t setPins, uint32_t clrPins,
+                            uint32_t* status, uint8_t getPin, uint8_t pin)
+{
+    LPCUSBSIO_Request_t sioReq;
+    int32_t res;
+
+    if (GPIO_CachedCmd(SIO_GetDevice(hUsbSio), port, cmd, setPins, clrPins, status, getPin)) {
+        /* same result as the response of a GPIO request */
+        g_lastError = LPCUSBSIO_OK;
+        return sizeof(uint32_t);
+    }
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    res = GPIO_SubmitCmd(hUsbSio, port, cmd, setPins, clrPins, status, getPin, pin, &sioReq);
+
+    return SIO_WaitResult(&sioReq, res);
+}
+
+/* Event thread of a device: runs the callbacks of the GPIO subscriptions and, unless the
+ * firmware reports the events itself, samples the watched ports. It submits requests
+ * like any caller and the reader thread delivers their responses, the reader thread
+ * itself never waits for the output pipe.
+ */
+static SIO_THREAD_RET_T SIO_THREAD_API SIO_EventThread(void *arg)
+{
+    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)arg;
+    LPC_HANDLE hUsbSio = SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0);
+    LPC_HANDLE hSub;
+    LPCUSBSIO_GpioSub_t *sub;
+    GPIO_EVENT_CALLBACK_T callback;
+    void *context;
+    uint64_t now, next = 0;
+    uint32_t pins, status, ports, i;
+    uint8_t port, due;
+
+    g_inEventThread = 1;
+    SIO_MutexLock(&dev->sioMutex);
+    while (dev->eventMode == SIO_EVENTS_RUNNING) {
+        for (i = 0; i < SIO_MAX_GPIO_SUBS; i++) {
+            sub = &dev->gpioSubs[i];
+            if (sub->active && (sub->cbPins != 0)) {
+                pins = sub->cbPins;
+                sub->cbPins = 0;
+                callback = sub->callback;
+                context = sub->context;
+                status = sub->status;
+                port = sub->port;
+                hSub = SIO_SubHandle(dev, i);
+                dev->eventCbSub = (uint8_t)(i + 1);
+                SIO_MutexUnlock(&dev->sioMutex);
+
+                callback(hSub, port, pins, status, context);
+
+                SIO_MutexLock(&dev->sioMutex);
+                dev->eventCbSub = 0;
+                SIO_CondBroadcast(&dev->eventCond);
+            }
+        }
+
+        ports = 0;
+        if ((dev->caps & HID_SIO_CAPS_GPIO_EVENTS) == 0) {
+            for (i = 0; i < SIO_MAX_GPIO_SUBS; i++) {
+                if (dev->gpioSubs[i].active) {
+                    ports |= 1u << dev->gpioSubs[i].port;
+                }
+            }
+        }
+        now = SIO_GetTickMs();
+        if ((ports != 0) && (now >= next)) {
+            next = now + dev->samplePeriod;
+            SIO_MutexUnlock(&dev->sioMutex);
+            for (port = 0; ports != 0; port++, ports >>= 1) {
+                if ((ports & 1) && (GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, &status, 0, 0) >= 0)) {
+                    SIO_MutexLock(&dev->sioMutex);
+                    SIO_GpioEventLocked(dev, port, status, 0, 0);
+                    SIO_MutexUnlock(&dev->sioMutex);
+                }
+            }
+            SIO_MutexLock(&dev->sioMutex);
+            continue;
+        }
+
+        /* the events may have been matched while the callbacks ran */
+        due = 0;
+        for (i = 0; i < SIO_MAX_GPIO_SUBS; i++) {
+            if (dev->gpioSubs[i].active && (dev->gpioSubs[i].cbPins != 0)) {
+                due = 1;
+            }
+        }
+        if ((due == 0) && (dev->eventMode == SIO_EVENTS_RUNNING)) {
+            SIO_CondWait(&dev->eventCond, &dev->sioMutex, (ports != 0) ? (uint32_t)(next - now) : LPCUSBSIO_READ_TMO);
+        }
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return 0;
+}
+
+/* Stop the event thread of a device and drop its GPIO subscriptions, called without sioMutex held */
+static void SIO_StopEvents(LPCUSBSIO_Ctrl_t *dev)
+{
+    SIO_MutexLock(&dev->sioMutex);
+    if (dev->eventMode == SIO_EVENTS_RUNNING) {
+        dev->eventMode = SIO_EVENTS_STOPPING;
+        SIO_CondBroadcast(&dev->eventCond);
+        SIO_MutexUnlock(&dev->sioMutex);
+
+        SIO_ThreadJoin(dev->eventThread);
+
+        SIO_MutexLock(&dev->sioMutex);
+        dev->eventMode = SIO_EVENTS_STOPPED;
+    }
+    memset(&dev->gpioSubs[0], 0, sizeof(dev->gpioSubs));
+    dev->gpioLevelKnown = 0;
+    /* wake up GPIO_WaitEvent() callers */
+    SIO_CondBroadcast(&dev->eventCond);
+    SIO_MutexUnlock(&dev->sioMutex);
+}
+
+static int32_t GPIO_SubmitTogglePin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Segment_t seg;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* construct req packet */
+    seg.data = &pin;
+    seg.len = 1;
+
+    pReq->resKind = SIO_RES_STATUS;
+    pReq->pin = pin;
+    return SIO_SubmitRequest(dev, pReq, port, HID_GPIO_REQ_TOGGLE_PIN, &seg, 1);
+}
+
+static int32_t GPIO_SubmitConfigIOPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin, uint32_t mode, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Segment_t seg;
+    uint8_t outData[5];
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* construct req packet */
+    outData[0] = (uint8_t)((mode >> 0) & 0xff);
+    outData[1] = (uint8_t)((mode >> 8) & 0xff);
+    outData[2] = (uint8_t)((mode >> 16) & 0xff);
+    outData[3] = (uint8_t)((mode >> 24) & 0xff);
+    outData[4] = pin;
+    seg.data = &outData[0];
+    seg.len = sizeof(outData);
+
+    pReq->resKind = SIO_RES_STATUS;
+    pReq->pin = pin;
+    pReq->args[0] = mode;
+    return SIO_SubmitRequest(dev, pReq, port, HID_GPIO_REQ_IOCONFIG, &seg, 1);
+}
+
+static int32_t I2C_SubmitDeviceRead(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer, uint16_t sizeToTransfer,
+                                    uint8_t options, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Ctrl_t *dev;
+    HID_I2C_RW_PARAMS_T param;
+    LPCUSBSIO_Segment_t seg;
+
+    if (devI2c == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+
+    /* do parameter check */
+    if ((sizeToTransfer > dev->maxDataSize) ||
+        ((sizeToTransfer > 0) && (buffer == NULL)) ||
+        (deviceAddress > 127)) {
+
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    param.length = sizeToTransfer;
+    param.options = options;
+    param.slaveAddr = deviceAddress;
+
+    seg.data = (const uint8_t *)&param;
+    seg.len = sizeof(HID_I2C_RW_PARAMS_T);
+
+    /* response data goes straight to the user buffer */
+    pReq->resKind = SIO_RES_IN_LEN;
+    pReq->inData = buffer;
+    pReq->inSize = sizeToTransfer;
+    return SIO_SubmitRequest(dev, pReq, devI2c->portNum, HID_I2C_REQ_DEVICE_READ, &seg, 1);
+}
+
+static int32_t I2C_SubmitDeviceWrite(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer, uint16_t sizeToTransfer,
+                                     uint8_t options, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Ctrl_t *dev;
+    HID_I2C_RW_PARAMS_T param;
+    LPCUSBSIO_Segment_t segs[2];
+
+    if (devI2c == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+
+    /* do parameter check */
+    if ((sizeToTransfer > dev->maxDataSize) ||
+        ((sizeToTransfer > 0) && (buffer == NULL)) ||
+        (deviceAddress > 127)) {
+
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+
+    param.length = sizeToTransfer;
+    param.options = options;
+    param.slaveAddr = deviceAddress;
+    /* construct req packet: params followed by the data buffer */
+    segs[0].data = (const uint8_t *)&param;
+    segs[0].len = sizeof(HID_I2C_RW_PARAMS_T);
+    segs[1].data = buffer;
+    segs[1].len = sizeToTransfer;
+
+    /* update user on transfered size */
+    pReq->resKind = SIO_RES_OUT_LEN;
+    pReq->outLen = sizeToTransfer;
+    return SIO_SubmitRequest(dev, pReq, devI2c->portNum, HID_I2C_REQ_DEVICE_WRITE, &segs[0], 2);
+}
+
+static int32_t I2C_SubmitFastXfer(LPC_HANDLE hI2C, I2C_FAST_XFER_T *xfer, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Ctrl_t *dev;
+    HID_I2C_XFER_PARAMS_T param;
+    LPCUSBSIO_Segment_t segs[2];
+
+    if (devI2c == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+
+    /* do parameter check */
+    if ((xfer->txSz > dev->maxDataSize) || (xfer->rxSz > dev->maxDataSize) ||
+        ((xfer->txSz > 0) && (xfer->txBuff == NULL)) ||
+        ((xfer->rxSz > 0) && (xfer->rxBuff == NULL)) ||
+        (xfer->slaveAddr > 127) ) {
+
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    param.txLength = xfer->txSz;
+    param.rxLength = xfer->rxSz;
+    param.options = xfer->options;
+    param.slaveAddr = xfer->slaveAddr;
+    /* construct req packet: params followed by the transmit buffer */
+    segs[0].data = (const uint8_t *)&param;
+    segs[0].len = sizeof(HID_I2C_XFER_PARAMS_T);
+    segs[1].data = xfer->txBuff;
+    segs[1].len = xfer->txSz;
+
+    pReq->resKind = SIO_RES_XFER_LEN;
+    pReq->outLen = xfer->txSz;
+    pReq->inData = xfer->rxBuff;
+    pReq->inSize = xfer->rxSz;
+    return SIO_SubmitRequest(dev, pReq, devI2c->portNum, HID_I2C_REQ_DEVICE_XFER, &segs[0], 2);
+}
+
+/* SPI transfer options sent to the firmware. Transmit only transfers are sent as full
+   duplex ones to firmware without HID_SIO_CAPS_SPI_TX_ONLY, the library drops the echo. */
+static uint8_t SPI_XferOptions(LPCUSBSIO_Ctrl_t *dev, uint8_t options)
+{
+    if ((dev->caps & HID_SIO_CAPS_SPI_TX_ONLY) == 0) {
+        options &= ~HID_SPI_XFER_OPTION_TX_ONLY;
+    }
+    return options;
+}
+
+static int32_t SPI_SubmitTransfer(LPC_HANDLE hSPI, SPI_XFER_T *xfer, LPCUSBSIO_Request_t *pReq)
+{
+    LPCUSBSIO_PortCtrl_t *devSPI = SIO_GetPort(hSPI, SIO_HANDLE_SPI);
+    LPCUSBSIO_Ctrl_t *dev;
+    HID_SPI_XFER_PARAMS_T param;
+    LPCUSBSIO_Segment_t segs[2];
+
+    if (devSPI == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devSPI->hUsbSio;
+
+    /* do parameter check */
+    if ((xfer->length > dev->maxDataSize) ||
+        ((xfer->length > 0) && (xfer->txBuff == NULL)) ||
+        ((xfer->length > 0) && (xfer->rxBuff == NULL) && ((xfer->options & HID_SPI_XFER_OPTION_TX_ONLY) == 0))) {
+
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+
+    Log("SPI_Transfer(hSPI=%p, xfer->device=%d, xfer->length=%d, xfer->options=%d)\n", hSPI, xfer->device, xfer->length, xfer->options);
+
+    param.length = xfer->length;
+    param.options = SPI_XferOptions(dev, xfer->options);
+    param.device = xfer->device;
+    /* construct req packet: params followed by the transmit buffer */
+    /* Note that the for 16 bit data transfer the bytes are transferred in Little Endian Format */
+    segs[0].data = (const uint8_t *)&param;
+    segs[0].len = sizeof(HID_SPI_XFER_PARAMS_T);
+    segs[1].data = xfer->txBuff;
+    segs[1].len = xfer->length;
+
+    pReq->args[0] = xfer->device;
+    if (xfer->options & HID_SPI_XFER_OPTION_TX_ONLY) {
+        /* report the transmitted size, whatever the firmware sends back is dropped */
+        pReq->resKind = SIO_RES_XFER_LEN;
+        pReq->outLen = xfer->length;
+    }
+    else {
+        pReq->resKind = SIO_RES_IN_LEN;
+        pReq->inData = xfer->rxBuff;
+        pReq->inSize = xfer->length;
+    }
+    return SIO_SubmitRequest(dev, pReq, devSPI->portNum, HID_SPI_REQ_DEVICE_XFER, &segs[0], 2);
+}
+
+void free_hid_dev(struct hid_device_info *dev)
+{
+    dev->next = NULL;
+    g_hid->free_enumeration(dev);
+}
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetNumPorts(uint32_t vid, uint32_t pid)
+{
+    LPCUSBSIO_DevList_t *list;
+    struct hid_device_info *cur_dev;
+    struct hid_device_info *temp_dev;
+    struct hid_device_info *prev_dev = NULL;
+    int32_t count = 0;
+    long hotplug;
+
+    Log("LPCUSBSIO_GetNumPorts(vid=0x%x, pid=0x%x)\n", vid, pid);
+
+    /* the current enumeration stays valid until a HID device arrives or leaves, the count is
+       taken first so that a device plugged during the enumeration is seen by the next call */
+    SIO_HidSelect();
+    hotplug = g_hid->hotplug_count();
+    list = SIO_AcquireDevList();
+    if ((list != NULL) && (hotplug >= 0) && (list->hotplugCount == hotplug) && (list->vid == vid) &&
+        (list->pid == pid)) {
+        count = (int32_t)list->count;
+        SIO_ReleaseDevList(list);
+        Log("LPCUSBSIO_GetNumPorts returns %d cached\n", count);
+        return count;
+    }
+    SIO_ReleaseDevList(list);
+
+    /* the new list is built privately, devices being opened keep using the previous one */
+    list = (LPCUSBSIO_DevList_t *)malloc(sizeof(LPCUSBSIO_DevList_t));
+    if (list == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+    }
+    memset(list, 0, sizeof(LPCUSBSIO_DevList_t));
+    list->refs = 1;
+    list->vid = vid;
+    list->pid = pid;
+    list->hotplugCount = hotplug;
+    list->hid = g_hid;
+    cur_dev = list->info = g_hid->enumerate(vid, pid);
+
+    Log("hid_enumerate returns %p\n", cur_dev);
+
+    while (cur_dev)
+    {
+#if SIO_DEBUG
+        char ps[512];
+        wcstombs(ps, cur_dev->product_string, sizeof(ps)-1);
+        Log("    #if=%d product_string=%s ...", cur_dev->interface_number, ps);
+#endif
+
+        /* iterate through the list and remove non-SIO devices */
+#ifdef __MACH__
+        /* usage_page only usable on Win/Mac */
+        if (cur_dev->usage_page != (0xFF00| HID_USAGE_PAGE_SERIAL_IO))
+        {
+#else
+        /* interface name used instead of usage_page indication */
+        if (wcsncmp(cur_dev->product_string, L"LPCSIO", 6) != 0 && wcsncmp(cur_dev->product_string, L"MCUSIO", 6) != 0)
+        {
+#endif
+            temp_dev = cur_dev->next;
+            /* Update head pointer if the head is removed */
+            if (list->info == cur_dev) {
+                list->info = temp_dev;
+            }
+            /*If previously valid device found then point it to next node */
+            if (prev_dev != NULL) {
+                prev_dev->next = temp_dev;
+            }
+            free_hid_dev(cur_dev);
+            cur_dev = temp_dev;
+            Log("skipping\n");
+            continue;
+        }
+        Log("using as device %d\n", count);
+        count++;
+        prev_dev = cur_dev;
+        cur_dev = cur_dev->next;
+    }
+
+    list->count = (uint32_t)count;
+    if (SIO_IndexDevList(list) != LPCUSBSIO_OK) {
+        list->refs = 0;
+        g_hid->free_enumeration(list->info);
+        free(list);
+        return g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+    }
+
+    /* free the previous list once no other thread uses it */
+    SIO_ReleaseDevList(SIO_SwapDevList(list));
+
+    Log("LPCUSBSIO_GetNumPorts returns %d\n", count);
+
+    return count;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetDeviceInfo(uint32_t index, HIDAPI_DEVICE_INFO_T* pInfo)
+{
+    LPCUSBSIO_DevList_t *list = SIO_AcquireDevList();
+    struct hid_device_info* dev = GetDevAtIndex(list, index);
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
+
+    /* copied under the reference, the strings stay valid while the list is the current one */
+    if (dev)
+    {
+        memset(pInfo, 0, sizeof(*pInfo));
+        pInfo->path = dev->path;
+        pInfo->vendor_id = dev->vendor_id;
+        pInfo->product_id = dev->product_id;
+        pInfo->serial_number = dev->serial_number;
         pInfo->release_number = dev->release_number;
         pInfo->manufacturer_string = dev->manufacturer_string;
         pInfo->product_string = dev->product_string;
         pInfo->interface_number = dev->interface_number;
+        res = LPCUSBSIO_OK;
+    }
+    SIO_ReleaseDevList(list);
+
+    return res;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetIndexBySerial(const wchar_t *serial)
+{
+    LPCUSBSIO_DevList_t *list = SIO_AcquireDevList();
+    int32_t index = (serial != NULL) ? SIO_FindDev(list, serial, NULL) : -1;
+
+    SIO_ReleaseDevList(list);
+    return (index >= 0) ? index : LPCUSBSIO_ERR_BAD_HANDLE;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetIndexByPath(const char *path)
+{
+    LPCUSBSIO_DevList_t *list = SIO_AcquireDevList();
+    int32_t index = (path != NULL) ? SIO_FindDev(list, NULL, path) : -1;
+
+    SIO_ReleaseDevList(list);
+    return (index >= 0) ? index : LPCUSBSIO_ERR_BAD_HANDLE;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_PortsChanged(void)
+{
+    long hotplug = g_hid->hotplug_count();
+    LPCUSBSIO_DevList_t *list = SIO_AcquireDevList();
+    int32_t res = ((list == NULL) || (hotplug < 0) || (list->hotplugCount != hotplug)) ? 1 : 0;
+
+    SIO_ReleaseDevList(list);
+    return res;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_SetBackend(uint32_t backend, const char *options)
+{
+    const SIO_HidBackend_t *hid;
+
+    Log("LPCUSBSIO_SetBackend(backend=%u, options=%s)\n", backend, (options != NULL) ? options : "");
+
+    if (backend == LPCUSBSIO_BACKEND_HIDAPI) {
+        hid = &g_hidApi;
+    }
+    else if (backend == LPCUSBSIO_BACKEND_MOCK) {
+        hid = &g_hidMock;
+    }
+    else {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    if ((SIO_AtomicLoad(&g_Ctrl.numDevices) != 0) || (g_hidapiEnums != NULL)) {
+        return g_lastError = LPCUSBSIO_ERR_HID_LIB;
+    }
+    /* an explicit choice overrides the environment */
+    SIO_HidSelect();
+    if ((hid == &g_hidMock) && (options != NULL) && (mock_hid_configure(options) != 0)) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+
+    /* the devices of the previous backend are gone */
+    SIO_ReleaseDevList(SIO_SwapDevList(NULL));
+    if (hid != g_hid) {
+        g_hid->exit();
+        g_hid = hid;
+    }
+    return LPCUSBSIO_OK;
+}
+
+/* Serial number of a controller as the key of its cache entry, returns 0 if it has none
+   or one which cannot be kept in the cache file */
+static uint32_t SIO_CapsSerial(const struct hid_device_info *info, char *serial)
+{
+    uint32_t i;
+
+    if (info->serial_number == NULL) {
+        return 0;
+    }
+    for (i = 0; info->serial_number[i] != 0; i++) {
+        if ((i == SIO_CAPS_SERIAL_LEN - 1) || (info->serial_number[i] <= 0x20) || (info->serial_number[i] >= 0x7F)) {
+            return 0;
+        }
+        serial[i] = (char)info->serial_number[i];
+    }
+    serial[i] = 0;
+    return i;
+}
+
+static SIO_CapsEntry_t *SIO_CapsFindLocked(uint16_t vid, uint16_t pid, uint16_t release, const char *serial)
+{
+    uint32_t i;
+
+    for (i = 0; i < g_Ctrl.numCaps; i++) {
+        if ((g_Ctrl.caps[i].vid == vid) && (g_Ctrl.caps[i].pid == pid) && (g_Ctrl.caps[i].release == release) &&
+            (strcmp(g_Ctrl.caps[i].serial, serial) == 0)) {
+            return &g_Ctrl.caps[i];
+        }
+    }
+    return NULL;
+}
+
+static void SIO_CapsToDev(const SIO_CapsEntry_t *e, LPCUSBSIO_Ctrl_t *dev)
+{
+    dev->maxI2CPorts = e->maxI2CPorts;
+    dev->maxSPIPorts = e->maxSPIPorts;
+    dev->maxGPIOPorts = e->maxGPIOPorts;
+    dev->caps = e->caps;
+    dev->maxDataSize = e->maxDataSize;
+    dev->fwVersion = e->fwVersion;
+    memcpy(&dev->fwBuild[0], &e->fwBuild[0], sizeof(dev->fwBuild));
+}
+
+/* Copy the capabilities of a device into an entry, returns 0 if they were there already */
+static uint32_t SIO_CapsFromDev(SIO_CapsEntry_t *e, const LPCUSBSIO_Ctrl_t *dev)
+{
+    uint32_t changed = ((e->maxI2CPorts != dev->maxI2CPorts) || (e->maxSPIPorts != dev->maxSPIPorts) ||
+                        (e->maxGPIOPorts != dev->maxGPIOPorts) || (e->caps != dev->caps) ||
+                        (e->maxDataSize != dev->maxDataSize) || (e->fwVersion != dev->fwVersion) ||
+                        (strcmp(e->fwBuild, dev->fwBuild) != 0)) ? 1 : 0;
+
+    e->maxI2CPorts = dev->maxI2CPorts;
+    e->maxSPIPorts = dev->maxSPIPorts;
+    e->maxGPIOPorts = dev->maxGPIOPorts;
+    e->caps = dev->caps;
+    e->maxDataSize = dev->maxDataSize;
+    e->fwVersion = dev->fwVersion;
+    memcpy(&e->fwBuild[0], &dev->fwBuild[0], sizeof(e->fwBuild));
+    return changed;
+}
+
+static FILE *SIO_CapsOpenFile(const char *path, const char *mode)
+{
+    FILE *f;
+
+#ifdef _WIN32
+    if (fopen_s(&f, path, mode) != 0) {
+        f = NULL;
+    }
+#else
+    f = fopen(path, mode);
+#endif
+    return f;
+}
+
+/* Add the entries of the cache file, one line per controller:
+   vid pid release serial i2c spi gpio caps maxDataSize fwVersion fwBuild */
+static void SIO_CapsLoadLocked(void)
+{
+    char line[SIO_CAPS_SERIAL_LEN + MAX_FWVER_STRLEN + 64];
+    SIO_CapsEntry_t *e;
+    char *p;
+    size_t len;
+    uint32_t i;
+    FILE *f = SIO_CapsOpenFile(g_Ctrl.capsPath, "r");
+
+    if (f == NULL) {
+        return;
+    }
+    while ((g_Ctrl.numCaps < SIO_MAX_CAPS) && (fgets(&line[0], sizeof(line), f) != NULL)) {
+        e = &g_Ctrl.caps[g_Ctrl.numCaps];
+        p = &line[0];
+        e->vid = (uint16_t)strtoul(p, &p, 16);
+        e->pid = (uint16_t)strtoul(p, &p, 16);
+        e->release = (uint16_t)strtoul(p, &p, 16);
+        while (*p == ' ') {
+            p++;
+        }
+        for (i = 0; (i < SIO_CAPS_SERIAL_LEN - 1) && (p[i] > 0x20) && (p[i] < 0x7F); i++) {
+            e->serial[i] = p[i];
+        }
+        e->serial[i] = 0;
+        p += i;
+        e->maxI2CPorts = (uint8_t)strtoul(p, &p, 10);
+        e->maxSPIPorts = (uint8_t)strtoul(p, &p, 10);
+        e->maxGPIOPorts = (uint8_t)strtoul(p, &p, 10);
+        e->caps = (uint8_t)strtoul(p, &p, 10);
+        e->maxDataSize = (uint32_t)strtoul(p, &p, 10);
+        e->fwVersion = (uint32_t)strtoul(p, &p, 10);
+        /* the rest of the line is the version string */
+        len = strcspn(p, "\r\n");
+        if ((i == 0) || (e->maxDataSize == 0) || (*p != ' ') || (len > MAX_FWVER_STRLEN) ||
+            (SIO_CapsFindLocked(e->vid, e->pid, e->release, e->serial) != NULL)) {
+            continue;
+        }
+        memcpy(&e->fwBuild[0], p + 1, len - 1);
+        e->fwBuild[len - 1] = 0;
+        g_Ctrl.numCaps++;
+    }
+    fclose(f);
+}
+
+/* Rewrite the cache file if the entries changed since it was last written. The entries
+   are copied under capsMutex and written without it to a file of this process, which then
+   replaces the cache file so that no reader sees it partly written. */
+static void SIO_CapsSave(void)
+{
+    char path[SIO_TRACE_PATH_LEN];
+    char tmp[SIO_TRACE_PATH_LEN + 16];
+    const SIO_CapsEntry_t *e;
+    SIO_CapsEntry_t *entries;
+    uint32_t num, gen, i;
+    int32_t ok;
+    FILE *f;
+
+    SIO_MutexLock(&g_Ctrl.capsSaveMutex);
+    entries = (SIO_CapsEntry_t *)malloc(sizeof(g_Ctrl.caps));
+    SIO_MutexLock(&g_Ctrl.capsMutex);
+    gen = g_Ctrl.capsGen;
+    num = g_Ctrl.numCaps;
+    memcpy(&path[0], &g_Ctrl.capsPath[0], sizeof(path));
+    if (entries != NULL) {
+        memcpy(entries, &g_Ctrl.caps[0], num * sizeof(SIO_CapsEntry_t));
+    }
+    SIO_MutexUnlock(&g_Ctrl.capsMutex);
+
+    if ((entries != NULL) && (path[0] != 0) && (gen != g_Ctrl.capsSavedGen)) {
+#ifdef _WIN32
+        sprintf_s(&tmp[0], sizeof(tmp), "%s.%lu", path, (unsigned long)GetCurrentProcessId());
+#else
+        sprintf(&tmp[0], "%s.%lu", path, (unsigned long)getpid());
+#endif
+        f = SIO_CapsOpenFile(tmp, "w");
+        if (f != NULL) {
+            for (i = 0; i < num; i++) {
+                e = &entries[i];
+                fprintf(f, "%04x %04x %04x %s %u %u %u %u %u %u %s\n", e->vid, e->pid, e->release, e->serial,
+                        e->maxI2CPorts, e->maxSPIPorts, e->maxGPIOPorts, e->caps, e->maxDataSize, e->fwVersion,
+                        e->fwBuild);
+            }
+            ok = (ferror(f) == 0) ? 1 : 0;
+            if (fclose(f) != 0) {
+                ok = 0;
+            }
+#ifdef _WIN32
+            if (ok && (MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING) == 0)) {
+                ok = 0;
+            }
+#else
+            if (ok && (rename(tmp, path) != 0)) {
+                ok = 0;
+            }
+#endif
+            if (ok) {
+                g_Ctrl.capsSavedGen = gen;
+            }
+            else {
+                remove(tmp);
+            }
+        }
+    }
+    free(entries);
+    SIO_MutexUnlock(&g_Ctrl.capsSaveMutex);
+}
+
+/* Enable or disable the capability cache, loading the entries of the file if one is named */
+static void SIO_CapsSetup(uint8_t enable, const char *path)
+{
+    SIO_MutexLock(&g_Ctrl.capsMutex);
+    if (path != NULL) {
+        memcpy(&g_Ctrl.capsPath[0], path, strlen(path) + 1);
+        SIO_CapsLoadLocked();
+    }
+    else {
+        g_Ctrl.capsPath[0] = 0;
+    }
+    SIO_AtomicStore(&g_Ctrl.capsOn, enable ? 1 : 0);
+    SIO_MutexUnlock(&g_Ctrl.capsMutex);
+}
+
+/* Set up an opening device from the cache, returns 0 if it is not cached. The
+   capabilities are confirmed by SIO_CapsCheck() before the first request. */
+static uint32_t SIO_CapsLookup(const struct hid_device_info *info, LPCUSBSIO_Ctrl_t *dev)
+{
+    char serial[SIO_CAPS_SERIAL_LEN];
+    const SIO_CapsEntry_t *e;
+
+    if ((SIO_AtomicLoad(&g_Ctrl.capsOn) == 0) || (SIO_CapsSerial(info, &serial[0]) == 0)) {
+        return 0;
+    }
+    SIO_MutexLock(&g_Ctrl.capsMutex);
+    e = SIO_CapsFindLocked(info->vendor_id, info->product_id, info->release_number, &serial[0]);
+    if (e != NULL) {
+        SIO_CapsToDev(e, dev);
+        dev->capsEntry = (uint32_t)(e - &g_Ctrl.caps[0]) + 1;
+        dev->capsCheck = 1;
+    }
+    SIO_MutexUnlock(&g_Ctrl.capsMutex);
+    return (e != NULL) ? 1 : 0;
+}
+
+/* Add the capabilities of an opened device to the cache */
+static void SIO_CapsStore(const struct hid_device_info *info, const LPCUSBSIO_Ctrl_t *dev)
+{
+    char serial[SIO_CAPS_SERIAL_LEN];
+    SIO_CapsEntry_t *e;
+
+    if ((SIO_AtomicLoad(&g_Ctrl.capsOn) == 0) || (SIO_CapsSerial(info, &serial[0]) == 0)) {
+        return;
+    }
+    SIO_MutexLock(&g_Ctrl.capsMutex);
+    e = SIO_CapsFindLocked(info->vendor_id, info->product_id, info->release_number, &serial[0]);
+    if ((e == NULL) && (g_Ctrl.numCaps < SIO_MAX_CAPS)) {
+        e = &g_Ctrl.caps[g_Ctrl.numCaps++];
+        e->vid = info->vendor_id;
+        e->pid = info->product_id;
+        e->release = info->release_number;
+        memcpy(&e->serial[0], &serial[0], sizeof(serial));
+    }
+    if (e != NULL) {
+        SIO_CapsFromDev(e, dev);
+        g_Ctrl.capsGen++;
+    }
+    SIO_MutexUnlock(&g_Ctrl.capsMutex);
+
+    if (e != NULL) {
+        SIO_CapsSave();
+    }
+}
+
+/* Ask the firmware for the capabilities of an opening device, LPCUSBSIO_OK once known */
+static int32_t SIO_GetDevInfo(LPCUSBSIO_Ctrl_t *dev)
+{
+    /* on the stack, the request is also sent on the transfer path by SIO_CapsCheck() */
+    uint8_t inData[12 + MAX_FWVER_STRLEN];
+    uint32_t inLen;
+    int32_t res;
+
+    memset(inData, 0, sizeof(inData));
+    /* Send HID_SIO_REQ_DEV_INFO, keep the version string zero terminated */
+    inLen = 12 + MAX_FWVER_STRLEN - 1;
+    res = SIO_SendRequest(dev, 0, HID_SIO_REQ_DEV_INFO, NULL, 0, inData, &inLen);
+    if (res == LPCUSBSIO_OK) {
+        /* parse response */
+        if (inLen >= 12)	{
+            dev->maxI2CPorts = inData[0];
+            dev->maxSPIPorts = inData[1];
+            dev->maxGPIOPorts = inData[2];
+            dev->caps = inData[3];
+            dev->maxDataSize = *((uint32_t*)(inData + 4));
+            dev->fwVersion = *((uint32_t*)(inData + 8));
+            /* copy data back to user buffer, the build string is cut to what fits after
+               the longest "FW 65535.65535 " */
+            #ifdef _WIN32
+            sprintf_s(&dev->fwBuild[0], MAX_FWVER_STRLEN, "FW %d.%d %.*s",
+                (dev->fwVersion >> 16),
+                (dev->fwVersion & 0xFFFF),
+                MAX_FWVER_STRLEN - 16, inData + 12);
+            #else
+            sprintf(&dev->fwBuild[0], "FW %d.%d %.*s",
+                (dev->fwVersion >> 16),
+                (dev->fwVersion & 0xFFFF),
+                MAX_FWVER_STRLEN - 16, inData + 12);
+            #endif
+        }
+        else {
+            res = LPCUSBSIO_ERR_HID_LIB;
+        }
+    }
+    else {
+        memcpy(&dev->fwBuild[0], &g_fwInitVer[0], strlen(g_fwInitVer));
+    }
+    return res;
+}
+
+/* Confirm the capabilities a device was opened with from the cache. The first caller asks
+   the firmware and refreshes the cache entry if the answer differs, the cached values are
+   kept if it cannot be asked. Other callers wait for the answer. */
+static void SIO_CapsCheck(LPCUSBSIO_Ctrl_t *dev)
+{
+    SIO_CapsEntry_t cached;
+    uint32_t changed = 0;
+
+    if (SIO_AtomicCas(&dev->capsCheck, 1, 2)) {
+        memset(&cached, 0, sizeof(cached));
+        SIO_CapsFromDev(&cached, dev);
+        /* callbacks run by this thread meanwhile must not wait for itself */
+        g_inCapsCheck = 1;
+        if (SIO_GetDevInfo(dev) != LPCUSBSIO_OK) {
+            SIO_CapsToDev(&cached, dev);
+        }
+        g_inCapsCheck = 0;
+
+        SIO_MutexLock(&g_Ctrl.capsMutex);
+        changed = SIO_CapsFromDev(&g_Ctrl.caps[dev->capsEntry - 1], dev);
+        if (changed) {
+            g_Ctrl.capsGen++;
+        }
+        SIO_MutexUnlock(&g_Ctrl.capsMutex);
+        if (changed) {
+            SIO_CapsSave();
+        }
+
+        SIO_MutexLock(&dev->sioMutex);
+        SIO_AtomicStore(&dev->capsCheck, 0);
+        SIO_CondBroadcast(&dev->rxCond);
+        SIO_MutexUnlock(&dev->sioMutex);
+        return;
+    }
+    SIO_MutexLock(&dev->sioMutex);
+    while ((SIO_AtomicLoad(&dev->capsCheck) != 0) && (dev->closing == 0)) {
+        SIO_ReadLocked(dev, LPCUSBSIO_READ_TMO);
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+}
+
+/* Open an enumerated device, the caller holds a reference to the list providing it */
+static LPCUSBSIO_Ctrl_t *SIO_OpenDev(struct hid_device_info *cur_dev)
+{
+    hid_device *pHid = NULL;
+    LPCUSBSIO_Ctrl_t *dev = NULL;
+    uint32_t i;
+    char env[16];
+
+    if (cur_dev) {
+        pHid = g_hid->open_path(cur_dev->path);
+
+        Log("LPCUSBSIO_Open: hid_open_path returns %p\n", pHid);
+
+        if (pHid) {
+            /* take a slot of the handle table, its handles become valid once the device is set up */
+            dev = SIO_ClaimSlot();
+            if (dev == NULL) {
+                g_hid->close(pHid);
+            }
+            else {
+                dev->hidDev = pHid;
+                g_lastError = LPCUSBSIO_OK;
+
+                dev->samplePeriod = SIO_GPIO_SAMPLE_MS;
+                dev->timeout = LPCUSBSIO_READ_TMO;
+
+                /* trace requested by the environment, see LPCUSBSIO_SetTrace() */
+                if (SIO_GetEnv("LPCUSBSIO_TRACE", &env[0], sizeof(env)) != NULL) {
+                    SIO_TraceStart(dev, (uint32_t)strtoul(&env[0], NULL, 0));
+                }
+
+                /* chain the preallocated request descriptors, the first one is used first */
+                for (i = SIO_REQ_POOL_SIZE; i > 0; i--) {
+                    dev->reqPool[i - 1].next = dev->reqFree;
+                    dev->reqFree = &dev->reqPool[i - 1];
+                }
+                dev->reqFreeTail = &dev->reqPool[SIO_REQ_POOL_SIZE - 1];
+
+                /* Set all calls to this hid device as blocking. */
+                // hid_set_nonblocking(dev->hidDev, 0);
+                /* the firmware is only asked for capabilities which are not cached */
+                if ((SIO_CapsLookup(cur_dev, dev) == 0) && (SIO_GetDevInfo(dev) == LPCUSBSIO_OK)) {
+                    SIO_CapsStore(cur_dev, dev);
+                }
+                SIO_PublishSlot(dev);
+            }
+        }
+    }
+    return dev;
+}
+
+LPCUSBSIO_API LPC_HANDLE LPCUSBSIO_Open(uint32_t index)
+{
+    LPCUSBSIO_Ctrl_t *dev;
+    LPCUSBSIO_DevList_t *list = SIO_AcquireDevList();
+    struct hid_device_info *cur_dev = GetDevAtIndex(list, index);
+
+    Log("LPCUSBSIO_Open(index=%d, dev_path=%s)\n", index, (cur_dev && cur_dev->path) ? cur_dev->path : "nil");
+
+    dev = SIO_OpenDev(cur_dev);
+    SIO_ReleaseDevList(list);
+    Log("LPCUSBSIO_Open: returning %p\n", dev);
+    return (dev != NULL) ? SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0) : NULL;
+}
+
+LPCUSBSIO_API LPC_HANDLE LPCUSBSIO_OpenBySerial(const wchar_t *serial)
+{
+    LPCUSBSIO_Ctrl_t *dev;
+    LPCUSBSIO_DevList_t *list = SIO_AcquireDevList();
+    int32_t index = (serial != NULL) ? SIO_FindDev(list, serial, NULL) : -1;
+
+    Log("LPCUSBSIO_OpenBySerial(index=%d)\n", index);
+
+    /* looked up and opened on the same list, a concurrent LPCUSBSIO_GetNumPorts() cannot move the index */
+    dev = (index >= 0) ? SIO_OpenDev(list->byIndex[index]) : NULL;
+    SIO_ReleaseDevList(list);
+    Log("LPCUSBSIO_OpenBySerial: returning %p\n", dev);
+    return (dev != NULL) ? SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0) : NULL;
+}
+
+static SIO_THREAD_RET_T SIO_THREAD_API SIO_OpenThread(void *arg)
+{
+    SIO_OpenJob_t *job = (SIO_OpenJob_t *)arg;
+    LPCUSBSIO_Ctrl_t *dev;
+    uint32_t i;
+
+    while ((i = SIO_AtomicAdd(&job->next, 1) - 1) < job->count) {
+        dev = (job->infos[i] != NULL) ? SIO_OpenDev(job->infos[i]) : NULL;
+        job->phUsbSio[i] = (dev != NULL) ? SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0) : NULL;
+    }
+
+    return 0;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_OpenMany(const uint32_t *indices, const wchar_t *const *serials, uint32_t count,
+                                         LPC_HANDLE *phUsbSio)
+{
+    SIO_THREAD_T threads[SIO_OPEN_THREADS - 1];
+    LPCUSBSIO_DevList_t *list;
+    SIO_OpenJob_t job;
+    uint32_t numThreads = 0;
+    uint32_t i;
+    int32_t index;
+    int32_t opened = 0;
+
+    if ((count == 0) || (phUsbSio == NULL) || ((indices == NULL) && (serials == NULL))) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    job.infos = (struct hid_device_info **)malloc(count * sizeof(struct hid_device_info *));
+    if (job.infos == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+    }
+    job.phUsbSio = phUsbSio;
+    job.count = count;
+    job.next = 0;
+
+    /* looked up and opened on the same list, see LPCUSBSIO_OpenBySerial() */
+    list = SIO_AcquireDevList();
+    for (i = 0; i < count; i++) {
+        if (indices != NULL) {
+            job.infos[i] = GetDevAtIndex(list, indices[i]);
+        }
+        else {
+            index = (serials[i] != NULL) ? SIO_FindDev(list, serials[i], NULL) : -1;
+            job.infos[i] = (index >= 0) ? list->byIndex[index] : NULL;
+        }
+    }
+
+    /* the calling thread opens devices too, and alone if no thread could be started */
+    while ((numThreads + 1 < count) && (numThreads < SIO_OPEN_THREADS - 1) &&
+           (SIO_ThreadCreate(&threads[numThreads], SIO_OpenThread, &job) == 0)) {
+        numThreads++;
+    }
+    SIO_OpenThread(&job);
+    for (i = 0; i < numThreads; i++) {
+        SIO_ThreadJoin(threads[i]);
+    }
+    SIO_ReleaseDevList(list);
+    free(job.infos);
+
+    for (i = 0; i < count; i++) {
+        if (phUsbSio[i] != NULL) {
+            opened++;
+        }
+    }
+    Log("LPCUSBSIO_OpenMany: %d of %d opened\n", opened, count);
+    return opened;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_SetCapsCache(uint8_t enable, const char *path)
+{
+    if ((path != NULL) && (strlen(path) >= SIO_TRACE_PATH_LEN)) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    /* the environment is read first, it does not override this call */
+    SIO_HidSelect();
+    SIO_CapsSetup(enable, path);
+    return LPCUSBSIO_OK;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_Close(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    int32_t res;
+    uint8_t i;
+    char path[SIO_TRACE_PATH_LEN];
+
+    Log("LPCUSBSIO_Close(hUsbSio=%p)\n", hUsbSio);
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    /* the handles of the device are invalid from here on, only one concurrent close wins */
+    if (SIO_AtomicCas(&g_Ctrl.devSlots[dev->slot].seq, dev->seq, dev->seq + 1) == 0) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    for (i = 0; i < dev->maxI2CPorts; i++) {
+        /* For each I2C port, check if it is open */
+        if (dev->i2cPorts[i].hUsbSio == dev) {
+            /* If I2C port is open, then close it */
+            res = SIO_ClosePort(&dev->i2cPorts[i], HID_I2C_REQ_DEINIT_PORT);
+        }
+    }
+
+    for (i = 0; i < dev->maxSPIPorts; i++) {
+        if (dev->spiPorts[i].hUsbSio == dev) {
+            /* Valid SPI port found, so close it */
+            res = SIO_ClosePort(&dev->spiPorts[i], HID_SPI_REQ_DEINIT_PORT);
+        }
+    }
+
+    SIO_MutexLock(&dev->sioMutex);
+    dev->closing = 1;
+    SIO_FailPending(dev, LPCUSBSIO_ERR_BAD_HANDLE);
+    SIO_CondBroadcast(&dev->rxCond);
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    SIO_StopEvents(dev);
+    SIO_StopReader(dev);
+
+    SIO_MutexLock(&dev->sioMutex);
+    /* wait for the thread writing to the device and for the active reader to leave */
+    SIO_PipeAcquireLocked(dev);
+    while (dev->readerActive) {
+        SIO_CondWait(&dev->rxCond, &dev->sioMutex, LPCUSBSIO_READ_TMO);
+    }
+    /* complete the outstanding asynchronous requests and release them */
+    SIO_RunCallbacksLocked(dev);
+    while (dev->asyncReqs != NULL) {
+        SIO_FreeRequest(dev, dev->asyncReqs);
+    }
+    g_hid->close(dev->hidDev);
+    dev->hidDev = NULL;
+    SIO_PipeReleaseLocked(dev);
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    /* nothing writes the trace any more, save it if the environment asks for it */
+    if ((dev->traceHead != 0) && (SIO_GetEnv("LPCUSBSIO_TRACE_FILE", &path[0], sizeof(path)) != NULL)) {
+        SIO_TraceDump(dev, &path[0]);
+    }
+
+    freeDevice(dev);
+
+    (void)(res);
+    return LPCUSBSIO_OK;
+}
+
+LPCUSBSIO_API const wchar_t *LPCUSBSIO_Error(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    const wchar_t *retStr = NULL;
+
+    if ((LPCUSBSIO_ERR_HID_LIB == g_lastError) && (dev != NULL)) {
+        retStr = g_hid->error(dev->hidDev);
+    } else {
+            retStr = GetErrorString(g_lastError);
+    }
+
+    return retStr;
+}
+
+LPCUSBSIO_API const char *LPCUSBSIO_GetVersion(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    uint32_t index = 0;
+
+    /* copy library version */
+    memcpy(&g_Version[index], &g_LibVersion[0], strlen(g_LibVersion));
+    index += (uint32_t)strlen(g_LibVersion);
+
+    /* if handle is good copy firmware version */
+    if (dev != NULL) {
+        g_Version[index] = '/';
+        index++;
+        /* copy firmware version */
+        memcpy(&g_Version[index], &dev->fwBuild[0], strlen(dev->fwBuild));
+        index += (uint32_t)strlen(dev->fwBuild);
+    }
+
+    return &g_Version[0];
+}
+
+LPCUSBSIO_API uint32_t LPCUSBSIO_GetNumI2CPorts(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    return dev->maxI2CPorts;
+}
+
+LPCUSBSIO_API uint32_t LPCUSBSIO_GetNumSPIPorts(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    return dev->maxSPIPorts;
+}
+
+LPCUSBSIO_API uint32_t LPCUSBSIO_GetNumGPIOPorts(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    return dev->maxGPIOPorts;
+}
+
+LPCUSBSIO_API uint32_t LPCUSBSIO_GetMaxDataSize(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    return dev->maxDataSize;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetLastError()
+{
+    return g_lastError;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetDeviceError(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    int32_t res;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    res = dev->lastError;
+    dev->lastError = LPCUSBSIO_OK;
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return res;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_SetReaderThread(LPC_HANDLE hUsbSio, uint8_t enable)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    int32_t res = LPCUSBSIO_OK;
+    uint8_t shared;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if (enable == LPCUSBSIO_READER_CALLER) {
+        SIO_StopReader(dev);
+        return LPCUSBSIO_OK;
+    }
+    /* a thread of its own where the backend cannot wait on several devices */
+    shared = ((enable == LPCUSBSIO_READER_SHARED) && (g_hid->poll(NULL, 0, NULL, 0) == 0)) ? 1 : 0;
+
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    while ((dev->readerMode == SIO_READER_STOPPING) && (dev->closing == 0)) {
+        SIO_CondWait(&dev->rxCond, &dev->sioMutex, LPCUSBSIO_READ_TMO);
+    }
+    if (dev->closing) {
+        res = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    else if (dev->readerMode == SIO_READER_CALLER) {
+        /* no caller takes the reader role from here on, wait for the active one to leave */
+        dev->readerMode = SIO_READER_STARTING;
+        while (dev->readerActive) {
+            SIO_CondWait(&dev->rxCond, &dev->sioMutex, LPCUSBSIO_READ_TMO);
+        }
+        dev->ringHead = 0;
+        dev->ringTail = 0;
+        if (dev->closing) {
+            res = LPCUSBSIO_ERR_BAD_HANDLE;
+        }
+        else if (shared) {
+            res = SIO_SharedAdd(dev);
+        }
+        else if (SIO_ThreadCreate(&dev->readerThread, SIO_ReaderThread, dev) != 0) {
+            res = LPCUSBSIO_ERR_SYNCHRONIZATION;
+        }
+        if (res != LPCUSBSIO_OK) {
+            dev->readerMode = SIO_READER_CALLER;
+        }
+        else {
+            dev->readerMode = shared ? SIO_READER_SHARED : SIO_READER_THREAD;
+        }
+        SIO_CondBroadcast(&dev->rxCond);
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    if (res != LPCUSBSIO_OK) {
+        g_lastError = res;
+    }
+    return res;
+}
+LPCUSBSIO_API int32_t LPCUSBSIO_SetSharedReaders(uint32_t numThreads)
+{
+    if (numThreads > SIO_MAX_SHARED_READERS) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    SIO_AtomicStore(&g_Ctrl.sharedMax, numThreads);
+    return LPCUSBSIO_OK;
+}
+LPCUSBSIO_API int32_t LPCUSBSIO_SetTimeout(LPC_HANDLE handle, uint32_t timeout_ms, uint32_t flags)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(handle);
+    LPCUSBSIO_PortCtrl_t *port = NULL;
+
+    if (dev == NULL) {
+        port = SIO_GetPort(handle, SIO_HANDLE_I2C);
+        if (port == NULL) {
+            port = SIO_GetPort(handle, SIO_HANDLE_SPI);
+        }
+        if (port == NULL) {
+            return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        }
+        dev = (LPCUSBSIO_Ctrl_t *)port->hUsbSio;
+    }
+    if ((flags & ~(uint32_t)(LPCUSBSIO_TIMEOUT_ADAPTIVE | LPCUSBSIO_TIMEOUT_TOTAL)) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    if (port != NULL) {
+        port->timeout = timeout_ms;
+        port->tmoFlags = (uint8_t)flags;
+    }
+    else {
+        dev->timeout = (timeout_ms != 0) ? timeout_ms : LPCUSBSIO_READ_TMO;
+        dev->tmoFlags = (uint8_t)flags;
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return g_lastError = LPCUSBSIO_OK;
+}
+
+LPCUSBSIO_API void LPCUSBSIO_SetCallTimeout(uint32_t timeout_ms)
+{
+    g_callTimeout = timeout_ms;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetStats(LPC_HANDLE handle, LPCUSBSIO_STATS_T *pStats)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(handle);
+    LPCUSBSIO_PortCtrl_t *port = NULL;
+
+    if (dev == NULL) {
+        port = SIO_GetPort(handle, SIO_HANDLE_I2C);
+        if (port == NULL) {
+            port = SIO_GetPort(handle, SIO_HANDLE_SPI);
+        }
+        if (port == NULL) {
+            return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        }
+        dev = (LPCUSBSIO_Ctrl_t *)port->hUsbSio;
+    }
+    if (pStats == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+
+    /* a copy under the lock, the traffic only waits for the memcpy */
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    memcpy(pStats, (port != NULL) ? &port->stats : &dev->stats, sizeof(LPCUSBSIO_STATS_T));
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return g_lastError = LPCUSBSIO_OK;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_SetTrace(LPC_HANDLE hUsbSio, uint32_t numRecords)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if (numRecords == 0) {
+        SIO_AtomicStore(&dev->traceOn, 0);
+        return g_lastError = LPCUSBSIO_OK;
+    }
+    return g_lastError = SIO_TraceStart(dev, numRecords);
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_GetTrace(LPC_HANDLE hUsbSio, LPCUSBSIO_TRACE_REC_T *pRecs, uint32_t maxRecs)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    uint32_t lost;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if ((pRecs == NULL) && (maxRecs > 0)) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    g_lastError = LPCUSBSIO_OK;
+    return (int32_t)SIO_TraceCopy(dev, pRecs, maxRecs, &lost);
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_DumpTrace(LPC_HANDLE hUsbSio, const char *path)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    int32_t res;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if (path == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    res = SIO_TraceDump(dev, path);
+    g_lastError = (res < 0) ? res : LPCUSBSIO_OK;
+    return res;
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_ResetStats(LPC_HANDLE hUsbSio)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    uint32_t i;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    for (i = 0; i < MAX_I2C_PORTS; i++) {
+        memset(&dev->i2cPorts[i].stats, 0, sizeof(dev->i2cPorts[i].stats));
+    }
+    for (i = 0; i < MAX_SPI_PORTS; i++) {
+        memset(&dev->spiPorts[i].stats, 0, sizeof(dev->spiPorts[i].stats));
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return g_lastError = LPCUSBSIO_OK;
+}
+
+/********************************  I2C functions *****************************************/
+
+LPCUSBSIO_API LPC_HANDLE I2C_Open(LPC_HANDLE hUsbSio, I2C_PORTCONFIG_T *config, uint8_t portNum)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    int32_t res;
+    LPC_HANDLE retHandle = NULL;
+
+
+    if ((dev == NULL) || (config == NULL) || (portNum >= dev->maxI2CPorts)) {
+        g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+        return NULL;
+    }
+
+    /* the config is sent as is */
+    res = SIO_SendRequest(dev, portNum, HID_I2C_REQ_INIT_PORT, (uint8_t *)config, sizeof(I2C_PORTCONFIG_T), NULL, NULL);
+    if (res == LPCUSBSIO_OK) {
+        dev->i2cPorts[portNum].portNum = portNum;
+        dev->i2cPorts[portNum].timeout = 0;
+        dev->i2cPorts[portNum].busSpeed = (uint32_t)config->ClockRate;
+        dev->i2cPorts[portNum].hUsbSio = (LPC_HANDLE)dev;
+        retHandle = SIO_MakeHandle(dev, SIO_HANDLE_I2C, portNum);
+    }
+
+    return retHandle;
+}
+
+LPCUSBSIO_API int32_t I2C_Close(LPC_HANDLE hI2C)
+{
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    if (devI2c == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    return SIO_ClosePort(devI2c, HID_I2C_REQ_DEINIT_PORT);
+}
+
+
+LPCUSBSIO_API int32_t I2C_DeviceRead(LPC_HANDLE hI2C,
+                                     uint8_t deviceAddress,
+                                     uint8_t *buffer,
+                                     uint16_t sizeToTransfer,
+                                     uint8_t options)
+{
+    LPCUSBSIO_Request_t sioReq;
+    int32_t res;
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    res = I2C_SubmitDeviceRead(hI2C, deviceAddress, buffer, sizeToTransfer, options, &sioReq);
+
+    return SIO_WaitResult(&sioReq, res);
+}
+
+LPCUSBSIO_API int32_t I2C_DeviceWrite(LPC_HANDLE hI2C,
+                                      uint8_t deviceAddress,
+                                      uint8_t *buffer,
+                                      uint16_t sizeToTransfer,
+                                      uint8_t options)
+{
+    LPCUSBSIO_Request_t sioReq;
+    int32_t res;
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    res = I2C_SubmitDeviceWrite(hI2C, deviceAddress, buffer, sizeToTransfer, options, &sioReq);
+
+    return SIO_WaitResult(&sioReq, res);
+}
+
+LPCUSBSIO_API int32_t I2C_FastXfer(LPC_HANDLE hI2C, I2C_FAST_XFER_T *xfer)
+{
+    LPCUSBSIO_Request_t sioReq;
+    int32_t res;
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    res = I2C_SubmitFastXfer(hI2C, xfer, &sioReq);
+
+    return SIO_WaitResult(&sioReq, res);
+}
+
+LPCUSBSIO_API int32_t I2C_FastXferV(LPC_HANDLE hI2C, uint8_t slaveAddr, uint16_t options,
+                                    const LPCUSBSIO_IOVEC_T *txv, uint32_t txCount,
+                                    const LPCUSBSIO_IOVEC_T *rxv, uint32_t rxCount)
+{
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Ctrl_t *dev;
+    LPCUSBSIO_Request_t sioReq;
+    HID_I2C_XFER_PARAMS_T param;
+    LPCUSBSIO_Segment_t segs[SIO_MAX_IOV + 1];
+    uint32_t txLen, rxLen;
+    int32_t res;
+
+    if (devI2c == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+
+    /* do parameter check */
+    if ((SIO_CheckIov(txv, txCount, dev->maxDataSize, &segs[1], &txLen) != LPCUSBSIO_OK) ||
+        (SIO_CheckIov(rxv, rxCount, dev->maxDataSize, NULL, &rxLen) != LPCUSBSIO_OK) ||
+        (slaveAddr > 127)) {
+
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    param.txLength = (uint16_t)txLen;
+    param.rxLength = (uint16_t)rxLen;
+    param.options = options;
+    param.slaveAddr = slaveAddr;
+    /* the params are followed by the transmit segments, gathered into the reports */
+    segs[0].data = (const uint8_t *)&param;
+    segs[0].len = sizeof(HID_I2C_XFER_PARAMS_T);
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    sioReq.resKind = SIO_RES_XFER_LEN;
+    sioReq.outLen = txLen;
+    sioReq.inSegs = rxv;
+    sioReq.numInSegs = rxCount;
+    sioReq.inSize = rxLen;
+    res = SIO_SubmitRequest(dev, &sioReq, devI2c->portNum, HID_I2C_REQ_DEVICE_XFER, &segs[0], txCount + 1);
+
+    return SIO_WaitResult(&sioReq, res);
+}
+
+LPCUSBSIO_API int32_t I2C_Reset(LPC_HANDLE hI2C)
+{
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Ctrl_t *dev;
+    int32_t res;
+
+    if (devI2c == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+
+    res = SIO_SendRequest(dev, devI2c->portNum, HID_I2C_REQ_RESET, NULL, 0, NULL, NULL);
+
+    return res;
+}
+
+/********************************  SPI functions *****************************************/
+
+LPCUSBSIO_API LPC_HANDLE SPI_Open(LPC_HANDLE hUsbSio, HID_SPI_PORTCONFIG_T *config, uint8_t portNum)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    int32_t res;
+    LPC_HANDLE retHandle = NULL;
+
+    if ((dev == NULL) || (config == NULL) || (portNum >= dev->maxSPIPorts)) {
+        g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+        return NULL;
+    }
+
+    Log("SPI_Open(hUsbSio=%p, cfg->busSpeed=%d, cfg->Options=%d, portNum=%d)\n", hUsbSio, config->busSpeed, config->Options);
+
+    /* the config is sent as is */
+    res = SIO_SendRequest(dev, portNum, HID_SPI_REQ_INIT_PORT, (uint8_t *)config, sizeof(HID_SPI_PORTCONFIG_T), NULL, NULL);
+    if (res == LPCUSBSIO_OK) {
+        dev->spiPorts[portNum].portNum = portNum;
+        dev->spiPorts[portNum].timeout = 0;
+        dev->spiPorts[portNum].busSpeed = config->busSpeed;
+        dev->spiPorts[portNum].hUsbSio = (LPC_HANDLE)dev;
+        retHandle = SIO_MakeHandle(dev, SIO_HANDLE_SPI, portNum);
+    }
+
+    Log("SPI_Open: returning %p)\n", retHandle);
+    return retHandle;
+}
+
+LPCUSBSIO_API int32_t SPI_Close(LPC_HANDLE hSPI)
+{
+    LPCUSBSIO_PortCtrl_t *devSPI = SIO_GetPort(hSPI, SIO_HANDLE_SPI);
+
+    if (devSPI == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    Log("SPI_Close(hSPI=%p\n", hSPI);
+
+    return SIO_ClosePort(devSPI, HID_SPI_REQ_DEINIT_PORT);
+}
+
+LPCUSBSIO_API int32_t SPI_Transfer(LPC_HANDLE hSPI, SPI_XFER_T *xfer)
+{
+    LPCUSBSIO_Request_t sioReq;
+    int32_t res;
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    res = SPI_SubmitTransfer(hSPI, xfer, &sioReq);
+    res = SIO_WaitResult(&sioReq, res);
+
+    Log("SPI_Transfer: returning %d\n", res);
+    return res;
+}
+
+LPCUSBSIO_API int32_t SPI_TransferV(LPC_HANDLE hSPI, uint8_t device, uint8_t options,
+                                    const LPCUSBSIO_IOVEC_T *txv, uint32_t txCount,
+                                    const LPCUSBSIO_IOVEC_T *rxv, uint32_t rxCount)
+{
+    LPCUSBSIO_PortCtrl_t *devSPI = SIO_GetPort(hSPI, SIO_HANDLE_SPI);
+    LPCUSBSIO_Ctrl_t *dev;
+    LPCUSBSIO_Request_t sioReq;
+    HID_SPI_XFER_PARAMS_T param;
+    LPCUSBSIO_Segment_t segs[SIO_MAX_IOV + 1];
+    uint32_t txLen, rxLen;
+    int32_t res;
+
+    if (devSPI == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devSPI->hUsbSio;
+
+    /* do parameter check, the length of the transfer is given by the transmit segments */
+    if ((SIO_CheckIov(txv, txCount, dev->maxDataSize, &segs[1], &txLen) != LPCUSBSIO_OK) ||
+        (SIO_CheckIov(rxv, rxCount, txLen, NULL, &rxLen) != LPCUSBSIO_OK)) {
+
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    if (rxCount == 0) {
+        /* nothing to receive into, do not have the data sent back */
+        options |= HID_SPI_XFER_OPTION_TX_ONLY;
+    }
+    param.length = (uint16_t)txLen;
+    param.options = SPI_XferOptions(dev, options);
+    param.device = device;
+    /* the params are followed by the transmit segments, gathered into the reports */
+    segs[0].data = (const uint8_t *)&param;
+    segs[0].len = sizeof(HID_SPI_XFER_PARAMS_T);
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    sioReq.resKind = (rxCount == 0) ? SIO_RES_XFER_LEN : SIO_RES_IN_LEN;
+    sioReq.args[0] = device;
+    sioReq.outLen = txLen;
+    sioReq.inSegs = rxv;
+    sioReq.numInSegs = rxCount;
+    sioReq.inSize = rxLen;
+    res = SIO_SubmitRequest(dev, &sioReq, devSPI->portNum, HID_SPI_REQ_DEVICE_XFER, &segs[0], txCount + 1);
+    res = SIO_WaitResult(&sioReq, res);
+
+    Log("SPI_TransferV: returning %d\n", res);
+    return res;
+}
+
+LPCUSBSIO_API int32_t SPI_Reset(LPC_HANDLE hSPI)
+{
+    LPCUSBSIO_PortCtrl_t *devSPI = SIO_GetPort(hSPI, SIO_HANDLE_SPI);
+    LPCUSBSIO_Ctrl_t *dev;
+    int32_t res;
+
+    if (devSPI == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+
+    Log("SPI_Reset(hSPI=%p)\n", hSPI);
+
+    /* get the SIO Device*/
+    dev = (LPCUSBSIO_Ctrl_t *)devSPI->hUsbSio;
+
+    res = SIO_SendRequest(dev, devSPI->portNum, HID_SPI_REQ_RESET, NULL, 0, NULL, NULL);
+
+    Log("SPI_Reset: returning %d\n", res);
+    return res;
+}
+
+/********************************  GPIO functions *****************************************/
+LPCUSBSIO_API int32_t GPIO_ReadPort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, status, 0, 0);
+}
+
+
+LPCUSBSIO_API int32_t GPIO_WritePort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status)
+{
+    uint32_t setPins = *status;
+
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, setPins, ~setPins, status, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_SetPort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, pins, 0, NULL, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_ClearPort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, pins, NULL, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_GetPortDir(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* pPins)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, 0, 0, pPins, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_SetPortOutDir(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, pins, 0, NULL, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_SetPortInDir(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, 0, pins, NULL, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_SetPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, (1 << pin), 0, NULL, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_GetPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, NULL, 1, pin);
+}
+
+LPCUSBSIO_API int32_t GPIO_ClearPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
+{
+    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, (1 << pin), NULL, 0, 0);
+}
+
+LPCUSBSIO_API int32_t GPIO_TogglePin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
+{
+    LPCUSBSIO_Request_t sioReq;
+    int32_t res;
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    res = GPIO_SubmitTogglePin(hUsbSio, port, pin, &sioReq);
+
+    return SIO_WaitResult(&sioReq, res);
+}
+
+LPCUSBSIO_API int32_t GPIO_ConfigIOPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin, uint32_t mode)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Request_t sioReq;
+    const LPCUSBSIO_GpioShadow_t *s;
+    uint8_t served = 0;
+    int32_t res;
+
+    if ((dev != NULL) && (port < SIO_MAX_GPIO_PORTS) && (pin < 32)) {
+        SIO_MutexLock(&dev->sioMutex);
+        s = &dev->gpioShadow[port];
+        served = ((dev->gpioCache != 0) && (s->modeKnown & (1UL << pin)) && (s->mode[pin] == mode)) ? 1 : 0;
+        SIO_MutexUnlock(&dev->sioMutex);
+    }
+    if (served) {
+        return g_lastError = LPCUSBSIO_OK;
+    }
+
+    memset(&sioReq, 0, sizeof(sioReq));
+    res = GPIO_SubmitConfigIOPin(hUsbSio, port, pin, mode, &sioReq);
+
+    return SIO_WaitResult(&sioReq, res);
+}
+
+LPCUSBSIO_API int32_t GPIO_UpdatePorts(LPC_HANDLE hUsbSio, const GPIO_PORT_UPDATE_T *updates, uint32_t *status, uint32_t count)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Request_t window[SIO_MAX_INFLIGHT_QUEUE];
+    uint32_t step = 0, sent = 0, collected = 0, port, cmd, setPins, clrPins;
+    uint32_t *pStatus;
+    int32_t res, err = LPCUSBSIO_OK;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if ((count > dev->maxGPIOPorts) || ((updates == NULL) && (status == NULL))) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+
+    /* send the requests of all ports back-to-back, like a batch */
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    SIO_PipeAcquireLocked(dev);
+    SIO_MutexUnlock(&dev->sioMutex);
+    g_cbHold++;
+
+    for (;;) {
+        if ((step < (2 * count)) && ((sent - collected) < SIO_MAX_INFLIGHT_QUEUE)) {
+            /* the output values go first so that pins switched to output start at their new level */
+            port = step / 2;
+            if ((step & 1) == 0) {
+                cmd = HID_GPIO_REQ_PORT_VALUE;
+                setPins = (updates != NULL) ? updates[port].setPins : 0;
+                clrPins = (updates != NULL) ? updates[port].clrPins : 0;
+                pStatus = (status != NULL) ? &status[port] : NULL;
+            }
+            else {
+                cmd = HID_GPIO_REQ_PORT_DIR;
+                setPins = (updates != NULL) ? updates[port].outPins : 0;
+                clrPins = (updates != NULL) ? updates[port].inPins : 0;
+                pStatus = NULL;
+            }
+            step++;
+
+            SIO_MutexLock(&dev->sioMutex);
+            GPIO_TrimLocked(dev, (uint8_t)port, cmd, &setPins, &clrPins);
+            SIO_MutexUnlock(&dev->sioMutex);
+            if ((setPins != 0) || (clrPins != 0) || (pStatus != NULL)) {
+                memset(&window[sent % SIO_MAX_INFLIGHT_QUEUE], 0, sizeof(LPCUSBSIO_Request_t));
+                window[sent % SIO_MAX_INFLIGHT_QUEUE].txHeld = 1;
+                res = GPIO_SubmitCmd(hUsbSio, (uint8_t)port, cmd, setPins, clrPins, pStatus, 0, 0, &window[sent % SIO_MAX_INFLIGHT_QUEUE]);
+                if (res == LPCUSBSIO_OK) {
+                    sent++;
+                }
+                else {
+                    /* the device is closing, do not send the rest */
+                    err = res;
+                    step = 2 * count;
+                }
+            }
+            continue;
+        }
+        if (collected == sent) {
+            break;
+        }
+        res = SIO_WaitResult(&window[collected % SIO_MAX_INFLIGHT_QUEUE], LPCUSBSIO_OK);
+        collected++;
+        if ((res < 0) && (err == LPCUSBSIO_OK)) {
+            err = res;
+        }
+    }
+
+    g_cbHold--;
+    SIO_MutexLock(&dev->sioMutex);
+    SIO_PipeReleaseLocked(dev);
+    SIO_RunCallbacksLocked(dev);
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return g_lastError = err;
+}
 
-        return LPCUSBSIO_OK;
+LPCUSBSIO_API int32_t GPIO_SetCache(LPC_HANDLE hUsbSio, uint8_t enable)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
     }
-    else
-    {
-        return LPCUSBSIO_ERR_BAD_HANDLE;
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
     }
+    /* start from an unknown state, it is learnt from the following requests */
+    dev->gpioCache = enable ? 1 : 0;
+    memset(&dev->gpioShadow[0], 0, sizeof(dev->gpioShadow));
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return g_lastError = LPCUSBSIO_OK;
 }
 
-LPCUSBSIO_API LPC_HANDLE LPCUSBSIO_Open(uint32_t index)
+/* Device a GPIO subscription handle refers to, NULL if it cannot be one. The subscription
+   is checked by SIO_GetSubLocked(). */
+static LPCUSBSIO_Ctrl_t *SIO_SubDevice(LPC_HANDLE hSub)
 {
-    hid_device *pHid = NULL;
-    LPCUSBSIO_Ctrl_t *dev = NULL;
-    struct hid_device_info *cur_dev = GetDevAtIndex(index);
-    int32_t res;
-    uint8_t *inData;
-    uint32_t inLen;
-
-    Log("LPCUSBSIO_Open(index=%d, dev_path=%s)\n", index, (cur_dev && cur_dev->path) ? cur_dev->path : "nil");
+    return SIO_LookupEntry(hSub, SIO_HANDLE_GPIO_SUB, SIO_MAX_GPIO_SUBS);
+}
 
-    if (cur_dev) {
-        pHid = hid_open_path(cur_dev->path);
+/* Resolve a GPIO subscription handle of dev, NULL unless the subscription it was returned
+   for is still active. Called with sioMutex held. */
+static LPCUSBSIO_GpioSub_t *SIO_GetSubLocked(LPCUSBSIO_Ctrl_t *dev, LPC_HANDLE hSub)
+{
+    uint32_t h = (uint32_t)(uintptr_t)hSub;
+    LPCUSBSIO_GpioSub_t *sub = &dev->gpioSubs[SIO_HANDLE_INDEX(h)];
 
-        Log("LPCUSBSIO_Open: hid_open_path returns %p\n", pHid);
+    return (sub->active && (sub->gen == SIO_HANDLE_GEN(h))) ? sub : NULL;
+}
 
-        if (pHid) {
-            dev = malloc(sizeof(LPCUSBSIO_Ctrl_t));
-            if (dev != NULL) {
-                memset(dev, 0, sizeof(LPCUSBSIO_Ctrl_t));
-                dev->hidDev = pHid;
-                dev->hidInfo = cur_dev;
-                g_lastError = LPCUSBSIO_OK;
+/* Read the status the subscriptions of a port start from. Firmware detecting the events
+   itself is told which edges of the port are watched. Returns negative error code on failure. */
+static int32_t SIO_GpioWatch(LPCUSBSIO_Ctrl_t *dev, LPC_HANDLE hUsbSio, uint8_t port, uint32_t *status)
+{
+    uint32_t masks[2] = {0, 0};
+    uint32_t inLen = sizeof(uint32_t);
+    uint32_t i;
 
-                /* insert at top */
-                dev->next = g_Ctrl.devList;
-                g_Ctrl.devList = dev;
-                /* Set all calls to this hid device as blocking. */
-                // hid_set_nonblocking(dev->hidDev, 0);
-                inData = (uint8_t *)malloc(12 + MAX_FWVER_STRLEN);
-#ifdef _WIN32
-                dev->sioMutex = CreateMutex(NULL, FALSE, NULL);
-                if (dev->sioMutex == NULL) {
-                    g_lastError = LPCUSBSIO_ERR_MUTEX_CREATE;
-                    if (inData != NULL) {
-                        free(inData);
-                    }
-                    return NULL;
-                }
-#else
-                res = pthread_mutex_init(&dev->sioMutex, NULL);
-                if (res != 0) {
-                    g_lastError = LPCUSBSIO_ERR_MUTEX_CREATE;
-                    if (inData != NULL) {
-                        free(inData);
-                    }
-                    return NULL;
-                }
-#endif
-                if (inData != NULL) {
-                    memset(inData, 0, 12 + MAX_FWVER_STRLEN);
-                    /* Send HID_SIO_REQ_DEV_INFO */
-                    res = SIO_SendRequest(dev, 0, HID_SIO_REQ_DEV_INFO, NULL, 0, inData, &inLen);
-                    if (res == LPCUSBSIO_OK) {
-                        /* parse response */
-                        if (inLen >= 12)	{
-                            dev->maxI2CPorts = inData[0];
-                            dev->maxSPIPorts = inData[1];
-                            dev->maxGPIOPorts = inData[2];
-                            dev->maxDataSize = *((uint32_t*)(inData + 4));
-                            dev->fwVersion = *((uint32_t*)(inData + 8));
-                            /* copy data back to user buffer */
-                            #ifdef _WIN32
-                            sprintf_s(&dev->fwBuild[0], MAX_FWVER_STRLEN, "FW %d.%d %s",
-                                (dev->fwVersion >> 16),
-                                (dev->fwVersion & 0xFFFF),
-                                inData + 12);
-                            #else
-                            sprintf(&dev->fwBuild[0], "FW %d.%d %s",
-                                (dev->fwVersion >> 16),
-                                (dev->fwVersion & 0xFFFF),
-                                inData + 12);
-                            #endif
-                        }
+    if ((dev->caps & HID_SIO_CAPS_GPIO_EVENTS) == 0) {
+        return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, status, 0, 0);
+    }
 
-                    }
-                    else {
-                        memcpy(&dev->fwBuild[0], &g_fwInitVer[0], strlen(g_fwInitVer));
-                    }
-                    free(inData);
-                }
+    SIO_MutexLock(&dev->sioMutex);
+    for (i = 0; i < SIO_MAX_GPIO_SUBS; i++) {
+        if (dev->gpioSubs[i].active && (dev->gpioSubs[i].port == port)) {
+            /* levels are entered by an edge as well */
+            if (dev->gpioSubs[i].condition & (GPIO_EVENT_RISING | GPIO_EVENT_HIGH)) {
+                masks[0] |= dev->gpioSubs[i].pins;
+            }
+            if (dev->gpioSubs[i].condition & (GPIO_EVENT_FALLING | GPIO_EVENT_LOW)) {
+                masks[1] |= dev->gpioSubs[i].pins;
             }
         }
     }
-    Log("LPCUSBSIO_Open: returning %p\n", dev);
-    return (LPC_HANDLE) dev;
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return SIO_SendRequest(dev, port, HID_GPIO_REQ_EVENT_CONFIG, (uint8_t *)&masks[0], sizeof(masks), (uint8_t *)status, &inLen);
 }
 
-LPCUSBSIO_API int32_t LPCUSBSIO_Close(LPC_HANDLE hUsbSio)
+LPCUSBSIO_API LPC_HANDLE GPIO_Subscribe(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins, uint8_t condition,
+                                        GPIO_EVENT_CALLBACK_T callback, void *context)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_GpioSub_t *sub = NULL;
+    LPC_HANDLE hSub = NULL;
+    uint32_t status = 0, i = 0, n;
     int32_t res;
-    uint8_t i;
-
-    Log("LPCUSBSIO_Close(hUsbSio=%p)\n", hUsbSio);
 
-    if (validHandle(hUsbSio) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    if (dev == NULL) {
+        g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        return NULL;
+    }
+    if ((port >= dev->maxGPIOPorts) || (port >= SIO_MAX_GPIO_PORTS) || (pins == 0) ||
+        ((condition & (GPIO_EVENT_BOTH_EDGES | GPIO_EVENT_HIGH | GPIO_EVENT_LOW)) == 0)) {
+        g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+        return NULL;
+    }
+    /* firmware events and the responses of the sampler are delivered by the reader thread,
+       which is left running by GPIO_Unsubscribe() */
+    res = LPCUSBSIO_SetReaderThread(hUsbSio, LPCUSBSIO_READER_OWN);
+    if (res != LPCUSBSIO_OK) {
+        return NULL;
     }
 
-    for (i = 0; i < dev->maxI2CPorts; i++) {
-        /* For each I2C port, check if it is open */
-        if (dev->i2cPorts[i].hUsbSio == dev) {
-            /* If I2C port is open, then close it */
-            res = I2C_Close(&dev->i2cPorts[i]);
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+        return NULL;
+    }
+    /* the free entries are taken in turn, so that an entry is reused after all others */
+    for (n = 0; n < SIO_MAX_GPIO_SUBS; n++) {
+        i = (dev->subNext + n) % SIO_MAX_GPIO_SUBS;
+        if (dev->gpioSubs[i].active == 0) {
+            break;
+        }
+    }
+    if (dev->closing) {
+        res = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    else if (n == SIO_MAX_GPIO_SUBS) {
+        res = LPCUSBSIO_ERR_MEM_ALLOC;
+    }
+    else if (dev->eventMode == SIO_EVENTS_STOPPED) {
+        if (SIO_ThreadCreate(&dev->eventThread, SIO_EventThread, dev) != 0) {
+            res = LPCUSBSIO_ERR_SYNCHRONIZATION;
+        }
+        else {
+            dev->eventMode = SIO_EVENTS_RUNNING;
         }
     }
+    if (res == LPCUSBSIO_OK) {
+        sub = &dev->gpioSubs[i];
+        memset(sub, 0, sizeof(LPCUSBSIO_GpioSub_t));
+        sub->active = 1;
+        sub->port = port;
+        sub->pins = pins;
+        sub->condition = condition;
+        sub->callback = callback;
+        sub->context = context;
+        sub->gen = SIO_EntryGen(dev, ++dev->subGen[i]);
+        dev->subNext = i + 1;
+        hSub = SIO_SubHandle(dev, i);
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
 
-    for (i = 0; i < dev->maxSPIPorts; i++) {
-        if (dev->spiPorts[i].hUsbSio == dev) {
-            /* Valid SPI port found, so close it */
-            res = SPI_Close(&dev->spiPorts[i]);
+    if (res == LPCUSBSIO_OK) {
+        res = SIO_GpioWatch(dev, hUsbSio, port, &status);
+        SIO_MutexLock(&dev->sioMutex);
+        if (res >= 0) {
+            SIO_GpioEventLocked(dev, port, status, 0, 0);
+        }
+        else {
+            sub->active = 0;
         }
+        SIO_MutexUnlock(&dev->sioMutex);
     }
-#ifdef _WIN32
-    if (dev->sioMutex != NULL) {
-        CloseHandle(dev->sioMutex);
-        dev->sioMutex = NULL;
+    if (res < 0) {
+        g_lastError = res;
+        return NULL;
     }
-#else
-    pthread_mutex_destroy(&dev->sioMutex);
-#endif
-    hid_close(dev->hidDev);
-    freeDevice(dev);
 
-    (void)(res);
-    return LPCUSBSIO_OK;
+    g_lastError = LPCUSBSIO_OK;
+    return hSub;
 }
 
-LPCUSBSIO_API const wchar_t *LPCUSBSIO_Error(LPC_HANDLE hUsbSio)
+LPCUSBSIO_API int32_t GPIO_WaitEvent(LPC_HANDLE hSub, uint32_t *pins, uint32_t *status, uint32_t timeout_ms)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
-    const wchar_t *retStr = NULL;
+    LPCUSBSIO_Ctrl_t *dev = SIO_SubDevice(hSub);
+    LPCUSBSIO_GpioSub_t *sub;
+    uint64_t now, deadline;
+    int32_t res = LPCUSBSIO_ERR_TIMEOUT;
 
-    if (LPCUSBSIO_ERR_HID_LIB == g_lastError) {
-        retStr = hid_error(dev->hidDev);
-    } else {
-            retStr = GetErrorString(g_lastError);
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    deadline = SIO_GetTickMs() + timeout_ms;
+    for (;;) {
+        sub = SIO_GetSubLocked(dev, hSub);
+        if ((sub == NULL) || dev->closing) {
+            res = LPCUSBSIO_ERR_BAD_HANDLE;
+            break;
+        }
+        if (sub->waitPins != 0) {
+            if (pins != NULL) {
+                *pins = sub->waitPins;
+            }
+            if (status != NULL) {
+                *status = sub->status;
+            }
+            sub->waitPins = 0;
+            res = LPCUSBSIO_OK;
+            break;
+        }
+        now = SIO_GetTickMs();
+        if (now >= deadline) {
+            break;
+        }
+        SIO_CondWait(&dev->eventCond, &dev->sioMutex, (uint32_t)(deadline - now));
     }
+    SIO_MutexUnlock(&dev->sioMutex);
 
-    return retStr;
+    return g_lastError = res;
 }
 
-LPCUSBSIO_API const char *LPCUSBSIO_GetVersion(LPC_HANDLE hUsbSio)
+LPCUSBSIO_API int32_t GPIO_Unsubscribe(LPC_HANDLE hSub)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
-    uint32_t index = 0;
-
-    /* copy library version */
-    memcpy(&g_Version[index], &g_LibVersion[0], strlen(g_LibVersion));
-    index += (uint32_t)strlen(g_LibVersion);
+    LPCUSBSIO_Ctrl_t *dev = SIO_SubDevice(hSub);
+    LPCUSBSIO_GpioSub_t *sub;
+    uint32_t index = SIO_HANDLE_INDEX((uint32_t)(uintptr_t)hSub);
+    uint32_t status, i;
+    uint8_t port, watched = 0;
+    int32_t res = LPCUSBSIO_OK;
+
+    if (dev == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    sub = SIO_GetSubLocked(dev, hSub);
+    if (sub == NULL) {
+        SIO_MutexUnlock(&dev->sioMutex);
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    port = sub->port;
+    sub->active = 0;
+    /* let a running callback of the subscription finish, unless this is called from it */
+    while ((dev->eventCbSub == index + 1) && (g_inEventThread == 0)) {
+        SIO_CondWait(&dev->eventCond, &dev->sioMutex, LPCUSBSIO_READ_TMO);
+    }
+    for (i = 0; i < SIO_MAX_GPIO_SUBS; i++) {
+        if (dev->gpioSubs[i].active && (dev->gpioSubs[i].port == port)) {
+            watched = 1;
+        }
+    }
+    if (watched == 0) {
+        dev->gpioLevelKnown &= (uint8_t)~(1u << port);
+    }
+    /* wake up GPIO_WaitEvent() callers of the subscription */
+    SIO_CondBroadcast(&dev->eventCond);
+    SIO_MutexUnlock(&dev->sioMutex);
 
-    /* if handle is good copy firmware version */
-    if (validHandle(hUsbSio) != 0) {
-        g_Version[index] = '/';
-        index++;
-        /* copy firmware version */
-        memcpy(&g_Version[index], &dev->fwBuild[0], strlen(dev->fwBuild));
-        index += (uint32_t)strlen(dev->fwBuild);
+    if (dev->caps & HID_SIO_CAPS_GPIO_EVENTS) {
+        res = SIO_GpioWatch(dev, SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0), port, &status);
     }
 
-    return &g_Version[0];
+    return g_lastError = (res < 0) ? res : LPCUSBSIO_OK;
 }
 
-LPCUSBSIO_API uint32_t LPCUSBSIO_GetNumI2CPorts(LPC_HANDLE hUsbSio)
+LPCUSBSIO_API int32_t GPIO_SetSamplePeriod(LPC_HANDLE hUsbSio, uint32_t period_ms)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
 
-    if (validHandle(hUsbSio) == 0) {
+    if (dev == NULL) {
         return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
     }
-    return dev->maxI2CPorts;
+    if (SIO_MutexLock(&dev->sioMutex) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    dev->samplePeriod = period_ms;
+    SIO_CondBroadcast(&dev->eventCond);
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return g_lastError = LPCUSBSIO_OK;
 }
 
-LPCUSBSIO_API uint32_t LPCUSBSIO_GetNumSPIPorts(LPC_HANDLE hUsbSio)
+LPCUSBSIO_API int32_t GPIO_ReadPorts(LPC_HANDLE hUsbSio, uint32_t *status, uint32_t count)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
-
-    if (validHandle(hUsbSio) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    if (status == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
     }
-    return dev->maxSPIPorts;
+    return GPIO_UpdatePorts(hUsbSio, NULL, status, count);
 }
 
-LPCUSBSIO_API uint32_t LPCUSBSIO_GetNumGPIOPorts(LPC_HANDLE hUsbSio)
+/********************************  Asynchronous requests *****************************************/
+
+LPCUSBSIO_API LPC_HANDLE I2C_DeviceReadAsync(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer, uint16_t sizeToTransfer,
+                                             uint8_t options, LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Request_t *pReq;
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
 
-    if (validHandle(hUsbSio) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    if (devI2c == NULL) {
+        g_lastError = res;
+        return NULL;
     }
-    return dev->maxGPIOPorts;
+    pReq = SIO_AllocRequest(devI2c->hUsbSio, callback, context);
+    if (pReq != NULL) {
+        res = I2C_SubmitDeviceRead(hI2C, deviceAddress, buffer, sizeToTransfer, options, pReq);
+    }
+    return SIO_AsyncHandle(pReq, res);
 }
 
-LPCUSBSIO_API uint32_t LPCUSBSIO_GetMaxDataSize(LPC_HANDLE hUsbSio)
+LPCUSBSIO_API LPC_HANDLE I2C_DeviceWriteAsync(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer, uint16_t sizeToTransfer,
+                                              uint8_t options, LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Request_t *pReq;
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
 
-    if (validHandle(hUsbSio) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    if (devI2c == NULL) {
+        g_lastError = res;
+        return NULL;
     }
-    return dev->maxDataSize;
+    pReq = SIO_AllocRequest(devI2c->hUsbSio, callback, context);
+    if (pReq != NULL) {
+        res = I2C_SubmitDeviceWrite(hI2C, deviceAddress, buffer, sizeToTransfer, options, pReq);
+    }
+    return SIO_AsyncHandle(pReq, res);
 }
 
-LPCUSBSIO_API int32_t LPCUSBSIO_GetLastError()
+LPCUSBSIO_API LPC_HANDLE I2C_FastXferAsync(LPC_HANDLE hI2C, I2C_FAST_XFER_T *xfer,
+                                           LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
 {
-    return g_lastError;
+    LPCUSBSIO_PortCtrl_t *devI2c = SIO_GetPort(hI2C, SIO_HANDLE_I2C);
+    LPCUSBSIO_Request_t *pReq;
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
+
+    if (devI2c == NULL) {
+        g_lastError = res;
+        return NULL;
+    }
+    pReq = SIO_AllocRequest(devI2c->hUsbSio, callback, context);
+    if (pReq != NULL) {
+        res = I2C_SubmitFastXfer(hI2C, xfer, pReq);
+    }
+    return SIO_AsyncHandle(pReq, res);
 }
-/********************************  I2C functions *****************************************/
 
-LPCUSBSIO_API LPC_HANDLE I2C_Open(LPC_HANDLE hUsbSio, I2C_PORTCONFIG_T *config, uint8_t portNum)
+LPCUSBSIO_API LPC_HANDLE SPI_TransferAsync(LPC_HANDLE hSPI, SPI_XFER_T *xfer,
+                                           LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *) hUsbSio;
-    int32_t res;
-    uint8_t *outData;
-    LPC_HANDLE retHandle = NULL;
-
+    LPCUSBSIO_PortCtrl_t *devSPI = SIO_GetPort(hSPI, SIO_HANDLE_SPI);
+    LPCUSBSIO_Request_t *pReq;
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
 
-    if ((validHandle(hUsbSio) == 0) || (config == NULL) || (portNum >= dev->maxI2CPorts)) {
-        g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    if (devSPI == NULL) {
+        g_lastError = res;
         return NULL;
     }
-
-    /* construct req packet */
-    outData = (uint8_t *)malloc(sizeof(I2C_PORTCONFIG_T));
-    if (outData != NULL) {
-        memcpy(outData, config, sizeof(I2C_PORTCONFIG_T));
-        res = SIO_SendRequest(dev, portNum, HID_I2C_REQ_INIT_PORT, outData, sizeof(I2C_PORTCONFIG_T), NULL, NULL);
-        if (res == LPCUSBSIO_OK) {
-            dev->i2cPorts[portNum].portNum = portNum;
-            dev->i2cPorts[portNum].hUsbSio = (LPC_HANDLE)dev;
-            retHandle = (LPC_HANDLE)&dev->i2cPorts[portNum];
-        }
-        free(outData);
+    pReq = SIO_AllocRequest(devSPI->hUsbSio, callback, context);
+    if (pReq != NULL) {
+        res = SPI_SubmitTransfer(hSPI, xfer, pReq);
     }
-
-    return retHandle;
+    return SIO_AsyncHandle(pReq, res);
 }
 
-LPCUSBSIO_API int32_t I2C_Close(LPC_HANDLE hI2C)
+/* Submit an asynchronous GPIO port request */
+static LPC_HANDLE GPIO_SendCmdAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t cmd, uint32_t setPins, uint32_t clrPins,
+                                    uint32_t* status, uint8_t getPin, uint8_t pin,
+                                    LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
 {
-    LPCUSBSIO_PortCtrl_t *devI2c = (LPCUSBSIO_PortCtrl_t *)hI2C;
-    int32_t res;
-    if (validPortHandle(hI2C) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Request_t *pReq;
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
+
+    if (dev == NULL) {
+        g_lastError = res;
+        return NULL;
     }
-    res = SIO_SendRequest(devI2c->hUsbSio, devI2c->portNum, HID_I2C_REQ_DEINIT_PORT, NULL, 0, NULL, NULL);
-    if (res == LPCUSBSIO_OK) {
-        devI2c->portNum = 0;
-        devI2c->hUsbSio = NULL;
+    pReq = SIO_AllocRequest(dev, callback, context);
+    if (pReq != NULL) {
+        res = GPIO_SubmitCmd(hUsbSio, port, cmd, setPins, clrPins, status, getPin, pin, pReq);
     }
-    return res;
+    return SIO_AsyncHandle(pReq, res);
 }
 
+LPCUSBSIO_API LPC_HANDLE GPIO_ReadPortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status,
+                                            LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, status, 0, 0, callback, context);
+}
 
-LPCUSBSIO_API int32_t I2C_DeviceRead(LPC_HANDLE hI2C,
-                                     uint8_t deviceAddress,
-                                     uint8_t *buffer,
-                                     uint16_t sizeToTransfer,
-                                     uint8_t options)
+LPCUSBSIO_API LPC_HANDLE GPIO_WritePortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status,
+                                             LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
 {
-    LPCUSBSIO_PortCtrl_t *devI2c = (LPCUSBSIO_PortCtrl_t *)hI2C;
-    LPCUSBSIO_Ctrl_t *dev;
-    int32_t res;
-    HID_I2C_RW_PARAMS_T param;
-    uint8_t *outData;
-    uint8_t *inData;
-    uint32_t inLen;
+    uint32_t setPins = *status;
 
-    if (validPortHandle(hI2C) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
-    }
-    /* get the SIO Device*/
-    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, setPins, ~setPins, status, 0, 0, callback, context);
+}
 
-    /* do parameter check */
-    if ((sizeToTransfer > dev->maxDataSize) ||
-        ((sizeToTransfer > 0) && (buffer == NULL)) ||
-        (deviceAddress > 127)) {
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                           LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, pins, 0, NULL, 0, 0, callback, context);
+}
 
-        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
-    }
-    param.length = sizeToTransfer;
-    param.options = options;
-    param.slaveAddr = deviceAddress;
-    /* construct req packet */
-    outData = (uint8_t *)malloc(sizeof(HID_I2C_RW_PARAMS_T));
-    inData = (uint8_t *)malloc(sizeToTransfer);
-    if ((outData != NULL) && (inData != NULL)) {
-        memcpy(outData, &param, sizeof(HID_I2C_RW_PARAMS_T));
+LPCUSBSIO_API LPC_HANDLE GPIO_ClearPortAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                             LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, pins, NULL, 0, 0, callback, context);
+}
 
-        res = SIO_SendRequest(dev, devI2c->portNum, HID_I2C_REQ_DEVICE_READ, outData, sizeof(HID_I2C_RW_PARAMS_T), inData, &inLen);
-        if (res == LPCUSBSIO_OK) {
-            /* copy data back to user buffer */
-            memcpy(buffer, inData, inLen);
-            res = inLen;
-        }
-        free(outData);
-        free(inData);
-    }
-    else {
-        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
-        res = LPCUSBSIO_ERR_MEM_ALLOC;
-    }
+LPCUSBSIO_API LPC_HANDLE GPIO_GetPortDirAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* pPins,
+                                              LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, 0, 0, pPins, 0, 0, callback, context);
+}
 
-    return res;
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPortOutDirAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                                 LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, pins, 0, NULL, 0, 0, callback, context);
 }
 
-LPCUSBSIO_API int32_t I2C_DeviceWrite(LPC_HANDLE hI2C,
-                                      uint8_t deviceAddress,
-                                      uint8_t *buffer,
-                                      uint16_t sizeToTransfer,
-                                      uint8_t options)
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPortInDirAsync(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins,
+                                                LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
 {
-    LPCUSBSIO_PortCtrl_t *devI2c = (LPCUSBSIO_PortCtrl_t *)hI2C;
-    LPCUSBSIO_Ctrl_t *dev;
-    int32_t res;
-    HID_I2C_RW_PARAMS_T param;
-    uint8_t *outData;
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, 0, pins, NULL, 0, 0, callback, context);
+}
 
-    if (validPortHandle(hI2C) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
-    }
-    /* get the SIO Device*/
-    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+LPCUSBSIO_API LPC_HANDLE GPIO_SetPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                          LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, (1 << pin), 0, NULL, 0, 0, callback, context);
+}
 
-    /* do parameter check */
-    if ((sizeToTransfer > dev->maxDataSize) ||
-        ((sizeToTransfer > 0) && (buffer == NULL)) ||
-        (deviceAddress > 127)) {
+LPCUSBSIO_API LPC_HANDLE GPIO_GetPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                          LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, NULL, 1, pin, callback, context);
+}
 
-        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
-    }
+LPCUSBSIO_API LPC_HANDLE GPIO_ClearPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                            LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    return GPIO_SendCmdAsync(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, (1 << pin), NULL, 0, 0, callback, context);
+}
 
-    param.length = sizeToTransfer;
-    param.options = options;
-    param.slaveAddr = deviceAddress;
-    /* construct req packet */
-    outData = (uint8_t *)malloc(sizeToTransfer + sizeof(HID_I2C_RW_PARAMS_T));
-    if (outData != NULL) {
-        /* copy params */
-        memcpy(outData, &param, sizeof(HID_I2C_RW_PARAMS_T));
-        /* copy data buffer now */
-        memcpy(outData + sizeof(HID_I2C_RW_PARAMS_T), buffer, sizeToTransfer);
+LPCUSBSIO_API LPC_HANDLE GPIO_TogglePinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin,
+                                             LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Request_t *pReq;
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
+
+    if (dev == NULL) {
+        g_lastError = res;
+        return NULL;
+    }
+    pReq = SIO_AllocRequest(dev, callback, context);
+    if (pReq != NULL) {
+        res = GPIO_SubmitTogglePin(hUsbSio, port, pin, pReq);
+    }
+    return SIO_AsyncHandle(pReq, res);
+}
 
-        res = SIO_SendRequest(dev, devI2c->portNum, HID_I2C_REQ_DEVICE_WRITE, outData, sizeof(HID_I2C_RW_PARAMS_T)+sizeToTransfer, NULL, NULL);
+LPCUSBSIO_API LPC_HANDLE GPIO_ConfigIOPinAsync(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin, uint32_t mode,
+                                               LPCUSBSIO_REQ_CALLBACK_T callback, void *context)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Request_t *pReq;
+    int32_t res = LPCUSBSIO_ERR_BAD_HANDLE;
 
-        if (res == LPCUSBSIO_OK) {
-            /* update user on transfered size */
-            res = sizeToTransfer;
-        }
-        free(outData);
+    if (dev == NULL) {
+        g_lastError = res;
+        return NULL;
     }
-    else {
-        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
-        res = LPCUSBSIO_ERR_MEM_ALLOC;
+    pReq = SIO_AllocRequest(dev, callback, context);
+    if (pReq != NULL) {
+        res = GPIO_SubmitConfigIOPin(hUsbSio, port, pin, mode, pReq);
+    }
+    return SIO_AsyncHandle(pReq, res);
+}
+
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqPoll(LPC_HANDLE hReq)
+{
+    LPCUSBSIO_Request_t *pReq = SIO_LockRequest(hReq);
+    LPCUSBSIO_Ctrl_t *dev;
+    int32_t res;
+
+    if (pReq == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    dev = pReq->dev;
+
+    if (pReq->state != SIO_REQ_DONE) {
+        SIO_PollLocked(dev);
     }
+    res = (pReq->state == SIO_REQ_DONE) ? pReq->result : LPCUSBSIO_ERR_PENDING;
+    SIO_MutexUnlock(&dev->sioMutex);
 
     return res;
 }
 
-LPCUSBSIO_API int32_t I2C_FastXfer(LPC_HANDLE hI2C, I2C_FAST_XFER_T *xfer)
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqWait(LPC_HANDLE hReq, uint32_t timeout_ms)
 {
-    LPCUSBSIO_PortCtrl_t *devI2c = (LPCUSBSIO_PortCtrl_t *)hI2C;
+    LPCUSBSIO_Request_t *pReq;
     LPCUSBSIO_Ctrl_t *dev;
+    uint64_t end, now;
     int32_t res;
-    HID_I2C_XFER_PARAMS_T param;
-    uint8_t *outData;
-    uint8_t *inData;
-    uint32_t inLen;
 
-    if (validPortHandle(hI2C) == 0) {
+    end = SIO_GetTickMs() + timeout_ms;
+    pReq = SIO_LockRequest(hReq);
+    if (pReq == NULL) {
         return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
     }
-    /* get the SIO Device*/
-    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
+    dev = pReq->dev;
 
-    /* do parameter check */
-    if ((xfer->txSz > dev->maxDataSize) || (xfer->rxSz > dev->maxDataSize) ||
-        ((xfer->txSz > 0) && (xfer->txBuff == NULL)) ||
-        ((xfer->rxSz > 0) && (xfer->rxBuff == NULL)) ||
-        (xfer->slaveAddr > 127) ) {
+    if (pReq->state != SIO_REQ_DONE) {
+        SIO_PollLocked(dev);
+    }
+    while (pReq->state != SIO_REQ_DONE) {
+        now = SIO_GetTickMs();
+        if (now >= end) {
+            break;
+        }
+        SIO_StepLocked(dev, pReq, (uint32_t)(end - now));
+    }
+    res = (pReq->state == SIO_REQ_DONE) ? pReq->result : LPCUSBSIO_ERR_PENDING;
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    return res;
+}
 
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqWaitAny(LPC_HANDLE *phReqs, uint32_t count, uint32_t timeout_ms)
+{
+    LPCUSBSIO_Request_t *pReq;
+    LPCUSBSIO_Ctrl_t *dev;
+    uint64_t end, now, nextDeadline;
+    uint32_t i, j, slice;
+    uint8_t oneDev = 1;
+    uint8_t done;
+
+    if ((phReqs == NULL) || (count == 0)) {
         return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
     }
-    param.txLength = xfer->txSz;
-    param.rxLength = xfer->rxSz;
-    param.options = xfer->options;
-    param.slaveAddr = xfer->slaveAddr;
-    /* construct req packet */
-    outData = (uint8_t *)malloc(sizeof(HID_I2C_XFER_PARAMS_T)+xfer->txSz);
-    inData = (uint8_t *)malloc(xfer->rxSz);
-    if ((outData != NULL) && (inData != NULL)) {
-        /* copy params */
-        memcpy(outData, &param, sizeof(HID_I2C_XFER_PARAMS_T));
-        /* copy data buffer now */
-        memcpy(outData + sizeof(HID_I2C_XFER_PARAMS_T), &xfer->txBuff[0], xfer->txSz);
-
-        res = SIO_SendRequest(dev, devI2c->portNum, HID_I2C_REQ_DEVICE_XFER, outData, sizeof(HID_I2C_XFER_PARAMS_T)+xfer->txSz, inData, &inLen);
-
-        if (res == LPCUSBSIO_OK) {
-            /* parse response */
-            res = inLen;
-            if (res != 0) {
-                /* copy data back to user buffer */
-                memcpy(&xfer->rxBuff[0], inData, res);
+    for (i = 0; i < count; i++) {
+        pReq = SIO_LockRequest(phReqs[i]);
+        if (pReq == NULL) {
+            return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        }
+        SIO_MutexUnlock(&pReq->dev->sioMutex);
+        if (SIO_HANDLE_SLOT((uint32_t)(uintptr_t)phReqs[i]) != SIO_HANDLE_SLOT((uint32_t)(uintptr_t)phReqs[0])) {
+            oneDev = 0;
+        }
+    }
+    end = SIO_GetTickMs() + timeout_ms;
+
+    for (;;) {
+        /* dispatch what each device already received and look for a completed request */
+        nextDeadline = end;
+        for (i = 0; i < count; i++) {
+            /* a request released meanwhile by another thread fails the wait */
+            pReq = SIO_LockRequest(phReqs[i]);
+            if (pReq == NULL) {
+                return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
             }
-            else {
-                /* else it should be Tx only transfer. Update transferred size. */
-                res = xfer->txSz;
+            dev = pReq->dev;
+            if (pReq->state != SIO_REQ_DONE) {
+                for (j = 0; (j < i) && (SIO_HANDLE_SLOT((uint32_t)(uintptr_t)phReqs[j]) != dev->slot); j++) {
+                }
+                if (j == i) {
+                    SIO_PollLocked(dev);
+                }
+            }
+            done = (pReq->state == SIO_REQ_DONE) ? 1 : 0;
+            if (pReq->deadline < nextDeadline) {
+                nextDeadline = pReq->deadline;
+            }
+            SIO_MutexUnlock(&dev->sioMutex);
+
+            if (done) {
+                return i;
             }
         }
-        free(outData);
-        free(inData);
-    }
-    else {
-        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
-        res = LPCUSBSIO_ERR_MEM_ALLOC;
-    }
 
-    return res;
+        now = SIO_GetTickMs();
+        if (now >= end) {
+            return LPCUSBSIO_ERR_PENDING;
+        }
+        /* block on one device, with requests spread over several devices only shortly */
+        slice = (nextDeadline > now) ? (uint32_t)(nextDeadline - now) : 0;
+        if ((oneDev == 0) && (slice > SIO_WAIT_ANY_SLICE)) {
+            slice = SIO_WAIT_ANY_SLICE;
+        }
+        pReq = SIO_LockRequest(phReqs[0]);
+        if (pReq == NULL) {
+            return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        }
+        dev = pReq->dev;
+        if (pReq->state != SIO_REQ_DONE) {
+            SIO_StepLocked(dev, pReq, slice);
+        }
+        SIO_MutexUnlock(&dev->sioMutex);
+    }
 }
 
-LPCUSBSIO_API int32_t I2C_Reset(LPC_HANDLE hI2C)
+LPCUSBSIO_API int32_t LPCUSBSIO_ReqFree(LPC_HANDLE hReq)
 {
-    LPCUSBSIO_PortCtrl_t *devI2c = (LPCUSBSIO_PortCtrl_t *)hI2C;
+    LPCUSBSIO_Request_t *pReq = SIO_LockRequest(hReq);
     LPCUSBSIO_Ctrl_t *dev;
-    int32_t res;
 
-    if (validPortHandle(hI2C) == 0) {
+    if (pReq == NULL) {
         return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
     }
+    dev = pReq->dev;
 
-    /* get the SIO Device*/
-    dev = (LPCUSBSIO_Ctrl_t *)devI2c->hUsbSio;
-
-    res = SIO_SendRequest(dev, devI2c->portNum, HID_I2C_REQ_RESET, NULL, 0, NULL, NULL);
+    if (pReq->cbState == SIO_CB_RUNNING) {
+        /* released by SIO_RunCallbacksLocked once the callback returns */
+        pReq->cbState = SIO_CB_FREE;
+        pReq->magic = 0;
+    }
+    else {
+        SIO_FreeRequest(dev, pReq);
+    }
+    SIO_MutexUnlock(&dev->sioMutex);
 
-    return res;
+    return LPCUSBSIO_OK;
 }
 
-/********************************  SPI functions *****************************************/
+/********************************  Batched requests *****************************************/
 
-LPCUSBSIO_API LPC_HANDLE SPI_Open(LPC_HANDLE hUsbSio, HID_SPI_PORTCONFIG_T *config, uint8_t portNum)
+/* Submit one batch operation, on failure the result of the operation is set here */
+static int32_t SIO_SubmitBatchOp(LPCUSBSIO_Ctrl_t *dev, LPCUSBSIO_BATCH_OP_T *op, LPCUSBSIO_Request_t *pReq)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
     int32_t res;
-    LPC_HANDLE retHandle = NULL;
-    uint8_t *outData;
 
-    if ((validHandle(hUsbSio) == 0) || (config == NULL) || (portNum >= dev->maxSPIPorts)) {
-        g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
-        return NULL;
-    }
+    memset(pReq, 0, sizeof(LPCUSBSIO_Request_t));
+    pReq->txHeld = 1;
 
-    Log("SPI_Open(hUsbSio=%p, cfg->busSpeed=%d, cfg->Options=%d, portNum=%d)\n", hUsbSio, config->busSpeed, config->Options);
+    switch (op->op) {
+    case LPCUSBSIO_BATCH_I2C_READ:
+    case LPCUSBSIO_BATCH_I2C_WRITE:
+    case LPCUSBSIO_BATCH_I2C_XFER:
+        if ((op->port >= dev->maxI2CPorts) || (dev->i2cPorts[op->port].hUsbSio != dev)) {
+            res = LPCUSBSIO_ERR_BAD_HANDLE;
+        }
+        else if (op->op == LPCUSBSIO_BATCH_I2C_READ) {
+            res = I2C_SubmitDeviceRead(SIO_MakeHandle(dev, SIO_HANDLE_I2C, op->port), op->addr, op->buffer, op->length, op->options, pReq);
+        }
+        else if (op->op == LPCUSBSIO_BATCH_I2C_WRITE) {
+            res = I2C_SubmitDeviceWrite(SIO_MakeHandle(dev, SIO_HANDLE_I2C, op->port), op->addr, op->buffer, op->length, op->options, pReq);
+        }
+        else {
+            res = (op->i2cXfer != NULL) ? I2C_SubmitFastXfer(SIO_MakeHandle(dev, SIO_HANDLE_I2C, op->port), op->i2cXfer, pReq) : LPCUSBSIO_ERR_INVALID_PARAM;
+        }
+        break;
 
-    /* construct req packet */
-    outData = (uint8_t *)malloc(sizeof(HID_SPI_PORTCONFIG_T));
-    if (outData != NULL) {
-        memcpy(outData, config, sizeof(HID_SPI_PORTCONFIG_T));
-        res = SIO_SendRequest(dev, portNum, HID_SPI_REQ_INIT_PORT, outData, sizeof(HID_SPI_PORTCONFIG_T), NULL, NULL);
-        if (res == LPCUSBSIO_OK) {
-            dev->spiPorts[portNum].portNum = portNum;
-            dev->spiPorts[portNum].hUsbSio = (LPC_HANDLE)dev;
-            retHandle = (LPC_HANDLE)&dev->spiPorts[portNum];
+    case LPCUSBSIO_BATCH_SPI_XFER:
+        if ((op->port >= dev->maxSPIPorts) || (dev->spiPorts[op->port].hUsbSio != dev)) {
+            res = LPCUSBSIO_ERR_BAD_HANDLE;
         }
-        free(outData);
+        else {
+            res = (op->spiXfer != NULL) ? SPI_SubmitTransfer(SIO_MakeHandle(dev, SIO_HANDLE_SPI, op->port), op->spiXfer, pReq) : LPCUSBSIO_ERR_INVALID_PARAM;
+        }
+        break;
+
+    case LPCUSBSIO_BATCH_GPIO_SET:
+        res = GPIO_SubmitCmd(SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0), op->port, HID_GPIO_REQ_PORT_VALUE, op->pins, 0, NULL, 0, 0, pReq);
+        break;
+    case LPCUSBSIO_BATCH_GPIO_CLEAR:
+        res = GPIO_SubmitCmd(SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0), op->port, HID_GPIO_REQ_PORT_VALUE, 0, op->pins, NULL, 0, 0, pReq);
+        break;
+    case LPCUSBSIO_BATCH_GPIO_READ:
+        res = GPIO_SubmitCmd(SIO_MakeHandle(dev, SIO_HANDLE_DEV, 0), op->port, HID_GPIO_REQ_PORT_VALUE, 0, 0, &op->pins, 0, 0, pReq);
+        break;
+
+    default:
+        res = LPCUSBSIO_ERR_INVALID_PARAM;
+        break;
     }
 
-    Log("SPI_Open: returning %p)\n", retHandle);
-    return retHandle;
+    if (res != LPCUSBSIO_OK) {
+        op->result = res;
+    }
+    return res;
 }
 
-LPCUSBSIO_API int32_t SPI_Close(LPC_HANDLE hSPI)
+/* Queue of the port a batch operation is addressed to */
+static uint8_t SIO_BatchQueue(const LPCUSBSIO_BATCH_OP_T *op)
 {
-    LPCUSBSIO_PortCtrl_t *devSPI = (LPCUSBSIO_PortCtrl_t *)hSPI;
-    int32_t res;
+    switch (op->op) {
+    case LPCUSBSIO_BATCH_I2C_READ:
+    case LPCUSBSIO_BATCH_I2C_WRITE:
+    case LPCUSBSIO_BATCH_I2C_XFER:
+        return SIO_QueueIndex(HID_I2C_REQ_DEVICE_XFER, op->port);
+    case LPCUSBSIO_BATCH_SPI_XFER:
+        return SIO_QueueIndex(HID_SPI_REQ_DEVICE_XFER, op->port);
+    default:
+        return SIO_QUEUE_GPIO;
+    }
+}
 
-    if (validPortHandle(hSPI) == 0) {
+LPCUSBSIO_API int32_t LPCUSBSIO_Batch(LPC_HANDLE hUsbSio, LPCUSBSIO_BATCH_OP_T *ops, uint32_t count)
+{
+    LPCUSBSIO_Ctrl_t *dev = SIO_GetDevice(hUsbSio);
+    LPCUSBSIO_Request_t window[SIO_MAX_INFLIGHT];
+    uint8_t inFlight[SIO_MAX_INFLIGHT];
+    uint8_t queues[SIO_NUM_QUEUES];
+    uint32_t i, slot;
+    int32_t res = LPCUSBSIO_OK;
+
+    if (dev == NULL) {
         return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
     }
+    if ((count > 0) && (ops == NULL)) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    memset(inFlight, 0, sizeof(inFlight));
+    memset(queues, 0, sizeof(queues));
 
-    Log("SPI_Close(hSPI=%p\n", hSPI);
+    /* wait for the other submitters of the ports, a stream in particular, taking the
+       queues in index order so that concurrent batches cannot deadlock */
+    for (i = 0; i < count; i++) {
+        queues[SIO_BatchQueue(&ops[i])] = 1;
+    }
+    for (i = 0; i < SIO_NUM_QUEUES; i++) {
+        if (queues[i]) {
+            SIO_MutexLock(&dev->queueMutex[i]);
+        }
+    }
 
-    res = SIO_SendRequest(devSPI->hUsbSio, devSPI->portNum, HID_SPI_REQ_DEINIT_PORT, NULL, 0, NULL, NULL);
-    if (res == LPCUSBSIO_OK) {
-        devSPI->portNum = 0;
-        devSPI->hUsbSio = NULL;
+    /* keep the reports of the whole batch back-to-back */
+    SIO_MutexLock(&dev->sioMutex);
+    SIO_PipeAcquireLocked(dev);
+    SIO_MutexUnlock(&dev->sioMutex);
+    g_cbHold++;
+
+    for (i = 0; i < count; i++) {
+        /* reuse the descriptor of the operation submitted SIO_MAX_INFLIGHT steps ago */
+        slot = i % SIO_MAX_INFLIGHT;
+        if (inFlight[slot]) {
+            SIO_WaitRequest(dev, &window[slot]);
+            ops[i - SIO_MAX_INFLIGHT].result = window[slot].result;
+        }
+        inFlight[slot] = (SIO_SubmitBatchOp(dev, &ops[i], &window[slot]) == LPCUSBSIO_OK) ? 1 : 0;
     }
-    return res;
+
+    g_cbHold--;
+    SIO_MutexLock(&dev->sioMutex);
+    SIO_PipeReleaseLocked(dev);
+    SIO_MutexUnlock(&dev->sioMutex);
+    for (i = SIO_NUM_QUEUES; i > 0; i--) {
+        if (queues[i - 1]) {
+            SIO_MutexUnlock(&dev->queueMutex[i - 1]);
+        }
+    }
+
+    /* collect the remaining responses */
+    for (i = (count > SIO_MAX_INFLIGHT) ? (count - SIO_MAX_INFLIGHT) : 0; i < count; i++) {
+        slot = i % SIO_MAX_INFLIGHT;
+        if (inFlight[slot]) {
+            SIO_WaitRequest(dev, &window[slot]);
+            ops[i].result = window[slot].result;
+        }
+    }
+
+    /* run the callbacks deferred during the batch */
+    SIO_MutexLock(&dev->sioMutex);
+    SIO_RunCallbacksLocked(dev);
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    for (i = 0; i < count; i++) {
+        if (ops[i].result < 0) {
+            res = ops[i].result;
+            break;
+        }
+    }
+    return g_lastError = res;
 }
 
-LPCUSBSIO_API int32_t SPI_Transfer(LPC_HANDLE hSPI, SPI_XFER_T *xfer)
+/********************************  Device groups *****************************************/
+
+/* Resolve a group handle with groupMutex held, NULL if the group has been freed */
+static LPCUSBSIO_GroupSlot_t *SIO_LookupGroupLocked(LPC_HANDLE hGroup)
 {
-    LPCUSBSIO_PortCtrl_t *devSPI = (LPCUSBSIO_PortCtrl_t *)hSPI;
-    LPCUSBSIO_Ctrl_t *dev;
-    int32_t res;
-    HID_SPI_XFER_PARAMS_T param;
-    uint8_t *outData;
-    uint8_t *inData;
-    uint32_t inLen;
+    uint32_t h = (uint32_t)(uintptr_t)hGroup;
+    LPCUSBSIO_GroupSlot_t *slot;
 
-    if (validPortHandle(hSPI) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    if (((uintptr_t)h != (uintptr_t)hGroup) || (SIO_HANDLE_KIND(h) != SIO_HANDLE_GROUP) ||
+        (SIO_HANDLE_SLOT(h) >= SIO_MAX_GROUPS)) {
+        return NULL;
     }
+    slot = &g_Ctrl.groups[SIO_HANDLE_SLOT(h)];
+    return ((slot->group != NULL) && ((slot->seq & 0xFFFFu) == SIO_HANDLE_SEQ(h))) ? slot : NULL;
+}
 
-    /* get the SIO Device*/
-    dev = (LPCUSBSIO_Ctrl_t *)devSPI->hUsbSio;
+static SIO_THREAD_RET_T SIO_THREAD_API SIO_GroupThread(void *arg)
+{
+    LPCUSBSIO_GroupJob_t *job = (LPCUSBSIO_GroupJob_t *)arg;
 
-    /* do parameter check */
-    if ((xfer->length > dev->maxDataSize) ||
-        ((xfer->length > 0) && ((xfer->txBuff == NULL) || (xfer->rxBuff == NULL)))) {
+    job->result = LPCUSBSIO_Batch(job->hUsbSio, job->ops, job->count);
 
-        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
-    }
+    return 0;
+}
 
-    Log("SPI_Transfer(hSPI=%p, xfer->device=%d, xfer->length=%d, xfer->options=%d)\n", hSPI, xfer->device, xfer->length, xfer->options);
+LPCUSBSIO_API LPC_HANDLE LPCUSBSIO_GroupCreate(const LPC_HANDLE *phUsbSio, uint32_t count)
+{
+    LPCUSBSIO_Group_t *group;
+    LPCUSBSIO_GroupSlot_t *slot = NULL;
+    uint32_t i, n;
 
-    param.length = xfer->length;
-    param.options = xfer->options;
-    param.device = xfer->device;
-    /* construct req packet */
-    outData = (uint8_t *)malloc(sizeof(HID_SPI_XFER_PARAMS_T) + xfer->length);
-    inData = (uint8_t *)malloc(xfer->length);
-    if ((outData != NULL) && (inData != NULL)) {
-        /* copy params */
-        memcpy(outData, &param, sizeof(HID_SPI_XFER_PARAMS_T));
-        /* copy data buffer now */
-        /* Note that the for 16 bit data transfer the bytes are transferred in Little Endian Format */
-        memcpy(outData + sizeof(HID_SPI_XFER_PARAMS_T), &xfer->txBuff[0], xfer->length);
-
-        res = SIO_SendRequest(dev, devSPI->portNum, HID_SPI_REQ_DEVICE_XFER, outData, sizeof(HID_SPI_XFER_PARAMS_T)+xfer->length, inData, &inLen);
-
-        if (res == LPCUSBSIO_OK) {
-            /* parse response */
-            res = inLen;
-            /* copy data back to user buffer */
-            memcpy(&xfer->rxBuff[0], inData, res);
-        }
-        free(outData);
-        free(inData);
+    if ((phUsbSio == NULL) || (count == 0)) {
+        g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+        return NULL;
     }
-    else {
+    for (i = 0; i < count; i++) {
+        if (SIO_GetDevice(phUsbSio[i]) == NULL) {
+            g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+            return NULL;
+        }
+    }
+
+    group = (LPCUSBSIO_Group_t *)malloc(sizeof(LPCUSBSIO_Group_t) + count * sizeof(LPC_HANDLE));
+    if (group == NULL) {
         g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
-        res = LPCUSBSIO_ERR_MEM_ALLOC;
+        return NULL;
+    }
+    group->count = count;
+    memcpy(&group->members[0], phUsbSio, count * sizeof(LPC_HANDLE));
+
+    SIO_Globals();
+    SIO_MutexLock(&g_Ctrl.groupMutex);
+    i = g_Ctrl.nextGroup;
+    for (n = 0; n < SIO_MAX_GROUPS; n++, i++) {
+        i %= SIO_MAX_GROUPS;
+        if (g_Ctrl.groups[i].group == NULL) {
+            slot = &g_Ctrl.groups[i];
+            slot->group = group;
+            g_Ctrl.nextGroup = i + 1;
+            break;
+        }
+    }
+    SIO_MutexUnlock(&g_Ctrl.groupMutex);
+    if (slot == NULL) {
+        free(group);
+        g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+        return NULL;
     }
 
-    Log("SPI_Transfer: returning %d\n", res);
-    return res;
+    g_lastError = LPCUSBSIO_OK;
+    return (LPC_HANDLE)(uintptr_t)(((slot->seq & 0xFFFFu) << 16) | (SIO_HANDLE_GROUP << 12) | i);
 }
 
-LPCUSBSIO_API int32_t SPI_Reset(LPC_HANDLE hSPI)
+LPCUSBSIO_API int32_t LPCUSBSIO_GroupBatch(LPC_HANDLE hGroup, LPCUSBSIO_BATCH_OP_T *ops, uint32_t count, int32_t *results)
 {
-    LPCUSBSIO_PortCtrl_t *devSPI = (LPCUSBSIO_PortCtrl_t *)hSPI;
-    LPCUSBSIO_Ctrl_t *dev;
-    int32_t res;
+    LPCUSBSIO_GroupSlot_t *slot;
+    LPCUSBSIO_GroupJob_t *jobs = NULL;
+    uint32_t i, members = 0;
+    int32_t res = LPCUSBSIO_OK;
 
-    if (validPortHandle(hSPI) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    if ((count > 0) && (ops == NULL)) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
     }
 
-    Log("SPI_Reset(hSPI=%p)\n", hSPI);
-
-    /* get the SIO Device*/
-    dev = (LPCUSBSIO_Ctrl_t *)devSPI->hUsbSio;
-
-    res = SIO_SendRequest(dev, devSPI->portNum, HID_SPI_REQ_RESET, NULL, 0, NULL, NULL);
+    /* the members are copied so that the group may be freed while the operations run */
+    SIO_Globals();
+    SIO_MutexLock(&g_Ctrl.groupMutex);
+    slot = SIO_LookupGroupLocked(hGroup);
+    if (slot != NULL) {
+        members = slot->group->count;
+        jobs = (LPCUSBSIO_GroupJob_t *)calloc(members, sizeof(LPCUSBSIO_GroupJob_t));
+        for (i = 0; (jobs != NULL) && (i < members); i++) {
+            jobs[i].hUsbSio = slot->group->members[i];
+        }
+    }
+    SIO_MutexUnlock(&g_Ctrl.groupMutex);
+    if (slot == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    if (jobs == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+    }
 
-    Log("SPI_Reset: returning %d\n", res);
-    return res;
-}
+    /* the first device is served by the calling thread, and so is any device whose
+       thread could not be started */
+    for (i = 0; i < members; i++) {
+        jobs[i].ops = &ops[i * count];
+        jobs[i].count = count;
+        if ((i > 0) && (SIO_ThreadCreate(&jobs[i].thread, SIO_GroupThread, &jobs[i]) == 0)) {
+            jobs[i].threaded = 1;
+        }
+    }
+    for (i = 0; i < members; i++) {
+        if (jobs[i].threaded) {
+            SIO_ThreadJoin(jobs[i].thread);
+        }
+        else {
+            SIO_GroupThread(&jobs[i]);
+        }
+        if (results != NULL) {
+            results[i] = jobs[i].result;
+        }
+        if ((res == LPCUSBSIO_OK) && (jobs[i].result < 0)) {
+            res = jobs[i].result;
+        }
+    }
+    free(jobs);
 
-/********************************  GPIO functions *****************************************/
-LPCUSBSIO_API int32_t GPIO_ReadPort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status)
-{
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, status);
+    return g_lastError = res;
 }
 
-
-LPCUSBSIO_API int32_t GPIO_WritePort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* status)
+LPCUSBSIO_API int32_t LPCUSBSIO_GroupFree(LPC_HANDLE hGroup)
 {
-    uint32_t setPins = *status;
+    LPCUSBSIO_GroupSlot_t *slot;
+    LPCUSBSIO_Group_t *group = NULL;
+
+    SIO_Globals();
+    SIO_MutexLock(&g_Ctrl.groupMutex);
+    slot = SIO_LookupGroupLocked(hGroup);
+    if (slot != NULL) {
+        group = slot->group;
+        slot->group = NULL;
+        slot->seq++;
+    }
+    SIO_MutexUnlock(&g_Ctrl.groupMutex);
+    if (group == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    free(group);
 
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, setPins, ~setPins, status);
+    return g_lastError = LPCUSBSIO_OK;
 }
 
-LPCUSBSIO_API int32_t GPIO_SetPort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
-{
-    uint32_t status = 0;
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, pins, 0, &status);
-}
+/********************************  Streamed transfers *****************************************/
 
-LPCUSBSIO_API int32_t GPIO_ClearPort(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
+/* Options of one chunk of a streamed I2C transfer: only the first chunk addresses the
+   slave and only the last one ends the transfer */
+static uint8_t SIO_StreamOptions(uint8_t options, uint32_t index, uint32_t count)
 {
-    uint32_t status = 0;
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, pins, &status);
+    if (index > 0) {
+        options = (options & ~I2C_TRANSFER_OPTIONS_START_BIT) | I2C_TRANSFER_OPTIONS_NO_ADDRESS;
+    }
+    if ((index + 1) < count) {
+        options &= ~(I2C_TRANSFER_OPTIONS_STOP_BIT | I2C_TRANSFER_OPTIONS_NACK_LAST_BYTE);
+    }
+    return options;
 }
 
-LPCUSBSIO_API int32_t GPIO_GetPortDir(LPC_HANDLE hUsbSio, uint8_t port, uint32_t* pPins)
+/* Submit one chunk of a streamed transfer, the caller holds the queue mutex of the port */
+static int32_t SIO_SubmitStreamChunk(LPC_HANDLE hPort, uint8_t req, uint8_t addr, uint8_t options,
+                                     const uint8_t *txBuff, uint8_t *rxBuff, uint16_t len, LPCUSBSIO_Request_t *pReq)
 {
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, 0, 0, pPins);
-}
+    SPI_XFER_T xfer;
 
-LPCUSBSIO_API int32_t GPIO_SetPortOutDir(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
-{
-    uint32_t status = 0;
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, pins, 0, &status);
-}
+    memset(pReq, 0, sizeof(LPCUSBSIO_Request_t));
+    pReq->queueHeld = 1;
 
-LPCUSBSIO_API int32_t GPIO_SetPortInDir(LPC_HANDLE hUsbSio, uint8_t port, uint32_t pins)
-{
-    uint32_t status;
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_DIR, 0, pins, &status);
+    if (req == HID_I2C_REQ_DEVICE_READ) {
+        return I2C_SubmitDeviceRead(hPort, addr, rxBuff, len, options, pReq);
+    }
+    if (req == HID_I2C_REQ_DEVICE_WRITE) {
+        return I2C_SubmitDeviceWrite(hPort, addr, (uint8_t *)txBuff, len, options, pReq);
+    }
+    xfer.length = len;
+    xfer.options = options;
+    xfer.device = addr;
+    xfer.txBuff = txBuff;
+    xfer.rxBuff = rxBuff;
+    return SPI_SubmitTransfer(hPort, &xfer, pReq);
 }
 
-LPCUSBSIO_API int32_t GPIO_SetPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
+/* Split a transfer of any length into requests of at most maxDataSize bytes. The next
+ * chunks are sent while the previous ones complete, up to the in-flight limit of a port.
+ * The queue mutex of the port is held for the whole stream so that no other transfer
+ * on the port comes between the chunks. A failed or short chunk ends the stream.
+ * Returns the number of bytes transferred or a negative error code.
+ */
+static int32_t SIO_StreamTransfer(LPC_HANDLE hPort, uint32_t kind, uint8_t req, uint8_t addr, uint8_t options,
+                                  const uint8_t *txBuff, uint8_t *rxBuff, uint32_t length)
 {
-    uint32_t status = 0;
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, (1 << pin), 0, &status);
-}
+    LPCUSBSIO_PortCtrl_t *port = SIO_GetPort(hPort, kind);
+    LPCUSBSIO_Ctrl_t *dev;
+    LPCUSBSIO_Request_t window[SIO_MAX_INFLIGHT_QUEUE];
+    uint32_t chunkLen[SIO_MAX_INFLIGHT_QUEUE];
+    uint32_t chunk, numChunks, sent = 0, collected = 0, offset = 0, done = 0, len, slot;
+    uint8_t queue;
+    int32_t res = LPCUSBSIO_OK;
+    int32_t err = LPCUSBSIO_OK;
+
+    if (port == NULL) {
+        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+    }
+    dev = (LPCUSBSIO_Ctrl_t *)port->hUsbSio;
 
-LPCUSBSIO_API int32_t GPIO_GetPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
-{
-    uint32_t status = 0;
-    int32_t res = GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, 0, &status);
+    /* do parameter check */
+    if ((length > 0x7FFFFFFFUL) ||
+        ((length > 0) && (txBuff == NULL) && (req != HID_I2C_REQ_DEVICE_READ)) ||
+        ((length > 0) && (rxBuff == NULL) && (req == HID_I2C_REQ_DEVICE_READ)) ||
+        ((length > 0) && (rxBuff == NULL) && (req == HID_SPI_REQ_DEVICE_XFER) && ((options & HID_SPI_XFER_OPTION_TX_ONLY) == 0)) ||
+        ((kind == SIO_HANDLE_I2C) && (addr > 127))) {
 
-    if (res > 0) {
-        res = (status & (1 << pin)) ? 1 : 0;
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
     }
-    return res;
-}
 
-LPCUSBSIO_API int32_t GPIO_ClearPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
-{
-    uint32_t status = 0;
-    return GPIO_SendCmd(hUsbSio, port, HID_GPIO_REQ_PORT_VALUE, 0, (1 << pin), &status);
-}
+    /* even sized chunks keep the 16 bit SPI frames whole, the length field is 16 bits wide */
+    chunk = (dev->maxDataSize > 0xFFFF) ? 0xFFFE : (dev->maxDataSize & ~1UL);
+    if (chunk == 0) {
+        return g_lastError = LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+    numChunks = (length > 0) ? ((length + chunk - 1) / chunk) : 1;
 
-LPCUSBSIO_API int32_t GPIO_TogglePin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin)
-{
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
-    int32_t res;
-    uint8_t outData;
+    queue = SIO_QueueIndex(req, port->portNum);
+    if (SIO_MutexLock(&dev->queueMutex[queue]) != 0) {
+        return g_lastError = LPCUSBSIO_ERR_SYNCHRONIZATION;
+    }
+    g_cbHold++;
+
+    while (collected < numChunks) {
+        if ((sent < numChunks) && ((sent - collected) < SIO_MAX_INFLIGHT_QUEUE) && (err == LPCUSBSIO_OK)) {
+            slot = sent % SIO_MAX_INFLIGHT_QUEUE;
+            len = ((length - offset) > chunk) ? chunk : (length - offset);
+            res = SIO_SubmitStreamChunk(hPort, req, addr,
+                                        (kind == SIO_HANDLE_I2C) ? SIO_StreamOptions(options, sent, numChunks) : options,
+                                        (txBuff != NULL) ? (txBuff + offset) : NULL,
+                                        (rxBuff != NULL) ? (rxBuff + offset) : NULL, (uint16_t)len, &window[slot]);
+            if (res != LPCUSBSIO_OK) {
+                err = res;
+            }
+            else {
+                chunkLen[slot] = len;
+                offset += len;
+                sent++;
+            }
+            continue;
+        }
+        if (collected == sent) {
+            break;
+        }
 
-    if (validHandle(hUsbSio) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
+        /* wait for the oldest chunk */
+        slot = collected % SIO_MAX_INFLIGHT_QUEUE;
+        res = SIO_WaitResult(&window[slot], LPCUSBSIO_OK);
+        collected++;
+        if (err == LPCUSBSIO_OK) {
+            if (res < 0) {
+                err = res;
+            }
+            else {
+                done += (uint32_t)res;
+                if ((uint32_t)res < chunkLen[slot]) {
+                    /* e.g. slave NAK with I2C_TRANSFER_OPTIONS_BREAK_ON_NACK, do not send more */
+                    err = 1;
+                }
+            }
+        }
     }
-    /* construct req packet */
-    outData = pin;
 
-    res = SIO_SendRequest(dev, port, HID_GPIO_REQ_TOGGLE_PIN, &outData, 1, NULL, NULL);
+    g_cbHold--;
+    SIO_MutexUnlock(&dev->queueMutex[queue]);
 
-    return res;
+    /* run the callbacks left over during the stream */
+    SIO_MutexLock(&dev->sioMutex);
+    SIO_RunCallbacksLocked(dev);
+    SIO_MutexUnlock(&dev->sioMutex);
+
+    if (err < 0) {
+        return g_lastError = err;
+    }
+    g_lastError = LPCUSBSIO_OK;
+    return (int32_t)done;
 }
 
-LPCUSBSIO_API int32_t GPIO_ConfigIOPin(LPC_HANDLE hUsbSio, uint8_t port, uint8_t pin, uint32_t mode)
+LPCUSBSIO_API int32_t I2C_DeviceReadStream(LPC_HANDLE hI2C, uint8_t deviceAddress, uint8_t *buffer, uint32_t sizeToTransfer,
+                                           uint8_t options)
 {
-    LPCUSBSIO_Ctrl_t *dev = (LPCUSBSIO_Ctrl_t *)hUsbSio;
-    int32_t res;
-    uint8_t outData[5];
-
-    if (validHandle(hUsbSio) == 0) {
-        return g_lastError = LPCUSBSIO_ERR_BAD_HANDLE;
-    }
-    /* construct req packet */
-    outData[0] = (uint8_t)((mode >> 0) & 0xff);
-    outData[1] = (uint8_t)((mode >> 8) & 0xff);
-    outData[2] = (uint8_t)((mode >> 16) & 0xff);
-    outData[3] = (uint8_t)((mode >> 24) & 0xff);
-    outData[4] = pin;
+    return SIO_StreamTransfer(hI2C, SIO_HANDLE_I2C, HID_I2C_REQ_DEVICE_READ, deviceAddress, options, NULL, buffer, sizeToTransfer);
+}
 
-    res = SIO_SendRequest(dev, port, HID_GPIO_REQ_IOCONFIG, &outData[0], 5, NULL, NULL);
+LPCUSBSIO_API int32_t I2C_DeviceWriteStream(LPC_HANDLE hI2C, uint8_t deviceAddress, const uint8_t *buffer, uint32_t sizeToTransfer,
+                                            uint8_t options)
+{
+    return SIO_StreamTransfer(hI2C, SIO_HANDLE_I2C, HID_I2C_REQ_DEVICE_WRITE, deviceAddress, options, buffer, NULL, sizeToTransfer);
+}
 
-    return res;
+LPCUSBSIO_API int32_t SPI_TransferStream(LPC_HANDLE hSPI, uint8_t device, uint8_t options, const uint8_t *txBuff,
+                                         uint8_t *rxBuff, uint32_t length)
+{
+    return SIO_StreamTransfer(hSPI, SIO_HANDLE_SPI, HID_SPI_REQ_DEVICE_XFER, device, options, txBuff, rxBuff, length);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -1244,12 +5732,15 @@ LPCUSBSIO_API HIDAPI_ENUM_HANDLE HIDAPI_Enumerate(uint32_t vid, uint32_t pid, in
 {
     HIDAPI_ENUM_T* enm = NULL;
 
-    struct hid_device_info* devs = hid_enumerate(vid, pid);
+    struct hid_device_info* devs;
+
+    SIO_HidSelect();
+    devs = g_hid->enumerate(vid, pid);
 
     enm = (HIDAPI_ENUM_T*)calloc(1, sizeof(HIDAPI_ENUM_T));
     if(!enm)
     {
-        hid_free_enumeration(devs);
+        g_hid->free_enumeration(devs);
         return NULL;
     }
 
@@ -1288,14 +5779,14 @@ LPCUSBSIO_API int32_t HIDAPI_EnumerateNext(HIDAPI_ENUM_HANDLE hHidEnum, HIDAPI_D
 
     if(enm->ex_info && dev->path)
     {
-        hid_device* dd = hid_open_path(dev->path);
+        hid_device* dd = g_hid->open_path(dev->path);
         if (dd != NULL)
         {
-            hid_get_report_lengths(dd, &pInfo->ex.output_report_length, &pInfo->ex.input_report_length);
-            hid_get_usage(dd, &pInfo->ex.usage_page, &pInfo->ex.usage);
+            g_hid->get_report_lengths(dd, &pInfo->ex.output_report_length, &pInfo->ex.input_report_length);
+            g_hid->get_usage(dd, &pInfo->ex.usage_page, &pInfo->ex.usage);
             pInfo->ex.is_valid = 1;
 
-            hid_close(dd);
+            g_hid->close(dd);
         }
     }
 
@@ -1334,7 +5825,7 @@ LPCUSBSIO_API int32_t HIDAPI_EnumerateFree(HIDAPI_ENUM_HANDLE hHidEnum)
 
     if (found)
     {
-        hid_free_enumeration(enm->head);
+        g_hid->free_enumeration(enm->head);
         free(enm);
     }
 
@@ -1343,7 +5834,10 @@ LPCUSBSIO_API int32_t HIDAPI_EnumerateFree(HIDAPI_ENUM_HANDLE hHidEnum)
 
 LPCUSBSIO_API HIDAPI_DEVICE_HANDLE HIDAPI_DeviceOpen(char* pDevicePath)
 {
-    hid_device* dd = hid_open_path(pDevicePath);
+    hid_device* dd;
+
+    SIO_HidSelect();
+    dd = g_hid->open_path(pDevicePath);
     return (HIDAPI_DEVICE_HANDLE)dd;
 }
 
@@ -1354,7 +5848,7 @@ LPCUSBSIO_API int32_t HIDAPI_DeviceClose(HIDAPI_DEVICE_HANDLE hDevice)
     if (!dd)
         return -1;
 
-    hid_close(dd);
+    g_hid->close(dd);
     return 0;
 }
 
@@ -1365,7 +5859,7 @@ LPCUSBSIO_API int32_t HIDAPI_DeviceWrite(HIDAPI_DEVICE_HANDLE hDevice, const voi
     if (!dd)
         return -1;
 
-    return hid_write_timeout(dd, (const unsigned char*)data, (size_t)size, timeout_ms);
+    return g_hid->write_timeout(dd, (const unsigned char*)data, (size_t)size, timeout_ms);
 }
 
 LPCUSBSIO_API int32_t HIDAPI_DeviceRead(HIDAPI_DEVICE_HANDLE hDevice, void* data, int32_t size, uint32_t timeout_ms)
@@ -1375,7 +5869,7 @@ LPCUSBSIO_API int32_t HIDAPI_DeviceRead(HIDAPI_DEVICE_HANDLE hDevice, void* data
     if (!dd)
         return -1;
 
-    return hid_read_timeout(dd, (unsigned char*)data, (size_t)size, timeout_ms);
+    return g_hid->read_timeout(dd, (unsigned char*)data, (size_t)size, timeout_ms);
 }
 
 // called whenever some device or enumeration is closed, to see if we can unload the HID library
@@ -1387,7 +5881,7 @@ static int32_t LibCleanup()
     if(g_hidapiEnums)
         return 0;
 
-    hid_exit();
+    g_hid->exit();
     return 1;
 }
 
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2022 NXP
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * NXP USBSIO Library: non-interactive latency and throughput benchmark
+ *
+ * Runs each selected operation with payload sizes from 1 byte up to the maximum data size
+ * of the bridge, on one or more devices with one or more threads per device, and prints
+ * one CSV line per run on stdout. Progress and errors go to stderr.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <wchar.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "lpcusbsio.h"
+
+/*****************************************************************************
+ * Private types/enumerations/variables
+ ****************************************************************************/
+
+#define BENCH_MAX_DEVICES   8
+#define BENCH_MAX_THREADS   16
+
+typedef enum {
+    BENCH_GPIO_TOGGLE,
+    BENCH_I2C_WRITE,
+    BENCH_I2C_READ,
+    BENCH_I2C_XFER,
+    BENCH_SPI_XFER,
+    BENCH_NUM_TESTS
+} BENCH_TEST_T;
+
+static const char *g_testNames[BENCH_NUM_TESTS] = {
+    "gpio_toggle", "i2c_write", "i2c_read", "i2c_xfer", "spi_xfer"
+};
+
+/* command line settings */
+typedef struct {
+    uint32_t devices;
+    uint32_t threads;
+    uint32_t iterations;
+    uint32_t maxSize;           /* 0 for the maximum data size of the bridge */
+    uint32_t i2cClock;
+    uint32_t spiSpeed;
+    uint8_t reader;             /* LPCUSBSIO_READER_xxx */
+    uint8_t i2cAddr;
+    uint8_t spiPort, spiPin;
+    uint8_t gpioPort, gpioPin;
+    uint8_t tests[BENCH_NUM_TESTS];
+} BENCH_CONFIG_T;
+
+/* an open bridge and its ports */
+typedef struct {
+    LPC_HANDLE hSIO;
+    LPC_HANDLE hI2C;
+    LPC_HANDLE hSPI;
+    uint32_t maxDataSize;
+} BENCH_DEVICE_T;
+
+/* work of one thread in a run */
+typedef struct {
+    BENCH_DEVICE_T *dev;
+    const BENCH_CONFIG_T *cfg;
+    BENCH_TEST_T test;
+    uint32_t size;
+    double *latUs;              /* latency of each operation in microseconds */
+    uint32_t errors;
+    int32_t lastError;
+} BENCH_WORKER_T;
+
+#ifdef _WIN32
+typedef HANDLE BENCH_THREAD_T;
+#else
+typedef pthread_t BENCH_THREAD_T;
+#endif
+
+/*****************************************************************************
+ * Private functions
+ ****************************************************************************/
+
+static double now_us(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1e6 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+#endif
+}
+
+/* one operation of the run, returns the library result */
+static int32_t run_one(BENCH_WORKER_T *w, uint8_t *tx, uint8_t *rx)
+{
+    const BENCH_CONFIG_T *cfg = w->cfg;
+    I2C_FAST_XFER_T i2cXfer;
+    SPI_XFER_T spiXfer;
+
+    switch (w->test) {
+    case BENCH_GPIO_TOGGLE:
+        return GPIO_TogglePin(w->dev->hSIO, cfg->gpioPort, cfg->gpioPin);
+    case BENCH_I2C_WRITE:
+        return I2C_DeviceWrite(w->dev->hI2C, cfg->i2cAddr, tx, (uint16_t)w->size,
+            I2C_TRANSFER_OPTIONS_START_BIT | I2C_TRANSFER_OPTIONS_STOP_BIT | I2C_TRANSFER_OPTIONS_BREAK_ON_NACK);
+    case BENCH_I2C_READ:
+        return I2C_DeviceRead(w->dev->hI2C, cfg->i2cAddr, rx, (uint16_t)w->size,
+            I2C_TRANSFER_OPTIONS_START_BIT | I2C_TRANSFER_OPTIONS_STOP_BIT | I2C_TRANSFER_OPTIONS_NACK_LAST_BYTE);
+    case BENCH_I2C_XFER:
+        /* write half of the payload and read the other half back */
+        memset(&i2cXfer, 0, sizeof(i2cXfer));
+        i2cXfer.txSz = (uint16_t)((w->size + 1) / 2);
+        i2cXfer.rxSz = (uint16_t)(w->size / 2);
+        i2cXfer.slaveAddr = cfg->i2cAddr;
+        i2cXfer.txBuff = tx;
+        i2cXfer.rxBuff = rx;
+        return I2C_FastXfer(w->dev->hI2C, &i2cXfer);
+    case BENCH_SPI_XFER:
+        memset(&spiXfer, 0, sizeof(spiXfer));
+        spiXfer.length = (uint16_t)w->size;
+        spiXfer.device = (uint8_t)LPCUSBSIO_GEN_SPI_DEVICE_NUM(cfg->spiPort, cfg->spiPin);
+        spiXfer.txBuff = tx;
+        spiXfer.rxBuff = rx;
+        return SPI_Transfer(w->dev->hSPI, &spiXfer);
+    default:
+        return LPCUSBSIO_ERR_INVALID_PARAM;
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_thread(LPVOID arg)
+#else
+static void *worker_thread(void *arg)
+#endif
+{
+    BENCH_WORKER_T *w = (BENCH_WORKER_T *)arg;
+    uint8_t *tx = malloc(w->size + 1);
+    uint8_t *rx = malloc(w->size + 1);
+    uint32_t i;
+    int32_t res;
+    double t0;
+
+    if ((tx != NULL) && (rx != NULL)) {
+        for (i = 0; i < w->size; i++) {
+            tx[i] = (uint8_t)i;
+        }
+        for (i = 0; i < w->cfg->iterations; i++) {
+            t0 = now_us();
+            res = run_one(w, tx, rx);
+            w->latUs[i] = now_us() - t0;
+            if (res < 0) {
+                w->errors++;
+                w->lastError = res;
+            }
+        }
+    }
+    else {
+        w->errors = w->cfg->iterations;
+        w->lastError = LPCUSBSIO_ERR_MEM_ALLOC;
+    }
+    free(tx);
+    free(rx);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static double percentile(const double *sorted, uint32_t count, double p)
+{
+    uint32_t i = (uint32_t)(p * (double)(count - 1) + 0.5);
+
+    return sorted[(i < count) ? i : (count - 1)];
+}
+
+/* run one test with one payload size on all devices and threads and print its CSV line */
+static int run_test(BENCH_DEVICE_T *devs, const BENCH_CONFIG_T *cfg, BENCH_TEST_T test, uint32_t size)
+{
+    BENCH_WORKER_T workers[BENCH_MAX_DEVICES * BENCH_MAX_THREADS];
+    BENCH_THREAD_T threads[BENCH_MAX_DEVICES * BENCH_MAX_THREADS];
+    uint32_t numWorkers = cfg->devices * cfg->threads;
+    uint32_t total = numWorkers * cfg->iterations;
+    double *lat = malloc(total * sizeof(double));
+    double start, elapsed, sum = 0;
+    uint32_t i, errors = 0;
+    int32_t lastError = LPCUSBSIO_OK;
+
+    if (lat == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    for (i = 0; i < numWorkers; i++) {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].dev = &devs[i / cfg->threads];
+        workers[i].cfg = cfg;
+        workers[i].test = test;
+        workers[i].size = size;
+        workers[i].latUs = &lat[i * cfg->iterations];
+    }
+
+    start = now_us();
+    for (i = 0; i < numWorkers; i++) {
+#ifdef _WIN32
+        threads[i] = CreateThread(NULL, 0, worker_thread, &workers[i], 0, NULL);
+#else
+        pthread_create(&threads[i], NULL, worker_thread, &workers[i]);
+#endif
+    }
+    for (i = 0; i < numWorkers; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+        errors += workers[i].errors;
+        if (workers[i].lastError != LPCUSBSIO_OK) {
+            lastError = workers[i].lastError;
+        }
+    }
+    elapsed = (now_us() - start) / 1e6;
+
+    for (i = 0; i < total; i++) {
+        sum += lat[i];
+    }
+    qsort(lat, total, sizeof(double), compare_double);
+    printf("%s,%u,%u,%u,%u,%.6f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%u,%d\n",
+        g_testNames[test], size, cfg->devices, cfg->threads, total, elapsed,
+        (double)total / elapsed, (double)total * size / elapsed,
+        sum / total, percentile(lat, total, 0.5), percentile(lat, total, 0.9),
+        percentile(lat, total, 0.99), lat[total - 1], errors, lastError);
+    fflush(stdout);
+    free(lat);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: benchmark [options] [test...]\n"
+        "tests: gpio_toggle i2c_write i2c_read i2c_xfer spi_xfer (default all)\n"
+        "  -d N        number of devices (%d max, default 1)\n"
+        "  -t N        threads per device (%d max, default 1)\n"
+        "  -n N        operations per thread and payload size (default 1000)\n"
+        "  -m N        largest payload size (default maximum data size of the bridge)\n"
+        "  -a ADDR     I2C slave address (default 0x50)\n"
+        "  -c HZ       I2C clock rate (default 400000)\n"
+        "  -s HZ       SPI bus speed (default 1000000)\n"
+        "  -p PORT.PIN SPI device select (default 0.0)\n"
+        "  -g PORT.PIN GPIO pin to toggle (default 0.0)\n"
+        "  -r MODE     input reports read by 0 the callers, 1 a thread per device, 2 shared threads (default 0)\n"
+        "Output: CSV with the columns printed in the first line, latencies in microseconds.\n",
+        BENCH_MAX_DEVICES, BENCH_MAX_THREADS);
+}
+
+static int parse_pin(const char *s, uint8_t *port, uint8_t *pin)
+{
+    unsigned int a, b;
+
+    if (sscanf(s, "%u.%u", &a, &b) != 2) {
+        return -1;
+    }
+    *port = (uint8_t)a;
+    *pin = (uint8_t)b;
+    return 0;
+}
+
+static int parse_args(int argc, char *argv[], BENCH_CONFIG_T *cfg)
+{
+    int i, t, any = 0;
+    const char *val;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->devices = 1;
+    cfg->threads = 1;
+    cfg->iterations = 1000;
+    cfg->i2cAddr = 0x50;
+    cfg->i2cClock = I2C_CLOCK_FAST_MODE;
+    cfg->spiSpeed = 1000000;
+
+    for (i = 1; i < argc; i++) {
+        if ((argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == 0)) {
+            if (i + 1 >= argc) {
+                return -1;
+            }
+            val = argv[++i];
+            switch (argv[i - 1][1]) {
+            case 'd': cfg->devices = (uint32_t)strtoul(val, NULL, 0); break;
+            case 't': cfg->threads = (uint32_t)strtoul(val, NULL, 0); break;
+            case 'n': cfg->iterations = (uint32_t)strtoul(val, NULL, 0); break;
+            case 'm': cfg->maxSize = (uint32_t)strtoul(val, NULL, 0); break;
+            case 'a': cfg->i2cAddr = (uint8_t)strtoul(val, NULL, 0); break;
+            case 'c': cfg->i2cClock = (uint32_t)strtoul(val, NULL, 0); break;
+            case 's': cfg->spiSpeed = (uint32_t)strtoul(val, NULL, 0); break;
+            case 'p': if (parse_pin(val, &cfg->spiPort, &cfg->spiPin) != 0) return -1; break;
+            case 'g': if (parse_pin(val, &cfg->gpioPort, &cfg->gpioPin) != 0) return -1; break;
+            case 'r': cfg->reader = (uint8_t)strtoul(val, NULL, 0); break;
+            default: return -1;
+            }
+            continue;
+        }
+        for (t = 0; t < BENCH_NUM_TESTS; t++) {
+            if (strcmp(argv[i], g_testNames[t]) == 0) {
+                cfg->tests[t] = 1;
+                any = 1;
+                break;
+            }
+        }
+        if (t == BENCH_NUM_TESTS) {
+            return -1;
+        }
+    }
+    if (!any) {
+        memset(&cfg->tests[0], 1, sizeof(cfg->tests));
+    }
+    if ((cfg->devices < 1) || (cfg->devices > BENCH_MAX_DEVICES) ||
+        (cfg->threads < 1) || (cfg->threads > BENCH_MAX_THREADS) || (cfg->iterations < 1) ||
+        (cfg->reader > LPCUSBSIO_READER_SHARED)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int open_devices(BENCH_DEVICE_T *devs, const BENCH_CONFIG_T *cfg)
+{
+    I2C_PORTCONFIG_T i2cCfg;
+    HID_SPI_PORTCONFIG_T spiCfg;
+    LPC_HANDLE handles[BENCH_MAX_DEVICES];
+    uint32_t indices[BENCH_MAX_DEVICES];
+    uint32_t i;
+    int num;
+
+    num = LPCUSBSIO_GetNumPorts(LPCUSBSIO_VID, LPCUSBSIO_PID);
+    if (num <= 0) {
+        num = LPCUSBSIO_GetNumPorts(LPCUSBSIO_VID, MCULINKSIO_PID);
+    }
+    if (num < (int)cfg->devices) {
+        fprintf(stderr, "%d USBSIO bridge devices found, %u needed\n", (num > 0) ? num : 0, cfg->devices);
+        return -1;
+    }
+
+    i2cCfg.ClockRate = (I2C_CLOCKRATE_T)cfg->i2cClock;
+    i2cCfg.Options = 0;
+    spiCfg.busSpeed = cfg->spiSpeed;
+    spiCfg.Options = HID_SPI_CONFIG_OPTION_DATA_SIZE_8 | HID_SPI_CONFIG_OPTION_POL_0 | HID_SPI_CONFIG_OPTION_PHA_0;
+
+    /* the bridges are opened concurrently */
+    for (i = 0; i < cfg->devices; i++) {
+        indices[i] = i;
+    }
+    LPCUSBSIO_OpenMany(indices, NULL, cfg->devices, handles);
+
+    for (i = 0; i < cfg->devices; i++) {
+        memset(&devs[i], 0, sizeof(devs[i]));
+        devs[i].hSIO = handles[i];
+        if (devs[i].hSIO == NULL) {
+            fprintf(stderr, "unable to open device %u\n", i);
+            return -1;
+        }
+        devs[i].maxDataSize = LPCUSBSIO_GetMaxDataSize(devs[i].hSIO);
+        if ((cfg->reader != LPCUSBSIO_READER_CALLER) && (LPCUSBSIO_SetReaderThread(devs[i].hSIO, cfg->reader) != LPCUSBSIO_OK)) {
+            fprintf(stderr, "unable to start the reader of device %u\n", i);
+            return -1;
+        }
+        if (cfg->tests[BENCH_I2C_WRITE] || cfg->tests[BENCH_I2C_READ] || cfg->tests[BENCH_I2C_XFER]) {
+            devs[i].hI2C = I2C_Open(devs[i].hSIO, &i2cCfg, 0);
+            if (devs[i].hI2C == NULL) {
+                fprintf(stderr, "unable to open I2C port of device %u: %ls\n", i, LPCUSBSIO_Error(devs[i].hSIO));
+                return -1;
+            }
+        }
+        if (cfg->tests[BENCH_SPI_XFER]) {
+            devs[i].hSPI = SPI_Open(devs[i].hSIO, &spiCfg, 0);
+            if (devs[i].hSPI == NULL) {
+                fprintf(stderr, "unable to open SPI port of device %u: %ls\n", i, LPCUSBSIO_Error(devs[i].hSIO));
+                return -1;
+            }
+        }
+        fprintf(stderr, "device %u: %s, max data size %u\n", i, LPCUSBSIO_GetVersion(devs[i].hSIO), devs[i].maxDataSize);
+    }
+    return 0;
+}
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    BENCH_DEVICE_T devs[BENCH_MAX_DEVICES];
+    BENCH_CONFIG_T cfg;
+    uint32_t i, size, maxSize;
+    int t, res = 0;
+
+    if (parse_args(argc, argv, &cfg) != 0) {
+        usage();
+        return 2;
+    }
+    memset(&devs[0], 0, sizeof(devs));
+    if (open_devices(devs, &cfg) != 0) {
+        res = 1;
+    }
+
+    /* payload sizes are the same on all devices, limited by the smallest bridge */
+    maxSize = 0xFFFF;
+    for (i = 0; i < cfg.devices; i++) {
+        if ((devs[i].maxDataSize > 0) && (devs[i].maxDataSize < maxSize)) {
+            maxSize = devs[i].maxDataSize;
+        }
+    }
+    if ((cfg.maxSize > 0) && (cfg.maxSize < maxSize)) {
+        maxSize = cfg.maxSize;
+    }
+
+    if (res == 0) {
+        printf("test,size,devices,threads,ops,seconds,ops_per_s,bytes_per_s,mean_us,p50_us,p90_us,p99_us,max_us,errors,last_error\n");
+        for (t = 0; (t < BENCH_NUM_TESTS) && (res == 0); t++) {
+            if (!cfg.tests[t]) {
+                continue;
+            }
+            if (t == BENCH_GPIO_TOGGLE) {
+                res = run_test(devs, &cfg, (BENCH_TEST_T)t, 0);
+                continue;
+            }
+            /* powers of two, and the largest size itself */
+            for (size = 1; (res == 0); size = (size * 2 < maxSize) ? size * 2 : maxSize) {
+                /* an I2C read and write exchange needs at least one byte each way */
+                if ((t != BENCH_I2C_XFER) || (size > 1)) {
+                    res = run_test(devs, &cfg, (BENCH_TEST_T)t, size);
+                }
+                if (size == maxSize) {
+                    break;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < cfg.devices; i++) {
+        if (devs[i].hSIO != NULL) {
+            LPCUSBSIO_Close(devs[i].hSIO);
+        }
+    }
+    return res;
+}
@@ -0,0 +1,985 @@
+/*
+ * Copyright 2022 NXP
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * NXP USBSIO Library: regression tests against the emulated bridges
+ *
+ * Runs without hardware, on the bridges of the mock HID backend. The makefile runs it
+ * with LPCUSBSIO_BACKEND=mock and each test sets up the emulated bridges it needs with
+ * LPCUSBSIO_SetBackend(). Tests may be selected by name on the command line. Failed
+ * checks are printed on stderr, the exit code is the number of failed tests.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <wchar.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "lpcusbsio.h"
+
+/*****************************************************************************
+ * Private types/enumerations/variables
+ ****************************************************************************/
+
+#define MOCK_I2C_ADDR       0x50
+#define MOCK_PIPE_ROUNDS    8       /* requests submitted per port by test_pipelining() */
+#define MOCK_STREAM_CHUNKS  32      /* chunks of the stream of test_batch_stream() */
+#define MOCK_GPIO_PORT      1
+#define MOCK_GPIO_PIN       3
+#define MOCK_WAIT_MS        2000    /* longest wait for a condition the test can observe */
+#define MOCK_MAX_REQS       1024    /* more than the request descriptors of a device */
+#define MOCK_GROUP_DEVS     3       /* bridges of test_groups() */
+#define MOCK_MAX_GROUPS     64      /* groups which may exist at the same time */
+#define MOCK_TRACE_RECS     128     /* ring of test_trace(), a power of two */
+#define MOCK_TRACE_FILE     "mocktest_trace.bin"
+#define MOCK_REQ_CYCLES     4200    /* requests submitted and released by test_requests(), more than 2^12 */
+
+#define I2C_OPTIONS_WRITE   (I2C_TRANSFER_OPTIONS_START_BIT | I2C_TRANSFER_OPTIONS_STOP_BIT)
+#define I2C_OPTIONS_READ    (I2C_TRANSFER_OPTIONS_START_BIT | I2C_TRANSFER_OPTIONS_STOP_BIT | \
+                             I2C_TRANSFER_OPTIONS_NACK_LAST_BYTE)
+
+#define CHECK(cond)         check((cond) != 0, #cond, __LINE__)
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} MOCK_TEST_T;
+
+/* completions reported to req_callback(), only called by the thread of the test */
+typedef struct {
+    uint32_t calls;
+    LPC_HANDLE hReq;
+    int32_t result;
+} MOCK_COMPLETION_T;
+
+/* stream running while test_batch_stream() executes its batch, result is read after the join */
+typedef struct {
+    LPC_HANDLE hI2C;
+    uint8_t *data;
+    uint32_t length;
+    int32_t result;
+} MOCK_STREAM_T;
+
+#ifdef _WIN32
+typedef HANDLE MOCK_THREAD_T;
+typedef CRITICAL_SECTION MOCK_MUTEX_T;
+typedef CONDITION_VARIABLE MOCK_COND_T;
+#else
+typedef pthread_t MOCK_THREAD_T;
+typedef pthread_mutex_t MOCK_MUTEX_T;
+typedef pthread_cond_t MOCK_COND_T;
+#endif
+
+/* events reported to gpio_callback(), protected by mutex */
+typedef struct {
+    MOCK_MUTEX_T mutex;
+    MOCK_COND_T cond;		/* signalled on every call */
+    uint32_t calls;
+    uint32_t pins;
+} MOCK_EVENTS_T;
+
+static uint32_t g_failed;
+
+/*****************************************************************************
+ * Private functions
+ ****************************************************************************/
+
+static int check(int ok, const char *expr, int line)
+{
+    if (!ok) {
+        fprintf(stderr, "  line %d: check failed: %s (last error %d)\n", line, expr, LPCUSBSIO_GetLastError());
+        g_failed++;
+    }
+    return ok;
+}
+
+static void sleep_ms(uint32_t ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+static void events_init(MOCK_EVENTS_T *events)
+{
+    events->calls = 0;
+    events->pins = 0;
+#ifdef _WIN32
+    InitializeCriticalSection(&events->mutex);
+    InitializeConditionVariable(&events->cond);
+#else
+    pthread_mutex_init(&events->mutex, NULL);
+    pthread_cond_init(&events->cond, NULL);
+#endif
+}
+
+static void events_destroy(MOCK_EVENTS_T *events)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(&events->mutex);
+#else
+    pthread_cond_destroy(&events->cond);
+    pthread_mutex_destroy(&events->mutex);
+#endif
+}
+
+/* wait until the callback ran at least calls times or timeout_ms elapsed, returns the
+   number of calls and the pins they reported */
+static uint32_t events_wait(MOCK_EVENTS_T *events, uint32_t calls, uint32_t timeout_ms, uint32_t *pins)
+{
+    uint32_t n;
+#ifdef _WIN32
+    DWORD start = GetTickCount();
+
+    EnterCriticalSection(&events->mutex);
+    while ((events->calls < calls) && ((GetTickCount() - start) < timeout_ms)) {
+        SleepConditionVariableCS(&events->cond, &events->mutex, timeout_ms - (GetTickCount() - start));
+    }
+    n = events->calls;
+    *pins = events->pins;
+    LeaveCriticalSection(&events->mutex);
+#else
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&events->mutex);
+    while ((events->calls < calls) && (pthread_cond_timedwait(&events->cond, &events->mutex, &deadline) == 0)) {
+    }
+    n = events->calls;
+    *pins = events->pins;
+    pthread_mutex_unlock(&events->mutex);
+#endif
+    return n;
+}
+
+/* wait until count transactions of the port completed, 0 if they did not in time */
+static int wait_transactions(LPC_HANDLE hPort, uint64_t count, uint32_t timeout_ms)
+{
+    LPCUSBSIO_STATS_T stats;
+    uint32_t ms;
+
+    for (ms = 0; ms < timeout_ms; ms++) {
+        if (LPCUSBSIO_GetStats(hPort, &stats) != LPCUSBSIO_OK) {
+            return 0;
+        }
+        if (stats.transactions >= count) {
+            return 1;
+        }
+        sleep_ms(1);
+    }
+    return 0;
+}
+
+/* configure the emulated bridges and open the first one, all devices must be closed */
+static LPC_HANDLE open_mock(const char *options)
+{
+    if (!CHECK(LPCUSBSIO_SetBackend(LPCUSBSIO_BACKEND_MOCK, options) == LPCUSBSIO_OK) ||
+        !CHECK(LPCUSBSIO_GetNumPorts(LPCUSBSIO_VID, MCULINKSIO_PID) > 0)) {
+        return NULL;
+    }
+    return LPCUSBSIO_Open(0);
+}
+
+static LPC_HANDLE open_i2c(LPC_HANDLE hSIO, uint8_t portNum)
+{
+    I2C_PORTCONFIG_T cfg;
+
+    cfg.ClockRate = I2C_CLOCK_FAST_MODE;
+    cfg.Options = 0;
+    return I2C_Open(hSIO, &cfg, portNum);
+}
+
+static LPC_HANDLE open_spi(LPC_HANDLE hSIO, uint8_t portNum)
+{
+    HID_SPI_PORTCONFIG_T cfg;
+
+    cfg.busSpeed = 1000000;
+    cfg.Options = HID_SPI_CONFIG_OPTION_DATA_SIZE_8 | HID_SPI_CONFIG_OPTION_POL_0 | HID_SPI_CONFIG_OPTION_PHA_0;
+    return SPI_Open(hSIO, &cfg, portNum);
+}
+
+/* Requests of two I2C ports and an SPI port are all submitted before the first one is
+   waited for. Each port keeps its own order: every read returns the write before it. */
+static void test_pipelining(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=2000,caps=1");
+    LPC_HANDLE hI2C[2], hSPI, reqs[MOCK_PIPE_ROUNDS * 5];
+    uint8_t i2cRx[2][MOCK_PIPE_ROUNDS][16], spiRx[MOCK_PIPE_ROUNDS][16], tx[16];
+    SPI_XFER_T xfer;
+    uint32_t n = 0, i, k, p;
+
+    if (!CHECK(hSIO != NULL)) {
+        return;
+    }
+    hI2C[0] = open_i2c(hSIO, 0);
+    hI2C[1] = open_i2c(hSIO, 1);
+    hSPI = open_spi(hSIO, 0);
+    if (CHECK((hI2C[0] != NULL) && (hI2C[1] != NULL) && (hSPI != NULL))) {
+        memset(&xfer, 0, sizeof(xfer));
+        xfer.length = sizeof(tx);
+        xfer.device = LPCUSBSIO_GEN_SPI_DEVICE_NUM(0, 0);
+        xfer.txBuff = tx;
+        for (k = 0; k < MOCK_PIPE_ROUNDS; k++) {
+            /* the transmit data is copied by the submit, tx is reused right away */
+            for (p = 0; p < 2; p++) {
+                for (i = 0; i < sizeof(tx); i++) {
+                    tx[i] = (uint8_t)(p * 0x80 + k * 0x10 + i);
+                }
+                reqs[n++] = I2C_DeviceWriteAsync(hI2C[p], (uint8_t)(MOCK_I2C_ADDR + p), tx, sizeof(tx),
+                                                 I2C_OPTIONS_WRITE, NULL, NULL);
+                reqs[n++] = I2C_DeviceReadAsync(hI2C[p], (uint8_t)(MOCK_I2C_ADDR + p), i2cRx[p][k], sizeof(tx),
+                                                I2C_OPTIONS_READ, NULL, NULL);
+            }
+            memset(tx, (int)(0xA0 + k), sizeof(tx));
+            xfer.rxBuff = spiRx[k];
+            reqs[n++] = SPI_TransferAsync(hSPI, &xfer, NULL, NULL);
+        }
+        for (i = 0; i < n; i++) {
+            CHECK(reqs[i] != NULL);
+        }
+        /* nothing was waited for yet and each response takes 2 ms */
+        if ((reqs[n - 1] != NULL) && CHECK(LPCUSBSIO_ReqPoll(reqs[n - 1]) == LPCUSBSIO_ERR_PENDING)) {
+            CHECK(LPCUSBSIO_ReqWaitAny(&reqs[n - 1], 1, 0) == LPCUSBSIO_ERR_PENDING);
+        }
+        for (i = 0; i < n; i++) {
+            if (reqs[i] != NULL) {
+                CHECK(LPCUSBSIO_ReqWait(reqs[i], 5000) == (int32_t)sizeof(tx));
+                CHECK(LPCUSBSIO_ReqFree(reqs[i]) == LPCUSBSIO_OK);
+            }
+        }
+        for (k = 0; k < MOCK_PIPE_ROUNDS; k++) {
+            for (p = 0; p < 2; p++) {
+                for (i = 0; i < sizeof(tx); i++) {
+                    CHECK(i2cRx[p][k][i] == (uint8_t)(p * 0x80 + k * 0x10 + i));
+                }
+            }
+            for (i = 0; i < sizeof(tx); i++) {
+                CHECK(spiRx[k][i] == (uint8_t)(0xA0 + k));
+            }
+        }
+    }
+    LPCUSBSIO_Close(hSIO);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI stream_thread(LPVOID arg)
+#else
+static void *stream_thread(void *arg)
+#endif
+{
+    MOCK_STREAM_T *s = (MOCK_STREAM_T *)arg;
+
+    s->result = I2C_DeviceWriteStream(s->hI2C, MOCK_I2C_ADDR, s->data, s->length, I2C_OPTIONS_WRITE);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* A batch reading the slave a stream is writing to must not come between the chunks of the
+   stream. The emulated slave memory is as large as a chunk and every chunk is filled with its
+   own number, so the batch reads the data before the stream or the last chunk. Each round
+   lets the stream complete one more transaction before the batch is submitted. */
+static void test_batch_stream(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=100,bandwidth=200000,maxdata=256,caps=1");
+    LPC_HANDLE hI2C;
+    LPCUSBSIO_BATCH_OP_T op;
+    MOCK_STREAM_T stream;
+    MOCK_THREAD_T thread;
+    uint8_t *data = malloc(MOCK_STREAM_CHUNKS * 256);
+    uint8_t rx[256];
+    uint32_t round, i;
+
+    if (!CHECK(hSIO != NULL) || !CHECK(data != NULL)) {
+        LPCUSBSIO_Close(hSIO);
+        free(data);
+        return;
+    }
+    CHECK(LPCUSBSIO_GetMaxDataSize(hSIO) == 256);
+    hI2C = open_i2c(hSIO, 0);
+    for (i = 0; i < MOCK_STREAM_CHUNKS * 256; i++) {
+        data[i] = (uint8_t)(i / 256 + 1);
+    }
+    for (round = 0; (round < 3) && CHECK(hI2C != NULL); round++) {
+        memset(rx, 0xEE, sizeof(rx));
+        CHECK(I2C_DeviceWrite(hI2C, MOCK_I2C_ADDR, rx, sizeof(rx), I2C_OPTIONS_WRITE) == (int32_t)sizeof(rx));
+        CHECK(LPCUSBSIO_ResetStats(hSIO) == LPCUSBSIO_OK);
+
+        memset(&stream, 0, sizeof(stream));
+        stream.hI2C = hI2C;
+        stream.data = data;
+        stream.length = MOCK_STREAM_CHUNKS * 256;
+#ifdef _WIN32
+        thread = CreateThread(NULL, 0, stream_thread, &stream, 0, NULL);
+#else
+        pthread_create(&thread, NULL, stream_thread, &stream);
+#endif
+        /* let the stream get some chunks ahead */
+        CHECK(wait_transactions(hI2C, round + 1, MOCK_WAIT_MS));
+
+        memset(&op, 0, sizeof(op));
+        op.op = LPCUSBSIO_BATCH_I2C_READ;
+        op.port = 0;
+        op.addr = MOCK_I2C_ADDR;
+        op.options = I2C_OPTIONS_READ;
+        op.length = sizeof(rx);
+        op.buffer = rx;
+        memset(rx, 0, sizeof(rx));
+        CHECK(LPCUSBSIO_Batch(hSIO, &op, 1) == LPCUSBSIO_OK);
+        CHECK(op.result == (int32_t)sizeof(rx));
+
+#ifdef _WIN32
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+#else
+        pthread_join(thread, NULL);
+#endif
+        CHECK(stream.result == (int32_t)stream.length);
+        CHECK((rx[0] == 0xEE) || (rx[0] == MOCK_STREAM_CHUNKS));
+        for (i = 1; i < sizeof(rx); i++) {
+            CHECK(rx[i] == rx[0]);
+        }
+    }
+    LPCUSBSIO_Close(hSIO);
+    free(data);
+}
+
+/* SPI_XFER_OPTION_TX_ONLY transfers with and without firmware support for the option */
+static void test_spi_tx_only(void)
+{
+    static const char *options[2] = {
+        "devices=1,latency=100,maxdata=1024,caps=1",    /* HID_SIO_CAPS_SPI_TX_ONLY */
+        "devices=1,latency=100,maxdata=1024,caps=0",
+    };
+    LPC_HANDLE hSIO, hSPI, hReq;
+    LPCUSBSIO_STATS_T before, after;
+    SPI_XFER_T xfer;
+    uint8_t tx[3000], rx[3000];
+    uint32_t f, i;
+
+    for (i = 0; i < sizeof(tx); i++) {
+        tx[i] = (uint8_t)i;
+    }
+    for (f = 0; f < 2; f++) {
+        hSIO = open_mock(options[f]);
+        if (!CHECK(hSIO != NULL)) {
+            continue;
+        }
+        hSPI = open_spi(hSIO, 0);
+        if (CHECK(hSPI != NULL)) {
+            memset(&xfer, 0, sizeof(xfer));
+            xfer.length = 64;
+            xfer.options = SPI_XFER_OPTION_TX_ONLY;
+            xfer.device = LPCUSBSIO_GEN_SPI_DEVICE_NUM(0, 0);
+            xfer.txBuff = tx;
+
+            CHECK(LPCUSBSIO_GetStats(hSPI, &before) == LPCUSBSIO_OK);
+            CHECK(SPI_Transfer(hSPI, &xfer) == 64);
+            CHECK(LPCUSBSIO_GetStats(hSPI, &after) == LPCUSBSIO_OK);
+            if (f == 0) {
+                /* the firmware does not send the received data back */
+                CHECK(after.bytesIn - before.bytesIn < 64);
+            }
+
+            /* a receive buffer is left alone */
+            memset(rx, 0xEE, sizeof(rx));
+            xfer.rxBuff = rx;
+            CHECK(SPI_Transfer(hSPI, &xfer) == 64);
+            hReq = SPI_TransferAsync(hSPI, &xfer, NULL, NULL);
+            if (CHECK(hReq != NULL)) {
+                CHECK(LPCUSBSIO_ReqWait(hReq, 5000) == 64);
+                CHECK(LPCUSBSIO_ReqFree(hReq) == LPCUSBSIO_OK);
+            }
+            CHECK(SPI_TransferStream(hSPI, xfer.device, SPI_XFER_OPTION_TX_ONLY, tx, NULL, sizeof(tx)) == (int32_t)sizeof(tx));
+            CHECK(SPI_TransferStream(hSPI, xfer.device, SPI_XFER_OPTION_TX_ONLY, tx, rx, sizeof(tx)) == (int32_t)sizeof(tx));
+            for (i = 0; i < sizeof(rx); i++) {
+                CHECK(rx[i] == 0xEE);
+            }
+
+            /* the other transfers still receive */
+            xfer.options = 0;
+            CHECK(SPI_Transfer(hSPI, &xfer) == 64);
+            CHECK(memcmp(rx, tx, 64) == 0);
+        }
+        LPCUSBSIO_Close(hSIO);
+    }
+}
+
+static void gpio_callback(LPC_HANDLE hSub, uint8_t port, uint32_t pins, uint32_t status, void *context)
+{
+    MOCK_EVENTS_T *events = (MOCK_EVENTS_T *)context;
+
+    (void)hSub;
+    (void)port;
+    (void)status;
+#ifdef _WIN32
+    EnterCriticalSection(&events->mutex);
+    events->pins |= pins;
+    events->calls++;
+    WakeAllConditionVariable(&events->cond);
+    LeaveCriticalSection(&events->mutex);
+#else
+    pthread_mutex_lock(&events->mutex);
+    events->pins |= pins;
+    events->calls++;
+    pthread_cond_broadcast(&events->cond);
+    pthread_mutex_unlock(&events->mutex);
+#endif
+}
+
+/* Events of an output pin driven by the test and seen by the GPIO sampler */
+static void test_gpio_events(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=100,caps=1");
+    LPC_HANDLE hRise, hHigh, hFall;
+    MOCK_EVENTS_T events;
+    const uint32_t mask = 1u << MOCK_GPIO_PIN;
+    uint32_t pins = 0, status = 0;
+
+    if (!CHECK(hSIO != NULL)) {
+        return;
+    }
+    events_init(&events);
+    CHECK(GPIO_SetPortOutDir(hSIO, MOCK_GPIO_PORT, mask) >= 0);
+    CHECK(GPIO_ClearPin(hSIO, MOCK_GPIO_PORT, MOCK_GPIO_PIN) >= 0);
+    CHECK(GPIO_SetSamplePeriod(hSIO, 2) == LPCUSBSIO_OK);
+
+    CHECK(GPIO_Subscribe(hSIO, MOCK_GPIO_PORT, mask, 0, NULL, NULL) == NULL);
+    hRise = GPIO_Subscribe(hSIO, MOCK_GPIO_PORT, mask, GPIO_EVENT_RISING, NULL, NULL);
+    hFall = GPIO_Subscribe(hSIO, MOCK_GPIO_PORT, mask, GPIO_EVENT_FALLING, gpio_callback, &events);
+    if (CHECK((hRise != NULL) && (hFall != NULL))) {
+        CHECK(GPIO_WaitEvent(hRise, &pins, &status, 20) == LPCUSBSIO_ERR_TIMEOUT);
+
+        CHECK(GPIO_SetPin(hSIO, MOCK_GPIO_PORT, MOCK_GPIO_PIN) >= 0);
+        CHECK(GPIO_WaitEvent(hRise, &pins, &status, 1000) == LPCUSBSIO_OK);
+        CHECK((pins == mask) && ((status & mask) != 0));
+
+        /* a level condition already met is reported right away */
+        hHigh = GPIO_Subscribe(hSIO, MOCK_GPIO_PORT, mask, GPIO_EVENT_HIGH, NULL, NULL);
+        if (CHECK(hHigh != NULL)) {
+            CHECK(GPIO_WaitEvent(hHigh, &pins, NULL, 0) == LPCUSBSIO_OK);
+            CHECK(pins == mask);
+            CHECK(GPIO_Unsubscribe(hHigh) == LPCUSBSIO_OK);
+        }
+
+        CHECK(events_wait(&events, 0, 0, &pins) == 0);
+        CHECK(GPIO_ClearPin(hSIO, MOCK_GPIO_PORT, MOCK_GPIO_PIN) >= 0);
+        CHECK(events_wait(&events, 1, MOCK_WAIT_MS, &pins) == 1);
+        CHECK(pins == mask);
+        /* the falling edge is no event of the rising subscription */
+        CHECK(GPIO_WaitEvent(hRise, &pins, NULL, 0) == LPCUSBSIO_ERR_TIMEOUT);
+    }
+    CHECK(GPIO_Unsubscribe(hRise) == LPCUSBSIO_OK);
+    CHECK(GPIO_Unsubscribe(hFall) == LPCUSBSIO_OK);
+    LPCUSBSIO_Close(hSIO);
+    events_destroy(&events);
+}
+
+/* Handles are rejected once released, also when their place is reused, and all handles of
+   a device once it is closed */
+static void test_handles(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=100,caps=1");
+    LPC_HANDLE hSIO2, hI2C, hI2C2, hReq, hReq2, hSub, hSub2, hGroup, hGroup2;
+    LPCUSBSIO_BATCH_OP_T op;
+    uint32_t status;
+
+    if (!CHECK(hSIO != NULL)) {
+        return;
+    }
+    memset(&op, 0, sizeof(op));
+    op.op = LPCUSBSIO_BATCH_GPIO_READ;
+
+    /* requests */
+    hReq = GPIO_ReadPortAsync(hSIO, 0, &status, NULL, NULL);
+    if (CHECK(hReq != NULL)) {
+        CHECK(LPCUSBSIO_ReqWait(hReq, 5000) >= 0);
+        CHECK(LPCUSBSIO_ReqFree(hReq) == LPCUSBSIO_OK);
+        CHECK(LPCUSBSIO_ReqPoll(hReq) == LPCUSBSIO_ERR_BAD_HANDLE);
+    }
+    hReq2 = GPIO_ReadPortAsync(hSIO, 0, &status, NULL, NULL);
+    if (CHECK(hReq2 != NULL)) {
+        CHECK(hReq2 != hReq);
+        CHECK(LPCUSBSIO_ReqFree(hReq) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(LPCUSBSIO_ReqWait(hReq, 0) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(LPCUSBSIO_ReqWait(hReq2, 5000) >= 0);
+    }
+
+    /* groups */
+    hGroup = LPCUSBSIO_GroupCreate(&hSIO, 1);
+    if (CHECK(hGroup != NULL)) {
+        CHECK(LPCUSBSIO_GroupBatch(hGroup, &op, 1, NULL) == LPCUSBSIO_OK);
+        CHECK(LPCUSBSIO_GroupFree(hGroup) == LPCUSBSIO_OK);
+        hGroup2 = LPCUSBSIO_GroupCreate(&hSIO, 1);
+        CHECK(hGroup2 != hGroup);
+        CHECK(LPCUSBSIO_GroupBatch(hGroup, &op, 1, NULL) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(LPCUSBSIO_GroupFree(hGroup) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(LPCUSBSIO_GroupFree(hGroup2) == LPCUSBSIO_OK);
+    }
+
+    /* GPIO subscriptions */
+    hSub = GPIO_Subscribe(hSIO, 0, 1, GPIO_EVENT_RISING, NULL, NULL);
+    hSub2 = NULL;
+    if (CHECK(hSub != NULL)) {
+        CHECK(GPIO_Unsubscribe(hSub) == LPCUSBSIO_OK);
+        hSub2 = GPIO_Subscribe(hSIO, 0, 1, GPIO_EVENT_RISING, NULL, NULL);
+        CHECK((hSub2 != NULL) && (hSub2 != hSub));
+        CHECK(GPIO_WaitEvent(hSub, NULL, NULL, 0) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(GPIO_Unsubscribe(hSub) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(GPIO_WaitEvent(hSub2, NULL, NULL, 0) == LPCUSBSIO_ERR_TIMEOUT);
+    }
+
+    /* ports */
+    hI2C = open_i2c(hSIO, 0);
+    hI2C2 = NULL;
+    if (CHECK(hI2C != NULL)) {
+        CHECK(I2C_Close(hI2C) == LPCUSBSIO_OK);
+        CHECK(I2C_Reset(hI2C) == LPCUSBSIO_ERR_BAD_HANDLE);
+        hI2C2 = open_i2c(hSIO, 0);
+        CHECK(hI2C2 != NULL);
+    }
+
+    /* closing the device releases all of them, a later device in the same slot does not
+       take them over */
+    hGroup = LPCUSBSIO_GroupCreate(&hSIO, 1);
+    CHECK(LPCUSBSIO_Close(hSIO) == LPCUSBSIO_OK);
+    CHECK(LPCUSBSIO_GetNumPorts(LPCUSBSIO_VID, MCULINKSIO_PID) > 0);
+    hSIO2 = LPCUSBSIO_Open(0);
+    if (CHECK(hSIO2 != NULL)) {
+        CHECK(hSIO2 != hSIO);
+        hReq = GPIO_ReadPortAsync(hSIO2, 0, &status, NULL, NULL);
+        hSub = GPIO_Subscribe(hSIO2, 0, 1, GPIO_EVENT_RISING, NULL, NULL);
+        CHECK((hReq != NULL) && (hSub != NULL));
+    }
+    CHECK(LPCUSBSIO_SetReaderThread(hSIO, LPCUSBSIO_READER_CALLER) == LPCUSBSIO_ERR_BAD_HANDLE);
+    CHECK(LPCUSBSIO_Close(hSIO) == LPCUSBSIO_ERR_BAD_HANDLE);
+    CHECK(LPCUSBSIO_ReqPoll(hReq2) == LPCUSBSIO_ERR_BAD_HANDLE);
+    CHECK(LPCUSBSIO_ReqFree(hReq2) == LPCUSBSIO_ERR_BAD_HANDLE);
+    CHECK(GPIO_WaitEvent(hSub2, NULL, NULL, 0) == LPCUSBSIO_ERR_BAD_HANDLE);
+    CHECK(GPIO_Unsubscribe(hSub2) == LPCUSBSIO_ERR_BAD_HANDLE);
+    CHECK(I2C_Reset(hI2C2) == LPCUSBSIO_ERR_BAD_HANDLE);
+    if (CHECK(hGroup != NULL)) {
+        /* the group outlives its device, the batch of the closed device fails */
+        CHECK(LPCUSBSIO_GroupBatch(hGroup, &op, 1, NULL) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(LPCUSBSIO_GroupFree(hGroup) == LPCUSBSIO_OK);
+    }
+    LPCUSBSIO_Close(hSIO2);
+}
+
+static void req_callback(LPC_HANDLE hReq, int32_t result, void *context)
+{
+    MOCK_COMPLETION_T *c = (MOCK_COMPLETION_T *)context;
+
+    c->calls++;
+    c->hReq = hReq;
+    c->result = result;
+}
+
+/* Request descriptors are reused and their old handles are rejected, in the same device and
+   in the next one opened in the slot */
+static void test_requests(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=100,caps=1");
+    LPC_HANDLE hOld, hReq, *reqs = malloc(MOCK_MAX_REQS * sizeof(LPC_HANDLE));
+    MOCK_COMPLETION_T done;
+    uint32_t status, i, n;
+
+    if (!CHECK(hSIO != NULL) || !CHECK(reqs != NULL)) {
+        LPCUSBSIO_Close(hSIO);
+        free(reqs);
+        return;
+    }
+
+    /* the callback runs once, with the result the wait returns */
+    memset(&done, 0, sizeof(done));
+    hReq = GPIO_ReadPortAsync(hSIO, 0, &status, req_callback, &done);
+    if (CHECK(hReq != NULL)) {
+        CHECK(LPCUSBSIO_ReqWait(hReq, 5000) >= 0);
+        CHECK((done.calls == 1) && (done.hReq == hReq) && (done.result == LPCUSBSIO_ReqPoll(hReq)));
+        CHECK(LPCUSBSIO_ReqFree(hReq) == LPCUSBSIO_OK);
+    }
+
+    /* a released handle stays invalid while the descriptors are reused many times */
+    hOld = hReq;
+    for (i = 0; i < MOCK_REQ_CYCLES; i++) {
+        hReq = GPIO_ReadPortAsync(hSIO, 0, &status, NULL, NULL);
+        if (!CHECK(hReq != NULL)) {
+            break;
+        }
+        CHECK(hReq != hOld);
+        CHECK(LPCUSBSIO_ReqPoll(hOld) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(LPCUSBSIO_ReqWait(hReq, 5000) >= 0);
+        CHECK(LPCUSBSIO_ReqFree(hReq) == LPCUSBSIO_OK);
+    }
+    CHECK(LPCUSBSIO_ReqFree(hOld) == LPCUSBSIO_ERR_BAD_HANDLE);
+
+    /* the pool runs out while all descriptors are held, a released one is available again */
+    for (n = 0; n < MOCK_MAX_REQS; n++) {
+        reqs[n] = GPIO_ReadPortAsync(hSIO, 0, &status, NULL, NULL);
+        if (reqs[n] == NULL) {
+            break;
+        }
+    }
+    if (CHECK((n > 0) && (n < MOCK_MAX_REQS))) {
+        CHECK(LPCUSBSIO_GetLastError() == LPCUSBSIO_ERR_MEM_ALLOC);
+        CHECK(LPCUSBSIO_ReqFree(reqs[0]) == LPCUSBSIO_OK);
+        reqs[0] = GPIO_ReadPortAsync(hSIO, 0, &status, NULL, NULL);
+        CHECK(reqs[0] != NULL);
+        for (i = 0; i < n; i++) {
+            CHECK(LPCUSBSIO_ReqWait(reqs[i], 5000) >= 0);
+        }
+        /* the outstanding requests are released by the close */
+        hOld = reqs[n - 1];
+        CHECK(LPCUSBSIO_Close(hSIO) == LPCUSBSIO_OK);
+
+        /* every descriptor of the next device in the slot is in use, none matches an old handle */
+        CHECK(LPCUSBSIO_GetNumPorts(LPCUSBSIO_VID, MCULINKSIO_PID) > 0);
+        hSIO = LPCUSBSIO_Open(0);
+        if (CHECK(hSIO != NULL)) {
+            for (i = 0; i < n; i++) {
+                CHECK(LPCUSBSIO_ReqPoll(reqs[i]) == LPCUSBSIO_ERR_BAD_HANDLE);
+                reqs[i] = GPIO_ReadPortAsync(hSIO, 0, &status, NULL, NULL);
+                CHECK(reqs[i] != NULL);
+            }
+            CHECK(LPCUSBSIO_ReqPoll(hOld) == LPCUSBSIO_ERR_BAD_HANDLE);
+            CHECK(LPCUSBSIO_ReqWait(hOld, 0) == LPCUSBSIO_ERR_BAD_HANDLE);
+            CHECK(LPCUSBSIO_ReqFree(hOld) == LPCUSBSIO_ERR_BAD_HANDLE);
+            for (i = 0; i < n; i++) {
+                CHECK(LPCUSBSIO_ReqWait(reqs[i], 5000) >= 0);
+                CHECK(LPCUSBSIO_ReqFree(reqs[i]) == LPCUSBSIO_OK);
+            }
+        }
+    }
+    LPCUSBSIO_Close(hSIO);
+    free(reqs);
+}
+
+/* Fixed, per call and adaptive time-outs against bridges answering after 50 ms. The adaptive
+   time-out of a long read covers its bus time, that of a short read does not cover the latency. */
+static void test_timeouts(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=50000,caps=1");
+    LPC_HANDLE hI2C;
+    LPCUSBSIO_STATS_T stats;
+    uint8_t rx[900];
+
+    if (!CHECK(hSIO != NULL)) {
+        return;
+    }
+    hI2C = open_i2c(hSIO, 0);
+    if (CHECK(hI2C != NULL)) {
+        CHECK(LPCUSBSIO_SetTimeout(hI2C, 10, ~0u) == LPCUSBSIO_ERR_INVALID_PARAM);
+
+        /* the time-out of the device applies to its ports */
+        CHECK(LPCUSBSIO_SetTimeout(hSIO, 10, 0) == LPCUSBSIO_OK);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, 1, I2C_OPTIONS_READ) == LPCUSBSIO_ERR_TIMEOUT);
+
+        /* the port overrides it, and the calling thread the port */
+        CHECK(LPCUSBSIO_SetTimeout(hI2C, 1000, 0) == LPCUSBSIO_OK);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, 1, I2C_OPTIONS_READ) == 1);
+        LPCUSBSIO_SetCallTimeout(10);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, 1, I2C_OPTIONS_READ) == LPCUSBSIO_ERR_TIMEOUT);
+        LPCUSBSIO_SetCallTimeout(0);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, 1, I2C_OPTIONS_READ) == 1);
+
+        /* 900 bytes take 20 ms at 400 kHz, the adaptive time-out gives them twice that and
+           more than a report interval per packet on top of the 10 ms margin */
+        CHECK(LPCUSBSIO_SetTimeout(hI2C, 10, LPCUSBSIO_TIMEOUT_ADAPTIVE) == LPCUSBSIO_OK);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, 1, I2C_OPTIONS_READ) == LPCUSBSIO_ERR_TIMEOUT);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, sizeof(rx), I2C_OPTIONS_READ) == (int32_t)sizeof(rx));
+
+        /* zero gives the port the settings of the device back */
+        CHECK(LPCUSBSIO_SetTimeout(hI2C, 0, 0) == LPCUSBSIO_OK);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, sizeof(rx), I2C_OPTIONS_READ) == LPCUSBSIO_ERR_TIMEOUT);
+        CHECK(LPCUSBSIO_SetTimeout(hSIO, 0, 0) == LPCUSBSIO_OK);
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, rx, sizeof(rx), I2C_OPTIONS_READ) == (int32_t)sizeof(rx));
+
+        /* the transactions which timed out are counted as failed */
+        CHECK(LPCUSBSIO_GetStats(hI2C, &stats) == LPCUSBSIO_OK);
+        CHECK((stats.timeouts == 4) && (stats.errors == 4));
+    }
+    LPCUSBSIO_Close(hSIO);
+}
+
+/* A group runs its own operation list on each device, a closed device only fails its part */
+static void test_groups(void)
+{
+    LPC_HANDLE hSIO[MOCK_GROUP_DEVS], groups[MOCK_MAX_GROUPS + 1], hGroup;
+    LPCUSBSIO_BATCH_OP_T ops[MOCK_GROUP_DEVS][3];
+    uint8_t tx[MOCK_GROUP_DEVS][32], rx[MOCK_GROUP_DEVS][32];
+    int32_t results[MOCK_GROUP_DEVS];
+    uint32_t d, i;
+
+    hSIO[0] = open_mock("devices=3,latency=1000,caps=1");
+    for (d = 1; d < MOCK_GROUP_DEVS; d++) {
+        hSIO[d] = LPCUSBSIO_Open(d);
+    }
+    for (d = 0; d < MOCK_GROUP_DEVS; d++) {
+        if (!CHECK((hSIO[d] != NULL) && (open_i2c(hSIO[d], 0) != NULL))) {
+            break;
+        }
+    }
+    if (d < MOCK_GROUP_DEVS) {
+        for (d = 0; d < MOCK_GROUP_DEVS; d++) {
+            LPCUSBSIO_Close(hSIO[d]);
+        }
+        return;
+    }
+    CHECK(LPCUSBSIO_GroupCreate(hSIO, 0) == NULL);
+    CHECK(LPCUSBSIO_GetLastError() == LPCUSBSIO_ERR_INVALID_PARAM);
+
+    hGroup = LPCUSBSIO_GroupCreate(hSIO, MOCK_GROUP_DEVS);
+    if (CHECK(hGroup != NULL)) {
+        memset(ops, 0, sizeof(ops));
+        for (d = 0; d < MOCK_GROUP_DEVS; d++) {
+            for (i = 0; i < sizeof(tx[d]); i++) {
+                tx[d][i] = (uint8_t)(d * 0x40 + i);
+            }
+            memset(rx[d], 0, sizeof(rx[d]));
+            ops[d][0].op = LPCUSBSIO_BATCH_I2C_WRITE;
+            ops[d][0].addr = MOCK_I2C_ADDR;
+            ops[d][0].options = I2C_OPTIONS_WRITE;
+            ops[d][0].length = sizeof(tx[d]);
+            ops[d][0].buffer = tx[d];
+            ops[d][1] = ops[d][0];
+            ops[d][1].op = LPCUSBSIO_BATCH_I2C_READ;
+            ops[d][1].options = I2C_OPTIONS_READ;
+            ops[d][1].buffer = rx[d];
+            ops[d][2].op = LPCUSBSIO_BATCH_GPIO_READ;
+        }
+        CHECK(LPCUSBSIO_GroupBatch(hGroup, &ops[0][0], 3, results) == LPCUSBSIO_OK);
+        for (d = 0; d < MOCK_GROUP_DEVS; d++) {
+            CHECK(results[d] == LPCUSBSIO_OK);
+            CHECK((ops[d][0].result == (int32_t)sizeof(tx[d])) && (ops[d][1].result == (int32_t)sizeof(rx[d])));
+            CHECK(ops[d][2].result >= 0);
+            /* each bridge has its own slave memory */
+            CHECK(memcmp(rx[d], tx[d], sizeof(rx[d])) == 0);
+        }
+
+        CHECK(LPCUSBSIO_Close(hSIO[1]) == LPCUSBSIO_OK);
+        hSIO[1] = NULL;
+        CHECK(LPCUSBSIO_GroupBatch(hGroup, &ops[0][0], 3, results) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK((results[0] == LPCUSBSIO_OK) && (results[1] == LPCUSBSIO_ERR_BAD_HANDLE) && (results[2] == LPCUSBSIO_OK));
+        CHECK(LPCUSBSIO_GroupFree(hGroup) == LPCUSBSIO_OK);
+        CHECK(LPCUSBSIO_GroupCreate(hSIO, 2) == NULL);
+        CHECK(LPCUSBSIO_GetLastError() == LPCUSBSIO_ERR_BAD_HANDLE);
+    }
+
+    /* the number of groups is limited, a released one makes room */
+    for (i = 0; i <= MOCK_MAX_GROUPS; i++) {
+        groups[i] = LPCUSBSIO_GroupCreate(&hSIO[0], 1);
+    }
+    CHECK((groups[MOCK_MAX_GROUPS - 1] != NULL) && (groups[MOCK_MAX_GROUPS] == NULL));
+    CHECK(LPCUSBSIO_GetLastError() == LPCUSBSIO_ERR_MEM_ALLOC);
+    if (CHECK(LPCUSBSIO_GroupFree(groups[0]) == LPCUSBSIO_OK)) {
+        groups[0] = LPCUSBSIO_GroupCreate(&hSIO[0], 1);
+        CHECK(groups[0] != NULL);
+    }
+    for (i = 0; i < MOCK_MAX_GROUPS; i++) {
+        CHECK(LPCUSBSIO_GroupFree(groups[i]) == LPCUSBSIO_OK);
+    }
+
+    for (d = 0; d < MOCK_GROUP_DEVS; d++) {
+        LPCUSBSIO_Close(hSIO[d]);
+    }
+}
+
+static uint32_t histogram_count(const LPCUSBSIO_HISTOGRAM_T *h)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < LPCUSBSIO_STATS_BUCKETS; i++) {
+        n += h->count[i];
+    }
+    return n;
+}
+
+/* Counters of a device and of its ports, kept apart per port and cleared by a reset */
+static void test_stats(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=100,caps=1,nak=0x51");
+    LPC_HANDLE hI2C, hSPI;
+    LPCUSBSIO_STATS_T stats, zero;
+    SPI_XFER_T xfer;
+    uint8_t buff[100];
+
+    if (!CHECK(hSIO != NULL)) {
+        return;
+    }
+    memset(&zero, 0, sizeof(zero));
+    memset(buff, 0x5A, sizeof(buff));
+    hI2C = open_i2c(hSIO, 0);
+    hSPI = open_spi(hSIO, 0);
+    if (CHECK((hI2C != NULL) && (hSPI != NULL))) {
+        CHECK(LPCUSBSIO_GetStats(hSIO, NULL) == LPCUSBSIO_ERR_INVALID_PARAM);
+        CHECK(LPCUSBSIO_ResetStats(hI2C) == LPCUSBSIO_ERR_BAD_HANDLE);
+        CHECK(LPCUSBSIO_ResetStats(hSIO) == LPCUSBSIO_OK);
+        CHECK((LPCUSBSIO_GetStats(hI2C, &stats) == LPCUSBSIO_OK) && (memcmp(&stats, &zero, sizeof(stats)) == 0));
+
+        CHECK(I2C_DeviceWrite(hI2C, MOCK_I2C_ADDR, buff, sizeof(buff), I2C_OPTIONS_WRITE) == (int32_t)sizeof(buff));
+        CHECK(I2C_DeviceRead(hI2C, MOCK_I2C_ADDR, buff, sizeof(buff), I2C_OPTIONS_READ) == (int32_t)sizeof(buff));
+        CHECK(I2C_DeviceWrite(hI2C, MOCK_I2C_ADDR + 1, buff, sizeof(buff), I2C_OPTIONS_WRITE) < 0);
+
+        CHECK(LPCUSBSIO_GetStats(hI2C, &stats) == LPCUSBSIO_OK);
+        CHECK((stats.transactions == 3) && (stats.errors == 1) && (stats.timeouts == 0));
+        CHECK((stats.bytesOut >= 2 * sizeof(buff)) && (stats.bytesIn >= sizeof(buff)));
+        CHECK(histogram_count(&stats.request) == 3);
+        CHECK((stats.request.maxUs > 0) && (stats.request.totalUs >= stats.request.maxUs));
+        /* reports are counted for the device only */
+        CHECK((stats.reportsOut == 0) && (stats.reportsIn == 0) && (histogram_count(&stats.write) == 0));
+
+        CHECK(LPCUSBSIO_GetStats(hSIO, &stats) == LPCUSBSIO_OK);
+        CHECK((stats.transactions >= 3) && (stats.reportsOut >= 5) && (stats.reportsIn >= 3));
+        CHECK((histogram_count(&stats.write) > 0) && (histogram_count(&stats.read) > 0));
+
+        /* the traffic of one port is not counted for another */
+        memset(&xfer, 0, sizeof(xfer));
+        xfer.length = 16;
+        xfer.device = LPCUSBSIO_GEN_SPI_DEVICE_NUM(0, 0);
+        xfer.txBuff = buff;
+        xfer.rxBuff = buff;
+        CHECK(SPI_Transfer(hSPI, &xfer) == 16);
+        CHECK((LPCUSBSIO_GetStats(hSPI, &stats) == LPCUSBSIO_OK) && (stats.transactions == 1));
+        CHECK((LPCUSBSIO_GetStats(hI2C, &stats) == LPCUSBSIO_OK) && (stats.transactions == 3));
+
+        CHECK(LPCUSBSIO_ResetStats(hSIO) == LPCUSBSIO_OK);
+        CHECK((LPCUSBSIO_GetStats(hSIO, &stats) == LPCUSBSIO_OK) && (memcmp(&stats, &zero, sizeof(stats)) == 0));
+        CHECK((LPCUSBSIO_GetStats(hI2C, &stats) == LPCUSBSIO_OK) && (memcmp(&stats, &zero, sizeof(stats)) == 0));
+        CHECK((LPCUSBSIO_GetStats(hSPI, &stats) == LPCUSBSIO_OK) && (memcmp(&stats, &zero, sizeof(stats)) == 0));
+    }
+    LPCUSBSIO_Close(hSIO);
+    CHECK(LPCUSBSIO_GetStats(hSIO, &stats) == LPCUSBSIO_ERR_BAD_HANDLE);
+}
+
+/* records of a transaction in the trace ring, the ring once it wrapped and its dump file */
+static void test_trace(void)
+{
+    LPC_HANDLE hSIO = open_mock("devices=1,latency=100,caps=1");
+    LPC_HANDLE hI2C;
+    LPCUSBSIO_TRACE_REC_T *recs = malloc(2 * MOCK_TRACE_RECS * sizeof(LPCUSBSIO_TRACE_REC_T));
+    uint32_t hdr[4], status, last, i;
+    int32_t n;
+    char magic[8];
+    uint8_t buff[10];
+    FILE *f;
+
+    if (!CHECK(hSIO != NULL) || !CHECK(recs != NULL)) {
+        LPCUSBSIO_Close(hSIO);
+        free(recs);
+        return;
+    }
+    memset(buff, 0, sizeof(buff));
+    hI2C = open_i2c(hSIO, 0);
+    if (CHECK(hI2C != NULL)) {
+        CHECK(LPCUSBSIO_GetTrace(hSIO, NULL, 1) == LPCUSBSIO_ERR_INVALID_PARAM);
+        CHECK(LPCUSBSIO_SetTrace(hSIO, MOCK_TRACE_RECS - 20) == LPCUSBSIO_OK);
+
+        /* one transaction: submitted, its reports, completed */
+        CHECK(I2C_DeviceWrite(hI2C, MOCK_I2C_ADDR, buff, sizeof(buff), I2C_OPTIONS_WRITE) == (int32_t)sizeof(buff));
+        n = LPCUSBSIO_GetTrace(hSIO, recs, MOCK_TRACE_RECS);
+        if (CHECK(n >= 4)) {
+            CHECK((recs[0].seq == 1) && (recs[0].event == LPCUSBSIO_TRACE_SUBMIT) && (recs[0].len >= sizeof(buff)));
+            CHECK((recs[n - 1].event == LPCUSBSIO_TRACE_COMPLETE) && (recs[n - 1].result >= 0));
+            CHECK((recs[0].req == HID_I2C_REQ_DEVICE_WRITE) && (recs[n - 1].req == HID_I2C_REQ_DEVICE_WRITE));
+            CHECK(recs[0].transId == recs[n - 1].transId);
+            for (i = 1; i < (uint32_t)n; i++) {
+                CHECK((recs[i].seq == recs[i - 1].seq + 1) && (recs[i].timeUs >= recs[i - 1].timeUs));
+            }
+        }
+
+        /* the ring keeps the latest records once it wrapped, the oldest one first */
+        for (i = 0; i < MOCK_TRACE_RECS; i++) {
+            GPIO_ReadPort(hSIO, 0, &status);
+        }
+        n = LPCUSBSIO_GetTrace(hSIO, recs, 2 * MOCK_TRACE_RECS);
+        if (CHECK(n == MOCK_TRACE_RECS)) {
+            for (i = 1; i < (uint32_t)n; i++) {
+                CHECK(recs[i].seq == recs[i - 1].seq + 1);
+            }
+            CHECK(recs[n - 1].event == LPCUSBSIO_TRACE_COMPLETE);
+        }
+        last = (n > 0) ? recs[n - 1].seq : 0;
+
+        /* a dump is the header and the records */
+        remove(MOCK_TRACE_FILE);
+        CHECK(LPCUSBSIO_DumpTrace(hSIO, MOCK_TRACE_FILE) == MOCK_TRACE_RECS);
+        f = fopen(MOCK_TRACE_FILE, "rb");
+        if (CHECK(f != NULL)) {
+            CHECK((fread(magic, sizeof(magic), 1, f) == 1) && (memcmp(magic, "SIOTRACE", sizeof(magic)) == 0));
+            CHECK(fread(hdr, sizeof(hdr), 1, f) == 1);
+            CHECK((hdr[0] == sizeof(LPCUSBSIO_TRACE_REC_T)) && (hdr[1] == MOCK_TRACE_RECS));
+            CHECK(hdr[2] == last - MOCK_TRACE_RECS);
+            CHECK(fread(recs, sizeof(LPCUSBSIO_TRACE_REC_T), 2 * MOCK_TRACE_RECS, f) == MOCK_TRACE_RECS);
+            CHECK(recs[MOCK_TRACE_RECS - 1].seq == last);
+            fclose(f);
+        }
+        remove(MOCK_TRACE_FILE);
+
+        /* nothing is recorded once the trace is stopped */
+        CHECK(LPCUSBSIO_SetTrace(hSIO, 0) == LPCUSBSIO_OK);
+        GPIO_ReadPort(hSIO, 0, &status);
+        n = LPCUSBSIO_GetTrace(hSIO, recs, 1);
+        CHECK((n == 1) && (recs[0].seq == last));
+    }
+    LPCUSBSIO_Close(hSIO);
+    free(recs);
+}
+
+static const MOCK_TEST_T g_tests[] = {
+    { "pipelining", test_pipelining },
+    { "batch_stream", test_batch_stream },
+    { "spi_tx_only", test_spi_tx_only },
+    { "gpio_events", test_gpio_events },
+    { "handles", test_handles },
+    { "requests", test_requests },
+    { "timeouts", test_timeouts },
+    { "groups", test_groups },
+    { "stats", test_stats },
+    { "trace", test_trace },
+};
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    uint32_t i, failed, failedTests = 0;
+    int j, run;
+
+    for (i = 0; i < sizeof(g_tests) / sizeof(g_tests[0]); i++) {
+        /* the tests named on the command line, or all */
+        run = (argc < 2);
+        for (j = 1; j < argc; j++) {
+            run |= (strcmp(argv[j], g_tests[i].name) == 0);
+        }
+        if (!run) {
+            continue;
+        }
+        failed = g_failed;
+        g_tests[i].run();
+        if (g_failed != failed) {
+            failedTests++;
+        }
+        fprintf(stderr, "%s: %s\n", g_tests[i].name, (g_failed != failed) ? "FAILED" : "ok");
+    }
+    return (int)failedTests;
+}